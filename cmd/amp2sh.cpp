@@ -16,6 +16,7 @@
 #include "progressbar.h"
 #include "image.h"
 #include "math/SH.h"
+#include "math/batch_least_squares.h"
 #include "dwi/gradient.h"
 #include "dwi/shells.h"
 #include "algo/threaded_loop.h"
@@ -86,13 +87,12 @@ class Amp2SHCommon { MEMALIGN(Amp2SHCommon)
           const vector<size_t>& dwis, 
           bool normalise_to_bzero) :
         sh2amp (sh2amp), 
-        amp2sh (Math::pinv (sh2amp)),
         bzeros (bzeros),
         dwis (dwis),
         normalise (normalise_to_bzero) { }
 
 
-    Eigen::MatrixXd sh2amp, amp2sh;
+    Eigen::MatrixXd sh2amp;
     const vector<size_t>& bzeros;
     const vector<size_t>& dwis;
     bool normalise;
@@ -101,57 +101,44 @@ class Amp2SHCommon { MEMALIGN(Amp2SHCommon)
 
 
 
+// Each row of voxels along the inner axis of the loop is fitted at once:
+// one row of the matrices below per voxel
 class Amp2SH { MEMALIGN(Amp2SH)
   public:
-    Amp2SH (const Amp2SHCommon& common) : 
+    Amp2SH (const Amp2SHCommon& common, const size_t axis, const Image<value_type>& amp, const Image<value_type>& SH,
+            const Image<value_type>& noise = Image<value_type>()) :
       C (common), 
-      a (common.amp2sh.cols()),
-      s (common.amp2sh.rows()),
-      c (common.amp2sh.rows()) { }
-
-    template <class SHImageType, class AmpImageType>
-      void operator() (SHImageType& SH, AmpImageType& amp) 
-      {
-        get_amps (amp);
-        c.noalias() = C.amp2sh * a;
-        write_SH (SH);
+      fit (common.sh2amp),
+      amp (amp),
+      SH (SH),
+      noise (noise),
+      axis (axis) { }
+
+    void operator() (const Iterator& pos)
+    {
+      assign_pos_of (pos, 0, 3).to (amp, SH);
+      get_amps();
+      fit.ols (a, c);
+      if (noise.valid()) {
+        assign_pos_of (pos, 0, 3).to (noise);
+        rician_correction();
       }
+      write_SH();
+    }
 
 
-
-    // Rician-corrected version:
-    template <class SHImageType, class AmpImageType, class NoiseImageType>
-      void operator() (SHImageType& SH, AmpImageType& amp, const NoiseImageType& noise) 
-      {
-        w = Eigen::VectorXd::Ones (C.sh2amp.rows());
-
-        get_amps (amp);
-        c = C.amp2sh * a;
-
-        for (size_t iter = 0; iter < 20; ++iter) {
-          sh2amp = C.sh2amp;
-          if (get_rician_bias (sh2amp, noise.value()))
-            break;
-          for (ssize_t n = 0; n < sh2amp.rows(); ++n) 
-            sh2amp.row (n).array() *= w[n];
-
-          s.noalias() = sh2amp.transpose() * ap;
-          Q.triangularView<Eigen::Lower>() = sh2amp.transpose() * sh2amp;
-          llt.compute (Q);
-          c = llt.solve (s);
-        }
-
-        write_SH (SH);
-      }
-
   protected:
     const Amp2SHCommon& C;
-    Eigen::VectorXd a, s, c, w, ap;
-    Eigen::MatrixXd Q, sh2amp;
-    Eigen::LLT<Eigen::MatrixXd> llt;
-
-    template <class AmpImageType>
-      void get_amps (AmpImageType& amp) {
+    Math::BatchLeastSquares fit;
+    Image<value_type> amp, SH, noise;
+    const size_t axis;
+    Eigen::MatrixXd a, c, ap, w, y, c_active, a_active;
+    Eigen::VectorXd sigma;
+    vector<ssize_t> active;
+
+    void get_amps () {
+      a.resize (amp.size (axis), fit.measurements());
+      for (auto l = Loop (axis) (amp); l; ++l) {
         double norm = 1.0;
         if (C.normalise) {
           for (size_t n = 0; n < C.bzeros.size(); n++) {
@@ -161,30 +148,80 @@ class Amp2SH { MEMALIGN(Amp2SH)
           norm = C.bzeros.size() / norm;
         }
 
-        for (ssize_t n = 0; n < a.size(); n++) {
+        for (ssize_t n = 0; n < a.cols(); n++) {
           amp.index(3) = C.dwis.size() ? C.dwis[n] : n;
-          a[n] = amp.value() * norm;
+          a (amp.index (axis), n) = amp.value() * norm;
         }
       }
+    }
 
-    template <class SHImageType>
-      void write_SH (SHImageType& SH) {
-        for (auto l = Loop(3) (SH); l; ++l)
-          SH.value() = c[SH.index(3)];
+    void write_SH () {
+      for (auto l = Loop (axis) (SH); l; ++l)
+        for (auto l2 = Loop(3) (SH); l2; ++l2)
+          SH.value() = c (SH.index (axis), SH.index(3));
+    }
+
+    // Rician-corrected version: iteratively reweighted fit, until convergence of each voxel;
+    //   voxels that have converged are removed from the set still being fitted
+    void rician_correction () {
+      active.resize (a.rows());
+      sigma.resize (a.rows());
+      for (auto l = Loop (axis) (noise); l; ++l) {
+        active[noise.index (axis)] = noise.index (axis);
+        sigma[noise.index (axis)] = noise.value();
+      }
+      c_active = c;
+      a_active = a;
+
+      for (size_t iter = 0; iter < 20; ++iter) {
+        ap.noalias() = c_active * fit.design().transpose();
+        w.resize (ap.rows(), ap.cols());
+        ssize_t num_active = 0;
+        for (ssize_t i = 0; i != ssize_t(active.size()); ++i) {
+          if (get_rician_bias (i)) {
+            c.row (active[i]) = c_active.row (i);
+            continue;
+          }
+          if (i != num_active) {
+            active[num_active] = active[i];
+            sigma[num_active] = sigma[i];
+            c_active.row (num_active) = c_active.row (i);
+            a_active.row (num_active) = a_active.row (i);
+            ap.row (num_active) = ap.row (i);
+            w.row (num_active) = w.row (i);
+          }
+          ++num_active;
+        }
+        if (!num_active)
+          return;
+        active.resize (num_active);
+        sigma.conservativeResize (num_active);
+        c_active.conservativeResize (num_active, Eigen::NoChange);
+        a_active.conservativeResize (num_active, Eigen::NoChange);
+        ap.conservativeResize (num_active, Eigen::NoChange);
+        w.conservativeResize (num_active, Eigen::NoChange);
+
+        y = ap.cwiseQuotient (w);
+        w = w.cwiseAbs2();
+        fit.wls (w, y, c_active);
       }
 
-    bool get_rician_bias (const Eigen::MatrixXd& sh2amp, default_type noise) {
-      ap = sh2amp * c;
+      for (size_t i = 0; i != active.size(); ++i)
+        c.row (active[i]) = c_active.row (i);
+    }
+
+    bool get_rician_bias (const ssize_t i) {
+      const default_type noise = sigma[i];
       default_type norm_diff = 0.0;
       default_type norm_amp = 0.0;
-      for (ssize_t n = 0; n < ap.size() ; ++n) {
-        ap[n] = std::max (ap[n], default_type(0.0));
-        default_type t = std::pow (ap[n]/noise, default_type(RICIAN_POWER));
-        w[n] = Math::pow2 ((t + 1.7)/(t + 1.12));
-        default_type diff = a[n] - noise * std::pow (t + 1.65, 1.0/RICIAN_POWER);
+      for (ssize_t n = 0; n < ap.cols() ; ++n) {
+        ap(i,n) = std::max (ap(i,n), default_type(0.0));
+        default_type t = std::pow (ap(i,n)/noise, default_type(RICIAN_POWER));
+        w(i,n) = Math::pow2 ((t + 1.7)/(t + 1.12));
+        default_type diff = a_active(i,n) - noise * std::pow (t + 1.65, 1.0/RICIAN_POWER);
         norm_diff += Math::pow2 (diff);
-        norm_amp += Math::pow2 (a[n]);
-        ap[n] += diff;
+        norm_amp += Math::pow2 (a_active(i,n));
+        ap(i,n) += diff;
       }
       return norm_diff/norm_amp < 1.0e-8; 
     }
@@ -247,14 +284,13 @@ void run ()
 
   Amp2SHCommon common (sh2amp, bzeros, dwis, normalise);
 
+  auto loop = ThreadedLoop ("mapping amplitudes to SH coefficients", amp, 0, 3);
+  Image<value_type> noise;
   opt = get_options ("rician");
   if (opt.size()) {
-    auto noise = Image<value_type>::open (opt[0][0]).with_direct_io();
-    ThreadedLoop ("mapping amplitudes to SH coefficients", amp, 0, 3)
-      .run (Amp2SH (common), SH, amp, noise);
-  }
-  else {
-    ThreadedLoop ("mapping amplitudes to SH coefficients", amp, 0, 3)
-      .run (Amp2SH (common), SH, amp);
+    noise = Image<value_type>::open (opt[0][0]).with_direct_io();
+    check_dimensions (noise, amp, 0, 3);
   }
+  Amp2SH functor (common, loop.inner_axes[0], amp, SH, noise);
+  loop.run_outer (functor);
 }
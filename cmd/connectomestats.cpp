@@ -93,11 +93,11 @@ void usage ()
 
 
 using Math::Stats::matrix_type;
-using Math::Stats::vector_type;
 
 
 
-void load_tfce_parameters (Stats::TFCE::Wrapper& enhancer)
+template <typename ValueType>
+void load_tfce_parameters (Stats::TFCE::Wrapper<ValueType>& enhancer)
 {
   const default_type dH = get_option_value ("tfce_dh", TFCE_DH_DEFAULT);
   const default_type E  = get_option_value ("tfce_e", TFCE_E_DEFAULT);
@@ -107,8 +107,12 @@ void load_tfce_parameters (Stats::TFCE::Wrapper& enhancer)
 
 
 
-void run()
+template <typename ValueType>
+void execute ()
 {
+  using stat_value_type = ValueType;
+  using stat_matrix_type = Eigen::Matrix<stat_value_type, Eigen::Dynamic, Eigen::Dynamic>;
+  using stat_vector_type = Eigen::Array<stat_value_type, Eigen::Dynamic, 1>;
 
   // Read filenames
   vector<std::string> filenames;
@@ -135,25 +139,25 @@ void run()
   const MR::Connectome::node_t num_nodes = example_connectome.rows();
 
   // Initialise enhancement algorithm
-  std::shared_ptr<Stats::EnhancerBase> enhancer;
+  std::shared_ptr<Stats::EnhancerBase<stat_value_type>> enhancer;
   switch (int(argument[1])) {
     case 0: {
       auto opt = get_options ("threshold");
       if (!opt.size())
         throw Exception ("For NBS algorithm, -threshold option must be provided");
-      enhancer.reset (new MR::Connectome::Enhance::NBS (num_nodes, opt[0][0]));
+      enhancer.reset (new MR::Connectome::Enhance::NBS<stat_value_type> (num_nodes, opt[0][0]));
       }
       break;
     case 1: {
-      std::shared_ptr<Stats::TFCE::EnhancerBase> base (new MR::Connectome::Enhance::NBS (num_nodes));
-      enhancer.reset (new Stats::TFCE::Wrapper (base));
-      load_tfce_parameters (*(dynamic_cast<Stats::TFCE::Wrapper*>(enhancer.get())));
+      std::shared_ptr<Stats::TFCE::EnhancerBase<stat_value_type>> base (new MR::Connectome::Enhance::NBS<stat_value_type> (num_nodes));
+      enhancer.reset (new Stats::TFCE::Wrapper<stat_value_type> (base));
+      load_tfce_parameters (*(dynamic_cast<Stats::TFCE::Wrapper<stat_value_type>*>(enhancer.get())));
       if (get_options ("threshold").size())
         WARN (std::string (argument[1]) + " is a threshold-free algorithm; -threshold option ignored");
       }
       break;
     case 2: {
-      enhancer.reset (new MR::Connectome::Enhance::PassThrough());
+      enhancer.reset (new MR::Connectome::Enhance::PassThrough<stat_value_type>());
       if (get_options ("threshold").size())
         WARN ("No enhancement algorithm being used; -threshold option ignored");
       }
@@ -206,7 +210,7 @@ void run()
   //   deals with the re-ordering of matrix data into this form.
   MR::Connectome::Mat2Vec mat2vec (num_nodes);
   const size_t num_edges = mat2vec.vec_size();
-  matrix_type data (num_edges, filenames.size());
+  stat_matrix_type data (num_edges, filenames.size());
   {
     ProgressBar progress ("Loading input connectome data", filenames.size());
     for (size_t subject = 0; subject < filenames.size(); subject++) {
@@ -237,17 +241,17 @@ void run()
   {
     ProgressBar progress ("outputting beta coefficients, effect size and standard deviation...", contrast.cols() + 3);
 
-    const matrix_type betas = Math::Stats::GLM::solve_betas (data, design);
+    const stat_matrix_type betas = Math::Stats::GLM::solve_betas (data, design);
     for (size_t i = 0; i < size_t(contrast.cols()); ++i) {
       save_matrix (mat2vec.V2M (betas.col(i)), output_prefix + "_beta_" + str(i) + ".csv");
       ++progress;
     }
 
-    const matrix_type abs_effects = Math::Stats::GLM::abs_effect_size (data, design, contrast);
+    const stat_matrix_type abs_effects = Math::Stats::GLM::abs_effect_size (data, design, contrast);
     save_matrix (mat2vec.V2M (abs_effects.col(0)), output_prefix + "_abs_effect.csv");
     ++progress;
 
-    const matrix_type std_effects = Math::Stats::GLM::std_effect_size (data, design, contrast);
+    const stat_matrix_type std_effects = Math::Stats::GLM::std_effect_size (data, design, contrast);
     matrix_type first_std_effect = mat2vec.V2M (std_effects.col (0));
     for (MR::Connectome::node_t i = 0; i != num_nodes; ++i) {
       for (MR::Connectome::node_t j = 0; j != num_nodes; ++j) {
@@ -258,30 +262,28 @@ void run()
     save_matrix (first_std_effect, output_prefix + "_std_effect.csv");
     ++progress;
 
-    const matrix_type stdevs = Math::Stats::GLM::stdev (data, design);
+    const stat_matrix_type stdevs = Math::Stats::GLM::stdev (data, design);
     save_vector (stdevs.col(0), output_prefix + "_std_dev.csv");
   }
 
-  Math::Stats::GLMTTest glm_ttest (data, design, contrast);
+  Math::Stats::GLMTTest<stat_value_type> glm_ttest (data, design, contrast);
 
   // If performing non-stationarity adjustment we need to pre-compute the empirical statistic
-  vector_type empirical_statistic;
+  stat_vector_type empirical_statistic;
   if (do_nonstationary_adjustment) {
     if (permutations_nonstationary.size()) {
-      Stats::PermTest::PermutationStack perm_stack (permutations_nonstationary, "precomputing empirical statistic for non-stationarity adjustment...");
-      Stats::PermTest::precompute_empirical_stat (glm_ttest, enhancer, perm_stack, empirical_statistic);
+      Stats::PermTest::precompute_empirical_stat (glm_ttest, enhancer, permutations_nonstationary, empirical_statistic);
     } else {
-      Stats::PermTest::PermutationStack perm_stack (nperms_nonstationary, design.rows(), "precomputing empirical statistic for non-stationarity adjustment...", true);
-      Stats::PermTest::precompute_empirical_stat (glm_ttest, enhancer, perm_stack, empirical_statistic);
+      Stats::PermTest::precompute_empirical_stat (glm_ttest, enhancer, nperms_nonstationary, empirical_statistic);
     }
     save_matrix (mat2vec.V2M (empirical_statistic), output_prefix + "_empirical.csv");
   }
 
   // Precompute default statistic and enhanced statistic
-  vector_type tvalue_output   (num_edges);
-  vector_type enhanced_output (num_edges);
+  stat_vector_type tvalue_output   (num_edges);
+  stat_vector_type enhanced_output (num_edges);
 
-  Stats::PermTest::precompute_default_permutation (glm_ttest, enhancer, empirical_statistic, enhanced_output, std::shared_ptr<vector_type>(), tvalue_output);
+  Stats::PermTest::precompute_default_permutation (glm_ttest, enhancer, empirical_statistic, enhanced_output, std::shared_ptr<stat_vector_type>(), tvalue_output);
 
   save_matrix (mat2vec.V2M (tvalue_output),   output_prefix + "_tvalue.csv");
   save_matrix (mat2vec.V2M (enhanced_output), output_prefix + "_enhanced.csv");
@@ -291,23 +293,26 @@ void run()
 
     // FIXME Getting NANs in the null distribution
     // Check: was result of pre-nulled subject data
-    vector_type null_distribution (num_perms);
-    vector_type uncorrected_pvalues (num_edges);
+    stat_vector_type null_distribution (num_perms);
+    stat_vector_type uncorrected_pvalues (num_edges);
 
+    bool complete;
     if (permutations.size()) {
-      Stats::PermTest::run_permutations (permutations, glm_ttest, enhancer, empirical_statistic,
-                                         enhanced_output, std::shared_ptr<vector_type>(),
-                                         null_distribution, std::shared_ptr<vector_type>(),
-                                         uncorrected_pvalues, std::shared_ptr<vector_type>());
+      complete = Stats::PermTest::run_permutations (permutations, glm_ttest, enhancer, empirical_statistic,
+                                                    enhanced_output, std::shared_ptr<stat_vector_type>(),
+                                                    null_distribution, std::shared_ptr<stat_vector_type>(),
+                                                    uncorrected_pvalues, std::shared_ptr<stat_vector_type>());
     } else {
-      Stats::PermTest::run_permutations (num_perms, glm_ttest, enhancer, empirical_statistic,
-                                         enhanced_output, std::shared_ptr<vector_type>(),
-                                         null_distribution, std::shared_ptr<vector_type>(),
-                                         uncorrected_pvalues, std::shared_ptr<vector_type>());
+      complete = Stats::PermTest::run_permutations (num_perms, glm_ttest, enhancer, empirical_statistic,
+                                                    enhanced_output, std::shared_ptr<stat_vector_type>(),
+                                                    null_distribution, std::shared_ptr<stat_vector_type>(),
+                                                    uncorrected_pvalues, std::shared_ptr<stat_vector_type>());
     }
+    if (!complete)
+      return;
 
     save_vector (null_distribution, output_prefix + "_null_dist.txt");
-    vector_type pvalue_output (num_edges);
+    stat_vector_type pvalue_output (num_edges);
     Math::Stats::Permutation::statistic2pvalue (null_distribution, enhanced_output, pvalue_output);
     save_matrix (mat2vec.V2M (pvalue_output),       output_prefix + "_fwe_pvalue.csv");
     save_matrix (mat2vec.V2M (uncorrected_pvalues), output_prefix + "_uncorrected_pvalue.csv");
@@ -315,3 +320,13 @@ void run()
   }
 
 }
+
+
+
+void run()
+{
+  if (Stats::PermTest::single_precision())
+    execute<float>();
+  else
+    execute<double>();
+}
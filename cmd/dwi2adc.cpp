@@ -15,8 +15,8 @@
 #include "command.h"
 #include "progressbar.h"
 #include "image.h"
-#include "algo/threaded_copy.h"
-#include "math/least_squares.h"
+#include "algo/threaded_loop.h"
+#include "math/batch_least_squares.h"
 #include "dwi/gradient.h"
 
 
@@ -45,33 +45,41 @@ using value_type = float;
 
 
 
+// Each row of voxels along the inner axis of the loop is fitted as a single matrix product
 class DWI2ADC { MEMALIGN(DWI2ADC)
   public:
-    DWI2ADC (const Eigen::MatrixXd& binv, size_t dwi_axis) :
-      dwi (binv.cols()),
-      adc (2), 
-      binv (binv), 
-      dwi_axis (dwi_axis) { }
-
-    template <class DWIType, class ADCType>
-      void operator() (DWIType& dwi_image, ADCType& adc_image) {
-        for (auto l = Loop (dwi_axis) (dwi_image); l; ++l) {
+    DWI2ADC (const Eigen::MatrixXd& b, size_t dwi_axis, size_t axis, const Image<value_type>& dwi_image, const Image<value_type>& adc_image) :
+      dwi_image (dwi_image),
+      adc_image (adc_image),
+      fit (b),
+      dwi_axis (dwi_axis),
+      axis (axis) { }
+
+    void operator() (const Iterator& pos) {
+      assign_pos_of (pos, 0, 3).to (dwi_image, adc_image);
+      dwi.resize (dwi_image.size (axis), fit.measurements());
+      for (auto l = Loop (axis) (dwi_image); l; ++l) {
+        for (auto l2 = Loop (dwi_axis) (dwi_image); l2; ++l2) {
           value_type val = dwi_image.value();
-          dwi[dwi_image.index (dwi_axis)] = val ? std::log (val) : 1.0e-12;
+          dwi (dwi_image.index (axis), dwi_image.index (dwi_axis)) = val ? std::log (val) : 1.0e-12;
         }
+      }
 
-        adc = binv * dwi;
+      fit.ols (dwi, adc);
 
+      for (auto l = Loop (axis) (adc_image); l; ++l) {
         adc_image.index(3) = 0;
-        adc_image.value() = std::exp (adc[0]);
+        adc_image.value() = std::exp (adc (adc_image.index (axis), 0));
         adc_image.index(3) = 1;
-        adc_image.value() = adc[1];
+        adc_image.value() = adc (adc_image.index (axis), 1);
       }
+    }
 
   protected:
-    Eigen::VectorXd dwi, adc;
-    const Eigen::MatrixXd& binv;
-    const size_t dwi_axis;
+    Image<value_type> dwi_image, adc_image;
+    Math::BatchLeastSquares fit;
+    Eigen::MatrixXd dwi, adc;
+    const size_t dwi_axis, axis;
 };
 
 
@@ -92,8 +100,6 @@ void run () {
     b(i,1) = -grad (i,3);
   }
 
-  auto binv = Math::pinv (b);
-
   Header header (dwi);
   header.datatype() = DataType::Float32;
   header.ndim() = 4;
@@ -102,8 +108,9 @@ void run () {
 
   auto adc = Image<value_type>::create (argument[1], header);
 
-  ThreadedLoop ("computing ADC values", dwi, 0, 3)
-    .run (DWI2ADC (binv, dwi_axis), dwi, adc);
+  auto loop = ThreadedLoop ("computing ADC values", dwi, 0, 3);
+  DWI2ADC functor (b, dwi_axis, loop.inner_axes[0], dwi, adc);
+  loop.run_outer (functor);
 }
 
 
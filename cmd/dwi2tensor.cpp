@@ -15,7 +15,8 @@
 #include "command.h"
 #include "progressbar.h"
 #include "image.h"
-#include "algo/threaded_copy.h"
+#include "algo/threaded_loop.h"
+#include "math/batch_least_squares.h"
 #include "dwi/gradient.h"
 #include "dwi/tensor.h"
 
@@ -71,95 +72,103 @@ void usage ()
 
 }
 
+// Voxels are processed one row at a time along the inner axis of the loop:
+// the ordinary least-squares fit of the whole row is a single matrix product,
+// and the iterative reweighting is solved for all voxels in the row at once
 template <class MASKType, class B0Type, class DKTType, class PredictType>
 class Processor { MEMALIGN(Processor)
   public:
-    Processor (const Eigen::MatrixXd& b, const int iter, MASKType* mask_image, B0Type* b0_image, DKTType* dkt_image, PredictType* predict_image) :
+    Processor (const Eigen::MatrixXd& b, const int iter, const size_t axis, const Image<value_type>& dwi_image, const Image<value_type>& dt_image,
+               MASKType* mask_image, B0Type* b0_image, DKTType* dkt_image, PredictType* predict_image) :
+      dwi_image (dwi_image),
+      dt_image (dt_image),
       mask_image (mask_image),
       b0_image (b0_image),
       dkt_image (dkt_image),
       predict_image (predict_image),
-      dwi(b.rows()),
-      p(b.cols()),
-      w(b.rows()),
-      work(b.cols(),b.cols()),
-      llt(work.rows()),
-      b(b),
-      maxit(iter) { }
-
-    template <class DWIType, class DTType>
-      void operator() (DWIType& dwi_image, DTType& dt_image)
-      {
+      fit (b),
+      axis (axis),
+      maxit (iter) { }
+
+    void operator() (const Iterator& pos)
+    {
+      assign_pos_of (pos, 0, 3).to (dwi_image, dt_image);
+      if (mask_image)
+        assign_pos_of (pos, 0, 3).to (*mask_image);
+
+      voxels.clear();
+      for (auto l = Loop (axis) (dwi_image); l; ++l) {
         if (mask_image) {
-          assign_pos_of (dwi_image, 0, 3).to (*mask_image);
+          mask_image->index (axis) = dwi_image.index (axis);
           if (!mask_image->value())
-            return;
+            continue;
         }
-        
+        voxels.push_back (dwi_image.index (axis));
+      }
+      if (voxels.empty())
+        return;
+
+      dwi.resize (voxels.size(), fit.measurements());
+      for (size_t v = 0; v != voxels.size(); ++v) {
+        dwi_image.index (axis) = voxels[v];
         for (auto l = Loop (3) (dwi_image); l; ++l)
-          dwi[dwi_image.index(3)] = dwi_image.value();
-        
-        double small_intensity = 1.0e-6 * dwi.maxCoeff(); 
-        for (int i = 0; i < dwi.rows(); i++) {
-          if (dwi[i] < small_intensity)
-            dwi[i] = small_intensity;
-          dwi[i] = std::log (dwi[i]);
-        }
-        
-        work.setZero();
-        work.selfadjointView<Eigen::Lower>().rankUpdate (b.transpose());
-        p = llt.compute (work.selfadjointView<Eigen::Lower>()).solve(b.transpose()*dwi);
-        for (int it = 0; it < maxit; it++) {
-          w = (b*p).array().exp();
-          work.setZero();
-          work.selfadjointView<Eigen::Lower>().rankUpdate (b.transpose()*w.asDiagonal());
-          p = llt.compute (work.selfadjointView<Eigen::Lower>()).solve(b.transpose()*w.asDiagonal()*w.asDiagonal()*dwi);
-        }
-        
+          dwi (v, dwi_image.index(3)) = dwi_image.value();
+        const double small_intensity = 1.0e-6 * dwi.row (v).maxCoeff();
+        dwi.row (v) = dwi.row (v).array().max (small_intensity).log().matrix();
+      }
+
+      fit.ols (dwi, p);
+      for (int it = 0; it < maxit; it++) {
+        w.noalias() = p * fit.design().transpose();
+        w = w.array().exp().square().matrix();
+        fit.wls (w, dwi, p);
+      }
+
+      if (predict_image)
+        w = (p * fit.design().transpose()).array().exp().matrix();
+
+      for (size_t v = 0; v != voxels.size(); ++v) {
+        dt_image.index (axis) = voxels[v];
+        for (auto l = Loop(3)(dt_image); l; ++l)
+          dt_image.value() = p (v, dt_image.index(3));
+
         if (b0_image) {
-          assign_pos_of (dwi_image, 0, 3).to (*b0_image);
-          b0_image->value() = exp(p[6]);
+          assign_pos_of (dt_image, 0, 3).to (*b0_image);
+          b0_image->value() = exp (p (v, 6));
         }
-        
-        for (auto l = Loop(3)(dt_image); l; ++l) {
-          dt_image.value() = p[dt_image.index(3)];
-        }
-        
+
         if (dkt_image) {
-          assign_pos_of (dwi_image, 0, 3).to (*dkt_image);
-          double adc_sq = (p[0]+p[1]+p[2])*(p[0]+p[1]+p[2])/9.0;
-          for (auto l = Loop(3)(*dkt_image); l; ++l) {
-            dkt_image->value() = p[dkt_image->index(3)+7]/adc_sq;
-          }
+          assign_pos_of (dt_image, 0, 3).to (*dkt_image);
+          double adc_sq = (p(v,0)+p(v,1)+p(v,2))*(p(v,0)+p(v,1)+p(v,2))/9.0;
+          for (auto l = Loop(3)(*dkt_image); l; ++l)
+            dkt_image->value() = p (v, dkt_image->index(3)+7) / adc_sq;
         }
-        
+
         if (predict_image) {
-          assign_pos_of (dwi_image, 0, 3).to (*predict_image);
-          dwi = (b*p).array().exp();
-          for (auto l = Loop(3)(*predict_image); l; ++l) {
-            predict_image->value() = dwi[predict_image->index(3)];
-          }
+          assign_pos_of (dt_image, 0, 3).to (*predict_image);
+          for (auto l = Loop(3)(*predict_image); l; ++l)
+            predict_image->value() = w (v, predict_image->index(3));
         }
-        
       }
+    }
 
   private:
+    Image<value_type> dwi_image, dt_image;
     copy_ptr<MASKType> mask_image;
     copy_ptr<B0Type> b0_image;
     copy_ptr<DKTType> dkt_image;
     copy_ptr<PredictType> predict_image;
-    Eigen::VectorXd dwi;
-    Eigen::VectorXd p;
-    Eigen::VectorXd w;
-    Eigen::MatrixXd work;
-    Eigen::LLT<Eigen::MatrixXd> llt;
-    const Eigen::MatrixXd& b;
+    Math::BatchLeastSquares fit;
+    MR::vector<ssize_t> voxels;
+    Eigen::MatrixXd dwi, p, w;
+    const size_t axis;
     const int maxit;
 };
 
 template <class MASKType, class B0Type, class DKTType, class PredictType> 
-inline Processor<MASKType, B0Type, DKTType, PredictType> processor (const Eigen::MatrixXd& b, const int& iter, MASKType* mask_image, B0Type* b0_image, DKTType* dkt_image, PredictType* predict_image) {
-  return { b, iter, mask_image, b0_image, dkt_image, predict_image };
+inline Processor<MASKType, B0Type, DKTType, PredictType> processor (const Eigen::MatrixXd& b, const int& iter, const size_t axis, const Image<value_type>& dwi, const Image<value_type>& dt,
+                                                                    MASKType* mask_image, B0Type* b0_image, DKTType* dkt_image, PredictType* predict_image) {
+  return { b, iter, axis, dwi, dt, mask_image, b0_image, dkt_image, predict_image };
 }
 
 void run ()
@@ -207,6 +216,8 @@ void run ()
   
   Eigen::MatrixXd b = -DWI::grad2bmatrix<double> (grad, opt.size()>0);
 
-  ThreadedLoop("computing tensors", dwi, 0, 3).run (processor (b, iter, mask, b0, dkt, predict), dwi, dt);
+  auto loop = ThreadedLoop ("computing tensors", dwi, 0, 3);
+  auto functor = processor (b, iter, loop.inner_axes[0], dwi, dt, mask, b0, dkt, predict);
+  loop.run_outer (functor);
 }
 
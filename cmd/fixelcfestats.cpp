@@ -12,8 +12,11 @@
  */
 
 
+#include <atomic>
+
 #include "command.h"
 #include "progressbar.h"
+#include "thread.h"
 #include "thread_queue.h"
 #include "algo/loop.h"
 #include "transform.h"
@@ -32,6 +35,8 @@
 #include "dwi/tractography/mapping/loader.h"
 #include "dwi/tractography/mapping/writer.h"
 
+#include <Eigen/SparseCore>
+
 
 using namespace MR;
 using namespace App;
@@ -115,6 +120,63 @@ void usage ()
 
 
 
+// Reads each subject's fixel data file directly into its column of the data matrix;
+// fixel data files are Nx1x1 images, so no traversal of the index image is required.
+// Once any subject fails to load, the remaining threads stop picking up new subjects
+template <typename ValueType>
+class SubjectLoader
+{ MEMALIGN(SubjectLoader<ValueType>)
+  public:
+    using stat_value_type = ValueType;
+    using stat_matrix_type = Eigen::Matrix<stat_value_type, Eigen::Dynamic, Eigen::Dynamic>;
+
+    SubjectLoader (const vector<std::string>& identifiers, stat_matrix_type& data, ProgressBar& progress) :
+        identifiers (identifiers),
+        data (data),
+        progress (progress),
+        next_subject (new std::atomic<size_t> (0)),
+        failed (new std::atomic<bool> (false)),
+        mutex (new std::mutex) { }
+
+    void execute () {
+      try {
+        size_t subject;
+        while (!*failed && (subject = (*next_subject)++) < identifiers.size())
+          load (subject);
+      }
+      catch (...) {
+        *failed = true;
+        throw;
+      }
+    }
+
+  private:
+    const vector<std::string>& identifiers;
+    stat_matrix_type& data;
+    ProgressBar& progress;
+    std::shared_ptr<std::atomic<size_t>> next_subject;
+    std::shared_ptr<std::atomic<bool>> failed;
+    std::shared_ptr<std::mutex> mutex;
+
+    void load (const size_t subject) {
+      auto subject_data = Image<stat_value_type>::open (identifiers[subject]).with_direct_io();
+      if (subject_data.size(0) != data.rows())
+        throw Exception ("number of fixels in subject data file " + identifiers[subject] + " (" + str(subject_data.size(0))
+                         + ") does not match template (" + str(data.rows()) + ")");
+      auto column = data.col (subject);
+      for (subject_data.index(0) = 0; subject_data.index(0) != subject_data.size(0); ++subject_data.index(0)) {
+        const stat_value_type value = subject_data.value();
+        if (!std::isfinite (value))
+          throw Exception ("subject data file " + identifiers[subject] + " contains non-finite value: " + str(value));
+        column[subject_data.index(0)] = value;
+      }
+      std::lock_guard<std::mutex> lock (*mutex);
+      ++progress;
+    }
+};
+
+
+
 template <class VectorType>
 void write_fixel_output (const std::string& filename,
                          const VectorType& data,
@@ -129,7 +191,12 @@ void write_fixel_output (const std::string& filename,
 
 
 
-void run() {
+template <typename ValueType>
+void execute ()
+{
+  using stat_value_type = ValueType;
+  using stat_matrix_type = Eigen::Matrix<stat_value_type, Eigen::Dynamic, Eigen::Dynamic>;
+  using stat_vector_type = Eigen::Array<stat_value_type, Eigen::Dynamic, 1>;
 
   auto opt = get_options ("negative");
   bool compute_negative_contrast = opt.size() ? true : false;
@@ -256,7 +323,10 @@ void run() {
   track_file.close();
 
   // Normalise connectivity matrix and threshold, pre-compute fixel-fixel weights for smoothing.
-  vector<std::map<uint32_t, connectivity_value_type> > smoothing_weights (num_fixels);
+  // Smoothing weights are stored as a sparse matrix (one row per fixel), such that the data
+  // for all subjects can subsequently be smoothed using a single sparse x dense matrix product
+  using smoothing_matrix_type = Eigen::SparseMatrix<stat_value_type, Eigen::RowMajor>;
+  smoothing_matrix_type smoothing_weights (num_fixels, num_fixels);
   bool do_smoothing = false;
 
   const float gaussian_const2 = 2.0 * smooth_std_dev * smooth_std_dev;
@@ -268,7 +338,9 @@ void run() {
 
   {
     ProgressBar progress ("normalising and thresholding fixel-fixel connectivity matrix", num_fixels);
+    std::map<uint32_t, connectivity_value_type> fixel_smoothing_weights;
     for (uint32_t fixel = 0; fixel < num_fixels; ++fixel) {
+      fixel_smoothing_weights.clear();
 
       auto it = connectivity_matrix[fixel].begin();
       while (it != connectivity_matrix[fixel].end()) {
@@ -282,7 +354,7 @@ void run() {
                                                    Math::pow2 (positions[fixel][2] - positions[it->first][2]));
             const connectivity_value_type smoothing_weight = connectivity * gaussian_const1 * std::exp (-std::pow (distance, 2) / gaussian_const2);
             if (smoothing_weight > 0.01)
-              smoothing_weights[fixel].insert (std::pair<uint32_t, connectivity_value_type> (it->first, smoothing_weight));
+              fixel_smoothing_weights.insert (std::pair<uint32_t, connectivity_value_type> (it->first, smoothing_weight));
           }
           // Here we pre-exponentiate each connectivity value by C
           it->second.value = std::pow (connectivity, cfe_c);
@@ -291,19 +363,23 @@ void run() {
       }
       // Make sure the fixel is fully connected to itself
       connectivity_matrix[fixel].insert (std::pair<uint32_t, Stats::CFE::connectivity> (fixel, Stats::CFE::connectivity (1.0)));
-      smoothing_weights[fixel].insert (std::pair<uint32_t, connectivity_value_type> (fixel, gaussian_const1));
+      fixel_smoothing_weights.insert (std::pair<uint32_t, connectivity_value_type> (fixel, gaussian_const1));
 
       // Normalise smoothing weights
       value_type sum = 0.0;
-      for (auto smooth_it = smoothing_weights[fixel].begin(); smooth_it != smoothing_weights[fixel].end(); ++smooth_it) {
+      for (auto smooth_it = fixel_smoothing_weights.begin(); smooth_it != fixel_smoothing_weights.end(); ++smooth_it) {
         sum += smooth_it->second;
       }
       value_type norm_factor = 1.0 / sum;
-      for (auto smooth_it = smoothing_weights[fixel].begin(); smooth_it != smoothing_weights[fixel].end(); ++smooth_it) {
+      // std::map is ordered by fixel index, so entries can be appended directly to each row
+      smoothing_weights.startVec (fixel);
+      for (auto smooth_it = fixel_smoothing_weights.begin(); smooth_it != fixel_smoothing_weights.end(); ++smooth_it) {
         smooth_it->second *= norm_factor;
+        smoothing_weights.insertBack (fixel, smooth_it->first) = smooth_it->second;
       }
       progress++;
     }
+    smoothing_weights.finalize();
   }
 
   Header output_header (header);
@@ -318,38 +394,28 @@ void run() {
 
 
   // Load input data
-  matrix_type data (num_fixels, identifiers.size());
-  data.setZero();
+  stat_matrix_type data (num_fixels, identifiers.size());
   {
     ProgressBar progress ("loading input images", identifiers.size());
-    for (size_t subject = 0; subject < identifiers.size(); subject++) {
-      LogLevelLatch log_level (0);
-
-      auto subject_data = Image<value_type>::open (identifiers[subject]).with_direct_io();
-      vector<value_type> subject_data_vector (num_fixels, 0.0);
-      for (auto i = Loop (index_image, 0, 3)(index_image); i; ++i) {
-        index_image.index(3) = 1;
-        uint32_t offset = index_image.value();
-        uint32_t fixel_index = 0;
-        for (auto f = Fixel::Loop (index_image) (subject_data); f; ++f, ++fixel_index) {
-          if (!std::isfinite(static_cast<value_type>(subject_data.value())))
-            throw Exception ("subject data file " + identifiers[subject] + " contains non-finite value: " + str(subject_data.value()));
-          subject_data_vector[offset + fixel_index] = subject_data.value();
-        }
-      }
+    LogLevelLatch log_level (0);
+    Thread::run (Thread::multi (SubjectLoader<stat_value_type> (identifiers, data, progress)), "subject loading threads").wait();
+  }
 
-      // Smooth the data
-      for (size_t fixel = 0; fixel < num_fixels; ++fixel) {
-        value_type value = 0.0;
-        std::map<uint32_t, connectivity_value_type>::const_iterator it = smoothing_weights[fixel].begin();
-        for (; it != smoothing_weights[fixel].end(); ++it) {
-          value += subject_data_vector[it->first] * it->second;
-        }
-        data (fixel, subject) = value;
-      }
-      progress++;
+  // Smooth the data, a block of subjects at a time, to avoid holding a
+  // second full copy of the data matrix in memory
+  if (do_smoothing) {
+    const ssize_t block_size = 16;
+    ProgressBar progress ("smoothing input data", (data.cols() + block_size - 1) / block_size);
+    stat_matrix_type block (data.rows(), std::min (block_size, ssize_t (data.cols())));
+    for (ssize_t col = 0; col < data.cols(); col += block_size) {
+      const ssize_t num_cols = std::min (block_size, ssize_t (data.cols()) - col);
+      block.leftCols (num_cols).noalias() = smoothing_weights * data.middleCols (col, num_cols);
+      data.middleCols (col, num_cols) = block.leftCols (num_cols);
+      ++progress;
     }
   }
+  smoothing_weights.resize (0, 0);
+  smoothing_weights.data().squeeze();
 
 
   if (!data.allFinite())
@@ -370,20 +436,18 @@ void run() {
     write_fixel_output (Path::join (output_fixel_directory, "std_dev.mif"), temp.row(0), output_header);
   }
 
-  Math::Stats::GLMTTest glm_ttest (data, design, contrast);
-  std::shared_ptr<Stats::EnhancerBase> cfe_integrator;
-  cfe_integrator.reset (new Stats::CFE::Enhancer (connectivity_matrix, cfe_dh, cfe_e, cfe_h));
-  vector_type empirical_cfe_statistic;
+  Math::Stats::GLMTTest<stat_value_type> glm_ttest (data, design, contrast);
+  std::shared_ptr<Stats::EnhancerBase<stat_value_type>> cfe_integrator;
+  cfe_integrator.reset (new Stats::CFE::Enhancer<stat_value_type> (connectivity_matrix, cfe_dh, cfe_e, cfe_h));
+  stat_vector_type empirical_cfe_statistic;
 
   // If performing non-stationarity adjustment we need to pre-compute the empirical CFE statistic
   if (do_nonstationary_adjustment) {
 
     if (permutations_nonstationary.size()) {
-      Stats::PermTest::PermutationStack permutations (permutations_nonstationary, "precomputing empirical statistic for non-stationarity adjustment");
-      Stats::PermTest::precompute_empirical_stat (glm_ttest, cfe_integrator, permutations, empirical_cfe_statistic);
+      Stats::PermTest::precompute_empirical_stat (glm_ttest, cfe_integrator, permutations_nonstationary, empirical_cfe_statistic);
     } else {
-      Stats::PermTest::PermutationStack permutations (nperms_nonstationary, design.rows(), "precomputing empirical statistic for non-stationarity adjustment", false);
-      Stats::PermTest::precompute_empirical_stat (glm_ttest, cfe_integrator, permutations, empirical_cfe_statistic);
+      Stats::PermTest::precompute_empirical_stat (glm_ttest, cfe_integrator, nperms_nonstationary, empirical_cfe_statistic);
     }
     output_header.keyval()["nonstationary adjustment"] = str(true);
     write_fixel_output (Path::join (output_fixel_directory, "cfe_empirical.mif"), empirical_cfe_statistic, output_header);
@@ -392,11 +456,11 @@ void run() {
   }
 
   // Precompute default statistic and CFE statistic
-  vector_type cfe_output (num_fixels);
-  std::shared_ptr<vector_type> cfe_output_neg;
-  vector_type tvalue_output (num_fixels);
+  stat_vector_type cfe_output (num_fixels);
+  std::shared_ptr<stat_vector_type> cfe_output_neg;
+  stat_vector_type tvalue_output (num_fixels);
   if (compute_negative_contrast)
-    cfe_output_neg.reset (new vector_type (num_fixels));
+    cfe_output_neg.reset (new stat_vector_type (num_fixels));
 
   Stats::PermTest::precompute_default_permutation (glm_ttest, cfe_integrator, empirical_cfe_statistic, cfe_output, cfe_output_neg, tvalue_output);
 
@@ -407,42 +471,55 @@ void run() {
 
   // Perform permutation testing
   if (!get_options ("notest").size()) {
-    vector_type perm_distribution (num_perms);
-    std::shared_ptr<vector_type> perm_distribution_neg;
-    vector_type uncorrected_pvalues (num_fixels);
-    std::shared_ptr<vector_type> uncorrected_pvalues_neg;
+    stat_vector_type perm_distribution (num_perms);
+    std::shared_ptr<stat_vector_type> perm_distribution_neg;
+    stat_vector_type uncorrected_pvalues (num_fixels);
+    std::shared_ptr<stat_vector_type> uncorrected_pvalues_neg;
 
     if (compute_negative_contrast) {
-      perm_distribution_neg.reset (new vector_type (num_perms));
-      uncorrected_pvalues_neg.reset (new vector_type (num_fixels));
+      perm_distribution_neg.reset (new stat_vector_type (num_perms));
+      uncorrected_pvalues_neg.reset (new stat_vector_type (num_fixels));
     }
 
+    bool complete;
     if (permutations.size()) {
-      Stats::PermTest::run_permutations (permutations, glm_ttest, cfe_integrator, empirical_cfe_statistic,
-                                         cfe_output, cfe_output_neg,
-                                         perm_distribution, perm_distribution_neg,
-                                         uncorrected_pvalues, uncorrected_pvalues_neg);
+      complete = Stats::PermTest::run_permutations (permutations, glm_ttest, cfe_integrator, empirical_cfe_statistic,
+                                                    cfe_output, cfe_output_neg,
+                                                    perm_distribution, perm_distribution_neg,
+                                                    uncorrected_pvalues, uncorrected_pvalues_neg);
     } else {
-      Stats::PermTest::run_permutations (num_perms, glm_ttest, cfe_integrator, empirical_cfe_statistic,
-                                         cfe_output, cfe_output_neg,
-                                         perm_distribution, perm_distribution_neg,
-                                         uncorrected_pvalues, uncorrected_pvalues_neg);
+      complete = Stats::PermTest::run_permutations (num_perms, glm_ttest, cfe_integrator, empirical_cfe_statistic,
+                                                    cfe_output, cfe_output_neg,
+                                                    perm_distribution, perm_distribution_neg,
+                                                    uncorrected_pvalues, uncorrected_pvalues_neg);
     }
+    if (!complete)
+      return;
 
     ProgressBar progress ("outputting final results");
     save_matrix (perm_distribution, Path::join (output_fixel_directory, "perm_dist.txt")); ++progress;
 
-    vector_type pvalue_output (num_fixels);
+    stat_vector_type pvalue_output (num_fixels);
     Math::Stats::Permutation::statistic2pvalue (perm_distribution, cfe_output, pvalue_output); ++progress;
     write_fixel_output (Path::join (output_fixel_directory, "fwe_pvalue.mif"), pvalue_output, output_header); ++progress;
     write_fixel_output (Path::join (output_fixel_directory, "uncorrected_pvalue.mif"), uncorrected_pvalues, output_header); ++progress;
 
     if (compute_negative_contrast) {
       save_matrix (*perm_distribution_neg, Path::join (output_fixel_directory, "perm_dist_neg.txt")); ++progress;
-      vector_type pvalue_output_neg (num_fixels);
+      stat_vector_type pvalue_output_neg (num_fixels);
       Math::Stats::Permutation::statistic2pvalue (*perm_distribution_neg, *cfe_output_neg, pvalue_output_neg); ++progress;
       write_fixel_output (Path::join (output_fixel_directory, "fwe_pvalue_neg.mif"), pvalue_output_neg, output_header); ++progress;
       write_fixel_output (Path::join (output_fixel_directory, "uncorrected_pvalue_neg.mif"), *uncorrected_pvalues_neg, output_header);
     }
   }
 }
+
+
+
+void run()
+{
+  if (Stats::PermTest::single_precision())
+    execute<float>();
+  else
+    execute<double>();
+}
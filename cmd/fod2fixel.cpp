@@ -117,6 +117,7 @@ class Segmented_FOD_receiver { MEMALIGN(Segmented_FOD_receiver)
     size_t num_outputs() const;
 
     bool operator() (const FOD_lobes&);
+    bool operator() (const FOD_lobes_batch&);
 
 
   private:
@@ -180,6 +181,15 @@ bool Segmented_FOD_receiver::operator() (const FOD_lobes& in)
 
 
 
+bool Segmented_FOD_receiver::operator() (const FOD_lobes_batch& in)
+{
+  for (const auto& voxel : in)
+    (*this) (voxel);
+  return true;
+}
+
+
+
 void Segmented_FOD_receiver::commit ()
 {
   if (!lobes.size() || !n_fixels || !num_outputs())
@@ -341,7 +351,7 @@ void run ()
   Segmenter fmls (dirs, Math::SH::LforN (H.size(3)));
   load_fmls_thresholds (fmls);
 
-  Thread::run_queue (writer, Thread::batch (SH_coefs()), Thread::multi (fmls), Thread::batch (FOD_lobes()), receiver);
+  Thread::run_queue (writer, SH_coefs_batch(), Thread::multi (fmls), FOD_lobes_batch(), receiver);
   receiver.commit ();
 }
 
@@ -12,6 +12,7 @@
  */
 
 
+#include <algorithm>
 #include <mutex>
 #include <vector>
 
@@ -93,9 +94,22 @@ void run ()
   const bool blocky = get_options ("blocky").size();
 
   {
+    // Labels are processed concurrently, largest bounding box first, so that
+    //   the slowest meshes are not left until the end
+    vector<size_t> order;
+    for (size_t i = 1; i != lower_corners.size(); ++i) {
+      if (upper_corners[i][0] >= 0)
+        order.push_back (i);
+      else
+        meshes[i].set_name (str(i));
+    }
+    auto volume = [&] (const size_t i) { return (upper_corners[i] - lower_corners[i] + 1).prod(); };
+    std::stable_sort (order.begin(), order.end(), [&] (const size_t a, const size_t b) { return volume (a) > volume (b); });
+
     std::mutex mutex;
-    ProgressBar progress ("Generating meshes from labels", lower_corners.size() - 1);
-    auto loader = [&] (size_t& out) { static size_t i = 1; out = i++; return (out != lower_corners.size()); };
+    ProgressBar progress ("Generating meshes from labels", order.size());
+    size_t next = 0;
+    auto loader = [&] (size_t& out) { if (next == order.size()) return false; out = order[next++]; return true; };
 
     auto worker = [&] (const size_t& in)
     {
@@ -113,7 +127,7 @@ void run ()
       if (blocky)
         MR::Surface::Algo::image2mesh_blocky (scratch, meshes[in]);
       else
-        MR::Surface::Algo::image2mesh_mc (scratch, meshes[in], 0.5);
+        MR::Surface::Algo::image2mesh_mc (scratch, meshes[in], 0.5, false);
       meshes[in].set_name (str(in));
       std::lock_guard<std::mutex> lock (mutex);
       ++progress;
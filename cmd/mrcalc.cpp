@@ -17,6 +17,7 @@
 #include "memory.h"
 #include "math/rng.h"
 #include "algo/threaded_copy.h"
+#include "image_io/pipe.h"
 
 
 using namespace MR;
@@ -158,6 +159,7 @@ class ThreadLocalStorageItem { NOMEMALIGN
   public:
     Chunk chunk;
     copy_ptr<Image<complex_type>> image;
+    ImageIO::PipeWait wait;
 };
 
 class ThreadLocalStorage : public vector<ThreadLocalStorageItem> { NOMEMALIGN
@@ -180,7 +182,10 @@ class ThreadLocalStorage : public vector<ThreadLocalStorageItem> { NOMEMALIGN
 
     Chunk& next () {
       ThreadLocalStorageItem& item ((*this)[current++]);
-      if (item.image) load (item.chunk, *item.image);
+      if (item.image) {
+        item.wait (*iter);
+        load (item.chunk, *item.image);
+      }
       return item.chunk;
     }
 
@@ -195,14 +200,221 @@ class ThreadLocalStorage : public vector<ThreadLocalStorageItem> { NOMEMALIGN
 
 
 
+/**********************************************************************
+  FUSED REAL-VALUED EVALUATION:
+ **********************************************************************/
+
+// Where no complex values are involved at any point in the expression, it is
+// instead compiled into a tree of kernels operating directly on real values
+// (single or double precision). Each chunk of data is processed in blocks
+// small enough to remain in cache, with all operators evaluated over each
+// block in turn, and input images are read using their native data types.
+
+constexpr size_t fused_block_size = 256;
+
+template <typename T>
+class FusedNode { NOMEMALIGN
+  public:
+    virtual ~FusedNode () { }
+    // load whatever data are required for the chunk at this position:
+    virtual void load (const Iterator& position) { }
+    // return the values for the block of voxels starting at offset within the chunk:
+    virtual const T* evaluate (size_t offset, size_t count) = 0;
+};
+
+template <typename T>
+using FusedOperands = vector<std::unique_ptr<FusedNode<T>>>;
+
+// operations that produce a complex output are never evaluated in the real
+// domain, but must nevertheless compile:
+template <typename T, typename V> inline T to_real (const V& value) { return value; }
+template <typename T> inline T to_real (const complex_type& value) { return value.real(); }
+
+
+template <typename T>
+class FusedValue : public FusedNode<T> { NOMEMALIGN
+  public:
+    FusedValue (const T value) { std::fill (out, out + fused_block_size, value); }
+    const T* evaluate (size_t offset, size_t count) override { return out; }
+  private:
+    T out[fused_block_size];
+};
+
+
+template <typename T>
+class FusedRandom : public FusedNode<T> { NOMEMALIGN
+  public:
+    FusedRandom (const bool gaussian) : gaussian (gaussian) { }
+    const T* evaluate (size_t offset, size_t count) override {
+      if (gaussian) {
+        std::normal_distribution<T> dis (0.0, 1.0);
+        for (size_t n = 0; n < count; ++n)
+          out[n] = dis (rng);
+      }
+      else {
+        std::uniform_real_distribution<T> dis (0.0, 1.0);
+        for (size_t n = 0; n < count; ++n)
+          out[n] = dis (rng);
+      }
+      return out;
+    }
+  private:
+    Math::RNG rng;
+    const bool gaussian;
+    T out[fused_block_size];
+};
+
+
+template <typename T>
+class FusedImageBase : public FusedNode<T> { NOMEMALIGN
+  public:
+    // create an independent instance for use within a thread:
+    virtual FusedImageBase* clone (const vector<size_t>& axes, const vector<size_t>& size) const = 0;
+};
+
+template <typename T, typename ValueType>
+class FusedImage : public FusedImageBase<T> { NOMEMALIGN
+  public:
+    FusedImage (const Image<ValueType>& image, const vector<size_t>& axes = vector<size_t>(), const vector<size_t>& size = vector<size_t>()) :
+      image (image),
+      axes (axes),
+      size (size),
+      data (size.size() ? size[0] * size[1] : 0),
+      wait (image, axes) { }
+
+    FusedImageBase<T>* clone (const vector<size_t>& axes, const vector<size_t>& size) const override {
+      return new FusedImage (image, axes, size);
+    }
+
+    void load (const Iterator& position) override {
+      wait (position);
+      for (size_t n = 0; n < image.ndim(); ++n)
+        if (image.size(n) > 1)
+          image.index(n) = position.index(n);
+
+      const bool vary_x = axes[0] < image.ndim() && image.size (axes[0]) > 1;
+      const bool vary_y = axes[1] < image.ndim() && image.size (axes[1]) > 1;
+      T* out = data.data();
+      for (size_t y = 0; y < size[1]; ++y) {
+        if (vary_y) image.index(axes[1]) = y;
+        if (vary_x) {
+          for (size_t x = 0; x < size[0]; ++x) {
+            image.index(axes[0]) = x;
+            *out++ = image.value();
+          }
+        }
+        else {
+          std::fill (out, out + size[0], T (image.value()));
+          out += size[0];
+        }
+      }
+    }
+
+    const T* evaluate (size_t offset, size_t count) override { return data.data() + offset; }
+
+  private:
+    Image<ValueType> image;
+    const vector<size_t> axes, size;
+    vector<T> data;
+    ImageIO::PipeWait wait;
+};
+
+// Read the image using the type in which its data are actually stored, such that
+// access is direct and the conversion to T is a simple cast wherever possible
+template <typename T>
+FusedImageBase<T>* fused_image (Header& header)
+{
+  if (header.intensity_offset() == 0.0 && header.intensity_scale() == 1.0) {
+    const DataType& dt (header.datatype());
+    if (dt == DataType::from<uint8_t>())  return new FusedImage<T,uint8_t>  (header.get_image<uint8_t>());
+    if (dt == DataType::from<int8_t>())   return new FusedImage<T,int8_t>   (header.get_image<int8_t>());
+    if (dt == DataType::from<uint16_t>()) return new FusedImage<T,uint16_t> (header.get_image<uint16_t>());
+    if (dt == DataType::from<int16_t>())  return new FusedImage<T,int16_t>  (header.get_image<int16_t>());
+    if (dt == DataType::from<uint32_t>()) return new FusedImage<T,uint32_t> (header.get_image<uint32_t>());
+    if (dt == DataType::from<int32_t>())  return new FusedImage<T,int32_t>  (header.get_image<int32_t>());
+    if (dt == DataType::from<float>())    return new FusedImage<T,float>    (header.get_image<float>());
+    if (dt == DataType::from<double>())   return new FusedImage<T,double>   (header.get_image<double>());
+  }
+  return new FusedImage<T,T> (header.get_image<T>());
+}
+
+
+template <typename T, class Operation>
+class FusedUnary : public FusedNode<T> { NOMEMALIGN
+  public:
+    FusedUnary (const Operation& operation, FusedOperands<T>& operands) :
+      op (operation),
+      a (std::move (operands[0])) { }
+    void load (const Iterator& position) override { a->load (position); }
+    const T* evaluate (size_t offset, size_t count) override {
+      const T* in = a->evaluate (offset, count);
+      for (size_t n = 0; n < count; ++n)
+        out[n] = to_real<T> (op.R (in[n]));
+      return out;
+    }
+  private:
+    const Operation op;
+    std::unique_ptr<FusedNode<T>> a;
+    T out[fused_block_size];
+};
+
+template <typename T, class Operation>
+class FusedBinary : public FusedNode<T> { NOMEMALIGN
+  public:
+    FusedBinary (const Operation& operation, FusedOperands<T>& operands) :
+      op (operation),
+      a (std::move (operands[0])),
+      b (std::move (operands[1])) { }
+    void load (const Iterator& position) override { a->load (position); b->load (position); }
+    const T* evaluate (size_t offset, size_t count) override {
+      const T* in1 = a->evaluate (offset, count);
+      const T* in2 = b->evaluate (offset, count);
+      for (size_t n = 0; n < count; ++n)
+        out[n] = to_real<T> (op.R (in1[n], in2[n]));
+      return out;
+    }
+  private:
+    const Operation op;
+    std::unique_ptr<FusedNode<T>> a, b;
+    T out[fused_block_size];
+};
+
+template <typename T, class Operation>
+class FusedTernary : public FusedNode<T> { NOMEMALIGN
+  public:
+    FusedTernary (const Operation& operation, FusedOperands<T>& operands) :
+      op (operation),
+      a (std::move (operands[0])),
+      b (std::move (operands[1])),
+      c (std::move (operands[2])) { }
+    void load (const Iterator& position) override { a->load (position); b->load (position); c->load (position); }
+    const T* evaluate (size_t offset, size_t count) override {
+      const T* in1 = a->evaluate (offset, count);
+      const T* in2 = b->evaluate (offset, count);
+      const T* in3 = c->evaluate (offset, count);
+      for (size_t n = 0; n < count; ++n)
+        out[n] = to_real<T> (op.R (in1[n], in2[n], in3[n]));
+      return out;
+    }
+  private:
+    const Operation op;
+    std::unique_ptr<FusedNode<T>> a, b, c;
+    T out[fused_block_size];
+};
+
+
+
 
 class LoadedImage { NOMEMALIGN
   public:
-    LoadedImage (std::shared_ptr<Image<complex_type>>& i, const bool c) :
-        image (i),
-        image_is_complex (c) { }
-    std::shared_ptr<Image<complex_type>> image;
+    LoadedImage (Header&& H) :
+        header (std::move (H)),
+        image_is_complex (header.datatype().is_complex()) { }
+    // the image data are only accessed once it is known whether the
+    // expression is to be evaluated in the real or the complex domain:
+    Header header;
     bool image_is_complex;
+    std::shared_ptr<Image<complex_type>> complex_image;
 };
 
 
@@ -224,15 +436,12 @@ class StackEntry { NOMEMALIGN
       auto search = image_list.find (arg);
       if (search != image_list.end()) {
         DEBUG (std::string ("image \"") + arg + "\" already loaded - re-using exising image");
-        image = search->second.image;
-        image_is_complex = search->second.image_is_complex;
+        image = search->second;
       }
       else {
         try {
-          auto header = Header::open (arg);
-          image_is_complex = header.datatype().is_complex();
-          image.reset (new Image<complex_type> (header.get_image<complex_type>()));
-          image_list.insert (std::make_pair (arg, LoadedImage (image, image_is_complex)));
+          image.reset (new LoadedImage (Header::open (arg)));
+          image_list.insert (std::make_pair (arg, image));
         }
         catch (Exception) {
           std::string a = lowercase (arg);
@@ -250,20 +459,21 @@ class StackEntry { NOMEMALIGN
 
     const char* arg;
     std::shared_ptr<Evaluator> evaluator;
-    std::shared_ptr<Image<complex_type>> image;
+    std::shared_ptr<LoadedImage> image;
     copy_ptr<Math::RNG> rng;
     complex_type value;
     bool rng_gausssian;
-    bool image_is_complex;
 
     bool is_complex () const;
+    bool is_real () const;
+    bool is_exact_in_float () const;
 
-    static std::map<std::string, LoadedImage> image_list;
+    static std::map<std::string, std::shared_ptr<LoadedImage>> image_list;
 
     Chunk& evaluate (ThreadLocalStorage& storage) const;
 };
 
-std::map<std::string, LoadedImage> StackEntry::image_list;
+std::map<std::string, std::shared_ptr<LoadedImage>> StackEntry::image_list;
 
 
 class Evaluator { NOMEMALIGN
@@ -291,6 +501,9 @@ class Evaluator { NOMEMALIGN
     virtual Chunk& evaluate (Chunk& a, Chunk& b) const { throw Exception ("operation \"" + id + "\" not supported!"); return a; }
     virtual Chunk& evaluate (Chunk& a, Chunk& b, Chunk& c) const { throw Exception ("operation \"" + id + "\" not supported!"); return a; }
 
+    virtual std::unique_ptr<FusedNode<float>> fused (FusedOperands<float>& operands) const = 0;
+    virtual std::unique_ptr<FusedNode<double>> fused (FusedOperands<double>& operands) const = 0;
+
     virtual bool is_complex () const {
       for (size_t n = 0; n < operands.size(); ++n) 
         if (operands[n].is_complex())  
@@ -304,12 +517,48 @@ class Evaluator { NOMEMALIGN
 
 
 inline bool StackEntry::is_complex () const {
-  if (image) return image_is_complex;
+  if (image) return image->image_is_complex;
   if (evaluator) return evaluator->is_complex();
   if (rng) return false;
   return value.imag() != 0.0;
 }
 
+// true if no complex values are involved anywhere in evaluating this entry:
+inline bool StackEntry::is_real () const {
+  if (image) return !image->image_is_complex;
+  if (evaluator) {
+    if (evaluator->is_complex())
+      return false;
+    for (const auto& operand : evaluator->operands)
+      if (!operand.is_real())
+        return false;
+    return true;
+  }
+  if (rng) return true;
+  return value.imag() == 0.0;
+}
+
+// a real datatype whose values can all be held exactly in single precision:
+inline bool is_exact_in_float (const DataType& dt) {
+  return dt.is_floating_point() ? dt.bytes() <= 4 : dt.bits() <= 16;
+}
+
+// true if every value involved in evaluating this entry is exactly
+// representable in single precision:
+inline bool StackEntry::is_exact_in_float () const {
+  if (image)
+    return image->header.intensity_offset() == 0.0 && image->header.intensity_scale() == 1.0 &&
+        ::is_exact_in_float (image->header.datatype());
+  if (evaluator) {
+    for (const auto& operand : evaluator->operands)
+      if (!operand.is_exact_in_float())
+        return false;
+    return true;
+  }
+  // random values and constants (parsed as complex_type) are single precision:
+  return true;
+}
+
 
 
 inline Chunk& StackEntry::evaluate (ThreadLocalStorage& storage) const
@@ -361,7 +610,7 @@ inline void replace (std::string& orig, size_t n, const std::string& value)
 std::string operation_string (const StackEntry& entry) 
 {
   if (entry.image)
-    return entry.image->name();
+    return entry.image->header.name();
   else if (entry.rng)
     return entry.rng_gausssian ? "randn()" : "rand()";
   else if (entry.evaluator) {
@@ -398,6 +647,14 @@ class UnaryEvaluator : public Evaluator { NOMEMALIGN
 
       return in; 
     }
+
+    std::unique_ptr<FusedNode<float>> fused (FusedOperands<float>& in) const override { return make_fused (in); }
+    std::unique_ptr<FusedNode<double>> fused (FusedOperands<double>& in) const override { return make_fused (in); }
+
+    template <typename T>
+      std::unique_ptr<FusedNode<T>> make_fused (FusedOperands<T>& in) const {
+        return std::unique_ptr<FusedNode<T>> (new FusedUnary<T,Operation> (op, in));
+      }
 };
 
 
@@ -434,6 +691,14 @@ class BinaryEvaluator : public Evaluator { NOMEMALIGN
       return out;
     }
 
+
+    std::unique_ptr<FusedNode<float>> fused (FusedOperands<float>& in) const override { return make_fused (in); }
+    std::unique_ptr<FusedNode<double>> fused (FusedOperands<double>& in) const override { return make_fused (in); }
+
+    template <typename T>
+      std::unique_ptr<FusedNode<T>> make_fused (FusedOperands<T>& in) const {
+        return std::unique_ptr<FusedNode<T>> (new FusedBinary<T,Operation> (op, in));
+      }
 };
 
 
@@ -470,6 +735,14 @@ class TernaryEvaluator : public Evaluator { NOMEMALIGN
       return out;
     }
 
+
+    std::unique_ptr<FusedNode<float>> fused (FusedOperands<float>& in) const override { return make_fused (in); }
+    std::unique_ptr<FusedNode<double>> fused (FusedOperands<double>& in) const override { return make_fused (in); }
+
+    template <typename T>
+      std::unique_ptr<FusedNode<T>> make_fused (FusedOperands<T>& in) const {
+        return std::unique_ptr<FusedNode<T>> (new FusedTernary<T,Operation> (op, in));
+      }
 };
 
 
@@ -571,24 +844,28 @@ void get_header (const StackEntry& entry, Header& header)
 
   if (!entry.image) 
     return;
+  const Header& image_header (entry.image->header);
 
   if (header.ndim() == 0) {
-    header = *entry.image;
+    header = image_header;
+    // the output is computed in floating-point, and must not inherit the
+    // input's intensity scaling, even if an integer output datatype is requested:
+    header.reset_intensity_scaling();
     return;
   }
 
-  if (header.ndim() < entry.image->ndim()) 
-    header.ndim() = entry.image->ndim();
-  for (size_t n = 0; n < std::min<size_t> (header.ndim(), entry.image->ndim()); ++n) {
-    if (header.size(n) > 1 && entry.image->size(n) > 1 && header.size(n) != entry.image->size(n))
+  if (header.ndim() < image_header.ndim()) 
+    header.ndim() = image_header.ndim();
+  for (size_t n = 0; n < std::min<size_t> (header.ndim(), image_header.ndim()); ++n) {
+    if (header.size(n) > 1 && image_header.size(n) > 1 && header.size(n) != image_header.size(n))
       throw Exception ("dimensions of input images do not match - aborting");
-    if (!transforms_match (header, *(entry.image)) && !transform_mis_match_reported) {
+    if (!transforms_match (header, image_header) && !transform_mis_match_reported) {
       WARN ("header transformations of input images do not match");
       transform_mis_match_reported = true;
     }
-    header.size(n) = std::max (header.size(n), entry.image->size(n));
+    header.size(n) = std::max (header.size(n), image_header.size(n));
     if (!std::isfinite (header.spacing(n))) 
-      header.spacing(n) = entry.image->spacing(n);
+      header.spacing(n) = image_header.spacing(n);
   }
 
 }
@@ -603,10 +880,12 @@ class ThreadFunctor { NOMEMALIGN
     ThreadFunctor (
         const vector<size_t>& inner_axes,
         const StackEntry& top_of_stack, 
-        Image<complex_type>& output_image) :
+        Image<complex_type>& output_image,
+        ImageIO::PipeProgress& progress) :
       top_entry (top_of_stack),
       image (output_image),
-      loop (Loop (inner_axes)) {
+      loop (Loop (inner_axes)),
+      progress (progress) {
         storage.axes = loop.axes;
         storage.size.push_back (image.size(storage.axes[0]));
         storage.size.push_back (image.size(storage.axes[1]));
@@ -623,7 +902,8 @@ class ThreadFunctor { NOMEMALIGN
 
       storage.push_back (ThreadLocalStorageItem());
       if (entry.image) {
-        storage.back().image.reset (new Image<complex_type> (*entry.image));
+        storage.back().image.reset (new Image<complex_type> (*entry.image->complex_image));
+        storage.back().wait = ImageIO::PipeWait (*storage.back().image, storage.axes);
         storage.back().chunk.resize (chunk_size);
         return;
       }
@@ -643,6 +923,7 @@ class ThreadFunctor { NOMEMALIGN
       auto value = chunk.cbegin();
       for (auto l = loop (image); l; ++l) 
         image.value() = *(value++);
+      progress.done (iter);
     }
 
 
@@ -650,6 +931,7 @@ class ThreadFunctor { NOMEMALIGN
     const StackEntry& top_entry;
     Image<complex_type> image;
     decltype (Loop (vector<size_t>())) loop;
+    ImageIO::PipeProgress& progress;
     ThreadLocalStorage storage;
     size_t chunk_size;
 };
@@ -657,6 +939,96 @@ class ThreadFunctor { NOMEMALIGN
 
 
 
+template <typename T>
+class FusedThreadFunctor { NOMEMALIGN
+  public:
+    using ImageMap = std::map<const LoadedImage*, std::shared_ptr<FusedImageBase<T>>>;
+
+    FusedThreadFunctor (
+        const vector<size_t>& inner_axes,
+        const StackEntry& top_of_stack,
+        Image<T>& output_image,
+        const ImageMap& input_images,
+        ImageIO::PipeProgress& progress) :
+      top_entry (top_of_stack),
+      image (output_image),
+      loop (Loop (inner_axes)),
+      images (input_images),
+      progress (progress),
+      size ({ size_t (image.size (loop.axes[0])), size_t (image.size (loop.axes[1])) }),
+      result (size[0] * size[1]),
+      root (build (top_entry)) { }
+
+    // each thread requires its own kernel, with its own buffers:
+    FusedThreadFunctor (const FusedThreadFunctor& that) :
+      top_entry (that.top_entry),
+      image (that.image),
+      loop (that.loop),
+      images (that.images),
+      progress (that.progress),
+      size (that.size),
+      result (that.result.size()),
+      root (build (top_entry)) { }
+
+    void operator() (const Iterator& iter) {
+      root->load (iter);
+      for (size_t offset = 0; offset < result.size(); offset += fused_block_size) {
+        const size_t count = std::min (fused_block_size, result.size() - offset);
+        const T* values = root->evaluate (offset, count);
+        std::copy (values, values + count, result.begin() + offset);
+      }
+
+      assign_pos_of (iter).to (image);
+      auto value = result.cbegin();
+      for (auto l = loop (image); l; ++l)
+        image.value() = *(value++);
+      progress.done (iter);
+    }
+
+  private:
+    const StackEntry& top_entry;
+    Image<T> image;
+    decltype (Loop (vector<size_t>())) loop;
+    const ImageMap& images;
+    ImageIO::PipeProgress& progress;
+    const vector<size_t> size;
+    vector<T> result;
+    std::unique_ptr<FusedNode<T>> root;
+
+    std::unique_ptr<FusedNode<T>> build (const StackEntry& entry) const {
+      if (entry.evaluator) {
+        FusedOperands<T> operands;
+        for (const auto& operand : entry.evaluator->operands)
+          operands.push_back (build (operand));
+        return entry.evaluator->fused (operands);
+      }
+      if (entry.image)
+        return std::unique_ptr<FusedNode<T>> (images.at (entry.image.get())->clone (loop.axes, size));
+      if (entry.rng)
+        return std::unique_ptr<FusedNode<T>> (new FusedRandom<T> (entry.rng_gausssian));
+      return std::unique_ptr<FusedNode<T>> (new FusedValue<T> (entry.value.real()));
+    }
+};
+
+
+
+template <typename T>
+void run_fused (const vector<StackEntry>& stack, Header& header)
+{
+  typename FusedThreadFunctor<T>::ImageMap images;
+  for (auto& entry : StackEntry::image_list)
+    images[entry.second.get()].reset (fused_image<T> (entry.second->header));
+
+  auto output = Header::create (stack[1].arg, header).get_image<T>();
+  auto loop = ThreadedLoop ("computing: " + operation_string(stack[0]), output, 0, output.ndim(), 2);
+  ImageIO::PipeProgress progress (output, loop.outer_loop.axes);
+  FusedThreadFunctor<T> functor (loop.inner_axes, stack[0], output, images, progress);
+  loop.run_outer (functor);
+}
+
+
+
+
 
 void run_operations (const vector<StackEntry>& stack) 
 {
@@ -691,11 +1063,29 @@ void run_operations (const vector<StackEntry>& stack)
   }
   else header.datatype() = DataType::from_command_line (DataType::Float32);
 
+  if (stack[0].is_real()) {
+    // single precision only where the output is stored at no more than single
+    // precision, and all images and constants are exactly representable in it:
+    if (is_exact_in_float (header.datatype()) && stack[0].is_exact_in_float()) {
+      DEBUG ("evaluating expression using fused single-precision kernel");
+      run_fused<float> (stack, header);
+    }
+    else {
+      DEBUG ("evaluating expression using fused double-precision kernel");
+      run_fused<double> (stack, header);
+    }
+    return;
+  }
+
+  for (auto& entry : StackEntry::image_list)
+    entry.second->complex_image.reset (new Image<complex_type> (entry.second->header.get_image<complex_type>()));
+
   auto output = Header::create (stack[1].arg, header).get_image<complex_type>();
 
   auto loop = ThreadedLoop ("computing: " + operation_string(stack[0]), output, 0, output.ndim(), 2);
 
-  ThreadFunctor functor (loop.inner_axes, stack[0], output);
+  ImageIO::PipeProgress progress (output, loop.outer_loop.axes);
+  ThreadFunctor functor (loop.inner_axes, stack[0], output, progress);
   loop.run_outer (functor);
 }
 
@@ -723,7 +1113,7 @@ class OpUnary : public OpBase { NOMEMALIGN
   public:
     OpUnary (const char* format_string, bool complex_maps_to_real = false, bool real_map_to_complex = false) :
       OpBase (format_string, complex_maps_to_real, real_map_to_complex) { }
-    complex_type R (real_type v) const { throw Exception ("operation not supported!"); return v; }
+    template <class T> T R (T v) const { throw Exception ("operation not supported!"); return v; }
     complex_type Z (complex_type v) const { throw Exception ("operation not supported!"); return v; }
 };
 
@@ -732,7 +1122,7 @@ class OpBinary : public OpBase { NOMEMALIGN
   public:
     OpBinary (const char* format_string, bool complex_maps_to_real = false, bool real_map_to_complex = false) :
       OpBase (format_string, complex_maps_to_real, real_map_to_complex) { }
-    complex_type R (real_type a, real_type b) const { throw Exception ("operation not supported!"); return a; }
+    template <class T> T R (T a, T b) const { throw Exception ("operation not supported!"); return a; }
     complex_type Z (complex_type a, complex_type b) const { throw Exception ("operation not supported!"); return a; }
 };
 
@@ -740,7 +1130,7 @@ class OpTernary : public OpBase { NOMEMALIGN
   public:
     OpTernary (const char* format_string, bool complex_maps_to_real = false, bool real_map_to_complex = false) :
       OpBase (format_string, complex_maps_to_real, real_map_to_complex) { }
-    complex_type R (real_type a, real_type b, real_type c) const { throw Exception ("operation not supported!"); return a; }
+    template <class T> T R (T a, T b, T c) const { throw Exception ("operation not supported!"); return a; }
     complex_type Z (complex_type a, complex_type b, complex_type c) const { throw Exception ("operation not supported!"); return a; }
 };
 
@@ -753,140 +1143,140 @@ class OpTernary : public OpBase { NOMEMALIGN
 class OpAbs : public OpUnary { NOMEMALIGN
   public:
     OpAbs () : OpUnary ("|%1|", true) { }
-    complex_type R (real_type v) const { return std::abs (v); }
+    template <class T> T R (T v) const { return std::abs (v); }
     complex_type Z (complex_type v) const { return std::abs (v); }
 };
 
 class OpNeg : public OpUnary { NOMEMALIGN
   public:
     OpNeg () : OpUnary ("-%1") { }
-    complex_type R (real_type v) const { return -v; }
+    template <class T> T R (T v) const { return -v; }
     complex_type Z (complex_type v) const { return -v; }
 };
 
 class OpSqrt : public OpUnary { NOMEMALIGN
   public:
     OpSqrt () : OpUnary ("sqrt (%1)") { } 
-    complex_type R (real_type v) const { return std::sqrt (v); }
+    template <class T> T R (T v) const { return std::sqrt (v); }
     complex_type Z (complex_type v) const { return std::sqrt (v); }
 };
 
 class OpExp : public OpUnary { NOMEMALIGN
   public:
     OpExp () : OpUnary ("exp (%1)") { }
-    complex_type R (real_type v) const { return std::exp (v); }
+    template <class T> T R (T v) const { return std::exp (v); }
     complex_type Z (complex_type v) const { return std::exp (v); }
 };
 
 class OpLog : public OpUnary { NOMEMALIGN
   public:
     OpLog () : OpUnary ("log (%1)") { }
-    complex_type R (real_type v) const { return std::log (v); }
+    template <class T> T R (T v) const { return std::log (v); }
     complex_type Z (complex_type v) const { return std::log (v); }
 };
 
 class OpLog10 : public OpUnary { NOMEMALIGN
   public:
     OpLog10 () : OpUnary ("log10 (%1)") { }
-    complex_type R (real_type v) const { return std::log10 (v); }
+    template <class T> T R (T v) const { return std::log10 (v); }
     complex_type Z (complex_type v) const { return std::log10 (v); }
 };
 
 class OpCos : public OpUnary { NOMEMALIGN
   public:
     OpCos () : OpUnary ("cos (%1)") { } 
-    complex_type R (real_type v) const { return std::cos (v); }
+    template <class T> T R (T v) const { return std::cos (v); }
     complex_type Z (complex_type v) const { return std::cos (v); }
 };
 
 class OpSin : public OpUnary { NOMEMALIGN
   public:
     OpSin () : OpUnary ("sin (%1)") { } 
-    complex_type R (real_type v) const { return std::sin (v); }
+    template <class T> T R (T v) const { return std::sin (v); }
     complex_type Z (complex_type v) const { return std::sin (v); }
 };
 
 class OpTan : public OpUnary { NOMEMALIGN
   public:
     OpTan () : OpUnary ("tan (%1)") { }
-    complex_type R (real_type v) const { return std::tan (v); }
+    template <class T> T R (T v) const { return std::tan (v); }
     complex_type Z (complex_type v) const { return std::tan (v); }
 };
 
 class OpCosh : public OpUnary { NOMEMALIGN
   public:
     OpCosh () : OpUnary ("cosh (%1)") { }
-    complex_type R (real_type v) const { return std::cosh (v); }
+    template <class T> T R (T v) const { return std::cosh (v); }
     complex_type Z (complex_type v) const { return std::cosh (v); }
 };
 
 class OpSinh : public OpUnary { NOMEMALIGN
   public:
     OpSinh () : OpUnary ("sinh (%1)") { }
-    complex_type R (real_type v) const { return std::sinh (v); }
+    template <class T> T R (T v) const { return std::sinh (v); }
     complex_type Z (complex_type v) const { return std::sinh (v); }
 };
 
 class OpTanh : public OpUnary { NOMEMALIGN
   public:
     OpTanh () : OpUnary ("tanh (%1)") { } 
-    complex_type R (real_type v) const { return std::tanh (v); }
+    template <class T> T R (T v) const { return std::tanh (v); }
     complex_type Z (complex_type v) const { return std::tanh (v); }
 };
 
 class OpAcos : public OpUnary { NOMEMALIGN
   public:
     OpAcos () : OpUnary ("acos (%1)") { }
-    complex_type R (real_type v) const { return std::acos (v); }
+    template <class T> T R (T v) const { return std::acos (v); }
 };
 
 class OpAsin : public OpUnary { NOMEMALIGN
   public:
     OpAsin () : OpUnary ("asin (%1)") { } 
-    complex_type R (real_type v) const { return std::asin (v); }
+    template <class T> T R (T v) const { return std::asin (v); }
 };
 
 class OpAtan : public OpUnary { NOMEMALIGN
   public:
     OpAtan () : OpUnary ("atan (%1)") { }
-    complex_type R (real_type v) const { return std::atan (v); }
+    template <class T> T R (T v) const { return std::atan (v); }
 };
 
 class OpAcosh : public OpUnary { NOMEMALIGN
   public:
     OpAcosh () : OpUnary ("acosh (%1)") { } 
-    complex_type R (real_type v) const { return std::acosh (v); }
+    template <class T> T R (T v) const { return std::acosh (v); }
 };
 
 class OpAsinh : public OpUnary { NOMEMALIGN
   public:
     OpAsinh () : OpUnary ("asinh (%1)") { }
-    complex_type R (real_type v) const { return std::asinh (v); }
+    template <class T> T R (T v) const { return std::asinh (v); }
 };
 
 class OpAtanh : public OpUnary { NOMEMALIGN
   public:
     OpAtanh () : OpUnary ("atanh (%1)") { }
-    complex_type R (real_type v) const { return std::atanh (v); }
+    template <class T> T R (T v) const { return std::atanh (v); }
 };
 
 
 class OpRound : public OpUnary { NOMEMALIGN
   public:
     OpRound () : OpUnary ("round (%1)") { } 
-    complex_type R (real_type v) const { return std::round (v); }
+    template <class T> T R (T v) const { return std::round (v); }
 };
 
 class OpCeil : public OpUnary { NOMEMALIGN
   public:
     OpCeil () : OpUnary ("ceil (%1)") { } 
-    complex_type R (real_type v) const { return std::ceil (v); }
+    template <class T> T R (T v) const { return std::ceil (v); }
 };
 
 class OpFloor : public OpUnary { NOMEMALIGN
   public:
     OpFloor () : OpUnary ("floor (%1)") { }
-    complex_type R (real_type v) const { return std::floor (v); }
+    template <class T> T R (T v) const { return std::floor (v); }
 };
 
 class OpReal : public OpUnary { NOMEMALIGN
@@ -916,21 +1306,21 @@ class OpConj : public OpUnary { NOMEMALIGN
 class OpIsNaN : public OpUnary { NOMEMALIGN
   public:
     OpIsNaN () : OpUnary ("isnan (%1)", true, false) { }
-    complex_type R (real_type v) const { return std::isnan (v) != 0; }
+    template <class T> T R (T v) const { return std::isnan (v) != 0; }
     complex_type Z (complex_type v) const { return std::isnan (v.real()) != 0 || std::isnan (v.imag()) != 0; }
 };
 
 class OpIsInf : public OpUnary { NOMEMALIGN
   public:
     OpIsInf () : OpUnary ("isinf (%1)", true, false) { }
-    complex_type R (real_type v) const { return std::isinf (v) != 0; }
+    template <class T> T R (T v) const { return std::isinf (v) != 0; }
     complex_type Z (complex_type v) const { return std::isinf (v.real()) != 0 || std::isinf (v.imag()) != 0; }
 };
 
 class OpFinite : public OpUnary { NOMEMALIGN
   public:
     OpFinite () : OpUnary ("finite (%1)", true, false) { }
-    complex_type R (real_type v) const { return std::isfinite (v) != 0; }
+    template <class T> T R (T v) const { return std::isfinite (v) != 0; }
     complex_type Z (complex_type v) const { return std::isfinite (v.real()) != 0|| std::isfinite (v.imag()) != 0; }
 };
 
@@ -942,85 +1332,85 @@ class OpFinite : public OpUnary { NOMEMALIGN
 class OpAdd : public OpBinary { NOMEMALIGN
   public:
     OpAdd () : OpBinary ("(%1 + %2)") { } 
-    complex_type R (real_type a, real_type b) const { return a+b; }
+    template <class T> T R (T a, T b) const { return a+b; }
     complex_type Z (complex_type a, complex_type b) const { return a+b; }
 };
 
 class OpSubtract : public OpBinary { NOMEMALIGN
   public:
     OpSubtract () : OpBinary ("(%1 - %2)") { } 
-    complex_type R (real_type a, real_type b) const { return a-b; }
+    template <class T> T R (T a, T b) const { return a-b; }
     complex_type Z (complex_type a, complex_type b) const { return a-b; }
 };
 
 class OpMultiply : public OpBinary { NOMEMALIGN
   public:
     OpMultiply () : OpBinary ("(%1 * %2)") { }
-    complex_type R (real_type a, real_type b) const { return a*b; }
+    template <class T> T R (T a, T b) const { return a*b; }
     complex_type Z (complex_type a, complex_type b) const { return a*b; }
 };
 
 class OpDivide : public OpBinary { NOMEMALIGN
   public:
     OpDivide () : OpBinary ("(%1 / %2)") { } 
-    complex_type R (real_type a, real_type b) const { return a/b; }
+    template <class T> T R (T a, T b) const { return a/b; }
     complex_type Z (complex_type a, complex_type b) const { return a/b; }
 };
 
 class OpPow : public OpBinary { NOMEMALIGN
   public:
     OpPow () : OpBinary ("%1^%2") { }
-    complex_type R (real_type a, real_type b) const { return std::pow (a, b); }
+    template <class T> T R (T a, T b) const { return std::pow (a, b); }
     complex_type Z (complex_type a, complex_type b) const { return std::pow (a, b); }
 };
 
 class OpMin : public OpBinary { NOMEMALIGN
   public:
     OpMin () : OpBinary ("min (%1, %2)") { }
-    complex_type R (real_type a, real_type b) const { return std::min (a, b); }
+    template <class T> T R (T a, T b) const { return std::min (a, b); }
 };
 
 class OpMax : public OpBinary { NOMEMALIGN
   public:
     OpMax () : OpBinary ("max (%1, %2)") { } 
-    complex_type R (real_type a, real_type b) const { return std::max (a, b); }
+    template <class T> T R (T a, T b) const { return std::max (a, b); }
 };
 
 class OpLessThan : public OpBinary { NOMEMALIGN
   public:
     OpLessThan () : OpBinary ("(%1 < %2)") { }
-    complex_type R (real_type a, real_type b) const { return a < b; }
+    template <class T> T R (T a, T b) const { return a < b; }
 };
 
 class OpGreaterThan : public OpBinary { NOMEMALIGN
   public:
     OpGreaterThan () : OpBinary ("(%1 > %2)") { } 
-    complex_type R (real_type a, real_type b) const { return a > b; }
+    template <class T> T R (T a, T b) const { return a > b; }
 };
 
 class OpLessThanOrEqual : public OpBinary { NOMEMALIGN
   public:
     OpLessThanOrEqual () : OpBinary ("(%1 <= %2)") { }
-    complex_type R (real_type a, real_type b) const { return a <= b; }
+    template <class T> T R (T a, T b) const { return a <= b; }
 };
 
 class OpGreaterThanOrEqual : public OpBinary { NOMEMALIGN
   public:
     OpGreaterThanOrEqual () : OpBinary ("(%1 >= %2)") { } 
-    complex_type R (real_type a, real_type b) const { return a >= b; }
+    template <class T> T R (T a, T b) const { return a >= b; }
 };
 
 class OpEqual : public OpBinary { NOMEMALIGN
   public:
     OpEqual () : OpBinary ("(%1 == %2)", true) { }
-    complex_type R (real_type a, real_type b) const { return a == b; }
+    template <class T> T R (T a, T b) const { return a == b; }
     complex_type Z (complex_type a, complex_type b) const { return a == b; }
 };
 
 class OpNotEqual : public OpBinary { NOMEMALIGN
   public:
     OpNotEqual () : OpBinary ("(%1 != %2)", true) { }
-    complex_type R (real_type a, real_type b) const { return a != b; }
+    template <class T> T R (T a, T b) const { return a != b; }
     complex_type Z (complex_type a, complex_type b) const { return a != b; }
 };
 
@@ -1043,7 +1433,7 @@ class OpComplex : public OpBinary { NOMEMALIGN
 class OpIf : public OpTernary { NOMEMALIGN
   public:
     OpIf () : OpTernary ("(%1 ? %2 : %3)") { }
-    complex_type R (real_type a, real_type b, real_type c) const { return a ? b : c; }
+    template <class T> T R (T a, T b, T c) const { return a ? b : c; }
     complex_type Z (complex_type a, complex_type b, complex_type c) const { return a.real() ? b : c; }
 };
 
@@ -1054,6 +1444,9 @@ class OpIf : public OpTernary { NOMEMALIGN
  **********************************************************************/
 
 void run () {
+  // streamed inputs are only accessed once each slab is available:
+  ImageIO::Pipe::defer_wait = true;
+
   vector<StackEntry> stack;
 
   for (int n = 1; n < App::argc; ++n) {
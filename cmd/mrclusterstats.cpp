@@ -100,16 +100,17 @@ void write_output (const VectorType& data,
 
 
 
-using value_type = Stats::TFCE::value_type;
-
-
-
-void run() {
-
-  const value_type cluster_forming_threshold = get_option_value ("threshold", NaN);
-  const value_type tfce_dh = get_option_value ("tfce_dh", DEFAULT_TFCE_DH);
-  const value_type tfce_H = get_option_value ("tfce_h", DEFAULT_TFCE_H);
-  const value_type tfce_E = get_option_value ("tfce_e", DEFAULT_TFCE_E);
+template <typename ValueType>
+void execute ()
+{
+  using stat_value_type = ValueType;
+  using stat_matrix_type = Eigen::Matrix<stat_value_type, Eigen::Dynamic, Eigen::Dynamic>;
+  using stat_vector_type = Eigen::Array<stat_value_type, Eigen::Dynamic, 1>;
+
+  const stat_value_type cluster_forming_threshold = get_option_value ("threshold", NaN);
+  const default_type tfce_dh = get_option_value ("tfce_dh", DEFAULT_TFCE_DH);
+  const default_type tfce_H = get_option_value ("tfce_h", DEFAULT_TFCE_H);
+  const default_type tfce_E = get_option_value ("tfce_e", DEFAULT_TFCE_E);
   const bool use_tfce = !std::isfinite (cluster_forming_threshold);
   int num_perms = get_option_value ("nperms", DEFAULT_NUMBER_PERMUTATIONS);
   int nperms_nonstationary = get_option_value ("nperms_nonstationary", DEFAULT_NUMBER_PERMUTATIONS_NONSTATIONARITY);
@@ -128,7 +129,7 @@ void run() {
   }
 
   // Load design matrix
-  const matrix_type design = load_matrix<value_type> (argument[1]);
+  const matrix_type design = load_matrix (argument[1]);
   if (design.rows() != (ssize_t)subjects.size())
     throw Exception ("number of input files does not match number of rows in design matrix");
 
@@ -153,7 +154,7 @@ void run() {
   }
 
   // Load contrast matrix
-  const matrix_type contrast = load_matrix<value_type> (argument[2]);
+  const matrix_type contrast = load_matrix (argument[2]);
   if (contrast.cols() != design.cols())
     throw Exception ("the number of contrasts does not equal the number of columns in the design matrix");
 
@@ -164,7 +165,7 @@ void run() {
   vector<vector<int> > mask_indices = connector.precompute_adjacency (mask_image);
   const size_t num_vox = mask_indices.size();
 
-  matrix_type data (num_vox, subjects.size());
+  stat_matrix_type data (num_vox, subjects.size());
 
   {
     // Load images
@@ -203,32 +204,30 @@ void run() {
   const std::string prefix (argument[4]);
   bool compute_negative_contrast = get_options("negative").size();
 
-  vector_type default_cluster_output (num_vox);
-  std::shared_ptr<vector_type> default_cluster_output_neg;
-  vector_type tvalue_output (num_vox);
-  vector_type empirical_enhanced_statistic;
+  stat_vector_type default_cluster_output (num_vox);
+  std::shared_ptr<stat_vector_type> default_cluster_output_neg;
+  stat_vector_type tvalue_output (num_vox);
+  stat_vector_type empirical_enhanced_statistic;
   if (compute_negative_contrast)
-    default_cluster_output_neg.reset (new vector_type (num_vox));
+    default_cluster_output_neg.reset (new stat_vector_type (num_vox));
 
-  Math::Stats::GLMTTest glm (data, design, contrast);
+  Math::Stats::GLMTTest<stat_value_type> glm (data, design, contrast);
 
-  std::shared_ptr<Stats::EnhancerBase> enhancer;
+  std::shared_ptr<Stats::EnhancerBase<stat_value_type>> enhancer;
   if (use_tfce) {
-    std::shared_ptr<Stats::TFCE::EnhancerBase> base (new Stats::Cluster::ClusterSize (connector, cluster_forming_threshold));
-    enhancer.reset (new Stats::TFCE::Wrapper (base, tfce_dh, tfce_E, tfce_H));
+    std::shared_ptr<Stats::TFCE::EnhancerBase<stat_value_type>> base (new Stats::Cluster::ClusterSize<stat_value_type> (connector, cluster_forming_threshold));
+    enhancer.reset (new Stats::TFCE::Wrapper<stat_value_type> (base, tfce_dh, tfce_E, tfce_H));
   } else {
-    enhancer.reset (new Stats::Cluster::ClusterSize (connector, cluster_forming_threshold));
+    enhancer.reset (new Stats::Cluster::ClusterSize<stat_value_type> (connector, cluster_forming_threshold));
   }
 
   if (do_nonstationary_adjustment) {
     if (!use_tfce)
       throw Exception ("nonstationary adjustment is not currently implemented for threshold-based cluster analysis");
     if (permutations_nonstationary.size()) {
-      Stats::PermTest::PermutationStack permutations (permutations_nonstationary, "precomputing empirical statistic for non-stationarity adjustment...");
-      Stats::PermTest::precompute_empirical_stat (glm, enhancer, permutations, empirical_enhanced_statistic);
+      Stats::PermTest::precompute_empirical_stat (glm, enhancer, permutations_nonstationary, empirical_enhanced_statistic);
     } else {
-      Stats::PermTest::PermutationStack permutations (nperms_nonstationary, design.rows(), "precomputing empirical statistic for non-stationarity adjustment...", false);
-      Stats::PermTest::precompute_empirical_stat (glm, enhancer, permutations, empirical_enhanced_statistic);
+      Stats::PermTest::precompute_empirical_stat (glm, enhancer, nperms_nonstationary, empirical_enhanced_statistic);
     }
 
     save_matrix (empirical_enhanced_statistic, prefix + "empirical.txt");
@@ -282,27 +281,30 @@ void run() {
 
   if (!get_options ("notest").size()) {
 
-    vector_type perm_distribution (num_perms);
-    std::shared_ptr<vector_type> perm_distribution_neg;
-    vector_type uncorrected_pvalue (num_vox);
-    std::shared_ptr<vector_type> uncorrected_pvalue_neg;
+    stat_vector_type perm_distribution (num_perms);
+    std::shared_ptr<stat_vector_type> perm_distribution_neg;
+    stat_vector_type uncorrected_pvalue (num_vox);
+    std::shared_ptr<stat_vector_type> uncorrected_pvalue_neg;
 
     if (compute_negative_contrast) {
-      perm_distribution_neg.reset (new vector_type (num_perms));
-      uncorrected_pvalue_neg.reset (new vector_type (num_vox));
+      perm_distribution_neg.reset (new stat_vector_type (num_perms));
+      uncorrected_pvalue_neg.reset (new stat_vector_type (num_vox));
     }
 
+    bool complete;
     if (permutations.size()) {
-      Stats::PermTest::run_permutations (permutations, glm, enhancer, empirical_enhanced_statistic,
-                                         default_cluster_output, default_cluster_output_neg,
-                                         perm_distribution, perm_distribution_neg,
-                                         uncorrected_pvalue, uncorrected_pvalue_neg);
+      complete = Stats::PermTest::run_permutations (permutations, glm, enhancer, empirical_enhanced_statistic,
+                                                    default_cluster_output, default_cluster_output_neg,
+                                                    perm_distribution, perm_distribution_neg,
+                                                    uncorrected_pvalue, uncorrected_pvalue_neg);
     } else {
-      Stats::PermTest::run_permutations (num_perms, glm, enhancer, empirical_enhanced_statistic,
-                                         default_cluster_output, default_cluster_output_neg,
-                                         perm_distribution, perm_distribution_neg,
-                                         uncorrected_pvalue, uncorrected_pvalue_neg);
+      complete = Stats::PermTest::run_permutations (num_perms, glm, enhancer, empirical_enhanced_statistic,
+                                                    default_cluster_output, default_cluster_output_neg,
+                                                    perm_distribution, perm_distribution_neg,
+                                                    uncorrected_pvalue, uncorrected_pvalue_neg);
     }
+    if (!complete)
+      return;
 
     save_matrix (perm_distribution, prefix + "perm_dist.txt");
     if (compute_negative_contrast) {
@@ -317,7 +319,7 @@ void run() {
     }
     ++progress;
     {
-      vector_type fwe_pvalue_output (num_vox);
+      stat_vector_type fwe_pvalue_output (num_vox);
       Math::Stats::Permutation::statistic2pvalue (perm_distribution, default_cluster_output, fwe_pvalue_output);
       auto fwe_pvalue_image = Image<float>::create (prefix + "fwe_pvalue.mif", output_header);
       write_output (fwe_pvalue_output, mask_indices, fwe_pvalue_image);
@@ -329,7 +331,7 @@ void run() {
       auto uncorrected_pvalue_image_neg = Image<float>::create (prefix + "uncorrected_pvalue_neg.mif", output_header);
       write_output (*uncorrected_pvalue_neg, mask_indices, uncorrected_pvalue_image_neg);
       ++progress;
-      vector_type fwe_pvalue_output_neg (num_vox);
+      stat_vector_type fwe_pvalue_output_neg (num_vox);
       Math::Stats::Permutation::statistic2pvalue (*perm_distribution_neg, *default_cluster_output_neg, fwe_pvalue_output_neg);
       auto fwe_pvalue_image_neg = Image<float>::create (prefix + "fwe_pvalue_neg.mif", output_header);
       write_output (fwe_pvalue_output_neg, mask_indices, fwe_pvalue_image_neg);
@@ -337,3 +339,13 @@ void run() {
   }
 
 }
+
+
+
+void run()
+{
+  if (Stats::PermTest::single_precision())
+    execute<float>();
+  else
+    execute<double>();
+}
@@ -15,6 +15,7 @@
 #include "command.h"
 #include "image.h"
 #include "algo/loop.h"
+#include "algo/threaded_loop.h"
 #include "adapter/extract.h"
 #include "filter/optimal_threshold.h"
 
@@ -48,6 +49,111 @@ void usage ()
 }
 
 
+// Sum the (DC terms of the) tissue compartments within each voxel
+class TissueSum { MEMALIGN(TissueSum)
+  public:
+    TissueSum (const vector<Image<float>>& tissues) :
+      tissues (tissues) { }
+
+    void operator() (Image<float>& summed) {
+      float sum = 0.0f;
+      for (auto& tissue : tissues) {
+        assign_pos_of (summed, 0, 3).to (tissue);
+        sum += tissue.value();
+      }
+      summed.value() = sum;
+    }
+
+  private:
+    vector<Image<float>> tissues;
+};
+
+
+
+// Accumulate the normal equations of the least-squares fit within the mask,
+//   such that the matrix of tissue values is never stored in full;
+//   each thread accumulates its own contribution, which is added to the
+//   totals on destruction
+class NormalEquations { MEMALIGN(NormalEquations)
+  public:
+    NormalEquations (const vector<Image<float>>& tissues, const default_type target,
+                     Eigen::MatrixXd& total_XtX, Eigen::VectorXd& total_Xty) :
+      tissues (tissues),
+      target (target),
+      total_XtX (total_XtX),
+      total_Xty (total_Xty),
+      XtX (Eigen::MatrixXd::Zero (tissues.size(), tissues.size())),
+      Xty (Eigen::VectorXd::Zero (tissues.size())),
+      x (tissues.size()) { }
+
+    ~NormalEquations () {
+      std::lock_guard<std::mutex> lock (mutex);
+      total_XtX += XtX;
+      total_Xty += Xty;
+    }
+
+    void operator() (Image<bool>& mask) {
+      if (!mask.value())
+        return;
+      for (size_t j = 0; j != tissues.size(); ++j) {
+        assign_pos_of (mask, 0, 3).to (tissues[j]);
+        x[j] = tissues[j].value();
+      }
+      XtX.selfadjointView<Eigen::Lower>().rankUpdate (x);
+      Xty += target * x;
+    }
+
+  private:
+    vector<Image<float>> tissues;
+    const default_type target;
+    Eigen::MatrixXd& total_XtX;
+    Eigen::VectorXd& total_Xty;
+    Eigen::MatrixXd XtX;
+    Eigen::VectorXd Xty, x;
+
+    static std::mutex mutex;
+};
+std::mutex NormalEquations::mutex;
+
+
+
+// Write all scaled tissue compartments within a single pass over the image:
+//   each thread processes one slice at a time, within which each image is
+//   traversed in the order of its strides
+class ScaleTissues { MEMALIGN(ScaleTissues)
+  public:
+    ScaleTissues (const vector<Image<float>>& inputs, const vector<Image<float>>& outputs,
+                  const Eigen::VectorXd& scale_factors, const size_t outer_axis) :
+      inputs (inputs),
+      outputs (outputs),
+      scale_factors (scale_factors)
+    {
+      for (const auto& in : inputs) {
+        auto order = Stride::order (in);
+        order.erase (std::find (order.begin(), order.end(), outer_axis));
+        inner_axes.push_back (order);
+      }
+    }
+
+    void operator() (const Iterator& pos) {
+      for (size_t j = 0; j != inputs.size(); ++j) {
+        auto& in (inputs[j]);
+        auto& out (outputs[j]);
+        const float scale_factor = scale_factors[j];
+        assign_pos_of (pos, 0, 3).to (in, out);
+        for (auto l = Loop (inner_axes[j]) (in, out); l; ++l)
+          out.value() = in.value() * scale_factor;
+      }
+    }
+
+  private:
+    vector<Image<float>> inputs, outputs;
+    const Eigen::VectorXd scale_factors;
+    vector<vector<size_t>> inner_axes;
+};
+
+
+
 void run ()
 {
 
@@ -80,59 +186,38 @@ void run ()
   auto opt = get_options("mask");
   if (opt.size()) {
     mask = Image<bool>::open (opt[0][0]);
+    check_dimensions (mask, input_images[0], 0, 3);
   } else {
     auto summed = Image<float>::scratch (input_images[0], "summed image");
-    for (size_t j = 0; j < input_images.size(); ++j) {
-      for (auto i = Loop (summed, 0, 3) (summed, input_images[j]); i; ++i)
-        summed.value() += input_images[j].value();
-    }
+    ThreadedLoop ("summing tissue compartments", summed, 0, 3).run (TissueSum (input_images), summed);
     Filter::OptimalThreshold threshold_filter (summed);
     mask = Image<bool>::scratch (threshold_filter);
     threshold_filter (summed, mask);
   }
-  size_t num_voxels = 0;
-  for (auto i = Loop (mask) (mask); i; ++i) {
-    if (mask.value())
-      num_voxels++;
-  }
 
   const float normalisation_value = get_option_value ("value", DEFAULT_NORM_VALUE);
 
-  {
-    ProgressBar progress ("normalising tissue compartments...");
-    Eigen::MatrixXf X (num_voxels, input_images.size());
-    Eigen::MatrixXf y (num_voxels, 1);
-    y.fill (normalisation_value);
-    uint32_t counter = 0;
-    for (auto i = Loop (mask) (mask); i; ++i) {
-      if (mask.value()) {
-        for (size_t j = 0; j < input_images.size(); ++j) {
-          assign_pos_of (mask, 0, 3).to (input_images[j]);
-          X (counter, j) = input_images[j].value();
-        }
-        ++counter;
-      }
-    }
-    progress++;
-    Eigen::MatrixXf w = X.jacobiSvd (Eigen::ComputeThinU | Eigen::ComputeThinV).solve(y);
-    progress++;
-    for (size_t j = 0; j < input_images.size(); ++j) {
-      float scale_factor = w(j,0);
-      // If scale factor already present, we accumulate (for use in mtbin script)
-      if (input_images[j].keyval().count("normalisation_scale_factor"))
-        scale_factor *= std::stof(input_images[j].keyval().at("normalisation_scale_factor"));
-      output_headers[j].keyval()["normalisation_scale_factor"] = str(scale_factor);
-      auto output_image = Image<float>::create (output_filenames[j], output_headers[j]);
-      if (std::find (sh_image_indexes.begin(), sh_image_indexes.end(), j) != sh_image_indexes.end()) {
-        auto input = Image<float>::open (argument[j * 2]);
-        for (auto i = Loop (input) (input, output_image); i; ++i)
-          output_image.value() = input.value() * w(j,0);
-      } else {
-        for (auto i = Loop (input_images[j]) (input_images[j], output_image); i; ++i)
-          output_image.value() = input_images[j].value() * w(j,0);
-      }
-      progress++;
-    }
+  const size_t num_tissues = input_images.size();
+  Eigen::MatrixXd XtX (Eigen::MatrixXd::Zero (num_tissues, num_tissues));
+  Eigen::VectorXd Xty (Eigen::VectorXd::Zero (num_tissues));
+  ThreadedLoop ("normalising tissue compartments", mask, 0, 3).run (NormalEquations (input_images, normalisation_value, XtX, Xty), mask);
+  if (XtX.isZero (0.0))
+    throw Exception ("unable to determine normalisation scale factors: no non-zero tissue values within the mask");
+  const Eigen::VectorXd w = XtX.selfadjointView<Eigen::Lower>().ldlt().solve (Xty);
+
+  vector<Image<float>> inputs, outputs;
+  for (size_t j = 0; j < num_tissues; ++j) {
+    float scale_factor = w[j];
+    // If scale factor already present, we accumulate (for use in mtbin script)
+    if (input_images[j].keyval().count("normalisation_scale_factor"))
+      scale_factor *= std::stof(input_images[j].keyval().at("normalisation_scale_factor"));
+    output_headers[j].keyval()["normalisation_scale_factor"] = str(scale_factor);
+    outputs.push_back (Image<float>::create (output_filenames[j], output_headers[j]));
+    if (std::find (sh_image_indexes.begin(), sh_image_indexes.end(), j) != sh_image_indexes.end())
+      inputs.push_back (Image<float>::open (argument[j * 2]));
+    else
+      inputs.push_back (input_images[j]);
   }
+  auto loop = ThreadedLoop ("writing normalised tissue compartments", input_images[0], 0, 3, 2);
+  loop.run_outer (ScaleTissues (inputs, outputs, w, loop.outer_loop.axes[0]));
 }
-
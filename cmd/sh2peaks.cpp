@@ -19,9 +19,16 @@
 #include "thread_queue.h"
 #include "image.h"
 #include "algo/loop.h"
+#include "dwi/directions/predefined.h"
+#include "dwi/directions/set.h"
 
 
 #define DOT_THRESHOLD 0.99
+
+// With -fast, each lobe is only searched for once, and would be lost if that
+// search failed to converge (as it can along narrow ridges); the search is
+// therefore allowed more iterations than when commenced from every seed
+#define FAST_MAX_ITERATIONS 500
 #define DEFAULT_NPEAKS 3
 
 using namespace MR;
@@ -33,6 +40,13 @@ void usage ()
 
   SYNOPSIS = "Extract the peaks of a spherical harmonic function at each voxel, by commencing a Newton search along a set of specified directions";
 
+  DESCRIPTION
+  + "By default, a Newton search is commenced from each of the seed directions in every voxel. "
+    "With the -fast option, the function is instead first sampled on a dense set of 1281 directions "
+    "(for a whole row of voxels at a time), and the Newton search is only commenced from those "
+    "samples that are local maxima. This yields the same peaks for all but the most closely "
+    "spaced lobes, while requiring far fewer Newton searches.";
+
   ARGUMENTS
   + Argument ("SH", "the input image of SH coefficients.")
   .type_image_in ()
@@ -67,6 +81,10 @@ void usage ()
             "the optimisation (by default, the built-in 60 direction set is used)")
   + Argument ("file").type_file_in()
 
+  + Option ("fast",
+            "only commence the Newton search from the local maxima of the function "
+            "sampled on a dense set of directions, rather than from every seed direction.")
+
   + Option ("mask",
             "only perform computation within the specified binary brain mask image.")
   + Argument ("image").type_image_in();
@@ -92,9 +110,11 @@ class Direction { MEMALIGN(Direction)
 
 
 
+// SH coefficients for a row of voxels along the first axis,
+// one column per voxel; pos is the position of the first voxel
 class Item { MEMALIGN(Item)
   public:
-    Eigen::VectorXf data;
+    Eigen::MatrixXf data;
     ssize_t pos[3];
 };
 
@@ -107,25 +127,27 @@ class DataLoader { MEMALIGN(DataLoader)
     DataLoader (Image<value_type>& sh_data,
                 Image<bool>* mask_data) :
       sh (sh_data),
-      loop (Loop("estimating peak directions", 0, 3) (sh)) { }
+      mask (mask_data ? new Image<bool> (*mask_data) : nullptr),
+      loop (Loop("estimating peak directions", 1, 3) (sh)) { }
 
     bool operator() (Item& item) {
       if (loop) {
-        item.data.resize (sh.size(3));
-        item.pos[0] = sh.index(0);
+        item.data.resize (sh.size(3), sh.size(0));
+        item.pos[0] = 0;
         item.pos[1] = sh.index(1);
         item.pos[2] = sh.index(2);
 
-        if (mask) {
-          assign_pos_of(sh).to(*mask);
-          if (!mask->value()) {
-            for (auto l = Loop(3) (sh); l; ++l)
-              item.data[sh.index(3)] = NAN;
+        for (auto x = Loop(0) (sh); x; ++x) {
+          if (mask) {
+            assign_pos_of (sh, 0, 3).to (*mask);
+            if (!mask->value()) {
+              item.data.col (sh.index(0)).fill (NAN);
+              continue;
+            }
           }
-        } else {
           // iterates over SH coefficients
           for (auto l = Loop(3) (sh); l; ++l)
-            item.data[sh.index(3)] = sh.value();
+            item.data (sh.index(3), sh.index(0)) = sh.value();
         }
 
         loop++;
@@ -144,6 +166,55 @@ class DataLoader { MEMALIGN(DataLoader)
 
 
 
+// Candidate peak directions found by sampling the SH function on a dense
+// direction set: each sample that exceeds the amplitude of all of its
+// neighbours is a local maximum, and is used to seed a Newton search.
+// The 1281-direction set covers a single hemisphere, and its adjacency wraps
+// across the equator onto the antipodal directions; since the (even-order)
+// SH function is antipodally symmetric, each lobe therefore yields a single
+// candidate, rather than one for each of +v and -v. Distinct candidates
+// whose Newton searches converge onto the same peak are still merged below.
+class Sampler { MEMALIGN(Sampler)
+  public:
+    Sampler (int lmax) :
+      directions (DWI::Directions::tesselation_1281()),
+      SH2A (Math::SH::init_transform (DWI::Directions::tesselation_1281(), lmax).cast<value_type>()) { }
+
+    //! sample the SH functions of a whole row of voxels with one matrix product
+    void sample (const Eigen::MatrixXf& data, Eigen::MatrixXf& amplitudes) const {
+      amplitudes.noalias() = SH2A * data;
+    }
+
+    template <class VectorType>
+    void local_maxima (const VectorType& amplitudes, vector<Direction>& candidates) const {
+      candidates.clear();
+      for (size_t i = 0; i != directions.size(); ++i) {
+        const value_type a = amplitudes[i];
+        bool is_maximum = true;
+        for (const auto j : directions.get_adj_dirs (i)) {
+          if (amplitudes[j] > a || (amplitudes[j] == a && j < i)) {
+            is_maximum = false;
+            break;
+          }
+        }
+        if (is_maximum) {
+          Direction d;
+          d.a = a;
+          d.v = directions[i].cast<value_type>();
+          candidates.push_back (d);
+        }
+      }
+      std::sort (candidates.begin(), candidates.end());
+    }
+
+  private:
+    const DWI::Directions::Set directions;
+    const Eigen::MatrixXf SH2A;
+};
+
+
+
+
 class Processor { MEMALIGN(Processor)
   public:
     Processor (Image<value_type>& dirs_data,
@@ -152,7 +223,8 @@ class Processor { MEMALIGN(Processor)
                int npeaks,
                vector<Direction> true_peaks,
                value_type threshold,
-               Image<value_type>* ipeaks_data) :
+               Image<value_type>* ipeaks_data,
+               const std::shared_ptr<Sampler>& sampler) :
       dirs_vox (dirs_data),
       dirs (directions),
       lmax (lmax),
@@ -160,25 +232,59 @@ class Processor { MEMALIGN(Processor)
       true_peaks (true_peaks),
       threshold (threshold),
       peaks_out (npeaks),
-      ipeaks_vox (ipeaks_data) { }
+      ipeaks_vox (ipeaks_data),
+      sampler (sampler) { }
 
     bool operator() (const Item& item) {
+      if (sampler)
+        sampler->sample (item.data, amplitudes);
 
-      dirs_vox.index(0) = item.pos[0];
-      dirs_vox.index(1) = item.pos[1];
-      dirs_vox.index(2) = item.pos[2];
+      for (ssize_t n = 0; n < item.data.cols(); ++n) {
+        data = item.data.col (n);
+        process (item.pos[0] + n, item.pos[1], item.pos[2], n);
+      }
+      return true;
+    }
 
-      if (check_input (item)) {
+  private:
+    Image<value_type> dirs_vox;
+    Eigen::Matrix<value_type, Eigen::Dynamic, 2> dirs;
+    int lmax, npeaks;
+    vector<Direction> true_peaks;
+    value_type threshold;
+    vector<Direction> peaks_out;
+    copy_ptr<Image<value_type> > ipeaks_vox;
+    std::shared_ptr<Sampler> sampler;
+    Eigen::VectorXf data;
+    Eigen::MatrixXf amplitudes;
+    vector<Direction> candidates;
+
+    void process (ssize_t x, ssize_t y, ssize_t z, ssize_t column) {
+
+      dirs_vox.index(0) = x;
+      dirs_vox.index(1) = y;
+      dirs_vox.index(2) = z;
+
+      if (check_input (x, y, z)) {
         for (auto l = Loop(3) (dirs_vox); l; ++l)
           dirs_vox.value() = NAN;
-        return true;
+        return;
+      }
+
+      // either commence the search from every seed direction,
+      // or only from the local maxima of the sampled function:
+      if (sampler)
+        sampler->local_maxima (amplitudes.col (column), candidates);
+      else {
+        candidates.clear();
+        for (size_t i = 0; i < size_t(dirs.rows()); i++)
+          candidates.push_back (Direction (dirs (i,0), dirs (i,1)));
       }
 
       vector<Direction> all_peaks;
 
-      for (size_t i = 0; i < size_t(dirs.rows()); i++) {
-        Direction p (dirs (i,0), dirs (i,1));
-        p.a = Math::SH::get_peak (item.data, lmax, p.v);
+      for (auto& p : candidates) {
+        p.a = Math::SH::get_peak (data, lmax, p.v, nullptr, sampler ? FAST_MAX_ITERATIONS : 50);
         if (std::isfinite (p.a)) {
           for (size_t j = 0; j < all_peaks.size(); j++) {
             if (std::abs (p.v.dot (all_peaks[j].v)) > DOT_THRESHOLD) {
@@ -192,9 +298,9 @@ class Processor { MEMALIGN(Processor)
       }
 
       if (ipeaks_vox) {
-        ipeaks_vox->index(0) = item.pos[0];
-        ipeaks_vox->index(1) = item.pos[1];
-        ipeaks_vox->index(2) = item.pos[2];
+        ipeaks_vox->index(0) = x;
+        ipeaks_vox->index(1) = y;
+        ipeaks_vox->index(2) = z;
 
         for (int i = 0; i < npeaks; i++) {
           Eigen::Vector3f p;
@@ -240,35 +346,24 @@ class Processor { MEMALIGN(Processor)
         dirs_vox.index(3)++;
       }
       for (; dirs_vox.index(3) < 3*npeaks; dirs_vox.index(3)++) dirs_vox.value() = NAN;
-
-      return true;
     }
 
-  private:
-    Image<value_type> dirs_vox;
-    Eigen::Matrix<value_type, Eigen::Dynamic, 2> dirs;
-    int lmax, npeaks;
-    vector<Direction> true_peaks;
-    value_type threshold;
-    vector<Direction> peaks_out;
-    copy_ptr<Image<value_type> > ipeaks_vox;
-
-    bool check_input (const Item& item) {
+    bool check_input (ssize_t x, ssize_t y, ssize_t z) {
       if (ipeaks_vox) {
-        ipeaks_vox->index(0) = item.pos[0];
-        ipeaks_vox->index(1) = item.pos[1];
-        ipeaks_vox->index(2) = item.pos[2];
+        ipeaks_vox->index(0) = x;
+        ipeaks_vox->index(1) = y;
+        ipeaks_vox->index(2) = z;
         ipeaks_vox->index(3) = 0;
         if (std::isnan (value_type (ipeaks_vox->value())))
           return true;
       }
 
       bool no_peaks = true;
-      for (size_t i = 0; i < size_t(item.data.size()); i++) {
-        if (std::isnan (item.data[i]))
+      for (size_t i = 0; i < size_t(data.size()); i++) {
+        if (std::isnan (data[i]))
           return true;
         if (no_peaks)
-          if (i && item.data[i] != 0.0) 
+          if (i && data[i] != 0.0) 
             no_peaks = false;
       }
 
@@ -292,7 +387,10 @@ void run ()
   if (opt.size())
     mask_data.reset (new Image<bool>(Image<bool>::open (opt[0][0])));
 
+  const bool fast = get_options ("fast").size();
   opt = get_options ("seeds");
+  if (fast && opt.size())
+    throw Exception ("options -seeds and -fast are mutually exclusive");
   Eigen::Matrix<value_type, Eigen::Dynamic, 2> dirs;
   if (opt.size())
     dirs = load_matrix<value_type> (opt[0][0]);
@@ -332,11 +430,16 @@ void run ()
   header.size(3) = 3 * npeaks;
   auto peaks = Image<value_type>::create (argument[1], header);
 
+  const int lmax = Math::SH::LforN (SH_data.size (3));
+  std::shared_ptr<Sampler> sampler;
+  if (fast)
+    sampler.reset (new Sampler (lmax));
+
   DataLoader loader (SH_data, mask_data.get());
-  Processor processor (peaks, dirs, Math::SH::LforN (SH_data.size (3)),
-      npeaks, true_peaks, threshold, ipeaks_data.get());
+  Processor processor (peaks, dirs, lmax,
+      npeaks, true_peaks, threshold, ipeaks_data.get(), sampler);
 
-  Thread::run_queue (loader, Thread::batch (Item()), Thread::multi (processor));
+  Thread::run_queue (loader, Item(), Thread::multi (processor));
 }
 
 
@@ -197,6 +197,8 @@ void usage ()
 
   + DWI::Tractography::Tracking::TrackOption
 
+  + DWI::Tractography::Tracking::ShardOption
+
   + DWI::Tractography::Seeding::SeedMechanismOption
 
   + DWI::Tractography::Seeding::SeedParameterOption
@@ -21,6 +21,7 @@
 
 #include "image.h"
 #include "thread_queue.h"
+#include "file/config.h"
 
 #include "dwi/gradient.h"
 #include "dwi/tractography/file.h"
@@ -84,7 +85,19 @@ const OptionGroup OutputDimOption = OptionGroup ("Options for the dimensionality
     + Option ("tod",
         "generate a Track Orientation Distribution (TOD) in each voxel; need to specify the maximum "
         "spherical harmonic degree lmax to use when generating Apodised Point Spread Functions")
-      + Argument ("lmax").type_integer (2, 20);
+      + Argument ("lmax").type_integer (2, 20)
+
+    + Option ("tod_dixel",
+        "when generating a TOD, quantise the streamline tangents onto a set of directions, and "
+        "accumulate the histogram of these directions within each voxel; this is only converted "
+        "to spherical harmonics (using the Apodised Point Spread Function of each direction) once "
+        "all streamlines have been mapped, which is considerably faster than computing the "
+        "Apodised Point Spread Function for every streamline vertex; only those directions "
+        "traversed within each voxel are stored. Requires either a number of "
+        "dixels (references an internal direction set), or a path to a text file containing a set "
+        "of directions stored as azimuth/elevation pairs. Only compatible with the sum and mean "
+        "voxel statistics, and not with the Gaussian track statistic.")
+      + Argument ("path").type_text();
 
 
 
@@ -243,6 +256,36 @@ MapWriterBase* make_writer (Header& H, const std::string& name, const vox_stat_t
 
 
 
+// With multiple threads, each mapping thread writes its own results rather than passing them
+//   to a single writer thread; each thread gets its own copy of the output buffers if
+//   memory permits, otherwise all threads write to the same buffers with locking
+template <class MapperType, class SetType>
+void run_mapping (TrackLoader& loader, MapperType& mapper, MapWriterBase& writer)
+{
+  const size_t num_threads = Thread::number_of_threads();
+  if (num_threads > 1) {
+    //CONF option: TckmapThreadBufferMemory
+    //CONF default: 1024
+    //CONF The maximum memory in MB that tckmap may use for per-thread
+    //CONF copies of its output buffers. If this would be exceeded, all
+    //CONF mapping threads instead write to a single set of buffers, with
+    //CONF concurrent updates to the same image slice serialised.
+    const int64_t limit = int64_t (File::Config::get_int ("TckmapThreadBufferMemory", 1024)) * 1024 * 1024;
+    const bool shared = int64_t(num_threads) * writer.footprint() > limit;
+    INFO (std::string ("writing from mapping threads using ") + (shared ? "shared buffers" : "per-thread buffers"));
+    Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (MapWriterThread<MapperType, SetType> (mapper, writer, shared)));
+  } else {
+    Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (mapper), Thread::batch (SetType()), writer);
+  }
+}
+
+
+
+
+
+
+
+
 DataType determine_datatype (const DataType current_dt, const contrast_t contrast, const DataType default_dt, const bool precise)
 {
   if (current_dt == DataType::Undefined) {
@@ -372,6 +415,16 @@ void run () {
     Stride::set (header, Stride::contiguous_along_axis (3, header));
   }
 
+  opt = get_options ("tod_dixel");
+  if (opt.size()) {
+    if (writer_type != TOD)
+      throw Exception ("The -tod_dixel option can only be used in conjunction with the -tod option");
+    if (Path::exists (opt[0][0]))
+      dirs.reset (new Directions::FastLookupSet (str(opt[0][0])));
+    else
+      dirs.reset (new Directions::FastLookupSet (to<size_t>(opt[0][0])));
+  }
+
   header.keyval()["twi_dimensionality"] = writer_dims[writer_type];
 
 
@@ -423,6 +476,13 @@ void run () {
 
   }
 
+  if (writer_type == TOD && dirs) {
+    if (stat_vox != V_SUM && stat_vox != V_MEAN)
+      throw Exception ("Cannot use voxel statistic other than 'sum' or 'mean' with the -tod_dixel option");
+    if (stat_tck == GAUSSIAN)
+      throw Exception ("Cannot use the Gaussian track statistic with the -tod_dixel option");
+  }
+
   header.keyval()["twi_contrast"] = contrasts[contrast];
   header.keyval()["twi_vox_stat"] = voxel_statistics[stat_vox];
   header.keyval()["twi_tck_stat"] = track_statistics[stat_tck];
@@ -554,8 +614,12 @@ void run () {
   mapper->set_map_ends_only       (ends_only);
   if (writer_type == DIXEL)
     mapper->create_dixel_plugin (*dirs);
-  if (writer_type == TOD)
-    mapper->create_tod_plugin (header.size(3));
+  if (writer_type == TOD) {
+    if (dirs)
+      mapper->create_tod_histogram_plugin (*dirs);
+    else
+      mapper->create_tod_plugin (header.size(3));
+  }
   if (contrast == SCALAR_MAP || contrast == SCALAR_MAP_COUNT || contrast == FOD_AMP) {
     opt = get_options ("image");
     if (!opt.size()) {
@@ -580,13 +644,24 @@ void run () {
     header.keyval()["twi_vector_file"] = Path::basename (path);
   }
 
+  // Matrix of the aPSF coefficients for each direction, to convert the histogram
+  //   of streamline directions within each voxel to the TOD
+  std::shared_ptr<Eigen::MatrixXd> tod_histogram;
+  if (writer_type == TOD && dirs) {
+    Math::SH::aPSF<default_type> aPSF (Math::SH::LforN (header.size(3)));
+    tod_histogram.reset (new Eigen::MatrixXd (header.size(3), dirs->size()));
+    Eigen::VectorXd sh;
+    for (size_t dir = 0; dir != dirs->size(); ++dir)
+      tod_histogram->col (dir) = aPSF (sh, (*dirs)[dir]);
+  }
+
   std::unique_ptr<MapWriterBase> writer;
   switch (writer_type) {
     case UNDEFINED: throw Exception ("Invalid TWI writer image dimensionality");
-    case GREYSCALE: writer.reset (make_writer           (header, argument[1], stat_vox, GREYSCALE)); break;
-    case DEC:       writer.reset (new MapWriter<float>  (header, argument[1], stat_vox, DEC));       break;
-    case DIXEL:     writer.reset (make_writer           (header, argument[1], stat_vox, DIXEL));     break;
-    case TOD:       writer.reset (new MapWriter<float>  (header, argument[1], stat_vox, TOD));       break;
+    case GREYSCALE: writer.reset (make_writer           (header, argument[1], stat_vox, GREYSCALE));          break;
+    case DEC:       writer.reset (new MapWriter<float>  (header, argument[1], stat_vox, DEC));                break;
+    case DIXEL:     writer.reset (make_writer           (header, argument[1], stat_vox, DIXEL));              break;
+    case TOD:       writer.reset (new MapWriter<float>  (header, argument[1], stat_vox, TOD, tod_histogram)); break;
   }
 
   // Finally get to do some number crunching!
@@ -597,18 +672,23 @@ void run () {
     mapper_ptr->set_gaussian_FWHM (gaussian_fwhm_tck);
     switch (writer_type) {
       case UNDEFINED: throw Exception ("Invalid TWI writer image dimensionality");
-      case GREYSCALE: Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxel()),    *writer); break;
-      case DEC:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxelDEC()), *writer); break;
-      case DIXEL:     Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetDixel()),    *writer); break;
-      case TOD:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxelTOD()), *writer); break;
+      case GREYSCALE: run_mapping<Gaussian::TrackMapper, Gaussian::SetVoxel>    (loader, *mapper_ptr, *writer); break;
+      case DEC:       run_mapping<Gaussian::TrackMapper, Gaussian::SetVoxelDEC> (loader, *mapper_ptr, *writer); break;
+      case DIXEL:     run_mapping<Gaussian::TrackMapper, Gaussian::SetDixel>    (loader, *mapper_ptr, *writer); break;
+      case TOD:       run_mapping<Gaussian::TrackMapper, Gaussian::SetVoxelTOD> (loader, *mapper_ptr, *writer); break;
     }
   } else {
     switch (writer_type) {
       case UNDEFINED: throw Exception ("Invalid TWI writer image dimensionality");
-      case GREYSCALE: Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper), Thread::batch (SetVoxel()),    *writer); break;
-      case DEC:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper), Thread::batch (SetVoxelDEC()), *writer); break;
-      case DIXEL:     Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper), Thread::batch (SetDixel()),    *writer); break;
-      case TOD:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper), Thread::batch (SetVoxelTOD()), *writer); break;
+      case GREYSCALE: run_mapping<TrackMapperTWI, SetVoxel>    (loader, *mapper, *writer); break;
+      case DEC:       run_mapping<TrackMapperTWI, SetVoxelDEC> (loader, *mapper, *writer); break;
+      case DIXEL:     run_mapping<TrackMapperTWI, SetDixel>    (loader, *mapper, *writer); break;
+      case TOD:
+        if (dirs)
+          run_mapping<TrackMapperTWI, SetDixel>    (loader, *mapper, *writer);
+        else
+          run_mapping<TrackMapperTWI, SetVoxelTOD> (loader, *mapper, *writer);
+        break;
     }
   }
 
@@ -0,0 +1,159 @@
+/* Copyright (c) 2008-2017 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include <fstream>
+#include <queue>
+
+#include "command.h"
+#include "progressbar.h"
+
+#include "dwi/tractography/file.h"
+#include "dwi/tractography/properties.h"
+
+
+
+
+using namespace MR;
+using namespace App;
+using namespace MR::DWI::Tractography;
+
+
+
+
+void usage ()
+{
+
+  AUTHOR = "agent (agent@local)";
+
+  SYNOPSIS = "Merge the outputs of a sharded tckgen run into a single track file";
+
+  DESCRIPTION
+  + "When tckgen is run with the -shard option, each process generates only those "
+    "streamlines whose global index falls within its shard, writing the index of each "
+    "output streamline to a text file using the -output_indices option. This command "
+    "interleaves the shards back into global index order, such that the result is "
+    "identical to that of a single tckgen run using the same -rng_seed and -seeds values."
+
+  + "The index files must be provided using the -indices option, once per input "
+    "track file and in the same order.";
+
+  ARGUMENTS
+  + Argument ("tracks_in",  "the input track files, one per shard").type_tracks_in().allow_multiple()
+  + Argument ("tracks_out", "the output track file").type_tracks_out();
+
+  OPTIONS
+  + Option ("indices", "the streamline index file written by tckgen for each shard").required().allow_multiple()
+    + Argument ("path").type_file_in()
+
+  + Option ("select", "only retain the first N selected streamlines in index order; "
+                      "this reproduces the behaviour of the -select option in a single tckgen run")
+    + Argument ("number").type_integer (1);
+
+}
+
+
+
+class Shard
+{ MEMALIGN(Shard)
+  public:
+    Shard (const std::string& tracks_path, const std::string& index_path, Properties& properties) :
+        reader (tracks_path, properties),
+        indices (index_path),
+        index_path (index_path),
+        index (0) { }
+
+    bool next () {
+      if (!reader (tck))
+        return false;
+      if (!(indices >> index))
+        throw Exception ("streamline index file \"" + index_path + "\" contains fewer entries than its track file");
+      return true;
+    }
+
+    Reader<float> reader;
+    std::ifstream indices;
+    const std::string index_path;
+    Streamline<float> tck;
+    uint64_t index;
+};
+
+
+
+void run ()
+{
+  const size_t num_inputs = argument.size() - 1;
+  auto opt = get_options ("indices");
+  if (opt.size() != num_inputs)
+    throw Exception ("number of index files (" + str(opt.size()) + ") does not match number of input track files (" + str(num_inputs) + ")");
+  const size_t max_selected = get_option_value ("select", size_t(0));
+
+  Properties properties;
+  vector<std::unique_ptr<Shard>> shards;
+  uint64_t total_count = 0, max_num_seeds = 0;
+  std::string rng_seed;
+
+  for (size_t n = 0; n != num_inputs; ++n) {
+    Properties p;
+    shards.push_back (std::unique_ptr<Shard> (new Shard (argument[n], opt[n][0], p)));
+    if (p.find ("shard") == p.end())
+      WARN ("input track file \"" + std::string (argument[n]) + "\" was not generated using the -shard option");
+    if (!n) {
+      for (const auto& i : p)
+        properties.insert (i);
+      properties.comments = p.comments;
+      rng_seed = p["rng_seed"];
+    } else if (p["rng_seed"] != rng_seed) {
+      throw Exception ("input track files were generated using different random number seeds; "
+                       "merged output would not be reproducible");
+    }
+    total_count += to<uint64_t> (p["total_count"]);
+    max_num_seeds += to<uint64_t> (p["max_num_seeds"]);
+  }
+
+  for (const auto& key : { "shard", "index_output", "count", "total_count" }) {
+    auto i = properties.find (key);
+    if (i != properties.end())
+      properties.erase (i);
+  }
+  properties["max_num_seeds"] = str (max_num_seeds);
+  if (max_selected)
+    properties["max_num_tracks"] = str (max_selected);
+
+  using entry_type = std::pair<uint64_t, size_t>;
+  std::priority_queue<entry_type, vector<entry_type>, std::greater<entry_type>> heap;
+  for (size_t n = 0; n != num_inputs; ++n) {
+    if (shards[n]->next())
+      heap.push (std::make_pair (shards[n]->index, n));
+  }
+
+  Writer<float> writer (argument[num_inputs], properties);
+  ProgressBar progress ("merging shards", max_selected);
+  uint64_t last_index = 0;
+  while (!heap.empty() && !(max_selected && writer.count >= max_selected)) {
+    const size_t n = heap.top().second;
+    heap.pop();
+    Shard& shard (*shards[n]);
+    if (writer.count && shard.index <= last_index)
+      throw Exception ("duplicate or out-of-order streamline index " + str(shard.index) + " in file \"" + shard.index_path + "\"");
+    last_index = shard.index;
+    writer (shard.tck);
+    ++progress;
+    if (shard.next())
+      heap.push (std::make_pair (shard.index, n));
+  }
+
+  // In a single run, the seed count reflects all attempts up to the final selected streamline
+  writer.total_count = (max_selected && writer.count >= max_selected) ? last_index + 1 : total_count;
+}
+
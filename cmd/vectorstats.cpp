@@ -59,8 +59,12 @@ using Math::Stats::vector_type;
 
 
 
-void run()
+template <typename ValueType>
+void execute ()
 {
+  using stat_value_type = ValueType;
+  using stat_matrix_type = Eigen::Matrix<stat_value_type, Eigen::Dynamic, Eigen::Dynamic>;
+  using stat_vector_type = Eigen::Array<stat_value_type, Eigen::Dynamic, 1>;
 
   // Read filenames
   vector<std::string> filenames;
@@ -110,7 +114,7 @@ void run()
   const std::string output_prefix = argument[4];
 
   // Load input data
-  matrix_type data (num_elements, filenames.size());
+  stat_matrix_type data (num_elements, filenames.size());
   {
     ProgressBar progress ("Loading input vector data", filenames.size());
     for (size_t subject = 0; subject < filenames.size(); subject++) {
@@ -126,7 +130,7 @@ void run()
       if (size_t(subject_data.size()) != num_elements)
         throw Exception ("Vector data for subject #" + str(subject) + " (file \"" + path + "\") is wrong length (" + str(subject_data.size()) + " , expected " + str(num_elements) + ")");
 
-      data.col(subject) = subject_data;
+      data.col(subject) = subject_data.cast<stat_value_type>();
 
       ++progress;
     }
@@ -135,18 +139,18 @@ void run()
   {
     ProgressBar progress ("outputting beta coefficients, effect size and standard deviation...", contrast.cols() + 3);
 
-    const matrix_type betas = Math::Stats::GLM::solve_betas (data, design);
+    const stat_matrix_type betas = Math::Stats::GLM::solve_betas (data, design);
     for (size_t i = 0; i < size_t(contrast.cols()); ++i) {
       save_vector (betas.col(i), output_prefix + "_beta_" + str(i) + ".csv");
       ++progress;
     }
 
-    const matrix_type abs_effects = Math::Stats::GLM::abs_effect_size (data, design, contrast);
+    const stat_matrix_type abs_effects = Math::Stats::GLM::abs_effect_size (data, design, contrast);
     save_vector (abs_effects.col(0), output_prefix + "_abs_effect.csv");
     ++progress;
 
-    const matrix_type std_effects = Math::Stats::GLM::std_effect_size (data, design, contrast);
-    vector_type first_std_effect = std_effects.col(0);
+    const stat_matrix_type std_effects = Math::Stats::GLM::std_effect_size (data, design, contrast);
+    stat_vector_type first_std_effect = std_effects.col(0);
     for (size_t i = 0; i != num_elements; ++i) {
       if (!std::isfinite (first_std_effect[i]))
         first_std_effect[i] = 0.0;
@@ -154,11 +158,11 @@ void run()
     save_vector (first_std_effect, output_prefix + "_std_effect.csv");
     ++progress;
 
-    const matrix_type stdevs = Math::Stats::GLM::stdev (data, design);
+    const stat_matrix_type stdevs = Math::Stats::GLM::stdev (data, design);
     save_vector (stdevs.col(0), output_prefix + "_std_dev.csv");
   }
 
-  Math::Stats::GLMTTest glm_ttest (data, design, contrast);
+  Math::Stats::GLMTTest<stat_value_type> glm_ttest (data, design, contrast);
 
   // Precompute default statistic
   // Don't use convenience function: No enhancer!
@@ -166,30 +170,33 @@ void run()
   vector<size_t> default_permutation (filenames.size());
   for (size_t i = 0; i != filenames.size(); ++i)
     default_permutation[i] = i;
-  vector_type default_tvalues;
+  stat_vector_type default_tvalues;
   glm_ttest (default_permutation, default_tvalues);
   save_vector (default_tvalues, output_prefix + "_tvalue.csv");
 
   // Perform permutation testing
   if (!get_options ("notest").size()) {
 
-    std::shared_ptr<Stats::EnhancerBase> enhancer;
-    vector_type null_distribution (num_perms), uncorrected_pvalues (num_perms);
-    vector_type empirical_distribution;
+    std::shared_ptr<Stats::EnhancerBase<stat_value_type>> enhancer;
+    stat_vector_type null_distribution (num_perms), uncorrected_pvalues (num_perms);
+    stat_vector_type empirical_distribution;
 
+    bool complete;
     if (permutations.size()) {
-      Stats::PermTest::run_permutations (permutations, glm_ttest, enhancer, empirical_distribution,
-                                         default_tvalues, std::shared_ptr<vector_type>(),
-                                         null_distribution, std::shared_ptr<vector_type>(),
-                                         uncorrected_pvalues, std::shared_ptr<vector_type>());
+      complete = Stats::PermTest::run_permutations (permutations, glm_ttest, enhancer, empirical_distribution,
+                                                    default_tvalues, std::shared_ptr<stat_vector_type>(),
+                                                    null_distribution, std::shared_ptr<stat_vector_type>(),
+                                                    uncorrected_pvalues, std::shared_ptr<stat_vector_type>());
     } else {
-      Stats::PermTest::run_permutations (num_perms, glm_ttest, enhancer, empirical_distribution,
-                                         default_tvalues, std::shared_ptr<vector_type>(),
-                                         null_distribution, std::shared_ptr<vector_type>(),
-                                         uncorrected_pvalues, std::shared_ptr<vector_type>());
+      complete = Stats::PermTest::run_permutations (num_perms, glm_ttest, enhancer, empirical_distribution,
+                                                    default_tvalues, std::shared_ptr<stat_vector_type>(),
+                                                    null_distribution, std::shared_ptr<stat_vector_type>(),
+                                                    uncorrected_pvalues, std::shared_ptr<stat_vector_type>());
     }
+    if (!complete)
+      return;
 
-    vector_type default_pvalues (num_elements);
+    stat_vector_type default_pvalues (num_elements);
     Math::Stats::Permutation::statistic2pvalue (null_distribution, default_tvalues, default_pvalues);
     save_vector (default_pvalues,     output_prefix + "_fwe_pvalue.csv");
     save_vector (uncorrected_pvalues, output_prefix + "_uncorrected_pvalue.csv");
@@ -197,3 +204,13 @@ void run()
   }
 
 }
+
+
+
+void run()
+{
+  if (Stats::PermTest::single_precision())
+    execute<float>();
+  else
+    execute<double>();
+}
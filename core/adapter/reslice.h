@@ -167,6 +167,13 @@ namespace MR
           return interp.value();
         }
 
+        //! the transform mapping voxel positions in the reference onto voxel positions in the original image
+        const transform_type& voxel_transform () const { return direct_transform; }
+        //! the number of samples taken along each spatial axis of the reference (1 if not oversampling)
+        int oversampling_factor (size_t axis) const { return oversampling ? OS[axis] : 1; }
+        //! whether values are averaged over multiple samples per voxel
+        bool is_oversampling () const { return oversampling; }
+
         ssize_t get_index (size_t axis) const { return axis < 3 ? x[axis] : interp.index(axis); }
         void move_index (size_t axis, ssize_t increment) {
           if (axis < 3) x[axis] += increment;
@@ -43,6 +43,16 @@ namespace MR {
   }
 
 
+  BitSet::BitSet (BitSet&& that) noexcept :
+      bits  (that.bits),
+      bytes (that.bytes),
+      data  (that.data)
+  {
+    that.bits = that.bytes = 0;
+    that.data = nullptr;
+  }
+
+
   BitSet::~BitSet() {
     delete[] data; data = nullptr;
   }
@@ -170,6 +180,15 @@ namespace MR {
   }
 
 
+  BitSet& BitSet::operator= (BitSet&& that) noexcept
+  {
+    std::swap (bits, that.bits);
+    std::swap (bytes, that.bytes);
+    std::swap (data, that.data);
+    return *this;
+  }
+
+
   bool BitSet::operator== (const BitSet& that) const
   {
     if (bits != that.bits)
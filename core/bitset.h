@@ -80,6 +80,8 @@ namespace MR {
        * will be identical, but subsequent modifications to the data in one instance
        * will not affect the other. */
       BitSet (const BitSet&);
+      //! move-construct a bitset, taking ownership of the data of \a that
+      BitSet (BitSet&&) noexcept;
       ~BitSet();
 
       //! resize the bitset, retaining existing data
@@ -174,6 +176,7 @@ namespace MR {
        * \endcode
        * */
       BitSet& operator=  (const BitSet&);
+      BitSet& operator=  (BitSet&&) noexcept;
       bool    operator== (const BitSet&) const;
       bool    operator!= (const BitSet&) const;
       BitSet& operator|= (const BitSet&);
@@ -60,7 +60,16 @@ namespace MR {
             else if (item.is (0x0028U, 0x0010U)) dim[1] = item.get_uint()[0];
             else if (item.is (0x0028U, 0x0011U)) dim[0] = item.get_uint()[0];
             else if (item.is (0x0028U, 0x0100U)) bits_alloc = item.get_uint()[0];
-            else if (item.is (0x7FE0U, 0x0010U)) data = item.offset (item.data);
+            else if (item.is (0x7FE0U, 0x0010U)) {
+              data = item.offset (item.data);
+              // nothing of interest follows the top-level pixel data (as
+              // opposed to that of e.g. an icon image sequence); stop here to
+              // avoid paging in the rest of the file, unless asked to print
+              // every element:
+              const bool top_level = item.level() == (item.is_new_sequence() ? 1 : 0);
+              if (top_level && !print_DICOM_fields && !print_CSA_fields)
+                break;
+            }
             else if (item.is (0x0008U, 0x0008U)) {
               // exclude Siemens MPR info image:
               // TODO: could handle this by splitting on basis on this entry
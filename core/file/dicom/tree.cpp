@@ -12,6 +12,18 @@
  */
 
 
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "thread.h"
+#include "file/config.h"
 #include "file/path.h"
 #include "file/dicom/element.h"
 #include "file/dicom/quick_scan.h"
@@ -25,6 +37,374 @@ namespace MR {
   namespace File {
     namespace Dicom {
 
+      namespace {
+
+        //CONF option: DICOMScanCache
+        //CONF default: (none)
+        //CONF The path of a file used to cache the relevant header entries of
+        //CONF each DICOM file scanned, keyed by its full path, modification
+        //CONF time (to the nanosecond, where available) and size. Files found
+        //CONF not to be valid DICOM are also recorded. When set, subsequent
+        //CONF scans of the same folders only need to read those files that
+        //CONF have been added or modified since, which can considerably speed
+        //CONF up access to large DICOM folders. The file is created if it
+        //CONF does not already exist.
+
+        // modification time in nanoseconds, so that a file rewritten within
+        // the same second is still detected as modified, where the platform
+        // provides the sub-second timestamp:
+        using stat_type = struct stat;
+        inline int64_t modification_time (const stat_type& buf) {
+#if defined(MRTRIX_MACOSX)
+          return int64_t (buf.st_mtimespec.tv_sec) * 1000000000 + buf.st_mtimespec.tv_nsec;
+#elif defined(MRTRIX_WINDOWS)
+          return int64_t (buf.st_mtime) * 1000000000;
+#else
+          return int64_t (buf.st_mtim.tv_sec) * 1000000000 + buf.st_mtim.tv_nsec;
+#endif
+        }
+
+
+
+        class ScanCache { NOMEMALIGN
+          public:
+            // valid is false for files that could not be read as DICOM:
+            class Entry { NOMEMALIGN
+              public:
+                int64_t mtime, size;
+                bool valid;
+                QuickScan reader;
+            };
+
+            ScanCache (const std::string& folder) :
+                path (File::Config::get ("DICOMScanCache")),
+                folder (folder),
+                modified (false) {
+              if (!active())
+                return;
+              // entries are keyed by canonical path, so that the cache
+              // remains valid regardless of how the folder was specified:
+#ifdef MRTRIX_WINDOWS
+              char buf[_MAX_PATH];
+              if (_fullpath (buf, folder.c_str(), _MAX_PATH))
+                full_folder = buf;
+#else
+              char* buf = realpath (folder.c_str(), nullptr);
+              if (buf) {
+                full_folder = buf;
+                free (buf);
+              }
+#endif
+              else
+                full_folder = folder;
+              if (Path::exists (path))
+                load();
+            }
+
+            bool active () const { return path.size(); }
+
+            // safe to call concurrently, since entries is not modified during the scan:
+            bool find (const std::string& filename, int64_t mtime, int64_t size, QuickScan& reader, bool& valid) const {
+              auto i = entries.find (key (filename));
+              if (i == entries.end() || i->second.mtime != mtime || i->second.size != size)
+                return false;
+              valid = i->second.valid;
+              if (valid) {
+                reader = i->second.reader;
+                reader.filename = filename;
+              }
+              return true;
+            }
+
+            // must be called with exclusive access:
+            void update (const std::string& filename, const Entry& entry) {
+              updated[key (filename)] = entry;
+              modified = true;
+            }
+
+            // merge in updated entries, remove those under the folder that
+            // were not encountered during the scan, and write back to file if
+            // anything changed:
+            void save (const vector<std::string>& encountered) {
+              if (!active())
+                return;
+              std::set<std::string> seen;
+              for (const auto& filename : encountered)
+                seen.insert (key (filename));
+              const std::string prefix = Path::join (full_folder, "");
+              for (auto i = entries.begin(); i != entries.end();) {
+                if (i->first.compare (0, prefix.size(), prefix) == 0 && !seen.count (i->first)) {
+                  i = entries.erase (i);
+                  modified = true;
+                }
+                else ++i;
+              }
+              if (!modified)
+                return;
+              for (auto& i : updated)
+                entries[i.first] = std::move (i.second);
+
+              const std::string tmp = path + "." + str (getpid());
+              {
+                std::ofstream out (tmp);
+                out << signature << "\n";
+                for (const auto& i : entries) {
+                  out << escape (i.first) << "\t" << i.second.mtime << "\t" << i.second.size;
+                  if (!i.second.valid) {
+                    out << "\n";
+                    continue;
+                  }
+                  const QuickScan& r (i.second.reader);
+                  for (const auto* field : { &r.modality, &r.patient, &r.patient_ID, &r.patient_DOB,
+                      &r.study, &r.study_ID, &r.study_date, &r.study_time,
+                      &r.series, &r.series_date, &r.series_time, &r.sequence })
+                    out << "\t" << escape (*field);
+                  out << "\t" << r.series_number << "\t" << r.bits_alloc << "\t" << r.dim[0] << "\t" << r.dim[1]
+                    << "\t" << r.data << "\t" << r.transfer_syntax_supported << "\n";
+                }
+                if (!out.good()) {
+                  std::remove (tmp.c_str());
+                  WARN ("error writing DICOM scan cache file \"" + path + "\" - cache not updated");
+                  return;
+                }
+              }
+              if (std::rename (tmp.c_str(), path.c_str())) {
+                std::remove (tmp.c_str());
+                WARN ("error updating DICOM scan cache file \"" + path + "\": " + strerror (errno));
+              }
+            }
+
+          private:
+            const std::string path, folder;
+            std::string full_folder;
+            std::map<std::string, Entry> entries, updated;
+            bool modified;
+            static constexpr const char* signature = "mrtrix DICOM scan cache v3";
+
+            void load () {
+              std::ifstream in (path);
+              std::string line;
+              if (!std::getline (in, line) || line != signature) {
+                WARN ("ignoring invalid DICOM scan cache file \"" + path + "\"");
+                return;
+              }
+              while (std::getline (in, line)) {
+                const auto F = split (line, "\t", false);
+                if (F.size() != 21 && F.size() != 3) {
+                  WARN ("ignoring invalid entry in DICOM scan cache file \"" + path + "\"");
+                  continue;
+                }
+                try {
+                  Entry entry;
+                  entry.mtime = to<int64_t> (F[1]);
+                  entry.size = to<int64_t> (F[2]);
+                  entry.valid = F.size() > 3;
+                  if (!entry.valid) {
+                    entries[unescape (F[0])] = entry;
+                    continue;
+                  }
+                  QuickScan& r (entry.reader);
+                  size_t n = 3;
+                  for (auto* field : { &r.modality, &r.patient, &r.patient_ID, &r.patient_DOB,
+                      &r.study, &r.study_ID, &r.study_date, &r.study_time,
+                      &r.series, &r.series_date, &r.series_time, &r.sequence })
+                    *field = unescape (F[n++]);
+                  r.series_number = to<size_t> (F[15]);
+                  r.bits_alloc = to<size_t> (F[16]);
+                  r.dim[0] = to<size_t> (F[17]);
+                  r.dim[1] = to<size_t> (F[18]);
+                  r.data = to<size_t> (F[19]);
+                  r.transfer_syntax_supported = to<bool> (F[20]);
+                  entries[unescape (F[0])] = entry;
+                }
+                catch (Exception&) {
+                  WARN ("ignoring invalid entry in DICOM scan cache file \"" + path + "\"");
+                }
+              }
+            }
+
+            // all paths encountered during the scan start with the folder:
+            std::string key (const std::string& filename) const {
+              const size_t start = filename.find_first_not_of (PATH_SEPARATOR, folder.size());
+              return start == std::string::npos ? full_folder : Path::join (full_folder, filename.substr (start));
+            }
+
+            static std::string escape (const std::string& s) {
+              std::string r;
+              for (const auto c : s) {
+                switch (c) {
+                  case '\\': r += "\\\\"; break;
+                  case '\t': r += "\\t"; break;
+                  case '\n': r += "\\n"; break;
+                  case '\r': r += "\\r"; break;
+                  default: r += c;
+                }
+              }
+              return r;
+            }
+
+            static std::string unescape (const std::string& s) {
+              std::string r;
+              for (size_t n = 0; n < s.size(); ++n) {
+                if (s[n] == '\\' && n+1 < s.size()) {
+                  switch (s[++n]) {
+                    case 't': r += '\t'; break;
+                    case 'n': r += '\n'; break;
+                    case 'r': r += '\r'; break;
+                    default: r += s[n];
+                  }
+                }
+                else r += s[n];
+              }
+              return r;
+            }
+        };
+        constexpr const char* ScanCache::signature;
+
+
+
+
+        // shared state for the scanning threads: a pool of pending paths
+        // (folders or files), with scan results collected as they complete
+        class SharedScan { NOMEMALIGN
+          public:
+            SharedScan (const std::string& folder, ProgressBar& progress, ScanCache& cache) :
+              pending (1, folder), cache (cache), progress (progress), active (0) { }
+
+            // block until either a path is available, or all threads are idle with nothing left to do:
+            bool next (std::string& path) {
+              std::unique_lock<std::mutex> lock (mutex);
+              while (pending.empty() && active)
+                condition.wait (lock);
+              if (pending.empty())
+                return false;
+              path = std::move (pending.back());
+              pending.pop_back();
+              ++active;
+              return true;
+            }
+
+            // file is non-empty if path was a regular file:
+            void done (vector<std::string>& entries, const std::string& file, std::unique_ptr<QuickScan>& reader, const ScanCache::Entry* cache_entry) {
+              std::lock_guard<std::mutex> lock (mutex);
+              for (auto& entry : entries)
+                pending.push_back (std::move (entry));
+              if (file.size()) {
+                files.push_back (file);
+                if (cache_entry)
+                  cache.update (file, *cache_entry);
+              }
+              if (reader)
+                results.push_back (std::move (reader));
+              ++progress;
+              --active;
+              condition.notify_all();
+            }
+
+            void error (const std::string& message) {
+              std::lock_guard<std::mutex> lock (mutex);
+              if (errors.empty())
+                errors = message;
+            }
+
+            vector<std::string> pending, files;
+            vector<std::unique_ptr<QuickScan>> results;
+            std::string errors;
+            ScanCache& cache;
+
+          private:
+            ProgressBar& progress;
+            size_t active;
+            std::mutex mutex;
+            std::condition_variable condition;
+        };
+
+
+
+        class Scanner { NOMEMALIGN
+          public:
+            Scanner (SharedScan& shared) : shared (shared) { }
+
+            void execute () {
+              std::string path;
+              while (shared.next (path)) {
+                vector<std::string> entries;
+                std::string file;
+                std::unique_ptr<QuickScan> reader;
+                ScanCache::Entry cache_entry;
+                bool update_cache = false;
+                try {
+                  struct stat buf;
+                  if (stat (path.c_str(), &buf)) {
+                    INFO ("error accessing \"" + path + "\": " + strerror (errno) + " - ignored");
+                  }
+                  else if (S_ISDIR (buf.st_mode)) {
+                    Path::Dir folder (path);
+                    std::string entry;
+                    while ((entry = folder.read_name()).size())
+                      entries.push_back (Path::join (path, entry));
+                  }
+                  else {
+                    file = path;
+                    reader.reset (new QuickScan);
+                    bool valid;
+                    if (shared.cache.find (path, modification_time (buf), buf.st_size, *reader, valid)) {
+                      DEBUG ("using cached DICOM header entries for file \"" + path + "\"");
+                      if (!valid)
+                        reader.reset();
+                    }
+                    else {
+                      cache_entry.valid = !reader->read (path);
+                      if (!cache_entry.valid) {
+                        INFO ("error reading file \"" + path + "\" - ignored");
+                        reader.reset();
+                      }
+                      if (shared.cache.active()) {
+                        cache_entry.mtime = modification_time (buf);
+                        cache_entry.size = buf.st_size;
+                        if (reader)
+                          cache_entry.reader = *reader;
+                        update_cache = true;
+                      }
+                    }
+                  }
+                }
+                catch (Exception& E) {
+                  if (reader)
+                    E.display (3);
+                  else
+                    shared.error ("error opening DICOM folder \"" + path + "\": " + E[0]);
+                  reader.reset();
+                  update_cache = false;
+                }
+                // anything else must still be reported via done(), otherwise
+                // the other threads would wait indefinitely for this one:
+                catch (std::exception& E) {
+                  shared.error ("error scanning DICOM path \"" + path + "\": " + E.what());
+                  entries.clear();
+                  reader.reset();
+                  update_cache = false;
+                }
+                catch (...) {
+                  shared.error ("unknown error scanning DICOM path \"" + path + "\"");
+                  entries.clear();
+                  reader.reset();
+                  update_cache = false;
+                }
+                shared.done (entries, file, reader, update_cache ? &cache_entry : nullptr);
+              }
+            }
+
+          private:
+            SharedScan& shared;
+        };
+
+      }
+
+
+
+
+
       std::shared_ptr<Patient> Tree::find (const std::string& patient_name, const std::string& patient_ID, const std::string& patient_DOB)
       {
         for (size_t n = 0; n < size(); n++) {
@@ -54,27 +434,24 @@ namespace MR {
 
       void Tree::read_dir (const std::string& filename, ProgressBar& progress)
       {
-        try {
-          Path::Dir folder (filename);
-          std::string entry;
-          while ((entry = folder.read_name()).size()) {
-            std::string name (Path::join (filename, entry));
-            if (Path::is_dir (name))
-              read_dir (name, progress);
-            else {
-              try {
-                read_file (name);
-              }
-              catch (Exception& E) {
-                E.display (3);
-              }
-            }
-            ++progress;
-          }
-        }
-        catch (Exception& E) {
-          throw Exception (E, "error opening DICOM folder \"" + filename + "\": " + strerror (errno));
-        }
+        // folders are listed and files scanned concurrently; since the order
+        // in which files complete is then arbitrary, results are sorted by
+        // path before being added, so that the resulting tree is the same
+        // regardless of the number of threads
+        ScanCache cache (filename);
+        SharedScan shared (filename, progress, cache);
+        Thread::run (Thread::multi (Scanner (shared)), "DICOM scan threads");
+
+        if (shared.errors.size())
+          throw Exception (shared.errors);
+
+        std::sort (shared.results.begin(), shared.results.end(),
+            [] (const std::unique_ptr<QuickScan>& a, const std::unique_ptr<QuickScan>& b) { return a->filename < b->filename; });
+
+        cache.save (shared.files);
+
+        for (const auto& reader : shared.results)
+          add (*reader);
       }
 
 
@@ -88,9 +465,15 @@ namespace MR {
           INFO ("error reading file \"" + filename + "\" - ignored");
           return;
         }
+        add (reader);
+      }
 
+
+
+      void Tree::add (const QuickScan& reader)
+      {
         if (! (reader.dim[0] && reader.dim[1] && reader.bits_alloc && reader.data)) {
-          INFO ("DICOM file \"" + filename + "\" does not seem to contain image data - ignored");
+          INFO ("DICOM file \"" + reader.filename + "\" does not seem to contain image data - ignored");
           return;
         }
 
@@ -99,7 +482,7 @@ namespace MR {
         std::shared_ptr<Series> series = study->find (reader.series, reader.series_number, reader.modality, reader.series_date, reader.series_time);
 
         std::shared_ptr<Image> image (new Image);
-        image->filename = filename;
+        image->filename = reader.filename;
         image->series = series.get();
         image->sequence_name = reader.sequence;
         image->transfer_syntax_supported = reader.transfer_syntax_supported;
@@ -17,6 +17,7 @@
 
 #include "memory.h"
 #include "file/dicom/patient.h"
+#include "file/dicom/quick_scan.h"
 
 namespace MR {
   namespace File {
@@ -43,6 +44,7 @@ namespace MR {
         protected:
           void read_dir (const std::string& filename, ProgressBar& progress);
           void read_file (const std::string& filename);
+          void add (const QuickScan& reader);
       }; 
 
       std::ostream& operator<< (std::ostream& stream, const Tree& item);
@@ -118,9 +118,11 @@ namespace MR
       std::string path;
       size_t buf_size = 32;
       while (true) {
-        path.reserve (buf_size);
-        if (getcwd (&path[0], buf_size))
+        path.resize (buf_size);
+        if (getcwd (&path[0], buf_size)) {
+          path.resize (strlen (path.c_str()));
           break;
+        }
         if (errno != ERANGE)
           throw Exception ("failed to get current working directory!");
         buf_size *= 2;
@@ -163,11 +163,11 @@ namespace MR
 
 
 
-    inline std::string create_tempfile (int64_t size = 0, const char* suffix = NULL)
+    inline std::string create_tempfile (int64_t size = 0, const char* suffix = NULL, const char* folder = NULL)
     {
       DEBUG ("creating temporary file of size " + str (size));
 
-      std::string filename (Path::join (tmpfile_dir(), tmpfile_prefix()) + "XXXXXX.");
+      std::string filename (Path::join (folder ? std::string (folder) : tmpfile_dir(), tmpfile_prefix()) + "XXXXXX.");
       int rand_index = filename.size() - 7;
       if (suffix) filename += suffix;
 
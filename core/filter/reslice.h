@@ -15,15 +15,417 @@
 #ifndef __filter_reslice_h__
 #define __filter_reslice_h__
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
 #include "adapter/reslice.h"
+#include "algo/loop.h"
 #include "algo/threaded_copy.h"
 #include "datatype.h"
+#include "progressbar.h"
+#include "thread.h"
+#include "interp/cubic.h"
+#include "interp/linear.h"
+#include "interp/nearest.h"
 
 namespace MR
 {
   namespace Filter
   {
 
+    //! \cond skip
+    namespace {
+
+      // 1D weights for those interpolators whose 3D kernel is the tensor
+      // product of identical kernels along each axis: weights() fills in the
+      // weights for the taps starting at the returned index, reproducing the
+      // edge handling of the corresponding Interp class. Interpolators not
+      // listed here (taps == 0) use the generic Adapter::Reslice path.
+      template <class InterpType> struct SeparableKernel { NOMEMALIGN
+        static constexpr int taps = 0;
+      };
+
+      template <class ImageType>
+        struct SeparableKernel<Interp::Nearest<ImageType>> { NOMEMALIGN
+          static constexpr int taps = 1;
+          template <typename ValueType>
+            static ssize_t weights (default_type pos, ssize_t, ValueType* w) {
+              w[0] = 1.0;
+              return std::round (pos);
+            }
+        };
+
+      template <class ImageType>
+        struct SeparableKernel<Interp::LinearInterp<ImageType, Interp::LinearInterpProcessingType::Value>> { NOMEMALIGN
+          static constexpr int taps = 2;
+          template <typename ValueType>
+            static ssize_t weights (default_type pos, ssize_t size, ValueType* w) {
+              const default_type c = std::floor (pos);
+              const ValueType f = (pos < 0.0 || pos > size-1.0) ? 0.0 : pos - c;
+              w[0] = 1.0 - f;
+              w[1] = f;
+              return c;
+            }
+        };
+
+      template <class ImageType, class SplineType>
+        struct SeparableKernel<Interp::SplineInterp<ImageType, SplineType, Math::SplineProcessingType::Value>> { NOMEMALIGN
+          static constexpr int taps = 4;
+          template <typename ValueType>
+            static ssize_t weights (default_type pos, ssize_t, ValueType* w) {
+              const default_type c = std::floor (pos);
+              SplineType H (Math::SplineProcessingType::Value);
+              H.set (pos - c);
+              for (int n = 0; n < 4; ++n)
+                w[n] = H.weights[n];
+              return ssize_t (c) - 1;
+            }
+        };
+
+
+
+      // Regridding for voxel transforms that map each destination axis onto
+      // a single source axis (axis permutations, flips, scalings and shifts,
+      // as produced by mrresize or regridding onto an aligned template). The
+      // interpolation then factorises into three 1D passes, each using a
+      // weight table precomputed once per axis (including any oversampling),
+      // and shared across all volumes. Intermediate results are held in
+      // default_type, as for the Interp classes.
+      template <class Kernel, class ImageTypeSource, class ImageTypeDestination>
+        class SeparableReslice { MEMALIGN(SeparableReslice<Kernel,ImageTypeSource,ImageTypeDestination>)
+          public:
+            using value_type = typename ImageTypeSource::value_type;
+
+            //! check whether the transform is separable, and if so find the source axis for each destination axis
+            static bool separable (const transform_type& T, int axes[3]) {
+              bool used[3] = { false, false, false };
+              for (size_t k = 0; k < 3; ++k) {
+                int a;
+                const default_type max = T.linear().col(k).cwiseAbs().maxCoeff (&a);
+                if (!max || used[a])
+                  return false;
+                for (size_t n = 0; n < 3; ++n)
+                  if (int(n) != a && std::abs (T.linear()(n,k)) > 1.0e-9 * max)
+                    return false;
+                used[a] = true;
+                axes[k] = a;
+              }
+              return true;
+            }
+
+            SeparableReslice (const ImageTypeSource& source, const ImageTypeDestination& destination,
+                const transform_type& T, const int axes[3], const int OS[3], bool oversampling, value_type value_when_out_of_bounds) :
+                source (source),
+                destination (destination),
+                oversampling (oversampling),
+                out_of_bounds_value (value_when_out_of_bounds),
+                num_volumes (1),
+                num_threads (std::max (Thread::number_of_threads(), size_t (1))),
+                waiting (0),
+                generation (0),
+                next (0)
+            {
+              for (size_t n = 0; n < 3; ++n)
+                size[0][n] = source.size (n);
+              for (size_t k = 0; k < 3; ++k) {
+                axis[k] = axes[k];
+                for (size_t n = 0; n < 3; ++n)
+                  size[k+1][n] = size[k][n];
+                size[k+1][axis[k]] = destination.size (k);
+                init_weights (k, T.linear()(axis[k],k), T.translation()[axis[k]], OS[k]);
+              }
+              for (size_t n = 3; n < destination.ndim(); ++n)
+                num_volumes *= destination.size (n);
+              buffer[0].resize (size[1][0] * size[1][1] * size[1][2]);
+              buffer[1].resize (size[2][0] * size[2][1] * size[2][2]);
+            }
+
+            //! run all passes over all volumes, using a single set of threads
+            void run (const std::string& message) {
+              ProgressBar progress_bar (message, num_volumes);
+              progress = &progress_bar;
+              Pass pass (*this);
+              Thread::run (Thread::multi (pass, num_threads), "reslice threads").wait();
+            }
+
+          private:
+            struct Weights { NOMEMALIGN
+              vector<size_t> start, index;
+              vector<default_type> weight;
+              vector<bool> valid;
+            };
+
+            // each thread runs the three 1D passes for every volume in turn,
+            // handling whole lines at a time along source axis axis[stage];
+            // all threads synchronise between passes. The first pass reads
+            // from the source image, the last writes to the destination image
+            class Pass { MEMALIGN(Pass)
+              public:
+                Pass (SeparableReslice& parent) :
+                    P (parent), source (parent.source), destination (parent.destination) { }
+
+                void execute () {
+                  for (size_t v = 0; v < P.num_volumes; ++v) {
+                    size_t n = v;
+                    for (size_t d = 3; d < destination.ndim(); ++d) {
+                      source.index(d) = destination.index(d) = n % destination.size (d);
+                      n /= destination.size (d);
+                    }
+                    for (size_t stage = 0; stage < 3; ++stage) {
+                      process (stage);
+                      P.synchronise (stage == 2);
+                    }
+                  }
+                }
+
+              private:
+                SeparableReslice& P;
+                ImageTypeSource source;
+                ImageTypeDestination destination;
+                vector<default_type> line_in, line_out;
+
+                void process (const size_t stage) {
+                  const size_t a = P.axis[stage];
+                  const size_t b = a ? 0 : 1;
+                  const size_t c = a == 2 ? 1 : 2;
+                  const size_t* in = P.size[stage];
+                  const size_t* out = P.size[stage+1];
+                  const size_t in_stride[] = { 1, in[0], in[0]*in[1] };
+                  const size_t out_stride[] = { 1, out[0], out[0]*out[1] };
+                  const Weights& W (P.weights[stage]);
+                  line_in.resize (in[a]);
+                  line_out.resize (out[a]);
+
+                  size_t l;
+                  while ((l = P.next++) < in[b] * in[c]) {
+                    const size_t pos[] = { l % in[b], l / in[b] };
+
+                    if (stage == 0) {
+                      source.index(b) = pos[0];
+                      source.index(c) = pos[1];
+                      for (auto i = Loop (a) (source); i; ++i)
+                        line_in[source.index(a)] = source.value();
+                    }
+                    else {
+                      const default_type* p = P.buffer[stage-1].data() + pos[0]*in_stride[b] + pos[1]*in_stride[c];
+                      for (size_t i = 0; i < in[a]; ++i, p += in_stride[a])
+                        line_in[i] = *p;
+                    }
+
+                    for (size_t i = 0; i < out[a]; ++i) {
+                      default_type sum = 0.0;
+                      for (size_t t = W.start[i]; t < W.start[i+1]; ++t)
+                        sum += W.weight[t] * line_in[W.index[t]];
+                      line_out[i] = sum;
+                    }
+
+                    if (stage == 2) {
+                      // destination axes 0 & 1 are constant along this line:
+                      size_t coord[3];
+                      coord[b] = pos[0];
+                      coord[c] = pos[1];
+                      destination.index(0) = coord[P.axis[0]];
+                      destination.index(1) = coord[P.axis[1]];
+                      const bool line_valid = P.oversampling ||
+                        (P.weights[0].valid[destination.index(0)] && P.weights[1].valid[destination.index(1)]);
+                      for (auto i = Loop (2) (destination); i; ++i) {
+                        const size_t n = destination.index(2);
+                        if (line_valid && (P.oversampling || W.valid[n]))
+                          destination.value() = line_out[n];
+                        else
+                          destination.value() = P.out_of_bounds_value;
+                      }
+                    }
+                    else {
+                      default_type* p = P.buffer[stage].data() + pos[0]*out_stride[b] + pos[1]*out_stride[c];
+                      for (size_t i = 0; i < out[a]; ++i, p += out_stride[a])
+                        *p = line_out[i];
+                    }
+                  }
+                }
+            };
+
+            ImageTypeSource source;
+            ImageTypeDestination destination;
+            const bool oversampling;
+            const value_type out_of_bounds_value;
+            size_t axis[3], size[4][3];
+            Weights weights[3];
+            vector<default_type> buffer[2];
+            size_t num_volumes;
+            const size_t num_threads;
+            ProgressBar* progress;
+
+            std::mutex mutex;
+            std::condition_variable all_done;
+            size_t waiting, generation;
+            std::atomic<size_t> next;
+
+            // wait until all threads have completed the current pass; the last
+            // thread to arrive resets the line counter for the next pass
+            void synchronise (bool end_of_volume) {
+              std::unique_lock<std::mutex> lock (mutex);
+              const size_t current = generation;
+              if (++waiting < num_threads) {
+                all_done.wait (lock, [&] { return generation != current; });
+                return;
+              }
+              waiting = 0;
+              next = 0;
+              if (end_of_volume)
+                ++(*progress);
+              ++generation;
+              all_done.notify_all();
+            }
+
+            // When oversampling, each output voxel averages samples at
+            // regular sub-voxel offsets; out-of-bounds samples contribute
+            // zero, so the average remains separable along each axis.
+            void init_weights (size_t k, default_type scale, default_type offset, int OS) {
+              const ssize_t N = source.size (axis[k]);
+              const default_type inc = 1.0 / default_type (OS), from = 0.5 * (inc - 1.0);
+              Weights& W (weights[k]);
+              W.start.assign (1, 0);
+              W.valid.assign (destination.size(k), false);
+              default_type w[Kernel::taps];
+              for (ssize_t i = 0; i < destination.size(k); ++i) {
+                for (int j = 0; j < OS; ++j) {
+                  const default_type pos = scale * ((OS > 1 ? i + from : i) + j*inc) + offset;
+                  if (pos <= -0.5 || pos >= N-0.5)
+                    continue;
+                  W.valid[i] = true;
+                  const ssize_t first = Kernel::weights (pos, N, w);
+                  for (int t = 0; t < Kernel::taps; ++t) {
+                    if (w[t] != 0.0) {
+                      W.index.push_back (std::min (std::max (first+t, ssize_t (0)), N-1));
+                      W.weight.push_back (w[t] / default_type (OS));
+                    }
+                  }
+                }
+                W.start.push_back (W.index.size());
+              }
+            }
+        };
+
+
+
+      // Regridding under a general affine voxel transform: each thread
+      // processes whole rows of the destination, and the interpolation
+      // weights computed at each position are reused for all volumes rather
+      // than recomputed once per volume.
+      template <class InterpType, class ImageTypeDestination>
+        class AffineReslice { MEMALIGN(AffineReslice<InterpType,ImageTypeDestination>)
+          public:
+            using value_type = typename InterpType::value_type;
+
+            AffineReslice (const InterpType& interp, const ImageTypeDestination& destination,
+                const transform_type& T, const int OS[3], bool oversampling, size_t axis) :
+                interp (interp),
+                destination (destination),
+                T (T),
+                axis (axis),
+                oversampling (oversampling)
+            {
+              if (oversampling) {
+                default_type inc[3];
+                for (size_t n = 0; n < 3; ++n) {
+                  inc[n] = 1.0 / default_type (OS[n]);
+                  from[n] = 0.5 * (inc[n] - 1.0);
+                }
+                for (int z = 0; z < OS[2]; ++z)
+                  for (int y = 0; y < OS[1]; ++y)
+                    for (int x = 0; x < OS[0]; ++x)
+                      offsets.push_back (Eigen::Vector3 (x*inc[0], y*inc[1], z*inc[2]));
+                norm = 1.0 / default_type (offsets.size());
+                size_t num_volumes = 1;
+                for (size_t n = 3; n < destination.ndim(); ++n)
+                  num_volumes *= destination.size (n);
+                sum.resize (num_volumes);
+              }
+            }
+
+            template <class PosType>
+              void operator() (const PosType& pos) {
+                assign_pos_of (pos, 0, 3).to (destination);
+                for (auto i = Loop (axis) (destination); i; ++i) {
+                  if (oversampling) {
+                    const Eigen::Vector3 d (destination.index(0)+from[0], destination.index(1)+from[1], destination.index(2)+from[2]);
+                    std::fill (sum.begin(), sum.end(), value_type (0.0));
+                    for (const auto& offset : offsets) {
+                      if (interp.voxel (T * Eigen::Vector3 (d + offset))) {
+                        // not using += since value_type may be bool:
+                        if (destination.ndim() == 3)
+                          sum[0] = sum[0] + interp.value();
+                        else {
+                          size_t v = 0;
+                          for (auto l = Loop (3, destination.ndim()) (interp); l; ++l, ++v)
+                            sum[v] = sum[v] + interp.value();
+                        }
+                      }
+                    }
+                    size_t v = 0;
+                    auto normalise = [&] () { value_type result = sum[v++]; result *= norm; return result; };
+                    if (destination.ndim() == 3)
+                      destination.value() = normalise();
+                    else {
+                      for (auto l = Loop (3, destination.ndim()) (destination); l; ++l)
+                        destination.value() = normalise();
+                    }
+                  }
+                  else {
+                    interp.voxel (T * Eigen::Vector3 (destination.index(0), destination.index(1), destination.index(2)));
+                    if (destination.ndim() == 3)
+                      destination.value() = interp.value();
+                    else {
+                      for (auto l = Loop (3, destination.ndim()) (destination, interp); l; ++l)
+                        destination.value() = interp.value();
+                    }
+                  }
+                }
+              }
+
+          private:
+            InterpType interp;
+            ImageTypeDestination destination;
+            const transform_type T;
+            const size_t axis;
+            const bool oversampling;
+            default_type from[3];
+            vector<Eigen::Vector3> offsets;
+            vector<value_type> sum;
+            default_type norm;
+        };
+
+
+
+      template <bool UseSeparable>
+        struct SeparableDispatch { NOMEMALIGN
+          template <class Kernel, class ImageTypeSource, class ImageTypeDestination, class ResliceType, typename ValueType>
+            static bool run (const std::string&, const ImageTypeSource&, const ImageTypeDestination&, const ResliceType&, ValueType) { return false; }
+        };
+
+      template <>
+        struct SeparableDispatch<true> { NOMEMALIGN
+          template <class Kernel, class ImageTypeSource, class ImageTypeDestination, class ResliceType, typename ValueType>
+            static bool run (const std::string& message, const ImageTypeSource& source, const ImageTypeDestination& destination,
+                const ResliceType& reslicer, ValueType value_when_out_of_bounds) {
+              using Reslicer = SeparableReslice<Kernel, ImageTypeSource, ImageTypeDestination>;
+              int axes[3];
+              if (!Reslicer::separable (reslicer.voxel_transform(), axes))
+                return false;
+              const int OS[] = { reslicer.oversampling_factor (0), reslicer.oversampling_factor (1), reslicer.oversampling_factor (2) };
+              DEBUG ("regridding using separable 1D passes along axes [ " + str(axes[0]) + " " + str(axes[1]) + " " + str(axes[2]) + " ]");
+              Reslicer (source, destination, reslicer.voxel_transform(), axes, OS, reslicer.is_oversampling(), value_when_out_of_bounds).run (message);
+              return true;
+            }
+        };
+
+    }
+    //! \endcond
+
+
+
     //! convenience function to regrid one Image onto another
     /*! This function resamples (regrids) the Image \a source onto the
      * Image& \a destination, using the templated interpolator class.
@@ -50,8 +452,37 @@ namespace MR
           const vector<int>& oversampling = Adapter::AutoOverSample,
           const typename ImageTypeDestination::value_type value_when_out_of_bounds = Interp::Base<ImageTypeDestination>::default_out_of_bounds_value())
       {
+        const std::string message = "reslicing \"" + source.name() + "\"";
         Adapter::Reslice<Interpolator, ImageTypeSource> interp (source, destination, transform, oversampling, value_when_out_of_bounds);
-        threaded_copy_with_progress_message ("reslicing \"" + source.name() + "\"", interp, destination, 0, source.ndim(), 2);
+
+        using SourceType = typename std::remove_const<ImageTypeSource>::type;
+        using Kernel = SeparableKernel<Interpolator<SourceType>>;
+        if (Kernel::taps) {
+          using value_type = typename SourceType::value_type;
+          constexpr bool separable = Kernel::taps > 0 && std::is_floating_point<value_type>::value &&
+            std::is_floating_point<typename ImageTypeDestination::value_type>::value;
+          if (SeparableDispatch<separable>::template run<Kernel, SourceType> (message, source, destination, interp, value_type (value_when_out_of_bounds)))
+            return;
+
+          // iterate over the destination's most contiguous spatial axis
+          size_t axis = 0;
+          for (size_t n = 1; n < 3; ++n)
+            if (std::abs (destination.stride (n)) < std::abs (destination.stride (axis)))
+              axis = n;
+          vector<size_t> outer_axes;
+          for (size_t n = 0; n < 3; ++n)
+            if (n != axis)
+              outer_axes.push_back (n);
+
+          const int OS[] = { interp.oversampling_factor (0), interp.oversampling_factor (1), interp.oversampling_factor (2) };
+          AffineReslice<Interpolator<SourceType>, ImageTypeDestination> functor (
+              Interpolator<SourceType> (source, value_when_out_of_bounds), destination,
+              interp.voxel_transform(), OS, interp.is_oversampling(), axis);
+          ThreadedLoop (message, destination, outer_axes, vector<size_t> (1, axis)).run_outer (functor);
+          return;
+        }
+
+        threaded_copy_with_progress_message (message, interp, destination, 0, source.ndim(), 2);
       }
 
 
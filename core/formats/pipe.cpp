@@ -13,6 +13,7 @@
 
 
 #include "app.h"
+#include "file/config.h"
 #include "file/utils.h"
 #include "file/path.h"
 #include "header.h"
@@ -24,6 +25,46 @@ namespace MR
   namespace Formats
   {
 
+    //* \cond skip
+    namespace
+    {
+      // header entry identifying a streamed image, holding the process ID
+      // of the command writing it:
+      const char* stream_key = "pipe_stream";
+
+      //CONF option: PipeStreaming
+      //CONF default: 0 (false)
+      //CONF When writing an image to a pipe, pass it to the next command as
+      //CONF soon as it is created rather than once it is complete, with its
+      //CONF data held in shared memory (/dev/shm where available). The
+      //CONF downstream command can then start up while the upstream command
+      //CONF is still running; commands that access their input sequentially
+      //CONF (currently mrcalc) can also start processing those parts of the
+      //CONF image that have already been written (complete slabs along the
+      //CONF outermost axis in memory), while other commands wait for the
+      //CONF image to be complete before accessing its data. Note that the
+      //CONF image file is only guaranteed complete once the upstream command
+      //CONF has finished, so this should not be enabled if piped images are
+      //CONF to be read by anything other than MRtrix3 commands.
+      bool streaming () {
+#ifdef MRTRIX_WINDOWS
+        return false;
+#else
+        static const bool value = File::Config::get_bool ("PipeStreaming", false);
+        return value;
+#endif
+      }
+
+      int64_t progress_offset (const ImageIO::Base& io, const Header& H) {
+        const int64_t end = io.files[0].start + footprint (H);
+        return end + ((8 - (end % 8)) % 8);
+      }
+    }
+    //* \endcond
+
+
+
+
     std::unique_ptr<ImageIO::Base> Pipe::read (Header& H) const
     {
       if (H.name() == "-") {
@@ -45,7 +86,17 @@ namespace MR
         throw Exception ("MRtrix only supports the .mif format for command-line piping");
 
       std::unique_ptr<ImageIO::Base> original_handler (mrtrix_handler.read (H));
-      std::unique_ptr<ImageIO::Pipe> io_handler (new ImageIO::Pipe (std::move (*original_handler)));
+
+      int64_t offset = -1, producer = 0;
+      auto entry = H.keyval().find (stream_key);
+      if (entry != H.keyval().end()) {
+        producer = to<int64_t> (entry->second);
+        offset = progress_offset (*original_handler, H);
+        // this entry must not propagate to images derived from this one:
+        H.keyval().erase (entry);
+      }
+
+      std::unique_ptr<ImageIO::Pipe> io_handler (new ImageIO::Pipe (std::move (*original_handler), offset, producer));
       return std::move (io_handler);
     }
 
@@ -58,7 +109,13 @@ namespace MR
       if (H.name() != "-")
         return false;
 
-      H.name() = File::create_tempfile (0, "mif");
+      H.keyval().erase (stream_key);
+      if (streaming()) {
+        H.keyval()[stream_key] = str (getpid());
+        H.name() = File::create_tempfile (0, "mif", Path::is_dir ("/dev/shm") ? "/dev/shm" : nullptr);
+      }
+      else
+        H.name() = File::create_tempfile (0, "mif");
 
       App::signal_handler += H.name();
 
@@ -71,7 +128,17 @@ namespace MR
     std::unique_ptr<ImageIO::Base> Pipe::create (Header& H) const
     {
       std::unique_ptr<ImageIO::Base> original_handler (mrtrix_handler.create (H));
-      std::unique_ptr<ImageIO::Pipe> io_handler (new ImageIO::Pipe (std::move (*original_handler)));
+      if (H.keyval().find (stream_key) == H.keyval().end()) {
+        std::unique_ptr<ImageIO::Pipe> io_handler (new ImageIO::Pipe (std::move (*original_handler)));
+        return std::move (io_handler);
+      }
+
+      // reserve space for the progress count after the image data, then
+      // hand the image over to the next command straight away:
+      const int64_t offset = progress_offset (*original_handler, H);
+      File::resize (H.name(), offset + sizeof(uint64_t));
+      std::unique_ptr<ImageIO::Pipe> io_handler (new ImageIO::Pipe (std::move (*original_handler), offset, getpid()));
+      std::cout << H.name() << std::endl;
       return std::move (io_handler);
     }
 
@@ -13,7 +13,13 @@
 
 
 #include <limits>
+#include <chrono>
+#include <thread>
+#include <cerrno>
 #include <unistd.h>
+#ifndef MRTRIX_WINDOWS
+# include <signal.h>
+#endif
 
 #include "app.h"
 #include "header.h"
@@ -24,6 +30,9 @@ namespace MR
   namespace ImageIO
   {
 
+    bool Pipe::defer_wait = false;
+
+
 
     void Pipe::load (const Header& header, size_t)
     {
@@ -36,18 +45,135 @@ namespace MR
       if (double (bytes_per_segment) >= double (std::numeric_limits<size_t>::max()))
         throw Exception ("image \"" + header.name() + "\" is larger than maximum accessible memory");
 
-      mmap.reset (new File::MMap (files[0], writable, !is_new, bytes_per_segment));
+      if (!is_streaming()) {
+        mmap.reset (new File::MMap (files[0], writable, !is_new, bytes_per_segment));
+        addresses.resize (1);
+        addresses[0].reset (mmap->address());
+        return;
+      }
+
+      // the progress word follows the image data, and is included in the mapping:
+      mmap.reset (new File::MMap (files[0], writable || is_new, false, progress_offset + sizeof(uint64_t) - files[0].start));
+      progress = reinterpret_cast<std::atomic<uint64_t>*> (mmap->address() + (progress_offset - files[0].start));
       addresses.resize (1);
       addresses[0].reset (mmap->address());
+      set_slabs (header);
+
+      if (is_new) {
+        progress->store (0, std::memory_order_release);
+        return;
+      }
+
+      // unless the command has undertaken to wait for each slab before
+      // accessing it, the image must be complete before it is handed over:
+      slabs_ready = 0;
+      if (!defer_wait)
+        wait_for_slab (num_slabs - 1);
+    }
+
+
+
+
+    void Pipe::set_slabs (const Header& header)
+    {
+      num_slabs = 1;
+      slab_axis = 0;
+      slab_reversed = false;
+
+      // the slab axis is the outermost axis in memory:
+      size_t max_stride = 0;
+      for (size_t n = 0; n < header.ndim(); ++n) {
+        if (header.size(n) > 1 && size_t (std::abs (header.stride(n))) > max_stride) {
+          max_stride = std::abs (header.stride(n));
+          slab_axis = n;
+        }
+      }
+      if (!max_stride)
+        return;
+
+      // slabs must start on a byte boundary:
+      const size_t voxels_per_slab = voxel_count (header) / header.size (slab_axis);
+      if ((header.datatype().bits() * voxels_per_slab) % 8)
+        return;
+
+      num_slabs = header.size (slab_axis);
+      slab_reversed = header.stride (slab_axis) < 0;
+      DEBUG ("piped image \"" + files[0].name + "\" streamed as " + str(num_slabs) + " slabs along axis " + str(slab_axis));
     }
 
 
+
+
+    void Pipe::publish (size_t n)
+    {
+      assert (is_new && progress);
+      std::lock_guard<std::mutex> lock (publish_mutex);
+      if (n <= slabs_published)
+        return;
+      slabs_published = std::min (n, num_slabs);
+      progress->store (slabs_published, std::memory_order_release);
+    }
+
+
+
+
+    void Pipe::wait (size_t n) const
+    {
+      static const uint64_t failed = std::numeric_limits<uint64_t>::max();
+      assert (progress);
+
+      uint64_t available = progress->load (std::memory_order_acquire);
+      if (available <= n && available != failed) {
+        DEBUG ("waiting for slab " + str(n) + " of piped image \"" + files[0].name + "\"...");
+        // poll with exponential backoff, checking periodically that the
+        // upstream command is still running:
+        std::chrono::microseconds delay (10), waited (0);
+        const std::chrono::microseconds max_delay (10000), liveness_interval (200000);
+        while ((available = progress->load (std::memory_order_acquire)) <= n && available != failed) {
+          std::this_thread::sleep_for (delay);
+          waited += delay;
+          delay = std::min (2*delay, max_delay);
+#ifndef MRTRIX_WINDOWS
+          if (waited >= liveness_interval) {
+            waited = std::chrono::microseconds (0);
+            if (::kill (pid_t (producer), 0) && errno == ESRCH) {
+              available = progress->load (std::memory_order_acquire);
+              if (available <= n)
+                available = failed;
+              break;
+            }
+          }
+#endif
+        }
+      }
+
+      if (available == failed)
+        throw Exception ("upstream command terminated before completing piped image \"" + files[0].name + "\"");
+
+      size_t ready = slabs_ready.load (std::memory_order_relaxed);
+      while (ready < available && !slabs_ready.compare_exchange_weak (ready, available, std::memory_order_release));
+    }
+
+
+
+
     void Pipe::unload (const Header&)
     {
       if (mmap) {
-        mmap.reset();
-        if (is_new)
+        if (is_streaming()) {
+          if (is_new) {
+            // an exception in the producer must not leave the downstream
+            // command waiting for data that will never arrive:
+            if (std::uncaught_exception())
+              progress->store (std::numeric_limits<uint64_t>::max(), std::memory_order_release);
+            else
+              publish (num_slabs);
+          }
+          progress = nullptr;
+        }
+        else if (is_new)
           std::cout << files[0].name << "\n";
+        mmap.reset();
         addresses[0].release();
       }
 
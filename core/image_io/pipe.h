@@ -15,7 +15,13 @@
 #ifndef __image_io_pipe_h__
 #define __image_io_pipe_h__
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+
 #include "memory.h"
+#include "types.h"
 #include "image_io/base.h"
 #include "file/mmap.h"
 
@@ -27,13 +33,182 @@ namespace MR
     class Pipe : public Base
     { NOMEMALIGN
       public:
-        Pipe (Base&& io_handler) : Base (std::move (io_handler)) { }
+        //! construct a handler for a piped image
+        /*! if \a progress_offset is non-negative, the image is streamed:
+         * the 64-bit word at that offset within the file holds the number of
+         * slabs along the outermost axis in memory that have been completely
+         * written, and \a producer is the process ID of the command writing
+         * them. The image may then be accessed by the downstream command
+         * while it is still being written, provided it has set defer_wait
+         * and invokes wait_for_slab() (e.g. via PipeWait) before accessing
+         * each slab. */
+        Pipe (Base&& io_handler, int64_t progress_offset = -1, int64_t producer = 0) :
+          Base (std::move (io_handler)),
+          progress_offset (progress_offset),
+          producer (producer),
+          progress (nullptr),
+          num_slabs (1),
+          slab_axis (0),
+          slab_reversed (false),
+          slabs_published (0),
+          slabs_ready (std::numeric_limits<size_t>::max()) { }
+
+        /*! if set, streamed images are handed over to the command reading
+         * them as soon as they are opened, rather than once they are
+         * complete; the command must then invoke wait_for_slab() before
+         * accessing the data in each slab (see PipeWait). */
+        static bool defer_wait;
+
+        bool is_streaming () const { return progress_offset >= 0; }
+
+        //! the axis along which slabs are streamed (outermost in memory)
+        size_t streaming_axis () const { return slab_axis; }
+
+        //! publish the fact that the first \a n slabs have been written
+        /*! the image is laid out on file as contiguous slabs along
+         * streaming_axis(), in file order: slab \a k corresponds to index
+         * \a k along that axis, or to index (size-1-k) if its stride is
+         * negative - see slab_index(). This must only be called once all
+         * data in these slabs have been written; the progress count never
+         * decreases. */
+        void publish (size_t n);
+
+        //! the slab (in file order) containing index \a index along streaming_axis()
+        size_t slab_index (ssize_t index) const {
+          return slab_reversed ? num_slabs - 1 - index : index;
+        }
+
+        //! the number of slabs, as seen by publish()
+        size_t slabs () const { return num_slabs; }
+
+        //! block until slab \a n (in file order) of a streamed image is available
+        void wait_for_slab (size_t n) const {
+          if (n >= slabs_ready.load (std::memory_order_acquire))
+            wait (n);
+        }
 
       protected:
         std::unique_ptr<File::MMap> mmap;
+        const int64_t progress_offset, producer;
+        std::atomic<uint64_t>* progress;
+        size_t num_slabs, slab_axis;
+        bool slab_reversed;
+        std::mutex publish_mutex;
+        size_t slabs_published;
+        mutable std::atomic<size_t> slabs_ready;
 
         virtual void load (const Header&, size_t);
         virtual void unload (const Header&);
+
+        void wait (size_t n) const;
+
+        void set_slabs (const Header& header);
+    };
+
+
+
+    //! publish the progress of an image written using a ThreadedLoop
+    /*! when \a image is being streamed down a pipe (see the PipeStreaming
+     * configuration option), this will publish each slab of the image to
+     * the downstream command as soon as all positions within it have been
+     * processed. Call done() with the position of each outer loop iteration
+     * once the corresponding data have been written. This has no effect if
+     * the image is not being streamed, or if the outermost of \a outer_axes
+     * (i.e. the last, slowest-varying one) does not match the axis along
+     * which the image is streamed.
+     *
+     * This class is thread-safe, and is intended to be shared by reference
+     * between the per-thread copies of the functor passed to
+     * ThreadedLoop::run_outer(). */
+    class PipeProgress
+    { NOMEMALIGN
+      public:
+        template <class ImageType>
+          PipeProgress (const ImageType& image, const vector<size_t>& outer_axes) :
+            pipe (nullptr)
+        {
+          if (!image.buffer->get_io() || image.buffer->data_buffer)
+            return;
+          pipe = dynamic_cast<Pipe*> (image.buffer->get_io());
+          if (!pipe || !pipe->is_streaming() || outer_axes.empty() || outer_axes.back() != pipe->streaming_axis()) {
+            pipe = nullptr;
+            return;
+          }
+          axis = outer_axes.back();
+          per_slab = 1;
+          for (size_t n = 0; n + 1 < outer_axes.size(); ++n)
+            per_slab *= image.size (outer_axes[n]);
+          completed.assign (pipe->slabs(), 0);
+          next = 0;
+        }
+
+        template <class PositionType>
+          void done (const PositionType& pos) {
+            if (!pipe)
+              return;
+            std::lock_guard<std::mutex> lock (mutex);
+            ++completed[pipe->slab_index (pos.index (axis))];
+            const size_t previous = next;
+            while (next < completed.size() && completed[next] == per_slab)
+              ++next;
+            if (next != previous)
+              pipe->publish (next);
+          }
+
+      private:
+        Pipe* pipe;
+        size_t axis, per_slab, next;
+        vector<size_t> completed;
+        std::mutex mutex;
+    };
+
+
+
+    //! wait for the data required from a streamed image to become available
+    /*! where the command reading a streamed piped image has set
+     * Pipe::defer_wait, the data in each slab must not be accessed until
+     * the upstream command has published it. Construct this from the image
+     * and the inner axes of the ThreadedLoop used to access it, and invoke it
+     * with the position of each outer loop iteration before reading the
+     * corresponding data. This blocks until these data are available, or
+     * until the whole image is if the streaming axis is one of \a inner_axes.
+     * This has no effect if the image is not being streamed.
+     *
+     * This class is thread-safe, and can be copied freely between the
+     * per-thread copies of the functor passed to ThreadedLoop::run_outer(). */
+    class PipeWait
+    { NOMEMALIGN
+      public:
+        PipeWait () :
+          pipe (nullptr),
+          axis (0),
+          whole (false) { }
+
+        template <class ImageType>
+          PipeWait (const ImageType& image, const vector<size_t>& inner_axes) :
+            PipeWait ()
+        {
+          if (!image.buffer->get_io() || image.buffer->data_buffer)
+            return;
+          pipe = dynamic_cast<const Pipe*> (image.buffer->get_io());
+          if (!pipe || !pipe->is_streaming()) {
+            pipe = nullptr;
+            return;
+          }
+          axis = pipe->streaming_axis();
+          whole = std::find (inner_axes.begin(), inner_axes.end(), axis) != inner_axes.end();
+        }
+
+        template <class PositionType>
+          void operator() (const PositionType& pos) const {
+            if (pipe)
+              pipe->wait_for_slab (whole ? pipe->slabs() - 1 : pipe->slab_index (pos.index (axis)));
+          }
+
+      private:
+        const Pipe* pipe;
+        size_t axis;
+        bool whole;
     };
 
   }
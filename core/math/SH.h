@@ -479,17 +479,19 @@ namespace MR
        * to operate directly in spherical coordinates. The initial search
        * direction is \a unit_init_dir. If \a precomputer is not nullptr, it
        * will be used to speed up the calculations, at the cost of a minor
-       * reduction in accuracy. */
+       * reduction in accuracy. If the search has not converged within
+       * \a max_iterations, NaN is returned. */
       template <class VectorType, class UnitVectorType, class ValueType = float>
         inline typename VectorType::Scalar get_peak (
             const VectorType& sh,
             int lmax,
             UnitVectorType& unit_init_dir,
-            PrecomputedAL<typename VectorType::Scalar>* precomputer = nullptr)
+            PrecomputedAL<typename VectorType::Scalar>* precomputer = nullptr,
+            int max_iterations = 50)
         {
           using value_type = typename VectorType::Scalar;
           assert (std::isfinite (unit_init_dir[0]));
-          for (int i = 0; i < 50; i++) {
+          for (int i = 0; i < max_iterations; i++) {
             value_type az = std::atan2 (unit_init_dir[1], unit_init_dir[0]);
             value_type el = std::acos (unit_init_dir[2]);
             value_type amplitude, dSH_del, dSH_daz, d2SH_del2, d2SH_deldaz, d2SH_daz2;
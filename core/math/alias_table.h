@@ -0,0 +1,106 @@
+/* Copyright (c) 2008-2017 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __math_alias_table_h__
+#define __math_alias_table_h__
+
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "types.h"
+#include "exception.h"
+
+
+namespace MR
+{
+  namespace Math
+  {
+
+
+    //! sample from a discrete distribution in constant time
+    /*! this implements Walker's alias method, using the numerically stable
+     * construction of Vose (1991). Construction is O(N) in the number of
+     * weights; thereafter each draw requires one uniform integer and one
+     * uniform real, regardless of how peaked the distribution is. The table
+     * is immutable once built, so it can be shared between threads, each
+     * drawing from its own random number generator. */
+    class AliasTable
+    { NOMEMALIGN
+      public:
+        AliasTable () { }
+
+        template <class Container>
+          AliasTable (const Container& weights) :
+            probability (weights.size()),
+            alias (weights.size())
+        {
+          const size_t N = weights.size();
+          if (!N)
+            throw Exception ("Cannot construct alias table from empty set of weights");
+          if (N > std::numeric_limits<uint32_t>::max())
+            throw Exception ("Too many weights for alias table");
+
+          double sum = 0.0;
+          for (const auto w : weights) {
+            if (w < 0.0)
+              throw Exception ("Cannot construct alias table with negative weights");
+            sum += w;
+          }
+          if (!sum)
+            throw Exception ("Cannot construct alias table from weights that sum to zero");
+
+          vector<double> scaled (N);
+          vector<uint32_t> small, large;
+          for (size_t i = 0; i != N; ++i) {
+            scaled[i] = weights[i] * N / sum;
+            (scaled[i] < 1.0 ? small : large).push_back (i);
+          }
+
+          while (small.size() && large.size()) {
+            const uint32_t s = small.back(); small.pop_back();
+            const uint32_t l = large.back();
+            probability[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+              large.pop_back();
+              small.push_back (l);
+            }
+          }
+          // Whatever remains is (up to rounding error) exactly 1
+          for (const auto i : large) { probability[i] = 1.0f; alias[i] = i; }
+          for (const auto i : small) { probability[i] = 1.0f; alias[i] = i; }
+        }
+
+        size_t size () const { return probability.size(); }
+
+        //! draw an index, with probability proportional to its weight
+        template <class URBG>
+          size_t operator() (URBG& rng) const {
+            const uint32_t i = std::uniform_int_distribution<uint32_t> (0, probability.size()-1) (rng);
+            return std::uniform_real_distribution<float>() (rng) < probability[i] ? i : alias[i];
+          }
+
+      private:
+        vector<float> probability;
+        vector<uint32_t> alias;
+    };
+
+
+  }
+}
+
+#endif
+
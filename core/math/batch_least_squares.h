@@ -0,0 +1,131 @@
+/* Copyright (c) 2008-2017 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#ifndef __math_batch_least_squares_h__
+#define __math_batch_least_squares_h__
+
+#include "types.h"
+#include "math/least_squares.h"
+
+namespace MR
+{
+  namespace Math
+  {
+
+    /** @addtogroup linalg
+      @{ */
+
+    /** @defgroup batchls Batched least-squares fitting
+      @{ */
+
+
+
+    //! solve many linear least-squares problems sharing the same design matrix
+    /*! Each row of the measurement matrix \a Y passed to the fitting functions
+     * is an independent problem (typically one voxel), such that a whole block
+     * of voxels can be fitted at once. The ordinary least-squares fit reduces
+     * to a single matrix product with the pseudo-inverse of the design matrix.
+     *
+     * For the weighted fit, the lower triangle of the normal matrix of every
+     * row is formed by a single matrix product of the weights with the
+     * pairwise products of the columns of the design matrix; these are then
+     * solved by Cholesky decomposition in structure-of-arrays form, with each
+     * column of the working matrices holding one element of the normal matrix
+     * for all rows, such that every arithmetic operation is vectorised across
+     * the block.
+     *
+     * The working matrices are held by the class, so each thread should use
+     * its own copy. */
+    class BatchLeastSquares
+    { MEMALIGN(BatchLeastSquares)
+      public:
+        BatchLeastSquares (const Eigen::MatrixXd& design) :
+            M (design),
+            Minv_t (pinv (design).transpose()),
+            products (design.rows(), design.cols() * (design.cols()+1) / 2)
+        {
+          for (ssize_t c = 0; c != M.cols(); ++c)
+            for (ssize_t r = c; r != M.cols(); ++r)
+              products.col (index (r, c)) = M.col (r).cwiseProduct (M.col (c));
+        }
+
+        size_t measurements () const { return M.rows(); }
+        size_t coefficients () const { return M.cols(); }
+        const Eigen::MatrixXd& design () const { return M; }
+
+        //! ordinary least-squares fit of each row of \a Y
+        template <class MeasType, class CoefType>
+          void ols (const MeasType& Y, CoefType& X) const {
+            X.noalias() = Y * Minv_t;
+          }
+
+        //! weighted least-squares fit of each row of \a Y, using weights in the corresponding row of \a W
+        /*! solves \f$ (M^T \mathrm{diag}(w) M) x = M^T \mathrm{diag}(w) y \f$
+         * for each row. Rows for which the normal matrix is not positive
+         * definite yield non-finite coefficients. */
+        template <class WeightType, class MeasType, class CoefType>
+          void wls (const WeightType& W, const MeasType& Y, CoefType& X) {
+            const ssize_t n = M.cols();
+            L.noalias() = W * products;
+            X.noalias() = W.cwiseProduct (Y) * M;
+
+            // Cholesky decomposition, in place, column by column
+            for (ssize_t c = 0; c != n; ++c) {
+              auto diag = L.col (index (c, c)).array();
+              for (ssize_t k = 0; k != c; ++k)
+                diag -= L.col (index (c, k)).array().square();
+              diag = diag.sqrt();
+              for (ssize_t r = c+1; r != n; ++r) {
+                auto element = L.col (index (r, c)).array();
+                for (ssize_t k = 0; k != c; ++k)
+                  element -= L.col (index (r, k)).array() * L.col (index (c, k)).array();
+                element /= diag;
+              }
+            }
+
+            // forward substitution
+            for (ssize_t r = 0; r != n; ++r) {
+              auto x = X.col (r).array();
+              for (ssize_t k = 0; k != r; ++k)
+                x -= L.col (index (r, k)).array() * X.col (k).array();
+              x /= L.col (index (r, r)).array();
+            }
+
+            // back substitution
+            for (ssize_t r = n-1; r >= 0; --r) {
+              auto x = X.col (r).array();
+              for (ssize_t k = r+1; k != n; ++k)
+                x -= L.col (index (k, r)).array() * X.col (k).array();
+              x /= L.col (index (r, r)).array();
+            }
+          }
+
+      protected:
+        const Eigen::MatrixXd M, Minv_t;
+        Eigen::MatrixXd products, L;
+
+        // index of element (r,c), r >= c, within the column-major lower triangle
+        ssize_t index (const ssize_t r, const ssize_t c) const {
+          return c*M.cols() - (c*(c-1))/2 + (r-c);
+        }
+    };
+
+    /** @} */
+    /** @} */
+
+
+  }
+}
+
+#endif
@@ -21,6 +21,8 @@
 #endif
 
 #include <mutex>
+#include <limits>
+#include <cstdint>
 
 #include "mrtrix.h"
 
@@ -77,6 +79,78 @@ namespace MR
     };
 
 
+    //! counter-based random number generator
+    /*! this implements the Philox4x32-10 generator of Salmon et al. (2011),
+     * and satisfies the requirements of a UniformRandomBitGenerator, so it
+     * can be used with the standard C++11 distributions. Unlike RNG, its
+     * output is a pure function of a 64-bit key and a 128-bit counter: the
+     * upper 64 bits of the counter identify an independent \e stream, and
+     * the lower 64 bits are incremented as numbers are drawn from it. This
+     * means that any stream can be regenerated exactly, in any order and on
+     * any thread, simply by calling seek() with its index. */
+    class Philox
+    { NOMEMALIGN
+      public:
+        using result_type = uint32_t;
+
+        Philox () : Philox (RNG::get_seed()) { }
+        Philox (uint64_t key, uint64_t stream = 0) :
+          key { uint32_t (key), uint32_t (key >> 32) } { seek (stream); }
+
+        static constexpr result_type min () { return 0; }
+        static constexpr result_type max () { return std::numeric_limits<result_type>::max(); }
+
+        //! restart the generator at the beginning of stream \a stream
+        void seek (uint64_t stream) {
+          counter[0] = counter[1] = 0;
+          counter[2] = uint32_t (stream);
+          counter[3] = uint32_t (stream >> 32);
+          next = 4;
+        }
+
+        result_type operator() () {
+          if (next == 4) {
+            generate_block();
+            next = 0;
+          }
+          return block[next++];
+        }
+
+        void discard (unsigned long long n) { while (n--) (*this)(); }
+
+      private:
+        uint32_t key[2], counter[4], block[4];
+        size_t next;
+
+        static void mulhilo (uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+          const uint64_t product = uint64_t (a) * uint64_t (b);
+          hi = uint32_t (product >> 32);
+          lo = uint32_t (product);
+        }
+
+        void generate_block () {
+          uint32_t c[4] = { counter[0], counter[1], counter[2], counter[3] };
+          uint32_t k[2] = { key[0], key[1] };
+          for (size_t round = 0; round != 10; ++round) {
+            uint32_t hi0, lo0, hi1, lo1;
+            mulhilo (0xD2511F53, c[0], hi0, lo0);
+            mulhilo (0xCD9E8D57, c[2], hi1, lo1);
+            c[0] = hi1 ^ c[1] ^ k[0];
+            c[1] = lo1;
+            c[2] = hi0 ^ c[3] ^ k[1];
+            c[3] = lo0;
+            k[0] += 0x9E3779B9;
+            k[1] += 0xBB67AE85;
+          }
+          for (size_t n = 0; n != 4; ++n)
+            block[n] = c[n];
+          if (!++counter[0])
+            ++counter[1];
+        }
+    };
+
+
+
     template <typename ValueType>
       class RNG::Uniform { NOMEMALIGN
         public:
@@ -44,13 +44,14 @@ namespace MR
 
 
 
-        void ttest (matrix_type& tvalues,
-                    const matrix_type& design,
-                    const matrix_type& pinv_design,
-                    const matrix_type& measurements,
-                    const matrix_type& scaled_contrasts,
-                    matrix_type& betas,
-                    matrix_type& residuals)
+        template <typename ValueType>
+        void ttest (Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& tvalues,
+                    const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& design,
+                    const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& pinv_design,
+                    const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements,
+                    const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& scaled_contrasts,
+                    Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& betas,
+                    Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& residuals)
         {
           betas.noalias() = measurements * pinv_design;
           residuals.noalias() = measurements - betas * design;
@@ -61,33 +62,59 @@ namespace MR
 
 
 
-        matrix_type solve_betas (const matrix_type& measurements, const matrix_type& design)
+        template <typename ValueType>
+        Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> solve_betas (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements, const matrix_type& design)
         {
-          return design.jacobiSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(measurements.transpose());
+          return design.cast<ValueType>().jacobiSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(measurements.transpose());
         }
 
 
 
-        matrix_type abs_effect_size (const matrix_type& measurements, const matrix_type& design, const matrix_type& contrast)
+        template <typename ValueType>
+        Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> abs_effect_size (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements, const matrix_type& design, const matrix_type& contrast)
         {
-          return contrast * solve_betas (measurements, design);
+          return contrast.cast<ValueType>() * solve_betas (measurements, design);
         }
 
 
-        matrix_type stdev (const matrix_type& measurements, const matrix_type& design)
+        template <typename ValueType>
+        Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> stdev (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements, const matrix_type& design)
         {
-          matrix_type residuals = measurements.transpose() - design * solve_betas (measurements, design); //TODO
+          using result_type = Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>;
+          result_type residuals = measurements.transpose() - design.cast<ValueType>() * solve_betas (measurements, design); //TODO
           residuals = residuals.array().pow(2.0);
-          matrix_type one_over_dof (1, measurements.cols());  //TODO supply transposed measurements
+          result_type one_over_dof (1, measurements.cols());  //TODO supply transposed measurements
           one_over_dof.fill (1.0 / value_type(design.rows()-Math::rank (design)));
           return (one_over_dof * residuals).array().sqrt();
         }
 
 
-        matrix_type std_effect_size (const matrix_type& measurements, const matrix_type& design, const matrix_type& contrast)
+        template <typename ValueType>
+        Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> std_effect_size (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements, const matrix_type& design, const matrix_type& contrast)
         {
           return abs_effect_size (measurements, design, contrast).array() / stdev (measurements, design).array();
         }
+
+
+
+#define INSTANTIATE_GLM(ValueType) \
+        template void ttest (Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, \
+                             const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, \
+                             const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, \
+                             const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, \
+                             const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, \
+                             Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, \
+                             Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&); \
+        template Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> solve_betas (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, const matrix_type&); \
+        template Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> abs_effect_size (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, const matrix_type&, const matrix_type&); \
+        template Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> stdev (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, const matrix_type&); \
+        template Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> std_effect_size (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>&, const matrix_type&, const matrix_type&);
+
+        INSTANTIATE_GLM(float)
+        INSTANTIATE_GLM(double)
+
+#undef INSTANTIATE_GLM
+
       }
 
 
@@ -97,17 +124,17 @@ namespace MR
 
 
 
-      GLMTTest::GLMTTest (const matrix_type& measurements, const matrix_type& design, const matrix_type& contrast) :
+      template <typename ValueType>
+      GLMTTest<ValueType>::GLMTTest (const matrix_type& measurements, const Math::Stats::matrix_type& design, const Math::Stats::matrix_type& contrast) :
           y (measurements),
-          X (design),
-          scaled_contrasts (GLM::scale_contrasts (contrast, X, X.rows()-rank(X)).transpose())
-      {
-        pinvX = Math::pinv (X);
-      }
+          X (design.cast<value_type>()),
+          pinvX (Math::pinv (design).cast<value_type>()),
+          scaled_contrasts (GLM::scale_contrasts (contrast, design, design.rows()-rank(design)).transpose().cast<value_type>()) { }
 
 
 
-      void GLMTTest::operator() (const vector<size_t>& perm_labelling, vector_type& stats) const
+      template <typename ValueType>
+      void GLMTTest<ValueType>::operator() (const vector<size_t>& perm_labelling, vector_type& stats) const
       {
         stats = vector_type::Zero (y.rows());
         matrix_type tvalues, betas, residuals, SX, pinvSX;
@@ -135,6 +162,10 @@ namespace MR
 
 
 
+      template class GLMTTest<float>;
+      template class GLMTTest<double>;
+
+
 
     }
   }
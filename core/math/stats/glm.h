@@ -44,13 +44,14 @@ namespace MR
          *
          * Note also that the contrast matrix should already have been scaled
          * using the GLM::scale_contrasts() function. */
-        void ttest (matrix_type& tvalues,
-                    const matrix_type& design,
-                    const matrix_type& pinv_design,
-                    const matrix_type& measurements,
-                    const matrix_type& scaled_contrasts,
-                    matrix_type& betas,
-                    matrix_type& residuals);
+        template <typename ValueType>
+        void ttest (Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& tvalues,
+                    const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& design,
+                    const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& pinv_design,
+                    const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements,
+                    const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& scaled_contrasts,
+                    Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& betas,
+                    Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& residuals);
 
 
 
@@ -61,7 +62,8 @@ namespace MR
           * @param design the design matrix (unlike other packages a column of ones is NOT automatically added for correlation analysis)
           * @return the matrix containing the output effect
           */
-          matrix_type solve_betas (const matrix_type& measurements, const matrix_type& design);
+          template <typename ValueType>
+          Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> solve_betas (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements, const matrix_type& design);
 
 
 
@@ -71,7 +73,8 @@ namespace MR
           * @param contrast a matrix defining the group difference
           * @return the matrix containing the output effect
           */
-          matrix_type abs_effect_size (const matrix_type& measurements, const matrix_type& design, const matrix_type& contrast);
+          template <typename ValueType>
+          Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> abs_effect_size (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements, const matrix_type& design, const matrix_type& contrast);
 
 
 
@@ -80,7 +83,8 @@ namespace MR
           * @param design the design matrix (unlike other packages a column of ones is NOT automatically added for correlation analysis)
           * @return the matrix containing the output standard deviation size
           */
-          matrix_type stdev (const matrix_type& measurements, const matrix_type& design);
+          template <typename ValueType>
+          Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> stdev (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements, const matrix_type& design);
 
 
 
@@ -90,7 +94,8 @@ namespace MR
           * @param contrast a matrix defining the group difference
           * @return the matrix containing the output standardised effect size
           */
-          matrix_type std_effect_size (const matrix_type& measurements, const matrix_type& design, const matrix_type& contrast);
+          template <typename ValueType>
+          Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic> std_effect_size (const Eigen::Matrix<ValueType, Eigen::Dynamic, Eigen::Dynamic>& measurements, const matrix_type& design, const matrix_type& contrast);
           //! @}
 
       } // End GLM namespace
@@ -99,15 +104,28 @@ namespace MR
 
       /** \addtogroup Statistics
       @{ */
-      /*! A class to compute t-statistics using a General Linear Model. */
+      /*! A class to compute t-statistics using a General Linear Model.
+       *
+       * The measurement data and the resulting t-statistics are held at the
+       * precision given by \a ValueType; instantiating with float halves the
+       * memory required for the measurement matrix, and doubles the throughput
+       * of the matrix products performed for each permutation. The design and
+       * contrast matrices are always provided in double precision, and the
+       * pseudo-inverse and scaled contrasts are computed at that precision
+       * before conversion. */
+      template <typename ValueType>
       class GLMTTest { NOMEMALIGN
         public:
+          using value_type = ValueType;
+          using matrix_type = Eigen::Matrix<value_type, Eigen::Dynamic, Eigen::Dynamic>;
+          using vector_type = Eigen::Array<value_type, Eigen::Dynamic, 1>;
+
           /*!
           * @param measurements a matrix storing the measured data for each subject in a column //TODO
           * @param design the design matrix (unlike other packages a column of ones is NOT automatically added for correlation analysis)
           * @param contrast a matrix containing the contrast of interest.
           */
-          GLMTTest (const matrix_type& measurements, const matrix_type& design, const matrix_type& contrast);
+          GLMTTest (const matrix_type& measurements, const Math::Stats::matrix_type& design, const Math::Stats::matrix_type& contrast);
 
           /*! Compute the t-statistics
           * @param perm_labelling a vector to shuffle the rows in the design matrix (for permutation testing)
@@ -120,10 +138,18 @@ namespace MR
           size_t num_subjects () const { return y.cols(); }
           size_t num_elements () const { return y.rows(); }
 
+          const matrix_type& design () const { return X; }
+          const matrix_type& contrasts () const { return scaled_contrasts; }
+
         protected:
           const matrix_type& y;
           matrix_type X, pinvX, scaled_contrasts;
       };
+
+
+
+      extern template class GLMTTest<float>;
+      extern template class GLMTTest<double>;
       //! @}
 
     }
@@ -14,6 +14,7 @@
 
 #include "math/stats/permutation.h"
 #include "math/math.h"
+#include "math/rng.h"
 
 namespace MR
 {
@@ -49,10 +50,33 @@ namespace MR
 
 
 
+        namespace
+        {
+          // Fisher-Yates shuffle; the bounded integers are drawn by rejection rather than via
+          //   std::uniform_int_distribution, whose output is implementation-defined, such that
+          //   a given seed yields the same permutations on all platforms
+          void shuffle (vector<size_t>& labelling, Math::Philox& rng)
+          {
+            for (size_t i = labelling.size(); i > 1; --i) {
+              const uint32_t range = i;
+              const uint32_t threshold = uint32_t(-range) % range;
+              uint32_t r;
+              do {
+                r = rng();
+              } while (r < threshold);
+              std::swap (labelling[i-1], labelling[r % range]);
+            }
+          }
+        }
+
+
+
         void generate (const size_t num_perms,
                        const size_t num_subjects,
+                       const uint64_t seed,
                        vector<vector<size_t> >& permutations,
-                       const bool include_default)
+                       const bool include_default,
+                       const uint64_t first_stream)
         {
           permutations.clear();
           vector<size_t> default_labelling (num_subjects);
@@ -64,9 +88,10 @@ namespace MR
             ++p;
           }
           for (;p < num_perms; ++p) {
+            Math::Philox rng (seed, first_stream + p);
             vector<size_t> permuted_labelling (default_labelling);
             do {
-              std::random_shuffle (permuted_labelling.begin(), permuted_labelling.end());
+              shuffle (permuted_labelling, rng);
             } while (is_duplicate (permuted_labelling, permutations));
             permutations.push_back (permuted_labelling);
           }
@@ -74,9 +99,12 @@ namespace MR
 
 
 
-        void statistic2pvalue (const vector_type& perm_dist, const vector_type& stats, vector_type& pvalues)
+        template <typename ValueType>
+        void statistic2pvalue (const Eigen::Array<ValueType, Eigen::Dynamic, 1>& perm_dist,
+                               const Eigen::Array<ValueType, Eigen::Dynamic, 1>& stats,
+                               Eigen::Array<ValueType, Eigen::Dynamic, 1>& pvalues)
         {
-          vector<value_type> permutations;
+          vector<ValueType> permutations;
           permutations.reserve (perm_dist.size());
           for (ssize_t i = 0; i != perm_dist.size(); ++i)
             permutations.push_back (perm_dist[i]);
@@ -100,6 +128,11 @@ namespace MR
 
 
 
+        template void statistic2pvalue (const Eigen::Array<float, Eigen::Dynamic, 1>&, const Eigen::Array<float, Eigen::Dynamic, 1>&, Eigen::Array<float, Eigen::Dynamic, 1>&);
+        template void statistic2pvalue (const Eigen::Array<double, Eigen::Dynamic, 1>&, const Eigen::Array<double, Eigen::Dynamic, 1>&, Eigen::Array<double, Eigen::Dynamic, 1>&);
+
+
+
         vector<vector<size_t> > load_permutations_file (const std::string& filename) {
           vector<vector<size_t> > temp = load_matrix_2D_vector<size_t> (filename);
           if (!temp.size())
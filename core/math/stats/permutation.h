@@ -41,12 +41,22 @@ namespace MR
         // Note that this function does not take into account grouping of subjects and therefore generated
         // permutations are not guaranteed to be unique wrt the computed test statistic.
         // Providing the number of subjects is large then the likelihood of generating duplicates is low.
+        // Each permutation is drawn from its own stream of a counter-based random number generator,
+        // keyed by the seed and indexed by the position of the permutation within the set; the result
+        // is therefore fully determined by the seed, regardless of how the permutations are subsequently
+        // distributed between threads, processes or runs. Independent sets of permutations can be
+        // generated from the same seed by starting from a different stream (first_stream).
         void generate (const size_t num_perms,
                        const size_t num_subjects,
+                       const uint64_t seed,
                        vector<vector<size_t> >& permutations,
-                       const bool include_default);
+                       const bool include_default,
+                       const uint64_t first_stream = 0);
 
-        void statistic2pvalue (const vector_type& perm_dist, const vector_type& stats, vector_type& pvalues);
+        template <typename ValueType>
+        void statistic2pvalue (const Eigen::Array<ValueType, Eigen::Dynamic, 1>& perm_dist,
+                               const Eigen::Array<ValueType, Eigen::Dynamic, 1>& stats,
+                               Eigen::Array<ValueType, Eigen::Dynamic, 1>& pvalues);
 
 
         vector<vector<size_t> > load_permutations_file (const std::string& filename);
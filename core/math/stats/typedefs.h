@@ -28,10 +28,20 @@ namespace MR
 
 
 
+      // Design matrices, contrasts and quantities derived from them are always held
+      //   in double precision
       using value_type = MR::default_type;
       using matrix_type = Eigen::Matrix<value_type, Eigen::Dynamic, Eigen::Dynamic>;
       using vector_type = Eigen::Array<value_type, Eigen::Dynamic, 1>;
 
+      // Default precision of measurement data, test statistics and enhanced statistics:
+      //   GLMTTest and the enhancers are templated on this precision, and the statistical
+      //   inference commands use single precision instead if requested (halving memory
+      //   usage and doubling the throughput of the GLM matrix products)
+      using stat_value_type = MR::default_type;
+      using stat_matrix_type = Eigen::Matrix<stat_value_type, Eigen::Dynamic, Eigen::Dynamic>;
+      using stat_vector_type = Eigen::Array<stat_value_type, Eigen::Dynamic, 1>;
+
 
 
     }
@@ -18,6 +18,7 @@
 #include "app.h"
 #include "thread.h"
 #include "file/config.h"
+#include "file/json.h"
 #include "thread_queue.h"
 
 namespace MR
@@ -59,6 +60,66 @@ namespace MR
 
 
 
+    //CONF option: PipelineStatistics
+    //CONF default: 0 (false)
+    //CONF A boolean value specifying whether multi-threaded pipelines
+    //CONF should record, for each stage, the number of items processed, the
+    //CONF time spent processing and waiting on the queues, and the
+    //CONF occupancy of each queue, and report these as JSON on completion.
+    //CONF This is always enabled when running with -debug.
+
+    bool pipeline_statistics_enabled ()
+    {
+      static const bool enabled = File::Config::get_bool ("PipelineStatistics", false);
+      return enabled || App::log_level >= 3;
+    }
+
+
+
+    void __PipelineStats::report () const
+    {
+      auto seconds = [] (uint64_t ns) { return 1.0e-9 * ns; };
+
+      nlohmann::json json;
+      json["elapsed"] = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+
+      for (const auto& stage : stages) {
+        nlohmann::json entry;
+        entry["name"] = stage->name;
+        entry["threads"] = uint64_t (stage->threads);
+        entry["items"] = uint64_t (stage->items);
+        entry["busy"] = seconds (stage->busy);
+        entry["wait_input"] = seconds (stage->wait_input);
+        entry["wait_output"] = seconds (stage->wait_output);
+        json["stages"].push_back (entry);
+      }
+
+      for (const auto& queue : queues) {
+        nlohmann::json entry;
+        vector<uint64_t> histogram (queue->num_bins);
+        uint64_t samples = 0;
+        double sum = 0.0;
+        for (size_t n = 0; n < queue->num_bins; ++n) {
+          histogram[n] = queue->bins[n];
+          samples += histogram[n];
+          sum += n * double (histogram[n]);
+        }
+        // trailing empty bins carry no information:
+        while (histogram.size() > 1 && !histogram.back())
+          histogram.pop_back();
+        entry["name"] = queue->name;
+        entry["capacity"] = queue->num_bins - 1;
+        entry["samples"] = samples;
+        entry["mean_occupancy"] = samples ? sum / samples : 0.0;
+        entry["occupancy_histogram"] = histogram;
+        json["queues"].push_back (entry);
+      }
+
+      CONSOLE ("pipeline statistics: " + json.dump());
+    }
+
+
+
     void (*__Backend::previous_print_func) (const std::string& msg) = nullptr;
     void (*__Backend::previous_report_to_user_func) (const std::string& msg, int type) = nullptr;
 
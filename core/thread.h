@@ -15,6 +15,7 @@
 #ifndef __mrtrix_thread_h__
 #define __mrtrix_thread_h__
 
+#include <atomic>
 #include <thread>
 #include <future>
 #include <mutex>
@@ -209,6 +210,26 @@ namespace MR
             }
         };
 
+      template <class Functor>
+        class __parallel_for { NOMEMALIGN
+          public:
+            __parallel_for (const size_t N, const size_t block_size, Functor& functor, std::atomic<size_t>& next) :
+              N (N), block_size (block_size), functor (functor), next (next) { }
+            void execute () {
+              size_t start;
+              while ((start = next.fetch_add (block_size)) < N) {
+                const size_t end = std::min (start + block_size, N);
+                for (size_t i = start; i != end; ++i)
+                  functor (i);
+              }
+            }
+          private:
+            const size_t N, block_size;
+            Functor& functor;
+            std::atomic<size_t>& next;
+        };
+
+
       template <class Functor>
         class __run<__Multi<Functor>> { NOMEMALIGN
           public:
@@ -340,6 +361,47 @@ namespace MR
         return __run<typename std::remove_reference<Functor>::type>() (functor, name);
       }
 
+
+
+    //! Invoke the functor for every index in the range [0, N), using multiple threads
+    /*! This is a convenience function for loops over independent elements
+     * that are not stored in an image (for which ThreadedLoop() should be
+     * used instead). The functor is invoked as:
+     * \code
+     * functor (index);
+     * \endcode
+     * with each index handed out exactly once. Indices are distributed across
+     * Thread::number_of_threads() threads in blocks of \a block_size
+     * consecutive indices, each thread claiming the next available block
+     * once it has completed its current one; the block size should be
+     * reduced where each call represents a substantial amount of work. The
+     * loop is run in the calling thread if there are too few indices to fill
+     * two blocks, or if multi-threading is disabled.
+     *
+     * The \e same functor object is shared by all threads, so it must be
+     * safe to invoke concurrently for different indices (e.g. each call
+     * writes only to the element of the output corresponding to its own
+     * index). For example:
+     * \code
+     * vector<float> out (in.size());
+     * Thread::parallel_for (in.size(), [&] (const size_t i) { out[i] = std::sqrt (in[i]); });
+     * \endcode
+     *
+     * This function only returns once all indices have been processed; any
+     * exception thrown by the functor is re-thrown at that point. */
+    template <class Functor>
+      inline void parallel_for (const size_t N, Functor&& functor, const size_t block_size = 1024, const std::string& name = "parallel for")
+      {
+        if (N < 2 * block_size || number_of_threads() < 2) {
+          for (size_t i = 0; i != N; ++i)
+            functor (i);
+          return;
+        }
+        std::atomic<size_t> next (0);
+        __parallel_for<typename std::remove_reference<Functor>::type> worker (N, block_size, functor, next);
+        run (multi (worker), name).wait();
+      }
+
     /** @} */
     /** @} */
   }
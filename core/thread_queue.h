@@ -16,6 +16,8 @@
 #define __mrtrix_thread_queue_h__
 
 #include <stack>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 
 #include "memory.h"
@@ -23,6 +25,7 @@
 
 #define MRTRIX_QUEUE_DEFAULT_CAPACITY 128
 #define MRTRIX_QUEUE_DEFAULT_BATCH_SIZE 128
+#define MRTRIX_QUEUE_SPIN_COUNT 256
 
 namespace MR
 {
@@ -83,6 +86,526 @@ namespace MR
 
 
 
+    /** \addtogroup thread_classes
+     * @{ */
+
+    //! tag to select a Thread::Queue synchronised by a mutex and condition variables
+    class Locking { NOMEMALIGN };
+
+    //! tag to select a Thread::Queue backed by a bounded lock-free ring buffer
+    /*! Pushing and popping items only involves atomic operations on the ring
+     * buffer; threads that find the queue full (or empty) spin for a while
+     * before parking on a condition variable. This avoids the mutex and the
+     * associated system calls for every item (or batch) in the common case
+     * where the queue is neither full nor empty, and is the default for
+     * Thread::run_queue(). */
+    class LockFree { NOMEMALIGN };
+
+    /** @} */
+
+
+
+    //! whether Thread::run_queue() should collect and report pipeline statistics
+    /*! This is set using the PipelineStatistics entry in the MRtrix
+     * configuration file, and is always enabled at debug level (i.e. when
+     * the -debug option is used).
+     * \sa Thread::run_queue() */
+    bool pipeline_statistics_enabled ();
+
+
+
+    //* \cond skip
+
+    //! timing and throughput statistics for one stage of a pipeline
+    class __StageStats { NOMEMALIGN
+      public:
+        __StageStats (const std::string& name) :
+          name (name), threads (0), items (0), busy (0), wait_input (0), wait_output (0) { }
+
+        const std::string name;
+        // times in nanoseconds, summed over all threads of the stage:
+        std::atomic<uint64_t> threads, items, busy, wait_input, wait_output;
+    };
+
+
+    //! histogram of the number of items waiting in a queue, sampled on every push
+    class __QueueOccupancy { NOMEMALIGN
+      public:
+        __QueueOccupancy (const std::string& name, size_t capacity) :
+          name (name), num_bins (capacity+1), bins (new std::atomic<uint64_t> [num_bins]) {
+            for (size_t n = 0; n < num_bins; ++n)
+              bins[n].store (0, std::memory_order_relaxed);
+          }
+
+        FORCE_INLINE void add (size_t occupancy) {
+          bins[std::min (occupancy, num_bins-1)].fetch_add (1, std::memory_order_relaxed);
+        }
+
+        const std::string name;
+        const size_t num_bins;
+        std::unique_ptr<std::atomic<uint64_t>[]> bins;
+    };
+
+
+    //! per-thread accumulator for a __StageStats instance
+    /*! Counters are kept local to the thread and only merged into the shared
+     * statistics on destruction. All methods reduce to a plain function call
+     * if no statistics are being collected. */
+    class __StageTimer { NOMEMALIGN
+      public:
+        __StageTimer (__StageStats* stats) :
+          stats (stats), items (0), busy (0), wait_input (0), wait_output (0) { }
+
+        ~__StageTimer () {
+          if (stats) {
+            ++stats->threads;
+            stats->items += items;
+            stats->busy += busy;
+            stats->wait_input += wait_input;
+            stats->wait_output += wait_output;
+          }
+        }
+
+        template <class Functor>
+          FORCE_INLINE bool process (Functor&& functor) {
+            if (!stats)
+              return functor();
+            ++items;
+            return timed (busy, functor);
+          }
+
+        template <class Functor>
+          FORCE_INLINE bool input (Functor&& functor) {
+            return stats ? timed (wait_input, functor) : functor();
+          }
+
+        template <class Functor>
+          FORCE_INLINE bool output (Functor&& functor) {
+            return stats ? timed (wait_output, functor) : functor();
+          }
+
+      private:
+        __StageStats* stats;
+        uint64_t items, busy, wait_input, wait_output;
+
+        template <class Functor>
+          FORCE_INLINE bool timed (uint64_t& counter, Functor& functor) {
+            const auto start = std::chrono::steady_clock::now();
+            const bool retval = functor();
+            counter += std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now() - start).count();
+            return retval;
+          }
+    };
+
+
+    //! statistics for all stages and queues of a Thread::run_queue() pipeline
+    class __PipelineStats { NOMEMALIGN
+      public:
+        __PipelineStats () : start (std::chrono::steady_clock::now()) { }
+
+        __StageStats* stage (const std::string& name) {
+          stages.push_back (std::unique_ptr<__StageStats> (new __StageStats (name)));
+          return stages.back().get();
+        }
+
+        __QueueOccupancy* queue (const std::string& name, size_t capacity) {
+          queues.push_back (std::unique_ptr<__QueueOccupancy> (new __QueueOccupancy (name, capacity)));
+          return queues.back().get();
+        }
+
+        //! write the statistics as a JSON report to the console
+        void report () const;
+
+      private:
+        const std::chrono::steady_clock::time_point start;
+        vector<std::unique_ptr<__StageStats>> stages;
+        vector<std::unique_ptr<__QueueOccupancy>> queues;
+    };
+
+    //! \endcond
+
+
+
+    //* \cond skip
+    namespace {
+
+      template <class T, class Sync> class __QueueBackend;
+
+
+
+      template <class T> class __QueueBackend<T,Locking> { NOMEMALIGN
+        protected:
+          // one slot is always left empty to tell a full buffer from an
+          // empty one, so allocate one more than the number of items held:
+          __QueueBackend (const std::string& description, size_t buffer_size) :
+            buffer (new T* [buffer_size+1]),
+            front (buffer),
+            back (buffer),
+            capacity (buffer_size+1),
+            writer_count (0),
+            reader_count (0),
+            name (description) {
+            assert (buffer_size > 0);
+          }
+
+          ~__QueueBackend () {
+            delete [] buffer;
+          }
+
+          void status () {
+            std::lock_guard<std::mutex> lock (mutex);
+            std::cerr << "Thread::Queue \"" + name + "\": "
+                      << writer_count << " writer" << (writer_count > 1 ? "s" : "") << ", "
+                      << reader_count << " reader" << (reader_count > 1 ? "s" : "") << ", items waiting: " << size() << "\n";
+          }
+
+          void register_writer ()   {
+            std::lock_guard<std::mutex> lock (mutex);
+            ++writer_count;
+          }
+          void unregister_writer () {
+            std::lock_guard<std::mutex> lock (mutex);
+            assert (writer_count);
+            --writer_count;
+            if (!writer_count) {
+              DEBUG ("no writers left on queue \"" + name + "\"");
+              more_data.notify_all();
+            }
+          }
+          void register_reader ()   {
+            std::lock_guard<std::mutex> lock (mutex);
+            ++reader_count;
+          }
+          void unregister_reader () {
+            std::lock_guard<std::mutex> lock (mutex);
+            assert (reader_count);
+            --reader_count;
+            if (!reader_count) {
+              DEBUG ("no readers left on queue \"" + name + "\"");
+              more_space.notify_all();
+            }
+          }
+
+          size_t occupancy () {
+            std::lock_guard<std::mutex> lock (mutex);
+            return size();
+          }
+
+          FORCE_INLINE T* get_item () {
+            std::lock_guard<std::mutex> lock (mutex);
+            T* item (new T);
+            items.push_back (std::unique_ptr<T> (item));
+            return item;
+          }
+
+          // all items remain owned by the queue until destruction:
+          FORCE_INLINE void release_item (T*) { }
+
+          FORCE_INLINE bool push (T*& item) {
+            std::unique_lock<std::mutex> lock (mutex);
+            more_space.wait (lock, [this]{ return !(full() && reader_count); });
+            if (!reader_count) return false;
+            *back = item;
+            back = inc (back);
+            if (item_stack.empty()) {
+              item = new T;
+              items.push_back (std::unique_ptr<T> (item));
+            }
+            else {
+              item = item_stack.top();
+              item_stack.pop();
+            }
+            more_data.notify_one();
+            return true;
+          }
+
+          FORCE_INLINE bool pop (T*& item) {
+            std::unique_lock<std::mutex> lock (mutex);
+            if (item)
+              item_stack.push (item);
+            item = nullptr;
+            more_data.wait (lock, [this]{ return !(empty() && writer_count); });
+            if (empty() && !writer_count)
+              return false;
+            item = *front;
+            front = inc (front);
+            more_space.notify_one();
+            return true;
+          }
+
+        private:
+          std::mutex mutex;
+          std::condition_variable more_data, more_space;
+          T** buffer;
+          T** front;
+          T** back;
+          size_t capacity;
+          size_t writer_count, reader_count;
+          std::stack<T*,vector<T*> > item_stack;
+          vector<std::unique_ptr<T>> items;
+          std::string name;
+
+          FORCE_INLINE bool empty () const {
+            return (front == back);
+          }
+          FORCE_INLINE bool full () const {
+            return (inc (back) == front);
+          }
+          FORCE_INLINE size_t size () const {
+            return ( (back < front ? back+capacity : back) - front);
+          }
+          FORCE_INLINE T** inc (T** p) const {
+            ++p;
+            if (p >= buffer + capacity) p = buffer;
+            return p;
+          }
+      };
+
+
+
+
+      // bounded multi-producer / multi-consumer ring buffer of pointers,
+      // after D. Vyukov: each cell carries a sequence number that tells
+      // producers and consumers whether it is ready for them. The number of
+      // cells is a power of two (and at least 2, since with a single cell
+      // the 'free' and 'ready' sequence numbers coincide); the number of
+      // items held at any one time is limited separately to the requested
+      // capacity.
+      template <class P> class __LockFreeRing { NOMEMALIGN
+        public:
+          __LockFreeRing (size_t capacity) :
+            limit (std::max (capacity, size_t(1))),
+            mask (ceil_pow2 (std::max (capacity, size_t(2))) - 1),
+            cells (new Cell [mask+1]),
+            enqueue_pos (0),
+            dequeue_pos (0) {
+              for (size_t n = 0; n <= mask; ++n)
+                cells[n].seq.store (n, std::memory_order_relaxed);
+            }
+
+          FORCE_INLINE bool try_push (P item) {
+            Cell* cell;
+            size_t pos = enqueue_pos.load (std::memory_order_relaxed);
+            while (true) {
+              // dequeue_pos only ever increases, so if this holds for the
+              // position claimed below, the limit cannot be exceeded (a stale
+              // pos may lag behind dequeue_pos, hence the signed comparison):
+              if (ssize_t (pos - dequeue_pos.load (std::memory_order_acquire)) >= ssize_t (limit))
+                return false;
+              cell = &cells[pos & mask];
+              const ssize_t diff = ssize_t (cell->seq.load (std::memory_order_acquire)) - ssize_t (pos);
+              if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak (pos, pos+1, std::memory_order_relaxed))
+                  break;
+              }
+              else if (diff < 0)
+                return false;
+              else
+                pos = enqueue_pos.load (std::memory_order_relaxed);
+            }
+            cell->data = item;
+            cell->seq.store (pos+1, std::memory_order_release);
+            return true;
+          }
+
+          FORCE_INLINE bool try_pop (P& item) {
+            Cell* cell;
+            size_t pos = dequeue_pos.load (std::memory_order_relaxed);
+            while (true) {
+              cell = &cells[pos & mask];
+              const ssize_t diff = ssize_t (cell->seq.load (std::memory_order_acquire)) - ssize_t (pos+1);
+              if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak (pos, pos+1, std::memory_order_relaxed))
+                  break;
+              }
+              else if (diff < 0)
+                return false;
+              else
+                pos = dequeue_pos.load (std::memory_order_relaxed);
+            }
+            item = cell->data;
+            cell->seq.store (pos+mask+1, std::memory_order_release);
+            return true;
+          }
+
+          //! approximate number of items in the ring
+          size_t size () const {
+            const size_t back = enqueue_pos.load (std::memory_order_relaxed);
+            const size_t front = dequeue_pos.load (std::memory_order_relaxed);
+            return back > front ? back - front : 0;
+          }
+
+          size_t capacity () const { return limit; }
+
+        private:
+          class Cell { NOMEMALIGN
+            public:
+              std::atomic<size_t> seq;
+              P data;
+          };
+
+          const size_t limit, mask;
+          std::unique_ptr<Cell[]> cells;
+          // keep producer and consumer positions on separate cache lines:
+          char pad0[64];
+          std::atomic<size_t> enqueue_pos;
+          char pad1[64];
+          std::atomic<size_t> dequeue_pos;
+          char pad2[64];
+
+          static size_t ceil_pow2 (size_t n) {
+            size_t p = 1;
+            while (p < n) p <<= 1;
+            return p;
+          }
+      };
+
+
+
+
+      template <class T> class __QueueBackend<T,LockFree> { NOMEMALIGN
+        protected:
+          __QueueBackend (const std::string& description, size_t buffer_size) :
+            ring (buffer_size),
+            recycled (2*buffer_size),
+            writer_count (0),
+            reader_count (0),
+            data_waiters (0),
+            space_waiters (0),
+            name (description) {
+            assert (buffer_size > 0);
+          }
+
+          // items are owned by whichever ring or Writer / Reader currently
+          // holds them, so only those left in the rings remain to be freed:
+          ~__QueueBackend () {
+            T* item;
+            while (ring.try_pop (item))
+              delete item;
+            while (recycled.try_pop (item))
+              delete item;
+          }
+
+          void status () {
+            std::cerr << "Thread::Queue \"" + name + "\" (lock-free): "
+                      << writer_count << " writer" << (writer_count > 1 ? "s" : "") << ", "
+                      << reader_count << " reader" << (reader_count > 1 ? "s" : "") << ", items waiting: " << ring.size() << "\n";
+          }
+
+          void register_writer ()   {
+            ++writer_count;
+          }
+          void unregister_writer () {
+            assert (writer_count);
+            if (!--writer_count) {
+              DEBUG ("no writers left on queue \"" + name + "\"");
+              std::lock_guard<std::mutex> lock (mutex);
+              more_data.notify_all();
+            }
+          }
+          void register_reader ()   {
+            ++reader_count;
+          }
+          void unregister_reader () {
+            assert (reader_count);
+            if (!--reader_count) {
+              DEBUG ("no readers left on queue \"" + name + "\"");
+              std::lock_guard<std::mutex> lock (mutex);
+              more_space.notify_all();
+            }
+          }
+
+          size_t occupancy () {
+            return ring.size();
+          }
+
+          FORCE_INLINE T* get_item () {
+            T* item;
+            if (recycled.try_pop (item))
+              return item;
+            return new T;
+          }
+
+          FORCE_INLINE void release_item (T* item) {
+            if (item && !recycled.try_push (item))
+              delete item;
+          }
+
+          FORCE_INLINE bool push (T*& item) {
+            bool pushed = false;
+            wait (more_space, space_waiters, [&] {
+                if (!reader_count) return true;
+                return (pushed = ring.try_push (item));
+                });
+            if (!pushed)
+              return false;
+            notify (more_data, data_waiters);
+            item = get_item();
+            return true;
+          }
+
+          FORCE_INLINE bool pop (T*& item) {
+            release_item (item);
+            item = nullptr;
+            wait (more_data, data_waiters, [&] {
+                if (ring.try_pop (item)) return true;
+                if (writer_count) return false;
+                // no writers left: any item pushed before the last writer
+                // unregistered is now visible, so check once more
+                ring.try_pop (item);
+                return true;
+                });
+            if (!item)
+              return false;
+            notify (more_space, space_waiters);
+            return true;
+          }
+
+        private:
+          __LockFreeRing<T*> ring, recycled;
+          std::atomic<size_t> writer_count, reader_count;
+          std::atomic<size_t> data_waiters, space_waiters;
+          std::mutex mutex;
+          std::condition_variable more_data, more_space;
+          std::string name;
+
+          // spin for a while, then park on the condition variable until
+          // ready() returns true:
+          template <class Predicate>
+            FORCE_INLINE void wait (std::condition_variable& cond, std::atomic<size_t>& waiters, Predicate&& ready) {
+              for (size_t n = 0; n < MRTRIX_QUEUE_SPIN_COUNT; ++n) {
+                if (ready())
+                  return;
+                if (n >= MRTRIX_QUEUE_SPIN_COUNT/4)
+                  std::this_thread::yield();
+              }
+              // the waiter count is raised before ready() is re-checked, and the
+              // lock is held until the thread is parked, such that a notify()
+              // following any change of state cannot be missed:
+              std::unique_lock<std::mutex> lock (mutex);
+              ++waiters;
+              std::atomic_thread_fence (std::memory_order_seq_cst);
+              while (!ready())
+                cond.wait (lock);
+              --waiters;
+            }
+
+          FORCE_INLINE void notify (std::condition_variable& cond, std::atomic<size_t>& waiters) {
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            if (waiters.load (std::memory_order_relaxed)) {
+              std::lock_guard<std::mutex> lock (mutex);
+              cond.notify_one();
+            }
+          }
+      };
+
+
+    }
+
+    //! \endcond 
+
+
+
 
     /** \addtogroup thread_classes
      * @{ */
@@ -344,7 +867,10 @@ namespace MR
      *
      * \sa Thread::run_queue()
      */
-    template <class T> class Queue { NOMEMALIGN
+    template <class T, class Sync = Locking> class Queue : private __QueueBackend<T,Sync> { NOMEMALIGN
+      private:
+        using Backend = __QueueBackend<T,Sync>;
+
       public:
         //! Construct a Queue of items of type \c T
         /*! \param description a string identifying the queue for degugging purposes
@@ -353,35 +879,20 @@ namespace MR
          * queue already contains this number of items, the thread will block until
          * at least one item has been popped.  By default, the buffer size is
          * MRTRIX_QUEUE_DEFAULT_CAPACITY items.
+         *
+         * The synchronisation strategy is selected using the \a Sync template
+         * argument: either Thread::Locking (the default) or Thread::LockFree.
          */
         Queue (const std::string& description = "unnamed", size_t buffer_size = MRTRIX_QUEUE_DEFAULT_CAPACITY) :
-          buffer (new T* [buffer_size]),
-          front (buffer),
-          back (buffer),
-          capacity (buffer_size),
-          writer_count (0),
-          reader_count (0),
-          name (description) {
-          assert (capacity > 0);
-        }
+          Backend (description, buffer_size),
+          occupancy_histogram (nullptr) { }
 
         //! needed for Thread::run_queue()
         Queue (const T& /*item_type*/, const std::string& description = "unnamed", size_t buffer_size = MRTRIX_QUEUE_DEFAULT_CAPACITY) :
-          buffer (new T* [buffer_size]),
-          front (buffer),
-          back (buffer),
-          capacity (buffer_size),
-          writer_count (0),
-          reader_count (0),
-          name (description) {
-          assert (capacity > 0);
-        }
+          Backend (description, buffer_size),
+          occupancy_histogram (nullptr) { }
 
 
-        ~Queue () {
-          delete [] buffer;
-        }
-
         //! This class is used to register a writer with the queue
         /*! Items cannot be written directly onto a Thread::Queue queue. An
          * object of this class must first be instanciated to notify the queue
@@ -397,7 +908,7 @@ namespace MR
             //! Register a Writer object with the queue
             /*! The Writer object will register itself with the queue as a
              * writer. */
-            Writer (Queue<T>& queue) : Q (queue) {
+            Writer (Queue<T,Sync>& queue) : Q (queue) {
               Q.register_writer();
             }
             Writer (const Writer& W) : Q (W.Q) {
@@ -425,10 +936,13 @@ namespace MR
                 Item (const Writer& writer) : Q (writer.Q), p (Q.get_item()) { }
                 //! Unregister the parent Writer from the queue
                 ~Item () {
+                  Q.release_item (p);
                   Q.unregister_writer();
                 }
                 //! Push the item onto the queue
                 FORCE_INLINE bool write () {
+                  if (Q.occupancy_histogram)
+                    Q.occupancy_histogram->add (Q.occupancy());
                   return Q.push (p);
                 }
                 FORCE_INLINE T& operator*() const throw ()   {
@@ -438,12 +952,12 @@ namespace MR
                   return p;
                 }
               private:
-                Queue<T>& Q;
+                Queue<T,Sync>& Q;
                 T* p;
             };
 
           private:
-            Queue<T>& Q;
+            Queue<T,Sync>& Q;
         };
 
 
@@ -462,7 +976,7 @@ namespace MR
             //! Register a Reader object with the queue.
             /*! The Reader object will register itself with the queue as a
              * reader. */
-            Reader (Queue<T>& queue) : Q (queue) {
+            Reader (Queue<T,Sync>& queue) : Q (queue) {
               Q.register_reader();
             }
             Reader (const Reader& reader) : Q (reader.Q) {
@@ -490,6 +1004,7 @@ namespace MR
                 Item (const Reader& reader) : Q (reader.Q), p (nullptr) { }
                 //! Unregister the parent Reader from the queue
                 ~Item () {
+                  Q.release_item (p);
                   Q.unregister_reader();
                 }
                 //! Get next item from the queue
@@ -506,118 +1021,31 @@ namespace MR
                   return !p;
                 }
               private:
-                Queue<T>& Q;
+                Queue<T,Sync>& Q;
                 T* p;
             };
           private:
-            Queue<T>& Q;
+            Queue<T,Sync>& Q;
         };
 
         //! Print out a status report for debugging purposes
         void status () {
-          std::lock_guard<std::mutex> lock (mutex);
-          std::cerr << "Thread::Queue \"" + name + "\": "
-                    << writer_count << " writer" << (writer_count > 1 ? "s" : "") << ", "
-                    << reader_count << " reader" << (reader_count > 1 ? "s" : "") << ", items waiting: " << size() << "\n";
+          Backend::status();
+        }
+
+        //! sample the number of items waiting in the queue on every push
+        /*! This is used by Thread::run_queue() to collect pipeline
+         * statistics; \a histogram may be \c nullptr to disable sampling. */
+        void record_occupancy (__QueueOccupancy* histogram) {
+          occupancy_histogram = histogram;
         }
 
 
       private:
-        std::mutex mutex;
-        std::condition_variable more_data, more_space;
-        T** buffer;
-        T** front;
-        T** back;
-        size_t capacity;
-        size_t writer_count, reader_count;
-        std::stack<T*,vector<T*> > item_stack;
-        vector<std::unique_ptr<T>> items;
-        std::string name;
+        __QueueOccupancy* occupancy_histogram;
 
         Queue (const Queue&) = delete;
         Queue& operator= (const Queue&) = delete;
-
-        void register_writer ()   {
-          std::lock_guard<std::mutex> lock (mutex);
-          ++writer_count;
-        }
-        void unregister_writer () {
-          std::lock_guard<std::mutex> lock (mutex);
-          assert (writer_count);
-          --writer_count;
-          if (!writer_count) {
-            DEBUG ("no writers left on queue \"" + name + "\"");
-            more_data.notify_all();
-          }
-        }
-        void register_reader ()   {
-          std::lock_guard<std::mutex> lock (mutex);
-          ++reader_count;
-        }
-        void unregister_reader () {
-          std::lock_guard<std::mutex> lock (mutex);
-          assert (reader_count);
-          --reader_count;
-          if (!reader_count) {
-            DEBUG ("no readers left on queue \"" + name + "\"");
-            more_space.notify_all();
-          }
-        }
-
-        FORCE_INLINE bool empty () const {
-          return (front == back);
-        }
-        FORCE_INLINE bool full () const {
-          return (inc (back) == front);
-        }
-        FORCE_INLINE size_t size () const {
-          return ( (back < front ? back+capacity : back) - front);
-        }
-
-        FORCE_INLINE T* get_item () {
-          std::lock_guard<std::mutex> lock (mutex);
-          T* item (new T);
-          items.push_back (std::unique_ptr<T> (item));
-          return item;
-        }
-
-        FORCE_INLINE bool push (T*& item) {
-          std::unique_lock<std::mutex> lock (mutex);
-          more_space.wait (lock, [this]{ return !(full() && reader_count); });
-          if (!reader_count) return false;
-          *back = item;
-          back = inc (back);
-          if (item_stack.empty()) {
-            item = new T;
-            items.push_back (std::unique_ptr<T> (item));
-          }
-          else {
-            item = item_stack.top();
-            item_stack.pop();
-          }
-          more_data.notify_one();
-          return true;
-        }
-
-        FORCE_INLINE bool pop (T*& item) {
-          std::unique_lock<std::mutex> lock (mutex);
-          if (item)
-            item_stack.push (item);
-          item = nullptr;
-          more_data.wait (lock, [this]{ return !(empty() && writer_count); });
-          if (empty() && !writer_count)
-            return false;
-          item = *front;
-          front = inc (front);
-          more_space.notify_one();
-          return true;
-        }
-
-        FORCE_INLINE T** inc (T** p) const {
-          ++p;
-          if (p >= buffer + capacity) p = buffer;
-          return p;
-        }
     };
 
 
@@ -627,10 +1055,10 @@ namespace MR
 
      //* \cond skip
 
-    template <class T> class Queue<__Batch<T>> { NOMEMALIGN
+    template <class T, class Sync> class Queue<__Batch<T>,Sync> { NOMEMALIGN
       private:
         using BatchType = vector<T>;
-        using BatchQueue = Queue<BatchType>;
+        using BatchQueue = Queue<BatchType,Sync>;
 
       public:
         Queue (const __Batch<T>& item_type, const std::string& description = "unnamed", size_t buffer_size = MRTRIX_QUEUE_DEFAULT_CAPACITY) :
@@ -640,7 +1068,7 @@ namespace MR
 
         class Writer { NOMEMALIGN
           public:
-            Writer (Queue<__Batch<T>>& queue) : 
+            Writer (Queue<__Batch<T>,Sync>& queue) : 
               batch_writer (queue.batch_queue), batch_size (queue.batch_size) { }
 
             class Item { NOMEMALIGN
@@ -684,7 +1112,7 @@ namespace MR
 
         class Reader { NOMEMALIGN
           public:
-            Reader (Queue<__Batch<T>>& queue) : 
+            Reader (Queue<__Batch<T>,Sync>& queue) : 
               batch_reader (queue.batch_queue), batch_size (queue.batch_size) { }
 
             class Item { NOMEMALIGN
@@ -718,6 +1146,7 @@ namespace MR
         };
 
         FORCE_INLINE void status () { batch_queue.status(); }
+        FORCE_INLINE void record_occupancy (__QueueOccupancy* histogram) { batch_queue.record_occupancy (histogram); }
 
 
       private:
@@ -736,66 +1165,72 @@ namespace MR
     namespace {
 
 
-       template <class Type, class Functor>
-         class __Source { MEMALIGN(__Source<Type,Functor>)
+       template <class Type, class Functor, class Sync = LockFree>
+         class __Source { MEMALIGN(__Source<Type,Functor,Sync>)
            public:
-             __Source (Queue<Type>& queue, Functor& functor) :
-               writer (queue), func (__job<Functor>::functor (functor)) { }
+             __Source (Queue<Type,Sync>& queue, Functor& functor, __StageStats* stats = nullptr) :
+               writer (queue), func (__job<Functor>::functor (functor)), stats (stats) { }
 
              void execute () {
-               typename Queue<Type>::Writer::Item out (writer);
+               typename Queue<Type,Sync>::Writer::Item out (writer);
+               __StageTimer timer (stats);
                do {
-                 if (!func (*out)) 
+                 if (!timer.process ([&] { return func (*out); }))
                    return;
-               } while (out.write());
+               } while (timer.output ([&] { return out.write(); }));
              }
 
            private:
-             typename Queue<Type>::Writer writer;
+             typename Queue<Type,Sync>::Writer writer;
              typename __job<Functor>::member_type func;
+             __StageStats* stats;
          };
 
 
-       template <class Type1, class Functor, class Type2>
-         class __Pipe { MEMALIGN(__Pipe<Type1,Functor,Type2>)
+       template <class Type1, class Functor, class Type2, class Sync = LockFree>
+         class __Pipe { MEMALIGN(__Pipe<Type1,Functor,Type2,Sync>)
            public:
-             __Pipe (Queue<Type1>& queue_in, Functor& functor, Queue<Type2>& queue_out) :
-               reader (queue_in), writer (queue_out), func (__job<Functor>::functor (functor)) { }
+             __Pipe (Queue<Type1,Sync>& queue_in, Functor& functor, Queue<Type2,Sync>& queue_out, __StageStats* stats = nullptr) :
+               reader (queue_in), writer (queue_out), func (__job<Functor>::functor (functor)), stats (stats) { }
 
              void execute () {
-               typename Queue<Type1>::Reader::Item in (reader);
-               typename Queue<Type2>::Writer::Item out (writer);
+               typename Queue<Type1,Sync>::Reader::Item in (reader);
+               typename Queue<Type2,Sync>::Writer::Item out (writer);
+               __StageTimer timer (stats);
                do {
-                 do { if (!in.read()) return; } 
-                 while (!func (*in, *out));
-               } while (out.write());
+                 do { if (!timer.input ([&] { return in.read(); })) return; } 
+                 while (!timer.process ([&] { return func (*in, *out); }));
+               } while (timer.output ([&] { return out.write(); }));
              }
 
            private:
-             typename Queue<Type1>::Reader reader;
-             typename Queue<Type2>::Writer writer;
+             typename Queue<Type1,Sync>::Reader reader;
+             typename Queue<Type2,Sync>::Writer writer;
              typename __job<Functor>::member_type func;
+             __StageStats* stats;
          };
 
 
 
-       template <class Type, class Functor>
-         class __Sink { MEMALIGN(__Sink<Type,Functor>)
+       template <class Type, class Functor, class Sync = LockFree>
+         class __Sink { MEMALIGN(__Sink<Type,Functor,Sync>)
            public:
-             __Sink (Queue<Type>& queue, Functor& functor) :
-               reader (queue), func (__job<Functor>::functor (functor)) { }
+             __Sink (Queue<Type,Sync>& queue, Functor& functor, __StageStats* stats = nullptr) :
+               reader (queue), func (__job<Functor>::functor (functor)), stats (stats) { }
 
              void execute () {
-               typename Queue<Type>::Reader::Item in (reader);
-               while (in.read()) {
-                 if (!func (*in))
+               typename Queue<Type,Sync>::Reader::Item in (reader);
+               __StageTimer timer (stats);
+               while (timer.input ([&] { return in.read(); })) {
+                 if (!timer.process ([&] { return func (*in); }))
                    return;
                }
              }
 
            private:
-             typename Queue<Type>::Reader reader;
+             typename Queue<Type,Sync>::Reader reader;
              typename __job<Functor>::member_type func;
+             __StageStats* stats;
          };
 
 
@@ -1004,6 +1439,19 @@ namespace MR
      *
      * Obviously, Thread::multi() and Thread::batch() can be used in any
      * combination to perform the operations required. 
+     *
+     * The queues set up by Thread::run_queue() use the Thread::LockFree
+     * synchronisation strategy.
+     *
+     * \section thread_run_queue_statistics Pipeline statistics
+     *
+     * If Thread::pipeline_statistics_enabled() returns true (i.e. the
+     * PipelineStatistics configuration entry is set, or when running with
+     * -debug), the number of items processed, the time spent processing,
+     * and the time spent waiting on the input and output queues are
+     * recorded for each stage, along with a histogram of the occupancy of
+     * each queue. These are reported as a JSON object once the pipeline has
+     * completed, making it possible to identify the bottleneck stage.
      */
 
     template <class Source, class Type, class Sink>
@@ -1021,15 +1469,22 @@ namespace MR
           return;
         }
 
-         Queue<Type> queue (item_type, "source->sink", capacity);
-         __Source<Type,Source> source_functor (queue, source);
-         __Sink<Type,Sink>     sink_functor   (queue, sink);
+        std::unique_ptr<__PipelineStats> stats (pipeline_statistics_enabled() ? new __PipelineStats : nullptr);
+
+        Queue<Type,LockFree> queue (item_type, "source->sink", capacity);
+        __Source<Type,Source> source_functor (queue, source, stats ? stats->stage ("source") : nullptr);
+        __Sink<Type,Sink>     sink_functor   (queue, sink, stats ? stats->stage ("sink") : nullptr);
+        if (stats)
+          queue.record_occupancy (stats->queue ("source->sink", capacity));
 
         auto t1 = run (__job<Source>::get (source, source_functor), "source");
         auto t2 = run (__job<Sink>::get (sink, sink_functor), "sink");
 
         t1.wait();
         t2.wait();
+
+        if (stats)
+          stats->report();
       }
 
 
@@ -1099,12 +1554,18 @@ namespace MR
         }
 
 
-        Queue<Type1> queue1 (item_type1, "source->pipe", capacity);
-        Queue<Type2> queue2 (item_type2, "pipe->sink", capacity);
+        std::unique_ptr<__PipelineStats> stats (pipeline_statistics_enabled() ? new __PipelineStats : nullptr);
 
-        __Source<Type1,Source>   source_functor (queue1, source);
-        __Pipe<Type1,Pipe,Type2> pipe_functor   (queue1, pipe, queue2);
-        __Sink<Type2,Sink>       sink_functor   (queue2, sink);
+        Queue<Type1,LockFree> queue1 (item_type1, "source->pipe", capacity);
+        Queue<Type2,LockFree> queue2 (item_type2, "pipe->sink", capacity);
+
+        __Source<Type1,Source>   source_functor (queue1, source, stats ? stats->stage ("source") : nullptr);
+        __Pipe<Type1,Pipe,Type2> pipe_functor   (queue1, pipe, queue2, stats ? stats->stage ("pipe") : nullptr);
+        __Sink<Type2,Sink>       sink_functor   (queue2, sink, stats ? stats->stage ("sink") : nullptr);
+        if (stats) {
+          queue1.record_occupancy (stats->queue ("source->pipe", capacity));
+          queue2.record_occupancy (stats->queue ("pipe->sink", capacity));
+        }
 
         auto t1 = run (__job<Source>::get (source, source_functor), "source");
         auto t2 = run (__job<Pipe>::get (pipe, pipe_functor), "pipe");
@@ -1113,6 +1574,9 @@ namespace MR
         t1.wait();
         t2.wait();
         t3.wait();
+
+        if (stats)
+          stats->report();
       }
 
 
@@ -1145,14 +1609,21 @@ namespace MR
         }
 
 
-        Queue<Type1> queue1 (item_type1, "source->pipe", capacity);
-        Queue<Type2> queue2 (item_type2, "pipe->pipe", capacity);
-        Queue<Type3> queue3 (item_type3, "pipe->sink", capacity);
+        std::unique_ptr<__PipelineStats> stats (pipeline_statistics_enabled() ? new __PipelineStats : nullptr);
 
-        __Source<Type1,Source>    source_functor (queue1, source);
-        __Pipe<Type1,Pipe1,Type2> pipe1_functor   (queue1, pipe1, queue2);
-        __Pipe<Type2,Pipe2,Type3> pipe2_functor   (queue2, pipe2, queue3);
-        __Sink<Type3,Sink>        sink_functor   (queue3, sink);
+        Queue<Type1,LockFree> queue1 (item_type1, "source->pipe", capacity);
+        Queue<Type2,LockFree> queue2 (item_type2, "pipe->pipe", capacity);
+        Queue<Type3,LockFree> queue3 (item_type3, "pipe->sink", capacity);
+
+        __Source<Type1,Source>    source_functor (queue1, source, stats ? stats->stage ("source") : nullptr);
+        __Pipe<Type1,Pipe1,Type2> pipe1_functor   (queue1, pipe1, queue2, stats ? stats->stage ("pipe1") : nullptr);
+        __Pipe<Type2,Pipe2,Type3> pipe2_functor   (queue2, pipe2, queue3, stats ? stats->stage ("pipe2") : nullptr);
+        __Sink<Type3,Sink>        sink_functor   (queue3, sink, stats ? stats->stage ("sink") : nullptr);
+        if (stats) {
+          queue1.record_occupancy (stats->queue ("source->pipe", capacity));
+          queue2.record_occupancy (stats->queue ("pipe->pipe", capacity));
+          queue3.record_occupancy (stats->queue ("pipe->sink", capacity));
+        }
 
         auto t1 = run (__job<Source>::get (source, source_functor), "source");
         auto t2 = run (__job<Pipe1>::get (pipe1, pipe1_functor), "pipe1");
@@ -1163,6 +1634,9 @@ namespace MR
         t2.wait();
         t3.wait();
         t4.wait();
+
+        if (stats)
+          stats->report();
       }
 
 
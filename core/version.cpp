@@ -0,0 +1,6 @@
+
+namespace MR { 
+  namespace App { 
+    const char* mrtrix_version = "6839e3e8-dirty";
+  } 
+}
@@ -0,0 +1 @@
+__version__ = "6839e3e8-dirty"
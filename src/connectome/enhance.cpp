@@ -26,7 +26,8 @@ namespace MR {
 
 
 
-      value_type PassThrough::operator() (const vector_type& in, vector_type& out) const
+      template <typename ValueType>
+      ValueType PassThrough<ValueType>::operator() (const vector_type& in, vector_type& out) const
       {
         out = in;
         return out.maxCoeff();
@@ -34,7 +35,8 @@ namespace MR {
 
 
 
-      value_type NBS::operator() (const vector_type& in, const value_type T, vector_type& out) const
+      template <typename ValueType>
+      ValueType NBS<ValueType>::operator() (const vector_type& in, const value_type T, vector_type& out) const
       {
         out = vector_type::Zero (in.size());
         value_type max_value = value_type(0);
@@ -74,7 +76,8 @@ namespace MR {
 
 
 
-      void NBS::initialise (const node_t num_nodes)
+      template <typename ValueType>
+      void NBS<ValueType>::initialise (const node_t num_nodes)
       {
         const Mat2Vec mat2vec (num_nodes);
         const size_t num_edges = mat2vec.vec_size();
@@ -102,6 +105,13 @@ namespace MR {
 
 
 
+      template class PassThrough<float>;
+      template class PassThrough<double>;
+      template class NBS<float>;
+      template class NBS<double>;
+
+
+
     }
   }
 }
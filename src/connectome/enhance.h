@@ -33,18 +33,19 @@ namespace MR {
 
 
 
-      using value_type = Math::Stats::value_type;
-      using vector_type = Math::Stats::vector_type;
-
-
-
       // This should be possible to use for any domain of inference
-      class PassThrough : public Stats::EnhancerBase
-      { MEMALIGN (PassThrough)
+      template <typename ValueType>
+      class PassThrough : public Stats::EnhancerBase<ValueType>
+      { MEMALIGN (PassThrough<ValueType>)
         public:
+          using value_type = ValueType;
+          using vector_type = typename Stats::EnhancerBase<ValueType>::vector_type;
+
           PassThrough() { }
           ~PassThrough() { }
 
+          std::string parameters () const override { return "none"; }
+
         private:
           value_type operator() (const vector_type&, vector_type&) const override;
 
@@ -52,9 +53,12 @@ namespace MR {
 
 
 
-      class NBS : public Stats::TFCE::EnhancerBase
-      { MEMALIGN (NBS)
+      template <typename ValueType>
+      class NBS : public Stats::TFCE::EnhancerBase<ValueType>
+      { MEMALIGN (NBS<ValueType>)
         public:
+          using value_type = ValueType;
+          using vector_type = typename Stats::TFCE::EnhancerBase<ValueType>::vector_type;
 
           NBS () = delete;
           NBS (const node_t i) : threshold (0.0) { initialise (i); }
@@ -70,6 +74,8 @@ namespace MR {
 
           value_type operator() (const vector_type&, const value_type, vector_type&) const override;
 
+          std::string parameters () const override { return "NBS threshold=" + str(threshold); }
+
         protected:
           std::shared_ptr< vector< vector<size_t> > > adjacency;
           value_type threshold;
@@ -81,6 +87,13 @@ namespace MR {
 
 
 
+      extern template class PassThrough<float>;
+      extern template class PassThrough<double>;
+      extern template class NBS<float>;
+      extern template class NBS<double>;
+
+
+
     }
   }
 }
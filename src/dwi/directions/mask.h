@@ -40,6 +40,13 @@ namespace MR {
               BitSet (that),
               dirs (that.dirs) { }
 
+          Mask (Mask&& that) noexcept :
+              BitSet (std::move (that)),
+              dirs (that.dirs) { }
+
+          Mask& operator= (const Mask& that) { BitSet::operator= (that); dirs = that.dirs; return *this; }
+          Mask& operator= (Mask&& that) noexcept { BitSet::operator= (std::move (that)); dirs = that.dirs; return *this; }
+
           const Set& get_dirs() const { return *dirs; }
 
           void erode  (const size_t iterations = 1);
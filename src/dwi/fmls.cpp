@@ -156,42 +156,93 @@ namespace MR {
 
 
 
-      class Max_abs { NOMEMALIGN
-        public:
-          bool operator() (const default_type& a, const default_type& b) const { return (std::abs (a) > std::abs (b)); }
-      };
-
       bool Segmenter::operator() (const SH_coefs& in, FOD_lobes& out) const {
 
         assert (in.size() == ssize_t (Math::SH::NforL (lmax)));
 
-        out.clear();
         out.vox = in.vox;
 
-        if (in[0] <= 0.0 || !std::isfinite (in[0]))
-          return true;
+        amplitudes.resize (dirs.size(), 1);
+        if (in[0] > 0.0 && std::isfinite (in[0]))
+          amplitudes.col (0).noalias() = transform->mat_SH2A() * in;
+
+        return segment (in, amplitudes.col (0), out);
+      }
+
+
 
-        Eigen::Matrix<default_type, Eigen::Dynamic, 1> values (dirs.size());
-        transform->SH2A (values, in);
+      bool Segmenter::operator() (const SH_coefs_batch& in, FOD_lobes_batch& out) const {
 
-        using map_type = std::multimap<default_type, index_type, Max_abs>;
+        assert (in.coefs.rows() == ssize_t (Math::SH::NforL (lmax)));
 
-        map_type data_in_order;
-        for (size_t i = 0; i != size_t(values.size()); ++i)
-          data_in_order.insert (std::make_pair (values[i], i));
+        out.resize (in.size());
+        amplitudes.noalias() = transform->mat_SH2A() * in.coefs.leftCols (in.size());
+
+        for (size_t i = 0; i != in.size(); ++i) {
+          out[i].vox = in.vox[i];
+          segment (in.coefs.col (i), amplitudes.col (i), out[i]);
+        }
+        return true;
+      }
+
+
+
+      void Segmenter::new_lobe (FOD_lobes& out, const index_type seed, const default_type value) const
+      {
+        if (spare_lobes.empty()) {
+          out.push_back (FOD_lobe (dirs, seed, value, (*weights)[seed]));
+        } else {
+          out.push_back (std::move (spare_lobes.back()));
+          spare_lobes.pop_back();
+          out.back().reset (seed, value, (*weights)[seed]);
+        }
+      }
+
+
+
+      void Segmenter::erase_lobe (FOD_lobes& out, const vector<FOD_lobe>::iterator lobe) const
+      {
+        spare_lobes.push_back (std::move (*lobe));
+        out.erase (lobe);
+      }
+
+
+
+      bool Segmenter::segment (const Eigen::Ref<const Eigen::Matrix<default_type, Eigen::Dynamic, 1>>& in,
+                               const Eigen::Ref<const Eigen::Matrix<default_type, Eigen::Dynamic, 1>>& values,
+                               FOD_lobes& out) const {
+
+        // Recycle the lobes of whichever voxel this output was last used for
+        for (auto& lobe : out)
+          spare_lobes.push_back (std::move (lobe));
+        out.clear();
+
+        if (in[0] <= 0.0 || !std::isfinite (in[0]))
+          return true;
 
-        if (data_in_order.begin()->first <= 0.0)
+        // Process directions in order of decreasing absolute amplitude; ties
+        //   are processed in order of direction index
+        order.resize (dirs.size());
+        for (index_type i = 0; i != dirs.size(); ++i)
+          order[i] = i;
+        std::sort (order.begin(), order.end(), [&] (const index_type a, const index_type b) {
+          const default_type abs_a = std::abs (values[a]), abs_b = std::abs (values[b]);
+          return abs_a > abs_b || (abs_a == abs_b && a < b);
+        });
+
+        if (values[order.front()] <= 0.0)
           return true;
 
-        vector< std::pair<index_type, uint32_t> > retrospective_assignments;
+        retrospective_assignments.clear();
 
-        for (const auto& i : data_in_order) {
+        for (const auto index : order) {
+          const default_type value = values[index];
 
-          vector<uint32_t> adj_lobes;
+          adj_lobes.clear();
           for (uint32_t l = 0; l != out.size(); ++l) {
-            if ((((i.first <= 0.0) &&  out[l].is_negative())
-                  || ((i.first >  0.0) && !out[l].is_negative()))
-                && (out[l].get_mask().is_adjacent (i.second))) {
+            if ((((value <= 0.0) &&  out[l].is_negative())
+                  || ((value >  0.0) && !out[l].is_negative()))
+                && (out[l].get_mask().is_adjacent (index))) {
 
               adj_lobes.push_back (l);
 
@@ -200,23 +251,23 @@ namespace MR {
 
           if (adj_lobes.empty()) {
 
-            out.push_back (FOD_lobe (dirs, i.second, i.first, (*weights)[i.second]));
+            new_lobe (out, index, value);
 
           } else if (adj_lobes.size() == 1) {
 
-            out[adj_lobes.front()].add (i.second, i.first, (*weights)[i.second]);
+            out[adj_lobes.front()].add (index, value, (*weights)[index]);
 
           } else {
 
             // Changed handling of lobe merges
             // Merge lobes as they appear to be merged, but update the
             //   contents of retrospective_assignments accordingly
-            if (std::abs (i.first) / out[adj_lobes.back()].get_max_peak_value() > ratio_of_peak_value_to_merge) {
+            if (std::abs (value) / out[adj_lobes.back()].get_max_peak_value() > ratio_of_peak_value_to_merge) {
 
               std::sort (adj_lobes.begin(), adj_lobes.end());
               for (size_t j = 1; j != adj_lobes.size(); ++j)
                 out[adj_lobes[0]].merge (out[adj_lobes[j]]);
-              out[adj_lobes[0]].add (i.second, i.first, (*weights)[i.second]);
+              out[adj_lobes[0]].add (index, value, (*weights)[index]);
               for (auto j = retrospective_assignments.begin(); j != retrospective_assignments.end(); ++j) {
                 bool modified = false;
                 for (size_t k = 1; k != adj_lobes.size(); ++k) {
@@ -238,12 +289,12 @@ namespace MR {
               for (size_t j = adj_lobes.size() - 1; j; --j) {
                 vector<FOD_lobe>::iterator ptr = out.begin();
                 advance (ptr, adj_lobes[j]);
-                out.erase (ptr);
+                erase_lobe (out, ptr);
               }
 
             } else {
 
-              retrospective_assignments.push_back (std::make_pair (i.second, adj_lobes.front()));
+              retrospective_assignments.push_back (std::make_pair (index, adj_lobes.front()));
 
             }
 
@@ -257,6 +308,7 @@ namespace MR {
         for (auto i = out.begin(); i != out.end();) { // Empty increment
 
           if (i->is_negative() || i->get_max_peak_value() < peak_value_threshold || i->get_integral() < integral_threshold) {
+            spare_lobes.push_back (std::move (*i));
             i = out.erase (i);
           } else {
 
@@ -15,8 +15,6 @@
 #ifndef __dwi_fmls_h__
 #define __dwi_fmls_h__
 
-#include <map> // Used for sorting FOD samples
-
 #include "memory.h"
 #include "math/SH.h"
 #include "dwi/directions/set.h"
@@ -29,6 +27,7 @@
 #define FMLS_INTEGRAL_THRESHOLD_DEFAULT 0.0 // By default, don't threshold by integral (tough to get a good number)
 #define FMLS_PEAK_VALUE_THRESHOLD_DEFAULT 0.1
 #define FMLS_RATIO_TO_PEAK_VALUE_TO_MERGE_DEFAULT 1.0 // By default, turn all peaks into lobes (discrete peaks are never merged)
+#define FMLS_BATCH_SIZE 64 // Number of voxels transformed from SH to amplitudes in a single matrix multiplication
 
 
 // By default, the mean direction of each FOD lobe is calculated by taking a weighted average of the
@@ -75,6 +74,21 @@ namespace MR
             values[seed] = value;
           }
 
+          // Re-initialise an existing lobe as though it were newly constructed, re-using its memory
+          void reset (const index_type seed, const default_type value, const default_type weight)
+          {
+            assert (size_t(values.size()) == mask.size());
+            mask.clear();
+            values.setZero();
+            max_peak_value = std::abs (value);
+            peak_dirs.assign (1, mask.get_dirs().get_dir (seed));
+            mean_dir = peak_dirs.front() * std::abs(value) * weight;
+            integral = std::abs (value * weight);
+            neg = (value <= 0.0);
+            mask[seed] = true;
+            values[seed] = value;
+          }
+
           // This is used for creating a `null lobe' i.e. an FOD lobe with zero size, containing all directions not
           //   assigned to any other lobe in the voxel
           FOD_lobe (const DWI::Directions::Mask& i) :
@@ -176,6 +190,19 @@ namespace MR
           Eigen::Array3i vox;
       };
 
+
+      // Batches of voxels, so that the SH coefficients of many voxels can be
+      //   transformed to amplitudes using a single matrix multiplication
+      class SH_coefs_batch { MEMALIGN(SH_coefs_batch)
+        public:
+          Eigen::Matrix<default_type, Eigen::Dynamic, Eigen::Dynamic> coefs; // One column per voxel
+          vector<Eigen::Array3i> vox;
+          size_t size() const { return vox.size(); }
+      };
+
+      class FOD_lobes_batch : public vector<FOD_lobes> { MEMALIGN(FOD_lobes_batch)
+      };
+
       class FODQueueWriter 
       { MEMALIGN (FODQueueWriter)
 
@@ -207,6 +234,23 @@ namespace MR
             return true;
           }
 
+          bool operator() (SH_coefs_batch& out)
+          {
+            out.coefs.resize (fod.size (3), FMLS_BATCH_SIZE);
+            out.vox.clear();
+            for (; loop && out.size() != FMLS_BATCH_SIZE; ++loop) {
+              if (mask.valid()) {
+                assign_pos_of (fod, 0, 3).to (mask);
+                if (!mask.value())
+                  continue;
+              }
+              for (auto l = Loop (3) (fod); l; ++l)
+                out.coefs (fod.index(3), out.size()) = fod.value();
+              out.vox.push_back (Eigen::Array3i (fod.index(0), fod.index(1), fod.index(2)));
+            }
+            return out.size();
+          }
+
         private:
           FODImageType fod;
           MaskImageType mask;
@@ -236,6 +280,7 @@ namespace MR
           Segmenter (const DWI::Directions::Set&, const size_t);
 
           bool operator() (const SH_coefs&, FOD_lobes&) const;
+          bool operator() (const SH_coefs_batch&, FOD_lobes_batch&) const;
 
 
           default_type get_integral_threshold           ()               const { return integral_threshold; }
@@ -278,6 +323,21 @@ namespace MR
               throw Exception ("For FOD segmentation, 'create_lookup_table' must be set in order for lookup tables to be dilated ('dilate_lookup_table')");
           }
 
+          // Per-thread scratch space, re-used between voxels to avoid memory allocation;
+          //   each thread invokes its own copy of the segmenter
+          mutable Eigen::Matrix<default_type, Eigen::Dynamic, Eigen::Dynamic> amplitudes;
+          mutable vector<index_type> order;
+          mutable vector<uint32_t> adj_lobes;
+          mutable vector< std::pair<index_type, uint32_t> > retrospective_assignments;
+          mutable vector<FOD_lobe> spare_lobes;
+
+          bool segment (const Eigen::Ref<const Eigen::Matrix<default_type, Eigen::Dynamic, 1>>& sh,
+                        const Eigen::Ref<const Eigen::Matrix<default_type, Eigen::Dynamic, 1>>& values,
+                        FOD_lobes& out) const;
+
+          void new_lobe (FOD_lobes&, const index_type, const default_type) const;
+          void erase_lobe (FOD_lobes&, const vector<FOD_lobe>::iterator) const;
+
 #ifdef FMLS_OPTIMISE_MEAN_DIR
           void optimise_mean_dir (FOD_lobe&) const;
 #endif
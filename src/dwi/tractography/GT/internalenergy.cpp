@@ -47,43 +47,68 @@ namespace MR {
           size_t x, y, z;
           pGrid.pos2xyz(ep, x, y, z);
           
-          float tolerance2 = Particle::L * Particle::L;   // distance threshold (particle length), hard coded
-          float costheta = Math::sqrt1_2;                 // angular threshold (45 degrees), hard coded
-          ParticleEnd pe;
-          float d1, d2, d, ct;
-          
+          // gather the candidate particles in the 27 surrounding grid cells
+          candidates.clear();
           for (int i = -1; i <= 1; i++) {
             for (int j = -1; j <= 1; j++) {
               for (int k = -1; k <= 1; k++) {
                 const ParticleGrid::ParticleVectorType* pvec = pGrid.at(x+i, y+j, z+k);
                 if (pvec == NULL)
                   continue;
-                
-                for (ParticleGrid::ParticleVectorType::const_iterator it = pvec->begin(); it != pvec->end(); ++it) 
-                {
-                  pe.par = *it;
-                  if (pe.par == p)
-                    continue;
-                  d1 = (ep - pe.par->getEndPoint(-1)).squaredNorm();
-                  d2 = (ep - pe.par->getEndPoint(+1)).squaredNorm();
-                  d = (d1 < d2) ? d1 : d2;
-                  pe.alpha = (d1 < d2) ? -1 : 1;
-                  if ( (pe.alpha == -1) ? (pe.par->hasPredecessor() && pe.par->getPredecessor() != p) : (pe.par->hasSuccessor() && pe.par->getSuccessor() != p) )		// Exclude connected endpoints, unless they are connected to the current particle.
-                    continue;
-                  ct = (-alpha0*pe.alpha) * p->getDirection().dot(pe.par->getDirection());
-                  if (d < tolerance2 && ct > costheta)
-                  {
-                    pe.e_conn = calcEnergy(p, alpha0, pe.par, pe.alpha);
-                    pe.p_suc = exp(-pe.e_conn/currTemp);
-                    normalization += pe.p_suc;
-                    neighbourhood.push_back(pe);
-                  }
+                for (ParticleGrid::IndexType idx : *pvec) {
+                  if (idx != p->getIndex())
+                    candidates.push_back(idx);
                 }
-                
               }
             }
           }
           
+          const ssize_t n = candidates.size();
+          if (n == 0)
+            return;
+          if (cpos.rows() < n) {
+            cpos.resize(2*n, 3);
+            cdir.resize(2*n, 3);
+            cdot.resize(2*n);
+            cdist.resize(2*n);
+            ccos.resize(2*n);
+          }
+          const ParticlePool& pool = pGrid.getPool();
+          for (ssize_t m = 0; m < n; ++m) {
+            for (size_t c = 0; c != 3; ++c) {
+              cpos(m, c) = pool.position(candidates[m], c) - ep[c];
+              cdir(m, c) = pool.direction(candidates[m], c);
+            }
+          }
+          
+          // Distance from ep to the nearest endpoint pos -/+ L*dir of each candidate,
+          // and the (signed) angle between both segments at that endpoint; evaluated
+          // over all candidates at once.
+          const float L = Particle::L;
+          const Point_t dir = p->getDirection();
+          cdot.head(n) = (cpos.topRows(n) * cdir.topRows(n)).rowwise().sum();
+          cdist.head(n) = cpos.topRows(n).square().rowwise().sum() - 2.0f*L*cdot.head(n).abs() + L*L;
+          ccos.head(n) = cdir.col(0).head(n) * dir[0] + cdir.col(1).head(n) * dir[1] + cdir.col(2).head(n) * dir[2];
+          ccos.head(n) = float(alpha0) * (cdot.head(n) > 0.0f).select(ccos.head(n), -ccos.head(n));
+          
+          float tolerance2 = Particle::L * Particle::L;   // distance threshold (particle length), hard coded
+          float costheta = Math::sqrt1_2;                 // angular threshold (45 degrees), hard coded
+          ParticleEnd pe;
+          
+          for (ssize_t m = 0; m < n; ++m)
+          {
+            if (cdist[m] >= tolerance2 || ccos[m] <= costheta)
+              continue;
+            pe.par = pGrid.get(candidates[m]);
+            pe.alpha = (cdot[m] > 0.0f) ? -1 : 1;
+            if ( (pe.alpha == -1) ? (pe.par->hasPredecessor() && pe.par->getPredecessor() != p) : (pe.par->hasSuccessor() && pe.par->getSuccessor() != p) )		// Exclude connected endpoints, unless they are connected to the current particle.
+              continue;
+            pe.e_conn = calcEnergy(p, alpha0, pe.par, pe.alpha);
+            pe.p_suc = exp(-pe.e_conn/currTemp);
+            normalization += pe.p_suc;
+            neighbourhood.push_back(pe);
+          }
+          
         }
         
         
@@ -108,6 +108,10 @@ namespace MR {
           double cpot, dEint;
           vector<ParticleEnd> neighbourhood;
           double normalization;
+          // structure-of-arrays buffers for the neighbourhood scan
+          vector<ParticleGrid::IndexType> candidates;
+          Eigen::Array<float, Eigen::Dynamic, 3> cpos, cdir;
+          Eigen::Array<float, Eigen::Dynamic, 1> cdot, cdist, ccos;
           Math::RNG::Uniform<double> rng_uniform;
           
           
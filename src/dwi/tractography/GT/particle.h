@@ -40,6 +40,7 @@ namespace MR {
           
           Particle()
           {
+            index = 0;
             predecessor = nullptr;
             successor = nullptr;
             visited = false;
@@ -47,6 +48,7 @@ namespace MR {
           }
           
           Particle(const Point_t& p, const Point_t& d)
+            : index(0)
           {
             init(p, d);
           }
@@ -189,12 +191,26 @@ namespace MR {
             return alive;
           }
           
+          /**
+           * @brief Stable index of this particle in the ParticlePool arena.
+           */
+          uint32_t getIndex() const
+          {
+            return index;
+          }
+          
+          void setIndex(const uint32_t idx)
+          {
+            index = idx;
+          }
+          
 
         protected:
           
           Point_t pos, dir;
           Particle* predecessor;
           Particle* successor;
+          uint32_t index;
           bool visited;
           bool alive;
           
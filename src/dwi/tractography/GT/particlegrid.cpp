@@ -24,23 +24,24 @@ namespace MR {
         {
           Particle* p = pool.create(pos, dir);
           size_t gidx = pos2idx(pos);
-          grid[gidx].push_back(p);
+          grid[gidx].push_back(p->getIndex());
         }
         
         void ParticleGrid::shift(Particle *p, const Point_t& pos, const Point_t& dir)
         {
           size_t gidx0 = pos2idx(p->getPosition());
           size_t gidx1 = pos2idx(pos);
-          std::remove (grid[gidx0].begin(), grid[gidx0].end(), p);
-          p->setPosition(pos);
-          p->setDirection(dir);
-          grid[gidx1].push_back(p);
+          pool.update(p, pos, dir);
+          if (gidx0 != gidx1) {
+            erase(grid[gidx0], p->getIndex());
+            grid[gidx1].push_back(p->getIndex());
+          }
         }
         
         void ParticleGrid::remove(Particle* p)
         {
           size_t gidx0 = pos2idx(p->getPosition());
-          std::remove (grid[gidx0].begin(), grid[gidx0].end(), p);
+          erase(grid[gidx0], p->getIndex());
           pool.destroy(p);
         }
         
@@ -68,8 +69,9 @@ namespace MR {
           // Loop through all unvisited particles
           for (ParticleVectorType& gridvox : grid)
           {
-            for (Particle* par0 : gridvox) 
+            for (IndexType idx0 : gridvox) 
             {
+              Particle* par0 = pool.get(idx0);
               par = par0;
               if (!par->isVisited())
               {
@@ -107,8 +109,8 @@ namespace MR {
           }
           // Free all particle locks
           for (ParticleVectorType& gridvox : grid) {
-            for (Particle* par : gridvox) {
-                par->setVisited(false);
+            for (IndexType idx : gridvox) {
+                pool.get(idx)->setVisited(false);
             }
           }
         }
@@ -33,12 +33,17 @@ namespace MR {
         
         /**
          * @brief The ParticleGrid class
+         *
+         * Each grid cell holds the (stable) pool indices of the particles
+         * whose position falls within it; particle data are retrieved from
+         * the ParticlePool arena.
          */
         class ParticleGrid
         { MEMALIGN(ParticleGrid)
         public:
           
-          using ParticleVectorType = vector<Particle*>;
+          using IndexType = ParticlePool::index_type;
+          using ParticleVectorType = vector<IndexType>;
           
           template <class HeaderType>
           ParticleGrid(const HeaderType& image)
@@ -83,6 +88,14 @@ namespace MR {
             return pool.random();
           }
           
+          inline Particle* get(const IndexType idx) {
+            return pool.get(idx);
+          }
+          
+          inline const ParticlePool& getPool() const {
+            return pool;
+          }
+          
           void exportTracks(Tractography::Writer<float>& writer);
           
           
@@ -95,6 +108,15 @@ namespace MR {
           size_t dims[3];
           
           
+          // cell order is irrelevant, so swap with the last entry and pop
+          static inline void erase(ParticleVectorType& cell, const IndexType idx)
+          {
+            auto it = std::find (cell.begin(), cell.end(), idx);
+            assert (it != cell.end());
+            *it = cell.back();
+            cell.pop_back();
+          }
+          
           inline size_t pos2idx(const Point_t& pos) const
           {
             size_t x, y, z;
@@ -15,8 +15,6 @@
 #ifndef __gt_particlepool_h__
 #define __gt_particlepool_h__
 
-#include <deque>
-#include <stack>
 #include <mutex>
 
 #include "math/rng.h"
@@ -31,11 +29,27 @@ namespace MR {
         /**
          * @brief ParticlePool manages creation and deletion of particles,
          *        minimizing the no. calls to new/delete.
+         *
+         * Particles are stored in an arena of fixed-size blocks, such that
+         * each particle has a stable address and a stable integer index.
+         * Alongside the particles, each block holds a copy of the particle
+         * positions and directions in structure-of-arrays form, which is
+         * what the neighbourhood scans in the internal energy operate on.
          */
         class ParticlePool
         { MEMALIGN(ParticlePool)
         public:
-          ParticlePool() { }
+          
+          using index_type = uint32_t;
+          
+          static constexpr size_t block_bits = 12;
+          static constexpr size_t block_size = size_t(1) << block_bits;
+          static constexpr size_t block_mask = block_size - 1;
+          static constexpr size_t max_blocks = (size_t(std::numeric_limits<index_type>::max()) + 1) >> block_bits;
+          
+          // the block table is never reallocated, so that concurrent
+          // lookups remain valid while other threads add particles
+          ParticlePool() : top (0) { blocks.reserve (max_blocks); }
           
           ParticlePool(const ParticlePool&) = delete;
           ParticlePool& operator=(const ParticlePool&) = delete;
@@ -47,15 +61,23 @@ namespace MR {
           Particle* create(const Point_t& pos, const Point_t& dir)
           {
             std::lock_guard<std::mutex> lock (mutex);
+            index_type idx;
             if (avail.empty()) {
-              pool.emplace_back(pos, dir);
-              return &pool.back();
+              if ((top >> block_bits) == blocks.size()) {
+                if (blocks.size() == max_blocks)
+                  throw Exception ("maximum number of particles exceeded");
+                blocks.push_back (std::unique_ptr<Block> (new Block()));
+              }
+              idx = top++;
             } else {
-              Particle* p = avail.top();
-              p->init(pos, dir);
-              avail.pop();
-              return p;
+              idx = avail.back();
+              avail.pop_back();
             }
+            Particle* p = get (idx);
+            p->init (pos, dir);
+            p->setIndex (idx);
+            store (p);
+            return p;
           }
           
           /**
@@ -64,14 +86,46 @@ namespace MR {
           void destroy(Particle* p) {
             std::lock_guard<std::mutex> lock (mutex);
             p->finalize();
-            avail.push(p);
+            avail.push_back (p->getIndex());
+          }
+          
+          /**
+           * @brief Update position and direction of the particle at pointer p.
+           */
+          void update(Particle* p, const Point_t& pos, const Point_t& dir) {
+            p->setPosition (pos);
+            p->setDirection (dir);
+            store (p);
           }
           
           /**
            * @brief Return number of Particles in the pool.
            */
           inline size_t size() const {
-            return pool.size() - avail.size();
+            return top - avail.size();
+          }
+          
+          /**
+           * @brief Return particle with index idx.
+           */
+          inline Particle* get(const index_type idx) {
+            return &blocks[idx >> block_bits]->particles[idx & block_mask];
+          }
+          
+          inline const Particle* get(const index_type idx) const {
+            return &blocks[idx >> block_bits]->particles[idx & block_mask];
+          }
+          
+          /**
+           * @brief Structure-of-arrays access to the position and direction
+           *        of particle idx; component c = 0, 1, 2.
+           */
+          inline float position(const index_type idx, const size_t c) const {
+            return blocks[idx >> block_bits]->pos[c][idx & block_mask];
+          }
+          
+          inline float direction(const index_type idx, const size_t c) const {
+            return blocks[idx >> block_bits]->dir[c][idx & block_mask];
           }
           
           /**
@@ -79,11 +133,11 @@ namespace MR {
            */
           Particle* random() {
             std::lock_guard<std::mutex> lock (mutex);
-            if (pool.size() > avail.size())
+            if (top > avail.size())
             {
-              std::uniform_int_distribution<size_t> dist(0, pool.size()-1);
+              std::uniform_int_distribution<index_type> dist(0, top-1);
               for (int k = 0; k != 5; ++k) {
-                Particle* p = &pool[dist(rng)];
+                Particle* p = get (dist(rng));
                 if (p->isAlive())
                   return p;
               }
@@ -96,16 +150,37 @@ namespace MR {
            */
           void clear() {
             std::lock_guard<std::mutex> lock (mutex);
-            pool.clear();
-            std::stack<Particle*, deque<Particle*> > e {};
-            avail.swap(e);
+            blocks.clear();
+            avail.clear();
+            top = 0;
           }
           
         protected:
+          
+          class Block
+          { MEMALIGN(Block)
+          public:
+            Particle particles[block_size];
+            float pos[3][block_size];
+            float dir[3][block_size];
+          };
+          
           std::mutex mutex;
-          deque<Particle> pool;
-          std::stack<Particle*, deque<Particle*> > avail;
+          vector<std::unique_ptr<Block>> blocks;
+          vector<index_type> avail;
+          size_t top;
           Math::RNG rng;
+          
+          inline void store(const Particle* p) {
+            const index_type idx = p->getIndex();
+            Block& b = *blocks[idx >> block_bits];
+            const Point_t pos = p->getPosition(), dir = p->getDirection();
+            for (size_t c = 0; c != 3; ++c) {
+              b.pos[c][idx & block_mask] = pos[c];
+              b.dir[c][idx & block_mask] = dir[c];
+            }
+          }
+          
         };
 
       }
@@ -12,9 +12,13 @@
  */
 
 
+#include <algorithm>
+#include <limits>
 #include <map>
 #include <set>
 
+#include "algo/loop.h"
+
 #include "dwi/tractography/connectome/tck2nodes.h"
 
 
@@ -25,6 +29,51 @@ namespace Connectome {
 
 
 
+namespace {
+
+  // One-dimensional squared Euclidean distance transform along a line of voxels with given spacing,
+  //   computed as the lower envelope of parabolas rooted at those voxels with finite input value
+  //   (Felzenszwalb & Huttenlocher, Distance Transforms of Sampled Functions, 2012)
+  void distance_transform_1d (const vector<double>& f, const default_type spacing, vector<double>& d, vector<size_t>& roots, vector<double>& bounds)
+  {
+    const size_t n = f.size();
+    auto intersect = [&] (const size_t q, const size_t r) {
+      return ((f[q] + Math::pow2 (q * spacing)) - (f[r] + Math::pow2 (r * spacing))) / (2.0 * spacing * (q - r));
+    };
+    ssize_t k = -1;
+    for (size_t q = 0; q != n; ++q) {
+      if (!std::isfinite (f[q]))
+        continue;
+      if (k < 0) {
+        k = 0;
+        roots[0] = q;
+        bounds[0] = -std::numeric_limits<double>::infinity();
+        bounds[1] = std::numeric_limits<double>::infinity();
+        continue;
+      }
+      double s = intersect (q, roots[k]);
+      while (s <= bounds[k])
+        s = intersect (q, roots[--k]);
+      ++k;
+      roots[k] = q;
+      bounds[k] = s;
+      bounds[k+1] = std::numeric_limits<double>::infinity();
+    }
+    if (k < 0) {
+      std::fill (d.begin(), d.end(), std::numeric_limits<double>::infinity());
+      return;
+    }
+    k = 0;
+    for (size_t q = 0; q != n; ++q) {
+      while (bounds[k+1] < q * spacing)
+        ++k;
+      d[q] = f[roots[k]] + Math::pow2 ((default_type(q) - default_type(roots[k])) * spacing);
+    }
+  }
+
+}
+
+
 
 
 node_t Tck2nodes_end_voxels::select_node (const Tractography::Streamline<>& tck, Image<node_t>& v, const bool end) const
@@ -58,8 +107,44 @@ void Tck2nodes_radial::initialise_search ()
     }
   }
   radial_search.reserve (radial_search_map.size());
-  for (auto i = radial_search_map.begin(); i != radial_search_map.end(); ++i)
+  radial_distance.reserve (radial_search_map.size());
+  for (auto i = radial_search_map.begin(); i != radial_search_map.end(); ++i) {
     radial_search.push_back (i->second);
+    radial_distance.push_back (i->first);
+  }
+}
+
+
+
+void Tck2nodes_radial::initialise_distance_transform ()
+{
+  // Exact Euclidean distance transform of the parcellation image, computed separably along each axis
+  const size_t dims[3] = { size_t(nodes.size(0)), size_t(nodes.size(1)), size_t(nodes.size(2)) };
+  const size_t strides[3] = { 1, dims[0], dims[0]*dims[1] };
+  vector<double> data (dims[0]*dims[1]*dims[2]);
+  Image<node_t> v (nodes);
+  auto value = data.begin();
+  for (auto l = Loop (v, 0, 3) (v); l; ++l)
+    *value++ = v.value() ? 0.0 : std::numeric_limits<double>::infinity();
+
+  for (size_t axis = 0; axis != 3; ++axis) {
+    const size_t n = dims[axis];
+    vector<double> f (n), d (n), bounds (n+1);
+    vector<size_t> roots (n);
+    for (size_t start = 0; start != data.size(); ++start) {
+      if ((start / strides[axis]) % n)
+        continue;
+      for (size_t i = 0; i != n; ++i)
+        f[i] = data[start + i*strides[axis]];
+      distance_transform_1d (f, nodes.spacing (axis), d, roots, bounds);
+      for (size_t i = 0; i != n; ++i)
+        data[start + i*strides[axis]] = d[i];
+    }
+  }
+
+  node_distance.reset (new vector<float> (data.size()));
+  for (size_t i = 0; i != data.size(); ++i)
+    (*node_distance)[i] = std::sqrt (data[i]);
 }
 
 
@@ -74,7 +159,24 @@ node_t Tck2nodes_radial::select_node (const Tractography::Streamline<>& tck, Ima
   const Eigen::Vector3 v_float = transform->scanner2voxel * p;
   const voxel_type centre { int(std::round (v_float[0])), int(std::round (v_float[1])), int(std::round (v_float[2])) };
 
-  for (vector<voxel_type>::const_iterator offset = radial_search.begin(); offset != radial_search.end(); ++offset) {
+  // No voxel with non-zero node index lies closer to the centre voxel than its value in the
+  //   distance transform, so the radial search can commence from that distance
+  vector<voxel_type>::const_iterator offset = radial_search.begin();
+  if (!is_out_of_bounds (v, centre)) {
+    const float nearest = (*node_distance)[centre[0] + nodes.size(0) * (centre[1] + nodes.size(1) * centre[2])];
+    if (!nearest) {
+      // Endpoint lies within a labelled voxel, which is necessarily the closest
+      const default_type dist ((p - transform->voxel2scanner * centre.matrix().cast<default_type>()).norm());
+      if (dist < max_dist) {
+        assign_pos_of (centre).to (v);
+        return v.value();
+      }
+    }
+    // Tolerance accounts for single-precision storage of the distance transform
+    offset += std::lower_bound (radial_distance.begin(), radial_distance.end(), (1.0 - 1e-6) * nearest) - radial_distance.begin();
+  }
+
+  for (; offset != radial_search.end(); ++offset) {
 
     const voxel_type this_voxel (centre + *offset);
     const Eigen::Vector3 p_voxel (transform->voxel2scanner * this_voxel.matrix().cast<default_type>());
@@ -129,13 +129,16 @@ class Tck2nodes_radial : public Tck2nodes_base { MEMALIGN(Tck2nodes_radial)
         max_add_dist   (std::sqrt (Math::pow2 (0.5 * nodes.spacing(2)) + Math::pow2 (0.5 * nodes.spacing(1)) + Math::pow2 (0.5 * nodes.spacing(0))))
     {
       initialise_search ();
+      initialise_distance_transform ();
     }
 
     Tck2nodes_radial (const Tck2nodes_radial& that) :
-        Tck2nodes_base (that),
-        radial_search  (that.radial_search),
-        max_dist       (that.max_dist),
-        max_add_dist   (that.max_add_dist) { }
+        Tck2nodes_base  (that),
+        radial_search   (that.radial_search),
+        radial_distance (that.radial_distance),
+        node_distance   (that.node_distance),
+        max_dist        (that.max_dist),
+        max_add_dist    (that.max_add_dist) { }
 
     ~Tck2nodes_radial() { }
 
@@ -143,7 +146,13 @@ class Tck2nodes_radial : public Tck2nodes_base { MEMALIGN(Tck2nodes_radial)
     node_t select_node (const Tractography::Streamline<>&, Image<node_t>&, const bool) const override;
 
     void initialise_search ();
+    void initialise_distance_transform ();
     vector<voxel_type> radial_search;
+    // Distance of each voxel offset in radial_search from the centre voxel
+    vector<default_type> radial_distance;
+    // Distance from the centre of each voxel to the centre of the nearest voxel with non-zero node index;
+    //   offsets closer than this can be skipped by the radial search without being tested
+    std::shared_ptr<vector<float>> node_distance;
     const default_type max_dist;
     // Distances are sub-voxel from the precise streamline termination point, so the search order is imperfect.
     //   This parameter controls when to stop the radial search because no voxel within the search space can be closer
@@ -165,7 +165,7 @@ namespace MR {
 
 
 
-          class SetVoxel : public std::set<Voxel>, public Mapping::SetVoxelExtras
+          class SetVoxel : public Mapping::VoxelSet<Voxel>, public Mapping::SetVoxelExtras
           { MEMALIGN(SetVoxel)
             public:
 
@@ -174,16 +174,14 @@ namespace MR {
               inline void insert (const Eigen::Vector3i& v, const default_type l, const default_type f)
               {
                 const Voxel temp (v, l, f);
-                iterator existing = std::set<Voxel>::find (temp);
-                if (existing == std::set<Voxel>::end())
-                  std::set<Voxel>::insert (temp);
-                else
-                  (*existing).add (l, f);
+                auto existing = Mapping::VoxelSet<Voxel>::insert (temp);
+                if (!existing.second)
+                  (*existing.first).add (l, f);
               }
           };
 
 
-          class SetVoxelDEC : public std::set<VoxelDEC>, public Mapping::SetVoxelExtras
+          class SetVoxelDEC : public Mapping::VoxelSet<VoxelDEC>, public Mapping::SetVoxelExtras
           { MEMALIGN(SetVoxelDEC)
             public:
 
@@ -192,16 +190,14 @@ namespace MR {
               inline void insert (const Eigen::Vector3i& v, const Eigen::Vector3& d, const default_type l, const default_type f)
               {
                 const VoxelDEC temp (v, d, l, f);
-                iterator existing = std::set<VoxelDEC>::find (temp);
-                if (existing == std::set<VoxelDEC>::end())
-                  std::set<VoxelDEC>::insert (temp);
-                else
-                  (*existing).add (d, l, f);
+                auto existing = Mapping::VoxelSet<VoxelDEC>::insert (temp);
+                if (!existing.second)
+                  (*existing.first).add (d, l, f);
               }
           };
 
 
-          class SetDixel : public std::set<Dixel>, public Mapping::SetVoxelExtras
+          class SetDixel : public Mapping::VoxelSet<Dixel>, public Mapping::SetVoxelExtras
           { MEMALIGN(SetDixel)
             public:
 
@@ -211,16 +207,14 @@ namespace MR {
               inline void insert (const Eigen::Vector3i& v, const dir_index_type d, const default_type l, const default_type f)
               {
                 const Dixel temp (v, d, l, f);
-                iterator existing = std::set<Dixel>::find (temp);
-                if (existing == std::set<Dixel>::end())
-                  std::set<Dixel>::insert (temp);
-                else
-                  (*existing).add (l, f);
+                auto existing = Mapping::VoxelSet<Dixel>::insert (temp);
+                if (!existing.second)
+                  (*existing.first).add (l, f);
               }
           };
 
 
-          class SetVoxelTOD : public std::set<VoxelTOD>, public Mapping::SetVoxelExtras
+          class SetVoxelTOD : public Mapping::VoxelSet<VoxelTOD>, public Mapping::SetVoxelExtras
           { MEMALIGN(SetVoxelTOD)
             public:
 
@@ -230,11 +224,9 @@ namespace MR {
               inline void insert (const Eigen::Vector3i& v, const vector_type& t, const default_type l, const default_type f)
               {
                 const VoxelTOD temp (v, t, l, f);
-                iterator existing = std::set<VoxelTOD>::find (temp);
-                if (existing == std::set<VoxelTOD>::end())
-                  std::set<VoxelTOD>::insert (temp);
-                else
-                  (*existing).add (t, l, f);
+                auto existing = Mapping::VoxelSet<VoxelTOD>::insert (temp);
+                if (!existing.second)
+                  (*existing.first).add (t, l, f);
               }
           };
 
@@ -29,12 +29,33 @@ void TrackMapperBase::voxelise (const Streamline<>& tck, SetVoxel& voxels) const
   for (const auto& i : tck) {
     vox = round (scanner2voxel * i);
     if (check (vox, info))
-      voxels.std::set<Voxel>::insert (vox);
+      voxels.VoxelSet<Voxel>::insert (vox);
   }
 }
 
 
 
+void TrackMapperBase::normalise (SetDixel& output) const
+{
+  if (!tod_histogram) {
+    for (auto& i : output)
+      i.normalize();
+    return;
+  }
+  // Each dixel receives the fraction of the streamline vertices within the
+  //   voxel whose tangent lies closest to that direction
+  voxel_totals.clear();
+  for (const auto& i : output) {
+    auto existing = voxel_totals.insert (Voxel (i, i.get_length()));
+    if (!existing.second)
+      (*existing.first) += i.get_length();
+  }
+  for (const auto& i : output)
+    i.scale_length (1.0 / voxel_totals.find (Voxel (i))->get_length());
+}
+
+
+
 
 
 void TrackMapperTWI::set_factor (const Streamline<>& tck, SetVoxelExtras& out) const
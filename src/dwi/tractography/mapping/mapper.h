@@ -63,6 +63,7 @@ namespace MR {
                 map_zero  (false),
                 precise   (false),
                 ends_only (false),
+                tod_histogram (false),
                 upsampler (1) { }
 
             template <class HeaderType>
@@ -72,6 +73,7 @@ namespace MR {
                 map_zero     (false),
                 precise      (false),
                 ends_only    (false),
+                tod_histogram (false),
                 dixel_plugin (new DixelMappingPlugin (dirs)),
                 upsampler    (1) { }
 
@@ -101,6 +103,15 @@ namespace MR {
               dixel_plugin.reset (new DixelMappingPlugin (dirs));
             }
 
+            // Map to dixels, but normalise such that each streamline makes a unit
+            //   contribution to each voxel rather than to each dixel; this yields the
+            //   histogram of streamline directions from which a TOD can be computed
+            void create_tod_histogram_plugin (const DWI::Directions::FastLookupSet& dirs)
+            {
+              create_dixel_plugin (dirs);
+              tod_histogram = true;
+            }
+
             void create_tod_plugin (const size_t N)
             {
               assert (!dixel_plugin && !tod_plugin);
@@ -138,10 +149,15 @@ namespace MR {
             bool map_zero;
             bool precise;
             bool ends_only;
+            bool tod_histogram;
 
             std::shared_ptr<DixelMappingPlugin> dixel_plugin;
             std::shared_ptr<TODMappingPlugin>   tod_plugin;
 
+            // Used by normalise() to accumulate the total contribution to each voxel
+            //   when generating direction histograms
+            mutable VoxelSet<Voxel> voxel_totals;
+
 
             // Specialist version of voxelise() is provided for the SetVoxel container:
             //   this is the simplest form of track mapping, and don't want to slow it down
@@ -156,6 +172,11 @@ namespace MR {
             template <class Cont> void voxelise_precise (const Streamline<>&, Cont&) const;
             template <class Cont> void voxelise_ends    (const Streamline<>&, Cont&) const;
 
+            // Used by voxelise() to remove the length dependence of the contribution of
+            //   the streamline; the SetDixel version deals with direction histograms
+            template <class Cont> void normalise (Cont& output) const { for (auto& i : output) i.normalize(); }
+            void normalise (SetDixel&) const;
+
             virtual bool preprocess  (const Streamline<>& tck, SetVoxelExtras& out) const { out.factor = 1.0; return true; }
             virtual void postprocess (const Streamline<>& tck, SetVoxelExtras& out) const { }
 
@@ -197,8 +218,7 @@ namespace MR {
                 add_to_set (output, vox, dir, 1.0);
             }
 
-            for (auto& i : output) 
-              i.normalize();
+            normalise (output);
 
           }
 
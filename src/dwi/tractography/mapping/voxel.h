@@ -17,9 +17,10 @@
 
 
 
-#include <set>
+#include <limits>
 
 #include "image.h"
+#include "types.h"
 
 #include "dwi/directions/set.h"
 
@@ -64,6 +65,7 @@ namespace MR {
             Voxel& operator= (const Voxel& V) { Eigen::Vector3i::operator= (V); length = V.length; return *this; }
             void operator+= (const default_type l) const { length += l; }
             void normalize() const { length = 1.0; }
+            void scale_length (const default_type factor) const { length *= factor; }
             default_type get_length() const { return length; }
           private:
             mutable default_type length;
@@ -278,19 +280,122 @@ namespace MR {
 
 
 
+        // Hash key for identifying the same voxel / dixel within a VoxelSet
+        // Image indices are packed into 21 bits each; collisions are resolved
+        //   through comparison of the elements themselves, so correctness does
+        //   not depend on the coordinates fitting within this range
+        inline uint64_t hash_key (const Voxel& v)
+        {
+          return uint64_t(uint32_t(v[0]) & 0x1FFFFF) | (uint64_t(uint32_t(v[1]) & 0x1FFFFF) << 21) | (uint64_t(uint32_t(v[2]) & 0x1FFFFF) << 42);
+        }
+        inline uint64_t hash_key (const Dixel& v)
+        {
+          return hash_key (static_cast<const Voxel&> (v)) ^ (uint64_t(v.get_dir()) * 0xC2B2AE3D27D4EB4FULL);
+        }
+
+
+
+
+        //! A set of voxels visited by a streamline, stored contiguously
+        /*! Elements are held in a vector in the order in which they are first
+         * inserted; an open-addressing hash table on the packed voxel
+         * coordinates (and direction index for dixels) is used to find an
+         * existing element when the same voxel is visited again. clear() retains
+         * the capacity of both, such that once a mapping thread has processed a
+         * few streamlines no further memory allocation takes place.
+         *
+         * Unlike std::set, iteration is in order of insertion rather than in
+         * order of voxel index. */
+        template <class VoxType>
+        class VoxelSet
+        { NOMEMALIGN
+          public:
+            using value_type = VoxType;
+            using iterator = typename vector<VoxType>::iterator;
+            using const_iterator = typename vector<VoxType>::const_iterator;
+
+            VoxelSet () : table (initial_table_size, uint32_t(empty_slot)) { }
+
+            iterator begin () { return elements.begin(); }
+            iterator end () { return elements.end(); }
+            const_iterator begin () const { return elements.begin(); }
+            const_iterator end () const { return elements.end(); }
+            size_t size () const { return elements.size(); }
+            bool empty () const { return elements.empty(); }
+
+            // Slots are emptied in reverse order of insertion, such that the
+            //   probe sequence of each element remains intact until it is reached
+            void clear ()
+            {
+              for (auto i = elements.rbegin(); i != elements.rend(); ++i)
+                table[find_slot (*i)] = empty_slot;
+              elements.clear();
+            }
+
+            iterator find (const VoxType& v)
+            {
+              const uint32_t index = table[find_slot (v)];
+              return index == empty_slot ? end() : begin() + index;
+            }
+
+            //! insert element if not already present; as std::set::insert()
+            std::pair<iterator, bool> insert (const VoxType& v)
+            {
+              size_t slot = find_slot (v);
+              if (table[slot] != empty_slot)
+                return std::make_pair (begin() + table[slot], false);
+              if (2 * (elements.size() + 1) > table.size()) {
+                grow();
+                slot = find_slot (v);
+              }
+              table[slot] = uint32_t (elements.size());
+              elements.push_back (v);
+              return std::make_pair (end() - 1, true);
+            }
+
+          private:
+            vector<VoxType> elements;
+            vector<uint32_t> table;
+
+            static constexpr size_t initial_table_size = 64;
+            static constexpr uint32_t empty_slot = std::numeric_limits<uint32_t>::max();
+
+            size_t mask () const { return table.size() - 1; }
+
+            // Slot either containing an element equal to v, or the empty slot
+            //   at which such an element would be inserted
+            size_t find_slot (const VoxType& v) const
+            {
+              size_t slot = ((hash_key (v) * 0x9E3779B97F4A7C15ULL) >> 32) & mask();
+              while (table[slot] != empty_slot && !(elements[table[slot]] == v))
+                slot = (slot + 1) & mask();
+              return slot;
+            }
+
+            void grow ()
+            {
+              table.assign (2 * table.size(), uint32_t(empty_slot));
+              for (size_t i = 0; i != elements.size(); ++i)
+                table[find_slot (elements[i])] = i;
+            }
+        };
+
+
+
+
+
+
         // Set classes that give sensible behaviour to the insert() function depending on the base voxel class
 
-        class SetVoxel : public std::set<Voxel>, public SetVoxelExtras
+        class SetVoxel : public VoxelSet<Voxel>, public SetVoxelExtras
         { NOMEMALIGN
           public:
             using VoxType = Voxel;
             inline void insert (const Voxel& v)
             {
-              iterator existing = std::set<Voxel>::find (v);
-              if (existing == std::set<Voxel>::end())
-                std::set<Voxel>::insert (v);
-              else
-                (*existing) += v.get_length();
+              auto existing = VoxelSet<Voxel>::insert (v);
+              if (!existing.second)
+                (*existing.first) += v.get_length();
             }
             inline void insert (const Eigen::Vector3i& v, const default_type l)
             {
@@ -303,17 +408,15 @@ namespace MR {
 
 
 
-        class SetVoxelDEC : public std::set<VoxelDEC>, public SetVoxelExtras
+        class SetVoxelDEC : public VoxelSet<VoxelDEC>, public SetVoxelExtras
         { NOMEMALIGN
           public:
             using VoxType = VoxelDEC;
             inline void insert (const VoxelDEC& v)
             {
-              iterator existing = std::set<VoxelDEC>::find (v);
-              if (existing == std::set<VoxelDEC>::end())
-                std::set<VoxelDEC>::insert (v);
-              else
-                existing->add (v.get_colour(), v.get_length());
+              auto existing = VoxelSet<VoxelDEC>::insert (v);
+              if (!existing.second)
+                existing.first->add (v.get_colour(), v.get_length());
             }
             inline void insert (const Eigen::Vector3i& v, const Eigen::Vector3& d)
             {
@@ -330,17 +433,15 @@ namespace MR {
 
 
 
-        class SetVoxelDir : public std::set<VoxelDir>, public SetVoxelExtras
+        class SetVoxelDir : public VoxelSet<VoxelDir>, public SetVoxelExtras
         { NOMEMALIGN
           public:
             using VoxType = VoxelDir;
             inline void insert (const VoxelDir& v)
             {
-              iterator existing = std::set<VoxelDir>::find (v);
-              if (existing == std::set<VoxelDir>::end())
-                std::set<VoxelDir>::insert (v);
-              else
-                existing->add (v.get_dir(), v.get_length());
+              auto existing = VoxelSet<VoxelDir>::insert (v);
+              if (!existing.second)
+                existing.first->add (v.get_dir(), v.get_length());
             }
             inline void insert (const Eigen::Vector3i& v, const Eigen::Vector3& d)
             {
@@ -355,7 +456,7 @@ namespace MR {
         };
 
 
-        class SetDixel : public std::set<Dixel>, public SetVoxelExtras
+        class SetDixel : public VoxelSet<Dixel>, public SetVoxelExtras
         { NOMEMALIGN
           public:
 
@@ -364,11 +465,9 @@ namespace MR {
 
             inline void insert (const Dixel& v)
             {
-              iterator existing = std::set<Dixel>::find (v);
-              if (existing == std::set<Dixel>::end())
-                std::set<Dixel>::insert (v);
-              else
-                (*existing) += v.get_length();
+              auto existing = VoxelSet<Dixel>::insert (v);
+              if (!existing.second)
+                (*existing.first) += v.get_length();
             }
             inline void insert (const Eigen::Vector3i& v, const dir_index_type d)
             {
@@ -386,7 +485,7 @@ namespace MR {
 
 
 
-        class SetVoxelTOD : public std::set<VoxelTOD>, public SetVoxelExtras
+        class SetVoxelTOD : public VoxelSet<VoxelTOD>, public SetVoxelExtras
         { NOMEMALIGN
           public:
 
@@ -395,11 +494,9 @@ namespace MR {
 
             inline void insert (const VoxelTOD& v)
             {
-              iterator existing = std::set<VoxelTOD>::find (v);
-              if (existing == std::set<VoxelTOD>::end())
-                std::set<VoxelTOD>::insert (v);
-              else
-                (*existing) += v.get_tod();
+              auto existing = VoxelSet<VoxelTOD>::insert (v);
+              if (!existing.second)
+                (*existing.first) += v.get_tod();
             }
             inline void insert (const Eigen::Vector3i& v, const vector_type& t)
             {
@@ -19,15 +19,20 @@
 #include "file/path.h"
 #include "file/utils.h"
 #include "image.h"
+#include "image_helpers.h"
 #include "algo/loop.h"
+#include "algo/threaded_loop.h"
 #include "thread_queue.h"
 
+#include "dwi/tractography/streamline.h"
+
 #include "dwi/tractography/mapping/twi_stats.h"
 #include "dwi/tractography/mapping/voxel.h"
 #include "dwi/tractography/mapping/gaussian/voxel.h"
 
 
 
+#include <mutex>
 #include <typeinfo>
 
 
@@ -77,6 +82,17 @@ namespace MR {
             virtual bool operator() (const Gaussian::SetVoxelTOD&) { return false; }
 
 
+            // Support for writing from within multiple mapping threads (see MapWriterThread):
+            //   create_thread_writer() provides a writer for use by a single thread, which
+            //   either writes to the buffers of this writer (shared), or accumulates into its
+            //   own buffers, which must subsequently be combined with this writer using merge()
+            virtual MapWriterBase* create_thread_writer (const bool shared) { return nullptr; }
+            virtual void merge (MapWriterBase&) { }
+
+            // Memory required for the output buffers
+            virtual int64_t footprint () const { return 0; }
+
+
           protected:
             const Header& H;
             const std::string output_image_name;
@@ -101,12 +117,25 @@ namespace MR {
         { MEMALIGN(MapWriter<value_type>)
 
           public:
-          MapWriter (const Header& header, const std::string& name, const vox_stat_t voxel_statistic = V_SUM, const writer_dim type = GREYSCALE) :
+          // To generate the TOD from the per-voxel histograms of streamline directions
+          //   provided as SetDixel, pass the matrix of aPSF coefficients for each
+          //   direction as tod_histogram: no image buffer is then allocated; instead, each
+          //   voxel records only those directions actually traversed, and these are only
+          //   converted to spherical harmonics when finalising
+          MapWriter (const Header& header, const std::string& name, const vox_stat_t voxel_statistic = V_SUM, const writer_dim type = GREYSCALE,
+                     std::shared_ptr<Eigen::MatrixXd> tod_histogram = nullptr) :
             MapWriterBase (header, name, voxel_statistic, type),
-            buffer (Image<value_type>::scratch (header, "TWI " + str(writer_dims[type]) + " buffer"))
+            buffer (tod_histogram ? Image<value_type>() : Image<value_type>::scratch (header, "TWI " + str(writer_dims[type]) + " buffer")),
+            tod_histogram (tod_histogram)
           {
-            auto loop = Loop (buffer);
-            if (type == DEC || type == TOD) {
+            assert (!tod_histogram || (type == TOD && (voxel_statistic == V_SUM || voxel_statistic == V_MEAN)));
+            assert (!tod_histogram || tod_histogram->rows() == header.size(3));
+            if (tod_histogram)
+              histograms.reset (new vector<DixelHistogram> (voxel_count (header, 0, 3)));
+            auto loop = Loop (header);
+            if (tod_histogram) {
+              // Bins are only created as directions are encountered
+            } else if (type == DEC || type == TOD) {
 
               if (voxel_statistic == V_MIN) {
                 for (auto l = loop (buffer); l; ++l )
@@ -148,8 +177,23 @@ namespace MR {
 
           MapWriter (const MapWriter&) = delete;
 
+          MapWriterBase* create_thread_writer (const bool shared);
+          void merge (MapWriterBase&);
+
+          // For direction histograms, this excludes the bins themselves, since the
+          //   number of directions traversed within each voxel is not known in advance
+          int64_t footprint () const {
+            return (histograms ? int64_t (histograms->size() * sizeof (DixelHistogram)) : MR::footprint<value_type> (voxel_count (buffer)))
+                + (counts ? MR::footprint<float> (voxel_count (*counts)) : 0);
+          }
+
           void finalise () {
 
+            if (histograms) {
+              finalise_tod_histogram();
+              return;
+            }
+
             auto loop = Loop (buffer, 0, 3);
             switch (voxel_statistic) {
 
@@ -170,7 +214,7 @@ namespace MR {
                 break;
 
               case V_MIN:
-                for (auto l = loop (buffer); l; ++l ) {
+                for (auto l = Loop (buffer) (buffer); l; ++l ) {
                   if (buffer.value() == std::numeric_limits<value_type>::max())
                     buffer.value() = value_type(0);
                 }
@@ -235,24 +279,63 @@ namespace MR {
 
           bool operator() (const SetVoxel& in)    { receive_greyscale (in); return true; }
           bool operator() (const SetVoxelDEC& in) { receive_dec       (in); return true; }
-          bool operator() (const SetDixel& in)    { receive_dixel     (in); return true; }
+          bool operator() (const SetDixel& in)    { if (tod_histogram) receive_tod_histogram (in); else receive_dixel (in); return true; }
           bool operator() (const SetVoxelTOD& in) { receive_tod       (in); return true; }
 
           bool operator() (const Gaussian::SetVoxel& in)    { receive_greyscale (in); return true; }
           bool operator() (const Gaussian::SetVoxelDEC& in) { receive_dec       (in); return true; }
-          bool operator() (const Gaussian::SetDixel& in)    { receive_dixel     (in); return true; }
+          bool operator() (const Gaussian::SetDixel& in)    { if (tod_histogram) receive_tod_histogram (in); else receive_dixel (in); return true; }
           bool operator() (const Gaussian::SetVoxelTOD& in) { receive_tod       (in); return true; }
 
 
           private:
           Image<value_type> buffer;
 
+          // Used when writing to the same buffers from multiple threads;
+          //   one mutex per image slice along the third axis
+          std::shared_ptr<vector<std::mutex>> slice_locks;
+
+          // aPSF coefficients for each direction, if generating TOD from direction histograms
+          std::shared_ptr<Eigen::MatrixXd> tod_histogram;
+
+          // The direction histogram of each voxel, with the first image axis varying fastest;
+          //   only those directions with some contribution are stored, sorted by direction index
+          using DixelHistogram = vector<std::pair<Dixel::dir_index_type, value_type>>;
+          std::shared_ptr<vector<DixelHistogram>> histograms;
+
+          // Construct a writer that accesses the buffers of another, with locking
+          MapWriter (const MapWriter& that, std::shared_ptr<vector<std::mutex>> slice_locks) :
+            MapWriterBase (that.H, that.output_image_name, that.voxel_statistic, that.type),
+            buffer (that.buffer),
+            slice_locks (slice_locks),
+            tod_histogram (that.tod_histogram),
+            histograms (that.histograms)
+          {
+            if (that.counts)
+              counts.reset (new Image<float> (*that.counts));
+          }
+
+          // Acquire the lock for the slice at the current buffer position, if required
+          std::unique_lock<std::mutex> lock_slice () {
+            return lock_slice (buffer.index(2));
+          }
+          std::unique_lock<std::mutex> lock_slice (const ssize_t slice) {
+            return slice_locks ? std::unique_lock<std::mutex> ((*slice_locks)[slice]) : std::unique_lock<std::mutex>();
+          }
+
+          size_t histogram_index (const Eigen::Vector3i& voxel) const {
+            return voxel[0] + H.size(0) * (voxel[1] + H.size(1) * size_t(voxel[2]));
+          }
+          static void add_to_histogram (DixelHistogram&, const Dixel::dir_index_type, const value_type);
+          void finalise_tod_histogram ();
+
           // Template functions used so that the functors don't have to be written twice
           //   (once for standard TWI and one for Gaussian track-wise statistic)
           template <class Cont> void receive_greyscale (const Cont&);
           template <class Cont> void receive_dec       (const Cont&);
           template <class Cont> void receive_dixel     (const Cont&);
           template <class Cont> void receive_tod       (const Cont&);
+          template <class Cont> void receive_tod_histogram (const Cont&);
 
           // These acquire the TWI factor at any point along the streamline;
           //   For the standard SetVoxel classes, this is a single value 'factor' for the set as
@@ -291,6 +374,7 @@ namespace MR {
             assert (MapWriterBase::type == GREYSCALE);
             for (const auto& i : in) { 
               assign_pos_of (i).to (buffer);
+              auto lock = lock_slice();
               const default_type factor = get_factor (i, in);
               const default_type weight = in.weight * i.get_length();
               switch (voxel_statistic) {
@@ -318,6 +402,7 @@ namespace MR {
             assert (type == DEC);
             for (const auto& i : in) { 
               assign_pos_of (i).to (buffer);
+              auto lock = lock_slice();
               const default_type factor = get_factor (i, in);
               const default_type weight = in.weight * i.get_length();
               auto scaled_colour = i.get_colour();
@@ -360,6 +445,7 @@ namespace MR {
             for (const auto& i : in) { 
               assign_pos_of (i, 0, 3).to (buffer);
               buffer.index(3) = i.get_dir();
+              auto lock = lock_slice();
               const default_type factor = get_factor (i, in);
               const default_type weight = in.weight * i.get_length();
               switch (voxel_statistic) {
@@ -389,6 +475,7 @@ namespace MR {
             VoxelTOD::vector_type sh_coefs;
             for (const auto& i : in) { 
               assign_pos_of (i, 0, 3).to (buffer);
+              auto lock = lock_slice();
               const default_type factor = get_factor (i, in);
               const default_type weight = in.weight * i.get_length();
               get_tod (sh_coefs);
@@ -434,6 +521,158 @@ namespace MR {
 
 
 
+        // Each element provides the fraction of the streamline within the voxel that
+        //   lies closest to a particular direction; since the TOD is linear in these,
+        //   only the summed and mean voxel statistics are supported
+        template <typename value_type>
+          template <class Cont>
+          void MapWriter<value_type>::receive_tod_histogram (const Cont& in)
+          {
+            assert (type == TOD && histograms);
+            for (const auto& i : in) {
+              DixelHistogram& histogram ((*histograms)[histogram_index (i)]);
+              auto lock = lock_slice (i[2]);
+              const default_type factor = get_factor (i, in);
+              const default_type weight = in.weight * i.get_length();
+              switch (voxel_statistic) {
+                case V_SUM:
+                  add_to_histogram (histogram, i.get_dir(), weight * factor);
+                  break;
+                case V_MEAN:
+                  add_to_histogram (histogram, i.get_dir(), weight * factor);
+                  assert (counts);
+                  assign_pos_of (i, 0, 3).to (*counts);
+                  counts->value() += weight;
+                  break;
+                default:
+                  throw Exception ("Unknown / unhandled voxel statistic in MapWriter::receive_tod_histogram()");
+              }
+            }
+          }
+
+
+
+        template <typename value_type>
+          void MapWriter<value_type>::add_to_histogram (DixelHistogram& histogram, const Dixel::dir_index_type dir, const value_type value)
+          {
+            auto bin = std::lower_bound (histogram.begin(), histogram.end(), dir,
+                [] (const std::pair<Dixel::dir_index_type, value_type>& a, const Dixel::dir_index_type b) { return a.first < b; });
+            if (bin != histogram.end() && bin->first == dir)
+              bin->second += value;
+            else
+              histogram.insert (bin, std::make_pair (dir, value));
+          }
+
+
+
+        template <typename value_type>
+          void MapWriter<value_type>::finalise_tod_histogram ()
+          {
+            assert (histograms);
+            const Eigen::MatrixXd& aPSF_matrix (*tod_histogram);
+            auto convert = [&] (Image<value_type>& tod, const default_type count) {
+              VoxelTOD::vector_type sh_coefs (VoxelTOD::vector_type::Zero (aPSF_matrix.rows()));
+              for (const auto& bin : (*histograms)[histogram_index (Eigen::Vector3i (tod.index(0), tod.index(1), tod.index(2)))])
+                sh_coefs += bin.second * aPSF_matrix.col (bin.first);
+              if (count)
+                sh_coefs *= 1.0 / count;
+              for (auto l = Loop (3) (tod); l; ++l)
+                tod.value() = sh_coefs[tod.index(3)];
+            };
+
+            auto out = Image<value_type>::create (output_image_name, H);
+            auto loop = ThreadedLoop ("converting direction histograms to TOD", out, 0, 3);
+            if (voxel_statistic == V_MEAN)
+              loop.run ([&] (Image<value_type>& tod, Image<float>& count) { convert (tod, count.value()); }, out, *counts);
+            else
+              loop.run ([&] (Image<value_type>& tod) { convert (tod, 0.0); }, out);
+          }
+
+
+
+
+
+        template <typename value_type>
+          MapWriterBase* MapWriter<value_type>::create_thread_writer (const bool shared)
+          {
+            if (!shared)
+              return new MapWriter (H, output_image_name, voxel_statistic, type, tod_histogram);
+            if (!slice_locks)
+              slice_locks.reset (new vector<std::mutex> (H.size(2)));
+            return new MapWriter (*this, slice_locks);
+          }
+
+
+
+        template <typename value_type>
+          void MapWriter<value_type>::merge (MapWriterBase& base)
+          {
+            MapWriter& that (dynamic_cast<MapWriter&> (base));
+            if (that.slice_locks)
+              return;
+
+            if (histograms) {
+              for (size_t v = 0; v != histograms->size(); ++v) {
+                for (const auto& bin : (*that.histograms)[v])
+                  add_to_histogram ((*histograms)[v], bin.first, bin.second);
+                DixelHistogram().swap ((*that.histograms)[v]);
+              }
+            } else if (type == GREYSCALE || type == DIXEL) {
+              for (auto l = Loop (buffer) (buffer, that.buffer); l; ++l) {
+                switch (voxel_statistic) {
+                  case V_SUM:
+                  case V_MEAN: buffer.value() += that.buffer.value(); break;
+                  case V_MIN:  buffer.value() = std::min (value_type (buffer.value()), value_type (that.buffer.value())); break;
+                  case V_MAX:  buffer.value() = std::max (value_type (buffer.value()), value_type (that.buffer.value())); break;
+                  default:     throw Exception ("Unknown / unhandled voxel statistic in MapWriter::merge()");
+                }
+              }
+            } else if (type == DEC) {
+              for (auto l = Loop (buffer, 0, 3) (buffer, that.buffer); l; ++l) {
+                const auto value = get_dec();
+                const auto other = that.get_dec();
+                switch (voxel_statistic) {
+                  case V_SUM:
+                  case V_MEAN: set_dec (value + other); break;
+                  case V_MIN:  if (other.squaredNorm() < value.squaredNorm()) set_dec (other); break;
+                  case V_MAX:  if (other.squaredNorm() > value.squaredNorm()) set_dec (other); break;
+                  default:     throw Exception ("Unknown / unhandled voxel statistic in MapWriter::merge()");
+                }
+              }
+            } else if (type == TOD) {
+              VoxelTOD::vector_type value, other;
+              for (auto l = Loop (buffer, 0, 3) (buffer, that.buffer); l; ++l) {
+                switch (voxel_statistic) {
+                  case V_SUM:
+                  case V_MEAN:
+                    get_tod (value);
+                    that.get_tod (other);
+                    set_tod (value + other);
+                    break;
+                  // The counts buffer holds the minimum / maximum factor for each voxel
+                  case V_MIN:
+                  case V_MAX:
+                    assign_pos_of (buffer, 0, 3).to (*counts, *that.counts);
+                    if (voxel_statistic == V_MIN ? (that.counts->value() < counts->value()) : (that.counts->value() > counts->value())) {
+                      counts->value() = that.counts->value();
+                      that.get_tod (other);
+                      set_tod (other);
+                    }
+                    break;
+                  default:
+                    throw Exception ("Unknown / unhandled voxel statistic in MapWriter::merge()");
+                }
+              }
+            }
+
+            if (counts && !(type == TOD && (voxel_statistic == V_MIN || voxel_statistic == V_MAX))) {
+              for (auto l = Loop (*counts) (*counts, *that.counts); l; ++l)
+                counts->value() += that.counts->value();
+            }
+          }
+
+
+
 
 
         template <typename value_type>
@@ -482,6 +721,65 @@ namespace MR {
 
 
 
+
+
+        //! Map streamlines and write the results from within each mapping thread
+        /*! When a single MapWriter receives the mapped streamlines from all mapper
+         * threads, the writer thread can become the bottleneck (particularly for
+         * DEC & TOD outputs, or the Gaussian track statistic), leaving the mapper
+         * threads idle. With this functor, each thread maps each streamline and
+         * writes the result itself, using a writer obtained from the output writer
+         * using MapWriterBase::create_thread_writer(). This either has its own
+         * copy of the output buffers, which is merged into the output writer once
+         * the thread has completed; or (if the buffers are too large to be
+         * replicated for every thread) writes directly to the output buffers,
+         * with concurrent updates to the same image slice serialised. */
+        template <class MapperType, class SetType>
+          class MapWriterThread
+        { MEMALIGN(MapWriterThread<MapperType,SetType>)
+
+          public:
+            MapWriterThread (const MapperType& mapper, MapWriterBase& output, const bool shared) :
+              mapper (mapper),
+              output (output),
+              shared (shared),
+              mutex (new std::mutex()) { }
+
+            MapWriterThread (const MapWriterThread& that) :
+              mapper (that.mapper),
+              output (that.output),
+              shared (that.shared),
+              mutex (that.mutex) { }
+
+            ~MapWriterThread () {
+              if (writer) {
+                std::lock_guard<std::mutex> lock (*mutex);
+                output.merge (*writer);
+              }
+            }
+
+            bool operator() (Streamline<>& in) {
+              if (!writer) {
+                std::lock_guard<std::mutex> lock (*mutex);
+                writer.reset (output.create_thread_writer (shared));
+              }
+              mapper (in, set);
+              return (*writer) (set);
+            }
+
+          private:
+            MapperType mapper;
+            MapWriterBase& output;
+            const bool shared;
+            std::shared_ptr<std::mutex> mutex;
+            std::unique_ptr<MapWriterBase> writer;
+            SetType set;
+        };
+
+
+
+
+
       }
     }
   }
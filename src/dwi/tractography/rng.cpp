@@ -22,9 +22,9 @@ namespace MR
     {
 
 #ifdef MRTRIX_MACOSX
-      __thread Math::RNG* rng = nullptr;
+      __thread Math::Philox* rng = nullptr;
 #else
-      thread_local Math::RNG* rng = nullptr;
+      thread_local Math::Philox* rng = nullptr;
 #endif 
 
     }
@@ -25,10 +25,14 @@ namespace MR
     {
 
       //! thread-local, but globally accessible RNG to vastly simplify multi-threading
+      /*! This is a counter-based generator: the tracking thread re-seeks it
+       * to the stream of each new streamline index before generating that
+       * streamline, so the output for any given index depends only on the
+       * global seed, not on which thread happened to process it. */
 #ifdef MRTRIX_MACOSX
-      extern __thread Math::RNG* rng;
+      extern __thread Math::Philox* rng;
 #else
-      extern thread_local Math::RNG* rng;
+      extern thread_local Math::Philox* rng;
 #endif 
 
     }
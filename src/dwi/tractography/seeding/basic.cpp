@@ -41,16 +41,29 @@ namespace MR
 
 
 
+        vector<Eigen::Vector3i> get_voxels (Mask& mask)
+        {
+          vector<Eigen::Vector3i> voxels;
+          for (mask.index(0) = 0; mask.index(0) != mask.size(0); ++mask.index(0)) {
+            for (mask.index(1) = 0; mask.index(1) != mask.size(1); ++mask.index(1)) {
+              for (mask.index(2) = 0; mask.index(2) != mask.size(2); ++mask.index(2)) {
+                if (mask.value())
+                  voxels.push_back ({ int(mask.index(0)), int(mask.index(1)), int(mask.index(2)) });
+              }
+            }
+          }
+          return voxels;
+        }
+
+
+
+
+
         bool SeedMask::get_seed (Eigen::Vector3f& p) const
         {
-          auto seed = mask;
-          do {
-            seed.index(0) = std::uniform_int_distribution<int>(0, mask.size(0)-1)(*rng);
-            seed.index(1) = std::uniform_int_distribution<int>(0, mask.size(1)-1)(*rng);
-            seed.index(2) = std::uniform_int_distribution<int>(0, mask.size(2)-1)(*rng);
-          } while (!seed.value());
+          const auto& v = voxels[std::uniform_int_distribution<size_t> (0, voxels.size()-1) (*rng)];
           std::uniform_real_distribution<float> uniform;
-          p = { seed.index(0)+uniform(*rng)-0.5f, seed.index(1)+uniform(*rng)-0.5f, seed.index(2)+uniform(*rng)-0.5f };
+          p = { v[0]+uniform(*rng)-0.5f, v[1]+uniform(*rng)-0.5f, v[2]+uniform(*rng)-0.5f };
           p = (*mask.voxel2scanner) * p;
           return true;
         }
@@ -62,33 +75,13 @@ namespace MR
 
         bool Random_per_voxel::get_seed (Eigen::Vector3f& p) const
         {
-
-          std::lock_guard<std::mutex> lock (mutex);
-
-          if (expired)
+          const size_t i = next.fetch_add (1, std::memory_order_relaxed);
+          if (i >= voxels.size() * num)
             return false;
 
-          if (mask.index(2) < 0 || ++inc == num) {
-            inc = 0;
-
-            do {
-              if (++mask.index(2) == mask.size(2)) {
-                mask.index(2) = 0;
-                if (++mask.index(1) == mask.size(1)) {
-                  mask.index(1) = 0;
-                  ++mask.index(0);
-                }
-              }
-            } while (mask.index(0) != mask.size(0) && !mask.value());
-
-            if (mask.index(0) == mask.size(0)) {
-              expired = true;
-              return false;
-            }
-          }
-
+          const auto& v = voxels[i / num];
           std::uniform_real_distribution<float> uniform;
-          p = { mask.index(0)+uniform(*rng)-0.5f, mask.index(1)+uniform(*rng)-0.5f, mask.index(2)+uniform(*rng)-0.5f };
+          p = { v[0]+uniform(*rng)-0.5f, v[1]+uniform(*rng)-0.5f, v[2]+uniform(*rng)-0.5f };
           p = (*mask.voxel2scanner) * p;
           return true;
         }
@@ -102,37 +95,15 @@ namespace MR
 
         bool Grid_per_voxel::get_seed (Eigen::Vector3f& p) const
         {
-
-          std::lock_guard<std::mutex> lock (mutex);
-
-          if (expired)
+          const size_t per_voxel = Math::pow3 (os);
+          size_t i = next.fetch_add (1, std::memory_order_relaxed);
+          if (i >= voxels.size() * per_voxel)
             return false;
 
-          if (++pos[2] >= os) {
-            pos[2] = 0;
-            if (++pos[1] >= os) {
-              pos[1] = 0;
-              if (++pos[0] >= os) {
-                pos[0] = 0;
-
-                do {
-                  if (++mask.index(2) == mask.size(2)) {
-                    mask.index(2) = 0;
-                    if (++mask.index(1) == mask.size(1)) {
-                      mask.index(1) = 0;
-                      ++mask.index(0);
-                    }
-                  }
-                } while (mask.index(0) != mask.size(0) && !mask.value());
-                if (mask.index(0) == mask.size(0)) {
-                  expired = true;
-                  return false;
-                }
-              }
-            }
-          }
-
-          p = { mask.index(0)+offset+(pos[0]*step), mask.index(1)+offset+(pos[1]*step), mask.index(2)+offset+(pos[2]*step) };
+          const auto& v = voxels[i / per_voxel];
+          i %= per_voxel;
+          const size_t pos[3] = { i / (os*os), (i / os) % os, i % os };
+          p = { v[0]+offset+(pos[0]*step), v[1]+offset+(pos[1]*step), v[2]+offset+(pos[2]*step) };
           p = (*mask.voxel2scanner) * p;
           return true;
 
@@ -140,15 +111,17 @@ namespace MR
 
 
         Rejection::Rejection (const std::string& in) :
-          Base (in, "rejection sampling", MAX_TRACKING_SEED_ATTEMPTS_RANDOM),
+          Base (in, "rejection sampling", MAX_TRACKING_SEED_ATTEMPTS_RANDOM)
 #ifdef REJECTION_SAMPLING_USE_INTERPOLATION
-          interp (in),
-#endif
+        , interp (in),
           max (0.0)
+#endif
         {
           auto vox = Image<float>::open (in);
           if (!(vox.ndim() == 3 || (vox.ndim() == 4 && vox.size(3) == 1)))
             throw Exception ("Seed image must be a 3D image");
+
+#ifdef REJECTION_SAMPLING_USE_INTERPOLATION
           vector<size_t> bottom (3, std::numeric_limits<size_t>::max());
           vector<size_t> top    (3, 0);
 
@@ -187,11 +160,26 @@ namespace MR
           volume *= buf.spacing(0) * buf.spacing(1) * buf.spacing(2);
 
           copy (sub, buf, 0, 3);
-#ifdef REJECTION_SAMPLING_USE_INTERPOLATION
           interp = Interp::Linear<Image<float>> (buf);
 #else
-          image = buf;
-          voxel2scanner = Transform (image).voxel2scanner.cast<float>();
+          vector<float> weights;
+          for (auto i = Loop (0,3) (vox); i; ++i) {
+            const float value = vox.value();
+            if (value) {
+              if (value < 0.0)
+                throw Exception ("Cannot have negative values in an image used for rejection sampling!");
+              voxels.push_back ({ int(vox.index(0)), int(vox.index(1)), int(vox.index(2)) });
+              weights.push_back (value);
+              volume += value;
+            }
+          }
+
+          if (voxels.empty())
+            throw Exception ("Cannot use image " + in + " for rejection sampling - image is empty");
+
+          table = Math::AliasTable (weights);
+          volume *= vox.spacing(0) * vox.spacing(1) * vox.spacing(2);
+          voxel2scanner = Transform (vox).voxel2scanner.cast<float>();
 #endif
         }
 
@@ -199,31 +187,25 @@ namespace MR
 
         bool Rejection::get_seed (Eigen::Vector3f& p) const
         {
-          std::uniform_real_distribution<float> uniform;
 #ifdef REJECTION_SAMPLING_USE_INTERPOLATION
+          std::uniform_real_distribution<float> uniform;
           auto seed = interp;
           float selector;
           Eigen::Vector3f pos;
           do {
             pos = {
-              uniform (*rng) * (interp.size(0)-1), 
-              uniform (*rng) * (interp.size(1)-1), 
-              uniform (*rng) * (interp.size(2)-1) 
+              uniform (*rng) * (interp.size(0)-1),
+              uniform (*rng) * (interp.size(1)-1),
+              uniform (*rng) * (interp.size(2)-1)
             };
             seed.voxel (pos);
-            selector = rng->Uniform() * max;
+            selector = uniform (*rng) * max;
           } while (seed.value() < selector);
           p = interp.voxel2scanner * pos;
 #else
-          auto seed = image;
-          float selector;
-          do {
-            seed.index(0) = std::uniform_int_distribution<int> (0, image.size(0)-1) (*rng);
-            seed.index(1) = std::uniform_int_distribution<int> (0, image.size(1)-1) (*rng);
-            seed.index(2) = std::uniform_int_distribution<int> (0, image.size(2)-1) (*rng);
-            selector = uniform (*rng) * max;
-          } while (seed.value() < selector);
-          p = { seed.index(0)+uniform(*rng)-0.5f, seed.index(1)+uniform(*rng)-0.5f, seed.index(2)+uniform(*rng)-0.5f };
+          const auto& v = voxels[table (*rng)];
+          std::uniform_real_distribution<float> uniform;
+          p = { v[0]+uniform(*rng)-0.5f, v[1]+uniform(*rng)-0.5f, v[2]+uniform(*rng)-0.5f };
           p = voxel2scanner * p;
 #endif
           return true;
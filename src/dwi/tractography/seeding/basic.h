@@ -15,6 +15,7 @@
 #ifndef __dwi_tractography_seeding_basic_h__
 #define __dwi_tractography_seeding_basic_h__
 
+#include "math/alias_table.h"
 #include "dwi/tractography/roi.h"
 #include "dwi/tractography/seeding/base.h"
 
@@ -60,25 +61,38 @@ namespace MR
         };
 
 
+        // List of the voxels within a mask, in the order in which the
+        //   fixed-number seeding mechanisms visit them
+        vector<Eigen::Vector3i> get_voxels (Mask&);
+
+
+
         class SeedMask : public Base
         { MEMALIGN(SeedMask)
 
           public:
             SeedMask (const std::string& in) :
               Base (in, "random seeding mask", MAX_TRACKING_SEED_ATTEMPTS_RANDOM),
-              mask (in) {
-                volume = get_count (mask) * mask.spacing(0) * mask.spacing(1) * mask.spacing(2);
+              mask (in),
+              voxels (get_voxels (mask)) {
+                if (voxels.empty())
+                  throw Exception ("Cannot use image " + in + " for seeding - mask is empty");
+                volume = voxels.size() * mask.spacing(0) * mask.spacing(1) * mask.spacing(2);
               }
 
             virtual bool get_seed (Eigen::Vector3f& p) const override;
 
           private:
             Mask mask;
+            const vector<Eigen::Vector3i> voxels;
 
         };
 
 
 
+        // The fixed-number seeding mechanisms claim seeds using an atomic
+        //   counter into the precomputed voxel list rather than walking the
+        //   mask under a lock, so multiple tracking threads don't serialise
         class Random_per_voxel : public Base
         { MEMALIGN(Random_per_voxel)
 
@@ -86,22 +100,21 @@ namespace MR
             Random_per_voxel (const std::string& in, const size_t num_per_voxel) :
               Base (in, "random per voxel", MAX_TRACKING_SEED_ATTEMPTS_FIXED),
               mask (in),
+              voxels (get_voxels (mask)),
               num (num_per_voxel),
-              inc (0),
-              expired (false) {
-                count = get_count (mask) * num_per_voxel;
-                mask.index(0) = 0; mask.index(1) = 0; mask.index(2) = -1;
+              next (0) {
+                count = voxels.size() * num_per_voxel;
               }
 
             virtual bool get_seed (Eigen::Vector3f& p) const override;
             virtual ~Random_per_voxel() { }
 
           private:
-            mutable Mask mask;
+            Mask mask;
+            const vector<Eigen::Vector3i> voxels;
             const size_t num;
 
-            mutable uint32_t inc;
-            mutable bool expired;
+            mutable std::atomic<size_t> next;
         };
 
 
@@ -113,12 +126,12 @@ namespace MR
             Grid_per_voxel (const std::string& in, const size_t os_factor) :
               Base (in, "grid per voxel", MAX_TRACKING_SEED_ATTEMPTS_FIXED),
               mask (in),
+              voxels (get_voxels (mask)),
               os (os_factor),
-              pos (os, os, os),
               offset (-0.5 + (1.0 / (2*os))),
               step (1.0 / os),
-              expired (false) {
-                count = get_count (mask) * Math::pow3 (os_factor);
+              next (0) {
+                count = voxels.size() * Math::pow3 (os_factor);
               }
 
             virtual ~Grid_per_voxel() { }
@@ -126,11 +139,11 @@ namespace MR
 
 
           private:
-            mutable Mask mask;
-            const int os;
-            mutable Eigen::Vector3i pos;
+            Mask mask;
+            const vector<Eigen::Vector3i> voxels;
+            const size_t os;
             const float offset, step;
-            mutable bool expired;
+            mutable std::atomic<size_t> next;
 
         };
 
@@ -148,11 +161,14 @@ namespace MR
           private:
 #ifdef REJECTION_SAMPLING_USE_INTERPOLATION
             Interp::Linear<Image<float>> interp;
+            float max;
 #else
-            Image<float> image;
+            // Voxels with non-zero weight, sampled in constant time via an
+            //   alias table rather than by rejection against the image maximum
+            vector<Eigen::Vector3i> voxels;
+            Math::AliasTable table;
             transform_type voxel2scanner;
 #endif
-            float max;
 
         };
 
@@ -40,17 +40,13 @@ namespace MR
 
 
 
+      // A single attempt only: the caller draws again on failure, and gives up
+      //   after a fixed number of attempts if the seed image contains no interface
       bool GMWMI::get_seed (Eigen::Vector3f& p) const
       {
         Interp interp (interp_template);
-        do {
-          init_seeder.get_seed (p);
-          if (find_interface (p, interp)) {
-            if (perturb (p, interp))
-              return true;
-          }
-        } while (1);
-        return false;
+        init_seeder.get_seed (p);
+        return find_interface (p, interp) && perturb (p, interp);
       }
 
 
@@ -62,7 +62,10 @@ namespace MR
                 typename Method::Shared shared (diff_path, properties);
                 WriteKernel writer (shared, destination, properties);
                 Exec<Method> tracker (shared);
-                Thread::run_queue (Thread::multi (tracker), Thread::batch (GeneratedTrack(), TRACKING_BATCH_SIZE), writer);
+                // In reproducible mode, a thread may wait for preceding streamlines to be
+                //   written (see SharedBase::wait_for_sequence()); this must not happen
+                //   while it holds a partially-filled batch, or the writer may stall
+                Thread::run_queue (Thread::multi (tracker), Thread::batch (GeneratedTrack(), shared.ordered ? 1 : TRACKING_BATCH_SIZE), writer);
 
               } else {
 
@@ -108,15 +111,34 @@ namespace MR
 
             Exec (const typename Method::Shared& shared) :
               S (shared),
+              thread_local_RNG (S.rng_seed),
               method (shared),
               track_excluded (false),
-              track_included (S.properties.include.size(), false) { }
+              track_included (S.properties.include.size(), false),
+              seeding_failed (false) { }
 
 
             bool operator() (GeneratedTrack& item) {
-              rng = &thread_local_RNG;
-              if (!seed_track (item))
+              if (seeding_failed)
+                return false;
+              const size_t sequence = S.claim_sequence();
+              if (S.ordered && S.max_num_seeds && sequence >= S.max_num_seeds)
                 return false;
+              if (S.ordered && !S.wait_for_sequence (sequence))
+                return false;
+              thread_local_RNG.seek (S.stream_index (sequence));
+              rng = &thread_local_RNG;
+              item.set_sequence (sequence);
+              if (!seed_track (item)) {
+                if (!S.ordered)
+                  return false;
+                // The writer cannot advance past a sequence number that never
+                //   reaches it, and threads waiting on it would then stall; pass
+                //   on an empty placeholder for it, and terminate on the next call
+                item.clear();
+                seeding_failed = true;
+                return true;
+              }
               if (track_excluded) {
                 item.set_status (GeneratedTrack::status_t::SEED_REJECTED);
                 S.add_rejection (INVALID_SEED);
@@ -137,10 +159,11 @@ namespace MR
           private:
 
             const typename Method::Shared& S;
-            Math::RNG thread_local_RNG;
+            Math::Philox thread_local_RNG;
             Method method;
             bool track_excluded;
             vector<bool> track_included;
+            bool seeding_failed;
 
 
             term_t iterate ()
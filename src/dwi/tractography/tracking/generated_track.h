@@ -42,16 +42,18 @@ namespace MR
 
             enum class status_t { INVALID, SEED_REJECTED, TRACK_REJECTED, ACCEPTED };
 
-            GeneratedTrack() : seed_index (0), status (status_t::INVALID) { }
+            GeneratedTrack() : seed_index (0), sequence (0), status (status_t::INVALID) { }
             void clear() { BaseType::clear(); seed_index = 0; status = status_t::INVALID; }
             size_t get_seed_index() const { return seed_index; }
+            size_t get_sequence() const { return sequence; }
             status_t get_status() const { return status; }
             void reverse() { std::reverse (begin(), end()); seed_index = size()-1; }
             void set_seed_index (const size_t i) { seed_index = i; }
+            void set_sequence (const size_t i) { sequence = i; }
             void set_status (const status_t i) { status = i; }
 
           private:
-            size_t seed_index;
+            size_t seed_index, sequence;
             status_t status;
 
         };
@@ -16,11 +16,15 @@
 #define __dwi_tractography_tracking_shared_h__
 
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <vector>
 
 #include "header.h"
 #include "image.h"
 #include "memory.h"
+#include "thread.h"
+#include "math/rng.h"
 #include "transform.h"
 #include "dwi/tractography/properties.h"
 #include "dwi/tractography/roi.h"
@@ -34,6 +38,11 @@
 //#define DEBUG_TERMINATIONS
 
 
+// Maximum number of streamlines held by the writer awaiting earlier ones in the
+//   sequence during reproducible tracking, per tracking thread
+#define TRACKING_MAX_PENDING_PER_THREAD 100
+
+
 namespace MR
 {
   namespace DWI
@@ -69,6 +78,10 @@ namespace MR
               rk4 (false),
               stop_on_all_include (false),
               implicit_max_num_seeds (properties.find ("max_num_seeds") == properties.end()),
+              ordered (false),
+              rng_seed (0),
+              shard_index (0),
+              shard_count (1),
               downsampler ()
 #ifdef DEBUG_TERMINATIONS
             , debug_header (Header::open (properties.find ("act") == properties.end() ? diff_path : properties["act"])),
@@ -93,6 +106,31 @@ namespace MR
                 max_num_seeds = TCKGEN_DEFAULT_SEED_TO_SELECT_RATIO * max_num_tracks;
                 properties.set (max_num_seeds, "max_num_seeds");
 
+                ordered = (properties.find ("rng_seed") != properties.end() || properties.find ("shard") != properties.end());
+                rng_seed = Math::RNG::get_seed();
+                properties.set (rng_seed, "rng_seed");
+
+                if (properties.find ("shard") != properties.end()) {
+                  auto V = parse_ints (properties["shard"]);
+                  if (V.size() != 2 || V[1] < 1 || V[0] < 0 || V[0] >= V[1])
+                    throw Exception ("invalid shard specification \"" + properties["shard"] + "\"");
+                  if (implicit_max_num_seeds)
+                    throw Exception ("Sharded tracking requires the total number of seeds across all shards to be set explicitly using the -seeds option");
+                  if (max_num_tracks)
+                    throw Exception ("Cannot use -select with -shard; apply the selection when merging shards using tckshardmerge");
+                  shard_index = V[0];
+                  shard_count = V[1];
+                  max_num_seeds = max_num_seeds > shard_index ? (max_num_seeds - shard_index + shard_count - 1) / shard_count : 0;
+                  properties["max_num_seeds"] = str (max_num_seeds);
+                }
+
+                if (ordered) {
+                  if (properties.seeds.is_finite())
+                    throw Exception ("Reproducible tracking (-rng_seed / -shard) cannot be used with a finite seeding mechanism");
+                  if (properties.find ("seed_dynamic") != properties.end())
+                    throw Exception ("Reproducible tracking (-rng_seed / -shard) cannot be used with dynamic seeding");
+                }
+
                 assert (properties.seeds.num_seeds());
                 max_seed_attempts = properties.seeds[0]->get_max_attempts();
                 properties.set (max_seed_attempts, "max_seed_attempts");
@@ -119,6 +157,11 @@ namespace MR
                   terminations[i] = 0;
                 for (size_t i = 0; i != REJECTION_REASON_COUNT; ++i)
                   rejections[i] = 0;
+                next_sequence = 0;
+                written_sequence = 0;
+                sequence_waiters = 0;
+                writer_finished = false;
+                max_pending = TRACKING_MAX_PENDING_PER_THREAD * std::max (Thread::number_of_threads(), size_t(1));
 
 #ifdef DEBUG_TERMINATIONS
                 debug_header.ndim() = 3;
@@ -213,6 +256,45 @@ namespace MR
             float step_size, threshold, init_threshold;
             size_t max_seed_attempts;
             bool unidirectional, rk4, stop_on_all_include, implicit_max_num_seeds;
+
+            // Members for counter-based random number generation:
+            //   each streamline attempt claims the next local sequence number,
+            //   which maps to a global stream index that is unique across shards
+            bool ordered;
+            uint64_t rng_seed;
+            size_t shard_index, shard_count;
+            size_t claim_sequence() const { return next_sequence++; }
+            size_t stream_index (const size_t sequence) const { return shard_index + shard_count * sequence; }
+
+            // Streamlines that reach the writer ahead of sequence must be held until
+            //   the preceding ones arrive; to bound the number held, a tracking thread
+            //   does not begin a streamline until it is within max_pending of the next
+            //   one to be written. Returns false once the writer has stopped accepting
+            //   streamlines.
+            bool wait_for_sequence (const size_t sequence) const
+            {
+              if (sequence < written_sequence + max_pending)
+                return !writer_finished;
+              std::unique_lock<std::mutex> lock (sequence_mutex);
+              ++sequence_waiters;
+              sequence_written.wait (lock, [&] { return writer_finished || sequence < written_sequence + max_pending; });
+              --sequence_waiters;
+              return !writer_finished;
+            }
+            void set_written_sequence (const size_t sequence) const
+            {
+              written_sequence = sequence;
+              if (sequence_waiters) {
+                std::lock_guard<std::mutex> lock (sequence_mutex);
+                sequence_written.notify_all();
+              }
+            }
+            void set_writer_finished () const
+            {
+              std::lock_guard<std::mutex> lock (sequence_mutex);
+              writer_finished = true;
+              sequence_written.notify_all();
+            }
             DWI::Tractography::Resampling::Downsampler downsampler;
 
             // Additional members for ACT
@@ -285,6 +367,11 @@ namespace MR
           private:
             mutable std::atomic<size_t> terminations[TERMINATION_REASON_COUNT];
             mutable std::atomic<size_t> rejections  [REJECTION_REASON_COUNT];
+            mutable std::atomic<size_t> next_sequence, written_sequence, sequence_waiters;
+            mutable std::atomic<bool> writer_finished;
+            mutable std::mutex sequence_mutex;
+            mutable std::condition_variable sequence_written;
+            size_t max_pending;
 
             std::unique_ptr<ACT::ACT_Shared_additions> act_shared_additions;
 
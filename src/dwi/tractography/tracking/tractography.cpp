@@ -92,6 +92,35 @@ namespace MR
 
 
 
+      const OptionGroup ShardOption = OptionGroup ("Reproducible and distributed tractography options")
+
+      + Option ("rng_seed",
+            "set the seed of the counter-based random number generator used during tracking. "
+            "Each streamline is generated from its own random number stream, "
+            "determined only by this seed and the index of that streamline; "
+            "if this option is provided, streamlines are written in index order, "
+            "such that the output is identical regardless of the number of threads used. "
+            "(default: random, or the value of the MRTRIX_RNG_SEED environment variable; "
+            "the value used is recorded in the output file header)")
+          + Argument ("value").type_integer (0)
+
+      + Option ("shard",
+            "only generate streamlines whose index i satisfies i mod count == index. "
+            "This allows a single tracking job to be split across multiple processes or machines; "
+            "each must be given the same -rng_seed and -seeds values, with -seeds specifying the "
+            "total number of seeds across all shards. The shards can then be recombined "
+            "into exactly the output of a single run using tckshardmerge. "
+            "Cannot be combined with -select, finite seeding mechanisms, or -seed_dynamic.")
+          + Argument ("index").type_integer (0)
+          + Argument ("count").type_integer (1)
+
+      + Option ("output_indices",
+            "output the global index of each streamline written to the output track file "
+            "(as required by tckshardmerge) to a text file")
+          + Argument ("path").type_file_out();
+
+
+
       void load_streamline_properties (Properties& properties)
       {
 
@@ -156,6 +185,19 @@ namespace MR
         opt = get_options ("grad");
         if (opt.size()) properties["DW_scheme"] = std::string (opt[0][0]);
 
+        opt = get_options ("rng_seed");
+        if (opt.size()) properties["rng_seed"] = str<uint64_t> (opt[0][0]);
+
+        opt = get_options ("shard");
+        if (opt.size()) {
+          if (int(opt[0][0]) >= int(opt[0][1]))
+            throw Exception ("shard index must be less than the number of shards");
+          properties["shard"] = str<int> (opt[0][0]) + "," + str<int> (opt[0][1]);
+        }
+
+        opt = get_options ("output_indices");
+        if (opt.size()) properties["index_output"] = std::string (opt[0][0]);
+
       }
 
 
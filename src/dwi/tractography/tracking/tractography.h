@@ -42,6 +42,7 @@ namespace MR
       {
 
         extern const App::OptionGroup TrackOption;
+        extern const App::OptionGroup ShardOption;
 
         void load_streamline_properties (Properties&);
 
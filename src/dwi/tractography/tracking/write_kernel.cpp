@@ -26,13 +26,65 @@ namespace MR
 
 
           bool WriteKernel::operator() (const GeneratedTrack& tck)
+          {
+            if (!S.ordered)
+              return write (tck);
+            if (tck.get_sequence() != next_sequence) {
+              pending.insert (std::make_pair (tck.get_sequence(), tck));
+              return true;
+            }
+            if (!write (tck)) {
+              S.set_writer_finished();
+              return false;
+            }
+            ++next_sequence;
+            for (auto i = pending.begin(); i != pending.end() && i->first == next_sequence; i = pending.erase (i)) {
+              if (!write (i->second)) {
+                S.set_writer_finished();
+                return false;
+              }
+              ++next_sequence;
+            }
+            S.set_written_sequence (next_sequence);
+            return true;
+          }
+
+
+
+          void WriteKernel::flush_pending ()
+          {
+            // Streamlines can only remain here if a preceding one in the sequence was
+            //   never received; write them in order, unless the target has been reached
+            size_t missing = 0;
+            for (const auto& i : pending) {
+              if (complete())
+                break;
+              missing += i.first - next_sequence;
+              if (!write (i.second))
+                break;
+              next_sequence = i.first + 1;
+            }
+            pending.clear();
+            if (missing)
+              WARN (str(missing) + " streamline" + (missing > 1 ? "s" : "") + " missing from the generation sequence; "
+                    "output may not be reproducible");
+          }
+
+
+
+          bool WriteKernel::write (const GeneratedTrack& tck)
           {
             if (complete())
               return false;
+            // Placeholder for a sequence number for which no seed could be drawn
+            if (tck.get_status() == GeneratedTrack::status_t::INVALID)
+              return true;
             if (tck.size() && output_seeds) {
               const auto& p = tck[tck.get_seed_index()];
               (*output_seeds) << str(writer.count) << "," << str(tck.get_seed_index()) << "," << str(p[0]) << "," << str(p[1]) << "," << str(p[2]) << ",\n";
             }
+            if (tck.size() && output_indices)
+              (*output_indices) << str(S.stream_index (tck.get_sequence())) << "\n";
             writer (tck);
             switch (tck.get_status()) {
               case GeneratedTrack::status_t::INVALID: assert (0); break;
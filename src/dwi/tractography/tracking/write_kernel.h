@@ -15,6 +15,7 @@
 #ifndef __dwi_tractography_tracking_write_kernel_h__
 #define __dwi_tractography_tracking_write_kernel_h__
 
+#include <map>
 #include <string>
 #include <vector>
 #include <cinttypes>
@@ -57,14 +58,18 @@ namespace MR
                 seeds (0),
                 streamlines (0),
                 selected (0),
+                next_sequence (0),
                 progress (printf ("       0 seeds,        0 streamlines,        0 selected", 0, 0), always_increment ? S.max_num_seeds : S.max_num_tracks),
                 early_exit (shared)
           {
-            const auto p = properties.find ("seed_output");
+            auto p = properties.find ("seed_output");
             if (p != properties.end()) {
               output_seeds.reset (new File::OFStream (p->second, std::ios_base::out | std::ios_base::trunc));
               (*output_seeds) << "#Track_index,Seed_index,Pos_x,Pos_y,Pos_z,\n";
             }
+            p = properties.find ("index_output");
+            if (p != properties.end())
+              output_indices.reset (new File::OFStream (p->second, std::ios_base::out | std::ios_base::trunc));
           }
 
           WriteKernel (const WriteKernel&) = delete;
@@ -72,6 +77,14 @@ namespace MR
 
           ~WriteKernel ()
           {
+            S.set_writer_finished();
+            if (pending.size()) {
+              try {
+                flush_pending();
+              } catch (Exception& e) {
+                e.display();
+              }
+            }
             // Use set_text() rather than update() here to force update of the text before progress goes out of scope
             progress.set_text (printf ("%8" PRIu64 " seeds, %8" PRIu64 " streamlines, %8" PRIu64 " selected", seeds, streamlines, selected));
             if (warn_on_max_seeds && writer.total_count == S.max_num_seeds
@@ -82,6 +95,8 @@ namespace MR
               (*output_seeds) << "\n";
               output_seeds->close();
             }
+            if (output_indices)
+              output_indices->close();
 
           }
 
@@ -96,9 +111,18 @@ namespace MR
           Writer<> writer;
           const bool always_increment, warn_on_max_seeds;
           size_t seeds, streamlines, selected;
-          std::unique_ptr<File::OFStream> output_seeds;
+          std::unique_ptr<File::OFStream> output_seeds, output_indices;
+
+          // In reproducible mode, streamlines are written in sequence order;
+          //   any that arrive early from the tracking threads are held here
+          //   (the number of these is bounded by SharedBase::wait_for_sequence())
+          std::map<size_t, GeneratedTrack> pending;
+          size_t next_sequence;
           ProgressBar progress;
           EarlyExit early_exit;
+
+          bool write (const GeneratedTrack&);
+          void flush_pending ();
       };
 
 
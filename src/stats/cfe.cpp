@@ -86,10 +86,11 @@ namespace MR
 
 
 
-      Enhancer::Enhancer (const vector<std::map<uint32_t, connectivity> >& connectivity_map,
-                          const value_type dh,
-                          const value_type E,
-                          const value_type H) :
+      template <typename ValueType>
+      Enhancer<ValueType>::Enhancer (const vector<std::map<uint32_t, connectivity> >& connectivity_map,
+                                     const default_type dh,
+                                     const default_type E,
+                                     const default_type H) :
           connectivity_map (connectivity_map),
           dh (dh),
           E (E),
@@ -97,19 +98,22 @@ namespace MR
 
 
 
-      value_type Enhancer::operator() (const vector_type& stats, vector_type& enhanced_stats) const
+      template <typename ValueType>
+      ValueType Enhancer<ValueType>::operator() (const vector_type& stats, vector_type& enhanced_stats) const
       {
         enhanced_stats = vector_type::Zero (stats.size());
         value_type max_enhanced_stat = 0.0;
         for (size_t fixel = 0; fixel < connectivity_map.size(); ++fixel) {
           std::map<uint32_t, connectivity>::const_iterator connected_fixel;
-          for (value_type h = this->dh; h < stats[fixel]; h +=  this->dh) {
-            value_type extent = 0.0;
+          default_type enhanced_stat = 0.0;
+          for (default_type h = this->dh; h < stats[fixel]; h +=  this->dh) {
+            default_type extent = 0.0;
             for (connected_fixel = connectivity_map[fixel].begin(); connected_fixel != connectivity_map[fixel].end(); ++connected_fixel)
               if (stats[connected_fixel->first] > h)
                 extent += connected_fixel->second.value;
-            enhanced_stats[fixel] += std::pow (extent, E) * std::pow (h, H);
+            enhanced_stat += std::pow (extent, E) * std::pow (h, H);
           }
+          enhanced_stats[fixel] = enhanced_stat;
           if (enhanced_stats[fixel] > max_enhanced_stat)
             max_enhanced_stat = enhanced_stats[fixel];
         }
@@ -119,6 +123,29 @@ namespace MR
 
 
 
+      // The connectivity matrix is summarised by its number of entries and an
+      //   index-weighted sum of their values, which suffices to detect differences
+      //   in the tractogram or the connectivity parameters
+      template <typename ValueType>
+      std::string Enhancer<ValueType>::parameters () const
+      {
+        size_t count = 0;
+        default_type sum = 0.0;
+        for (const auto& fixel : connectivity_map) {
+          count += fixel.size();
+          for (const auto& connected_fixel : fixel)
+            sum += connected_fixel.first * default_type (connected_fixel.second.value);
+        }
+        return "CFE dh=" + str(dh) + " E=" + str(E) + " H=" + str(H) + " connectivity=" + str(count) + "," + str(sum, 17);
+      }
+
+
+
+      template class Enhancer<float>;
+      template class Enhancer<double>;
+
+
+
     }
   }
 }
@@ -78,21 +78,35 @@ namespace MR
 
 
 
-      class Enhancer : public Stats::EnhancerBase { MEMALIGN (Enhancer)
+      // The CFE parameters, and the integration of the enhanced statistic for each
+      //   fixel, are handled in double precision regardless of the precision of the
+      //   test statistics
+      template <typename ValueType>
+      class Enhancer : public Stats::EnhancerBase<ValueType> { MEMALIGN (Enhancer<ValueType>)
         public:
+          using value_type = ValueType;
+          using vector_type = typename Stats::EnhancerBase<ValueType>::vector_type;
+
           Enhancer (const vector<std::map<uint32_t, connectivity> >& connectivity_map,
-                    const value_type dh, const value_type E, const value_type H);
+                    const default_type dh, const default_type E, const default_type H);
 
 
           value_type operator() (const vector_type& stats, vector_type& enhanced_stats) const override;
 
+          std::string parameters () const override;
+
 
         protected:
           const vector<std::map<uint32_t, connectivity> >& connectivity_map;
-          const value_type dh, E, H;
+          const default_type dh, E, H;
       };
 
 
+
+      extern template class Enhancer<float>;
+      extern template class Enhancer<double>;
+
+
       //! @}
 
     }
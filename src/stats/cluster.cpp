@@ -25,7 +25,8 @@ namespace MR
 
 
 
-      value_type ClusterSize::operator() (const vector_type& stats, const value_type T, vector_type& get_cluster_sizes) const
+      template <typename ValueType>
+      ValueType ClusterSize<ValueType>::operator() (const vector_type& stats, const value_type T, vector_type& get_cluster_sizes) const
       {
         vector<Filter::cluster> clusters;
         vector<uint32_t> labels (stats.size(), 0);
@@ -39,6 +40,11 @@ namespace MR
 
 
 
+      template class ClusterSize<float>;
+      template class ClusterSize<double>;
+
+
+
     }
   }
 }
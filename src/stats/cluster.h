@@ -29,14 +29,14 @@ namespace MR
     {
 
 
-      using value_type = Math::Stats::value_type;
-      using vector_type = Math::Stats::vector_type;
-
-
       /** \addtogroup Statistics
       @{ */
-      class ClusterSize : public Stats::TFCE::EnhancerBase { MEMALIGN (ClusterSize)
+      template <typename ValueType>
+      class ClusterSize : public Stats::TFCE::EnhancerBase<ValueType> { MEMALIGN (ClusterSize<ValueType>)
         public:
+          using value_type = ValueType;
+          using vector_type = typename Stats::TFCE::EnhancerBase<ValueType>::vector_type;
+
           ClusterSize (const Filter::Connector& connector, const value_type T) :
                        connector (connector), threshold (T) { }
 
@@ -49,6 +49,10 @@ namespace MR
 
           value_type operator() (const vector_type&, const value_type, vector_type&) const override;
 
+          const vector<vector<uint32_t>>* get_adjacency() const override { return &connector.adjacent_indices; }
+
+          std::string parameters () const override { return "cluster size threshold=" + str(threshold); }
+
 
         protected:
           const Filter::Connector& connector;
@@ -58,6 +62,11 @@ namespace MR
 
 
 
+      extern template class ClusterSize<float>;
+      extern template class ClusterSize<double>;
+
+
+
     }
   }
 }
@@ -15,6 +15,8 @@
 #ifndef __stats_enhance_h__
 #define __stats_enhance_h__
 
+#include <string>
+
 #include "math/stats/typedefs.h"
 
 namespace MR
@@ -25,13 +27,22 @@ namespace MR
 
 
     // This class defines the standardised interface by which statistical enhancement
-    //   is performed.
+    //   is performed. It is templated on the precision of the test statistics, such
+    //   that the permutation testing framework can operate in single precision.
+    template <typename ValueType>
     class EnhancerBase
     { NOMEMALIGN
       public:
+        using value_type = ValueType;
+        using vector_type = Eigen::Array<value_type, Eigen::Dynamic, 1>;
 
         // Return value is the maximal enhanced statistic
-        virtual Math::Stats::value_type operator() (const Math::Stats::vector_type& /*input_statistics*/, Math::Stats::vector_type& /*enhanced_statistics*/) const = 0;
+        virtual value_type operator() (const vector_type& /*input_statistics*/, vector_type& /*enhanced_statistics*/) const = 0;
+
+        // A description of all parameters that influence the enhanced statistics;
+        //   used to verify that partial permutation testing results being combined
+        //   were generated using identical settings
+        virtual std::string parameters () const = 0;
 
     };
 
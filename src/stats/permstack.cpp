@@ -23,28 +23,41 @@ namespace MR
 
 
 
-      PermutationStack::PermutationStack (const size_t num_permutations, const size_t num_samples, const std::string msg, const bool include_default) :
+      PermutationStack::PermutationStack (const size_t num_permutations, const size_t num_samples, const uint64_t seed, const std::string msg,
+                                          const bool include_default, const uint64_t first_stream) :
           num_permutations (num_permutations),
+          selection (num_permutations),
           counter (0),
+          block_end (num_permutations),
           progress (msg, num_permutations)
       {
-        Math::Stats::Permutation::generate (num_permutations, num_samples, permutations, include_default);
+        Math::Stats::Permutation::generate (num_permutations, num_samples, seed, permutations, include_default, first_stream);
+        for (size_t i = 0; i != num_permutations; ++i)
+          selection[i] = i;
       }
 
       PermutationStack::PermutationStack (vector <vector<size_t> >& permutations, const std::string msg) :
           num_permutations (permutations.size()),
           permutations (permutations),
+          selection (permutations.size()),
           counter (0),
-          progress (msg, permutations.size()) { }
+          block_end (permutations.size()),
+          progress (msg, permutations.size())
+      {
+        for (size_t i = 0; i != num_permutations; ++i)
+          selection[i] = i;
+      }
 
 
 
       bool PermutationStack::operator() (Permutation& out)
       {
-        if (counter < num_permutations) {
-          out.index = counter;
-          out.data = permutations[counter++];
+        if (counter < block_end) {
+          out.index = selection[counter++];
+          out.data = permutations[out.index];
           ++progress;
+          if (finished())
+            progress.done();
           return true;
         } else {
           out.index = num_permutations;
@@ -55,6 +68,28 @@ namespace MR
 
 
 
+      void PermutationStack::select (const vector<size_t>& indices)
+      {
+        for (auto i : indices) {
+          if (i >= num_permutations)
+            throw Exception ("permutation index " + str(i) + " out of range (" + str(num_permutations) + " permutations)");
+        }
+        selection = indices;
+        counter = 0;
+        block_end = selection.size();
+        progress.set_max (selection.size());
+      }
+
+
+
+      vector<size_t> PermutationStack::next_block (const size_t count)
+      {
+        block_end = std::min (counter + count, selection.size());
+        return vector<size_t> (selection.begin() + counter, selection.begin() + block_end);
+      }
+
+
+
     }
   }
 }
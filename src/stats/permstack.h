@@ -41,7 +41,8 @@ namespace MR
       class PermutationStack 
       { MEMALIGN (PermutationStack)
         public:
-          PermutationStack (const size_t num_permutations, const size_t num_samples, const std::string msg, const bool include_default = true);
+          PermutationStack (const size_t num_permutations, const size_t num_samples, const uint64_t seed, const std::string msg,
+                            const bool include_default = true, const uint64_t first_stream = 0);
 
           PermutationStack (vector <vector<size_t> >& permutations, const std::string msg);
 
@@ -51,11 +52,26 @@ namespace MR
             return permutations[index];
           }
 
+          //! only process the permutations with the given indices, in the order provided
+          void select (const vector<size_t>& indices);
+
+          //! make only the next \a count selected permutations available for processing
+          /*! This allows the permutations to be processed in successive blocks, with
+           * control returning to the caller between blocks; the indices of the
+           * permutations within the block are returned. */
+          vector<size_t> next_block (const size_t count);
+
+          bool finished () const { return counter == selection.size(); }
+
+          //! discard any permutations not yet processed
+          void done () { selection.resize (counter); block_end = counter; progress.done(); }
+
           const size_t num_permutations;
 
         protected:
           vector< vector<size_t> > permutations;
-          size_t counter;
+          vector<size_t> selection;
+          size_t counter, block_end;
           ProgressBar progress;
       };
 
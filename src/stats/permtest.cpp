@@ -14,6 +14,13 @@
 
 #include "stats/permtest.h"
 
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include "math/rng.h"
+#include "file/ofstream.h"
+
 namespace MR
 {
   namespace Stats
@@ -35,7 +42,37 @@ namespace MR
                                     "where each relabelling is defined as a column vector of size    m, and the number of columns, n, defines "
                                     "the number of permutations. Can be generated with the palm_quickperms function in PALM (http://fsl.fmrib.ox.ac.uk/fsl/fslwiki/PALM). "
                                     "Overrides the nperms option.")
-            + Argument ("file").type_file_in();
+            + Argument ("file").type_file_in()
+          + Option ("rng_seed", "set the seed used to generate the random permutations. Each permutation is determined "
+                                "only by this seed and its index, such that the permutation test can be divided between "
+                                "multiple runs (see the -permutation_range option) with a result identical to that of a "
+                                "single run (default: random, or the value of the MRTRIX_RNG_SEED environment variable; "
+                                "or the value stored in the file(s) provided via the -checkpoint or -merge options)")
+            + Argument ("value").type_integer (0)
+          + Option ("permutation_range", "only evaluate the permutations with indices from first to last inclusive (indexed "
+                                         "from zero). The partial results are written to the file provided via the -checkpoint "
+                                         "option, and no permutation testing outputs are generated; once all permutations have "
+                                         "been evaluated, the files from all runs are combined using the -merge option. "
+                                         "Note that each such run repeats all processing other than the permutations themselves, "
+                                         "including the pre-computation of the empirical statistic for non-stationarity adjustment "
+                                         "if requested, and the generation of all outputs that do not depend on the permutations. "
+                                         "Requires the -rng_seed and -checkpoint options.")
+            + Argument ("first").type_integer (0)
+            + Argument ("last").type_integer (0)
+          + Option ("checkpoint", "periodically save the progress of the permutation test to file. If this file already exists, "
+                                  "the permutations recorded within it are not evaluated again, such that an interrupted run "
+                                  "can be resumed.")
+            + Argument ("path").type_text()
+          + Option ("merge", "rather than evaluating the permutations, combine the files generated by runs over separate "
+                             "permutation ranges (see the -permutation_range option) to generate the final permutation testing "
+                             "outputs. All other inputs and options must match those of the original runs. This option "
+                             "can be specified multiple times, once per file.").allow_multiple()
+            + Argument ("path").type_file_in()
+          + Option ("single_precision", "hold the measurement data, test statistics and enhanced statistics in single rather "
+                                        "than double precision, and evaluate the GLM in single precision. This halves the memory "
+                                        "required and speeds up the permutation test, at the cost of numerical accuracy: test statistics "
+                                        "typically differ from those obtained in double precision by around 1e-6, and p-values can "
+                                        "change where a permuted statistic is very close to the default statistic.");
 
         if (include_nonstationarity) {
           result
@@ -47,15 +84,234 @@ namespace MR
                                                   "and the number of columns, n, defines the number of permutations. Can be generated with the palm_quickperms function in PALM "
                                                   "(http://fsl.fmrib.ox.ac.uk/fsl/fslwiki/PALM) "
                                                   "Overrides the nperms_nonstationary option.")
-            + Argument ("file").type_file_in();
+            + Argument ("file").type_file_in()
+          + Option ("nonstationary_tolerance", "compute the empirical statistic image for nonstationary correction adaptively: the permutations are "
+                                               "processed in blocks of " + str(NONSTATIONARITY_BLOCK_SIZE) + ", and the remaining permutations are skipped "
+                                               "once the standard error of the estimated empirical statistic in every element, relative to the estimate itself, "
+                                               "falls below this value. The number of permutations set by the -nperms_nonstationary or "
+                                               "-permutations_nonstationary option then serves as an upper limit. (Default: all permutations are used)")
+            + Argument ("value").type_float (0.0);
+        }
+
+
+        return result;
+      }
+
+
+
+      uint64_t rng_seed ()
+      {
+        static bool initialised = false;
+        static uint64_t seed = 0;
+        if (!initialised) {
+          auto opt = App::get_options ("rng_seed");
+          if (opt.size()) {
+            seed = opt[0][0].as_uint();
+          } else if ((opt = App::get_options ("merge")).size()) {
+            seed = Checkpoint::read_seed (opt[0][0]);
+          } else if ((opt = App::get_options ("checkpoint")).size() && Path::exists (opt[0][0])) {
+            seed = Checkpoint::read_seed (opt[0][0]);
+          } else {
+            if (App::get_options ("permutation_range").size())
+              throw Exception ("the -rng_seed option must be provided when using the -permutation_range option");
+            seed = Math::RNG::get_seed();
+          }
+          INFO ("random number seed for permutation testing: " + str(seed));
+          initialised = true;
+        }
+        return seed;
+      }
+
+
+
+      bool single_precision ()
+      {
+        return App::get_options ("single_precision").size();
+      }
+
+
+
+      std::string get_checkpoint_path ()
+      {
+        auto opt = App::get_options ("checkpoint");
+        return opt.size() ? std::string (opt[0][0]) : std::string();
+      }
+
+
+
+      void get_permutation_range (const size_t num_permutations, size_t& first, size_t& last)
+      {
+        first = 0;
+        last = num_permutations - 1;
+        auto opt = App::get_options ("permutation_range");
+        if (opt.size()) {
+          if (!App::get_options ("checkpoint").size())
+            throw Exception ("the -checkpoint option must be provided when using the -permutation_range option");
+          first = opt[0][0];
+          last = opt[0][1];
+          if (first > last || last >= num_permutations)
+            throw Exception ("invalid permutation range [" + str(first) + ", " + str(last) + "] for " + str(num_permutations) + " permutations");
+        }
+      }
+
+
+
+      default_type get_nonstationarity_tolerance ()
+      {
+        return App::get_option_value ("nonstationary_tolerance", 0.0);
+      }
+
+
+
+      std::string nonstationarity_parameters ()
+      {
+        std::string result = "nonstationary tolerance=" + str(get_nonstationarity_tolerance());
+        auto opt = App::get_options ("permutations_nonstationary");
+        if (opt.size()) {
+          std::ifstream in (opt[0][0]);
+          result += " permutations=" + std::string (std::istreambuf_iterator<char> (in), std::istreambuf_iterator<char>());
+        } else {
+          result += " nperms=" + str(App::get_option_value ("nperms_nonstationary", DEFAULT_NUMBER_PERMUTATIONS_NONSTATIONARITY));
         }
+        return result;
+      }
 
 
+
+      uint64_t hash (const std::string& data)
+      {
+        uint64_t result = 14695981039346656037ULL;
+        for (const auto c : data) {
+          result ^= uint8_t (c);
+          result *= 1099511628211ULL;
+        }
         return result;
       }
 
 
 
+      namespace {
+        const char* checkpoint_signature = "mrtrix permutation test";
+      }
+
+
+
+      Checkpoint::Checkpoint (const uint64_t seed, const uint64_t fingerprint, const size_t num_permutations, const size_t num_subjects, const size_t num_elements, const bool negative) :
+          seed (seed),
+          fingerprint (fingerprint),
+          num_subjects (num_subjects),
+          num_elements (num_elements),
+          negative (negative),
+          done (num_permutations, false),
+          perm_dist (num_permutations, 0.0),
+          perm_dist_neg (negative ? num_permutations : 0, 0.0),
+          uncorrected_pvalue_count (num_elements, 0)
+      {
+        if (negative)
+          uncorrected_pvalue_count_neg.reset (new vector<size_t> (num_elements, 0));
+      }
+
+
+
+      void Checkpoint::load (const std::string& path)
+      {
+        std::ifstream in (path);
+        if (!in)
+          throw Exception ("error opening permutation test file \"" + path + "\": " + strerror (errno));
+
+        std::string signature;
+        std::getline (in, signature);
+        if (signature != checkpoint_signature)
+          throw Exception ("file \"" + path + "\" is not a permutation test file");
+
+        uint64_t file_seed, file_fingerprint;
+        size_t file_num_permutations, file_num_subjects, file_num_elements, num_entries;
+        bool file_negative;
+        std::string key;
+        if (!(in >> key >> file_seed >> key >> file_num_permutations >> key >> file_num_subjects
+                 >> key >> file_num_elements >> key >> file_negative >> key >> file_fingerprint >> key >> num_entries))
+          throw Exception ("malformed header in permutation test file \"" + path + "\"");
+        if (file_seed != seed || file_num_permutations != done.size() || file_num_subjects != num_subjects
+            || file_num_elements != num_elements || file_negative != negative)
+          throw Exception ("permutation test file \"" + path + "\" was generated from a different experiment "
+                           "(seed " + str(file_seed) + ", " + str(file_num_permutations) + " permutations, "
+                           + str(file_num_subjects) + " subjects, " + str(file_num_elements) + " elements)");
+        if (file_fingerprint != fingerprint)
+          throw Exception ("permutation test file \"" + path + "\" was generated using a different design matrix, contrast, "
+                           "statistical enhancement parameters or non-stationarity adjustment settings");
+
+        for (size_t n = 0; n != num_entries; ++n) {
+          size_t index;
+          default_type value, value_neg = 0.0;
+          if (!(in >> index >> value) || (negative && !(in >> value_neg)) || index >= done.size())
+            throw Exception ("malformed permutation entry in file \"" + path + "\"");
+          if (done[index])
+            throw Exception ("permutation " + str(index) + " from file \"" + path + "\" has already been evaluated");
+          set (index, value, value_neg);
+        }
+
+        for (size_t i = 0; i != num_elements; ++i) {
+          size_t count, count_neg = 0;
+          if (!(in >> count) || (negative && !(in >> count_neg)))
+            throw Exception ("malformed uncorrected p-value counts in file \"" + path + "\"");
+          uncorrected_pvalue_count[i] += count;
+          if (negative)
+            (*uncorrected_pvalue_count_neg)[i] += count_neg;
+        }
+      }
+
+
+
+      void Checkpoint::save (const std::string& path) const
+      {
+        const std::string temp_path = path + ".tmp";
+        {
+          File::OFStream out (temp_path);
+          out << checkpoint_signature << "\n"
+              << "seed: " << seed << "\n"
+              << "permutations: " << done.size() << "\n"
+              << "subjects: " << num_subjects << "\n"
+              << "elements: " << num_elements << "\n"
+              << "negative: " << negative << "\n"
+              << "fingerprint: " << fingerprint << "\n"
+              << "completed: " << num_completed() << "\n";
+          out.precision (17);
+          for (size_t i = 0; i != done.size(); ++i) {
+            if (done[i]) {
+              out << i << " " << perm_dist[i];
+              if (negative)
+                out << " " << perm_dist_neg[i];
+              out << "\n";
+            }
+          }
+          for (size_t i = 0; i != num_elements; ++i) {
+            out << uncorrected_pvalue_count[i];
+            if (negative)
+              out << " " << (*uncorrected_pvalue_count_neg)[i];
+            out << "\n";
+          }
+          if (!out)
+            throw Exception ("error writing permutation test file \"" + temp_path + "\"");
+        }
+        if (std::rename (temp_path.c_str(), path.c_str()))
+          throw Exception ("error renaming permutation test file \"" + temp_path + "\" to \"" + path + "\": " + strerror (errno));
+      }
+
+
+
+      uint64_t Checkpoint::read_seed (const std::string& path)
+      {
+        std::ifstream in (path);
+        std::string signature, key;
+        uint64_t seed;
+        std::getline (in, signature);
+        if (signature != checkpoint_signature || !(in >> key >> seed))
+          throw Exception ("file \"" + path + "\" is not a permutation test file");
+        return seed;
+      }
+
+
+
     }
   }
 }
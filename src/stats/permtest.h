@@ -15,6 +15,7 @@
 #ifndef __stats_permtest_h__
 #define __stats_permtest_h__
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 
@@ -22,6 +23,9 @@
 #include "progressbar.h"
 #include "thread.h"
 #include "thread_queue.h"
+#include "timer.h"
+#include "file/config.h"
+#include "file/path.h"
 #include "math/math.h"
 #include "math/stats/permutation.h"
 #include "math/stats/typedefs.h"
@@ -32,6 +36,8 @@
 
 #define DEFAULT_NUMBER_PERMUTATIONS 5000
 #define DEFAULT_NUMBER_PERMUTATIONS_NONSTATIONARITY 5000
+#define NONSTATIONARITY_BLOCK_SIZE 100
+#define NONSTATIONARITY_FIRST_STREAM (uint64_t(1) << 63)
 
 
 namespace MR
@@ -41,26 +47,125 @@ namespace MR
     namespace PermTest
     {
 
-      using value_type = Math::Stats::value_type;
-      using vector_type = Math::Stats::vector_type;
+      const App::OptionGroup Options (const bool include_nonstationarity);
 
 
+      //! the seed from which all random permutations are generated
+      /*! This is taken from the -rng_seed option if provided; otherwise from
+       * the file(s) provided via the -merge or -checkpoint options, such that
+       * permutations are regenerated identically when combining or resuming
+       * runs; otherwise it is drawn at random (or from the MRTRIX_RNG_SEED
+       * environment variable). The same value is returned on every call. */
+      uint64_t rng_seed ();
 
-      const App::OptionGroup Options (const bool include_nonstationarity);
+      //! whether the -single_precision option was provided
+      bool single_precision ();
+
+      //! the path provided via the -checkpoint option, or an empty string
+      std::string get_checkpoint_path ();
+
+      //! the range of permutation indices to be evaluated in this run (inclusive)
+      void get_permutation_range (const size_t num_permutations, size_t& first, size_t& last);
+
+      //! the value provided via the -nonstationary_tolerance option, or zero
+      default_type get_nonstationarity_tolerance ();
+
+      //! a description of the options controlling the non-stationarity adjustment
+      std::string nonstationarity_parameters ();
+
+      //! a 64-bit FNV-1a hash of \a data
+      uint64_t hash (const std::string& data);
+
+      //! a hash of all settings that influence the permuted statistics
+      /*! This covers the statistical enhancement parameters, the settings for
+       * non-stationarity adjustment if used, and the design and contrast
+       * matrices, such that partial results generated with different settings
+       * are not inadvertently combined. */
+      template <class StatsType>
+        uint64_t fingerprint (const StatsType& stats_calculator,
+                              const std::shared_ptr<EnhancerBase<typename StatsType::value_type>> enhancer,
+                              const bool nonstationary)
+        {
+          std::string description = enhancer ? enhancer->parameters() : std::string ("none");
+          if (nonstationary)
+            description += "; " + nonstationarity_parameters();
+          for (const auto* M : { &stats_calculator.design(), &stats_calculator.contrasts() }) {
+            description += "; " + str(M->rows()) + "x" + str(M->cols()) + ": ";
+            description.append (reinterpret_cast<const char*> (M->data()), M->size() * sizeof (typename StatsType::value_type));
+          }
+          return hash (description);
+        }
+
+
+
+      //! The partial results of a permutation testing run
+      /*! For each completed permutation, this stores the maximal enhanced
+       * statistic (for both contrast directions if appropriate); and for each
+       * element, the number of completed permutations for which the default
+       * enhanced statistic exceeded the permuted one. This is sufficient to
+       * resume an interrupted run, or to combine runs over disjoint ranges of
+       * permutations, such that the final result is identical to that of a
+       * single complete run. */
+      class Checkpoint
+      { NOMEMALIGN
+        public:
+          Checkpoint (const uint64_t seed, const uint64_t fingerprint, const size_t num_permutations, const size_t num_subjects, const size_t num_elements, const bool negative);
+
+          //! add the permutations recorded in a file written using save()
+          /*! An exception is thrown if the file was generated from a different
+           * experiment (including different settings, as identified by the
+           * fingerprint), or contains permutations that have already been recorded. */
+          void load (const std::string& path);
+
+          //! write the current state to file
+          /*! The file is first written under a temporary name and then renamed,
+           * such that an interruption during writing cannot corrupt an existing
+           * checkpoint. */
+          void save (const std::string& path) const;
+
+          static uint64_t read_seed (const std::string& path);
+
+          bool completed (const size_t index) const { return done[index]; }
+          size_t num_completed () const { return std::count (done.begin(), done.end(), true); }
+          bool complete () const { return num_completed() == done.size(); }
+
+          void set (const size_t index, const default_type value, const default_type value_neg) {
+            done[index] = true;
+            perm_dist[index] = value;
+            if (negative)
+              perm_dist_neg[index] = value_neg;
+          }
+
+          const uint64_t seed, fingerprint;
+          const size_t num_subjects, num_elements;
+          const bool negative;
+
+          vector<bool> done;
+          vector<default_type> perm_dist, perm_dist_neg;
+          vector<size_t> uncorrected_pvalue_count;
+          std::shared_ptr<vector<size_t>> uncorrected_pvalue_count_neg;
+      };
 
 
-      /*! A class to pre-compute the empirical enhanced statistic image for non-stationarity correction */
+      /*! A class to pre-compute the empirical enhanced statistic image for non-stationarity correction
+       * The enhanced statistics (and their squares) are summed across permutations in double
+       * precision, regardless of the precision of the statistics themselves */
       template <class StatsType>
         class PreProcessor { MEMALIGN (PreProcessor<StatsType>)
           public:
+            using value_type = typename StatsType::value_type;
+            using vector_type = typename StatsType::vector_type;
+            using sum_type = Eigen::Array<default_type, Eigen::Dynamic, 1>;
+
             PreProcessor (const StatsType& stats_calculator,
-                          const std::shared_ptr<EnhancerBase> enhancer,
-                          vector_type& global_enhanced_sum,
+                          const std::shared_ptr<EnhancerBase<value_type>> enhancer,
+                          sum_type& global_enhanced_sum,
+                          sum_type& global_enhanced_sum_sq,
                           vector<size_t>& global_enhanced_count) :
                             stats_calculator (stats_calculator),
-                            enhancer (enhancer), global_enhanced_sum (global_enhanced_sum),
-                            global_enhanced_count (global_enhanced_count), enhanced_sum (vector_type::Zero (global_enhanced_sum.size())),
-                            enhanced_count (global_enhanced_sum.size(), 0.0), stats (global_enhanced_sum.size()),
+                            enhancer (enhancer), global_enhanced_sum (global_enhanced_sum), global_enhanced_sum_sq (global_enhanced_sum_sq),
+                            global_enhanced_count (global_enhanced_count), enhanced_sum (sum_type::Zero (global_enhanced_sum.size())),
+                            enhanced_sum_sq (sum_type::Zero (global_enhanced_sum.size())), enhanced_count (global_enhanced_sum.size(), 0.0), stats (global_enhanced_sum.size()),
                             enhanced_stats (global_enhanced_sum.size()), mutex (new std::mutex()) {}
 
             ~PreProcessor ()
@@ -68,6 +173,7 @@ namespace MR
               std::lock_guard<std::mutex> lock (*mutex);
               for (ssize_t i = 0; i < global_enhanced_sum.size(); ++i) {
                 global_enhanced_sum[i] += enhanced_sum[i];
+                global_enhanced_sum_sq[i] += enhanced_sum_sq[i];
                 global_enhanced_count[i] += enhanced_count[i];
               }
             }
@@ -79,6 +185,7 @@ namespace MR
               for (ssize_t i = 0; i < enhanced_stats.size(); ++i) {
                 if (enhanced_stats[i] > 0.0) {
                   enhanced_sum[i] += enhanced_stats[i];
+                  enhanced_sum_sq[i] += Math::pow2 (default_type (enhanced_stats[i]));
                   enhanced_count[i]++;
                 }
               }
@@ -87,10 +194,12 @@ namespace MR
 
           protected:
             StatsType stats_calculator;
-            std::shared_ptr<EnhancerBase> enhancer;
-            vector_type& global_enhanced_sum;
+            std::shared_ptr<EnhancerBase<value_type>> enhancer;
+            sum_type& global_enhanced_sum;
+            sum_type& global_enhanced_sum_sq;
             vector<size_t>& global_enhanced_count;
-            vector_type enhanced_sum;
+            sum_type enhanced_sum;
+            sum_type enhanced_sum_sq;
             vector<size_t> enhanced_count;
             vector_type stats;
             vector_type enhanced_stats;
@@ -104,8 +213,11 @@ namespace MR
         template <class StatsType>
           class Processor { MEMALIGN (Processor<StatsType>)
             public:
+              using value_type = typename StatsType::value_type;
+              using vector_type = typename StatsType::vector_type;
+
               Processor (const StatsType& stats_calculator,
-                         const std::shared_ptr<EnhancerBase> enhancer,
+                         const std::shared_ptr<EnhancerBase<value_type>> enhancer,
                          const vector_type& empirical_enhanced_statistics,
                          const vector_type& default_enhanced_statistics,
                          const std::shared_ptr<vector_type> default_enhanced_statistics_neg,
@@ -118,14 +230,11 @@ namespace MR
                            default_enhanced_statistics (default_enhanced_statistics), default_enhanced_statistics_neg (default_enhanced_statistics_neg),
                            statistics (stats_calculator.num_elements()), enhanced_statistics (stats_calculator.num_elements()),
                            uncorrected_pvalue_counter (stats_calculator.num_elements(), 0),
+                           uncorrected_pvalue_counter_neg (global_uncorrected_pvalue_counter_neg ? stats_calculator.num_elements() : 0, 0),
                            perm_dist_pos (perm_dist_pos), perm_dist_neg (perm_dist_neg),
                            global_uncorrected_pvalue_counter (global_uncorrected_pvalue_counter),
                            global_uncorrected_pvalue_counter_neg (global_uncorrected_pvalue_counter_neg),
-                           mutex (new std::mutex())
-              {
-                if (global_uncorrected_pvalue_counter_neg)
-                  uncorrected_pvalue_counter_neg.reset (new vector<size_t>(stats_calculator.num_elements(), 0));
-              }
+                           mutex (new std::mutex()) { }
 
 
               ~Processor () {
@@ -133,7 +242,7 @@ namespace MR
                 for (size_t i = 0; i < stats_calculator.num_elements(); ++i) {
                   global_uncorrected_pvalue_counter[i] += uncorrected_pvalue_counter[i];
                   if (global_uncorrected_pvalue_counter_neg)
-                    (*global_uncorrected_pvalue_counter_neg)[i] = (*uncorrected_pvalue_counter_neg)[i];
+                    (*global_uncorrected_pvalue_counter_neg)[i] += uncorrected_pvalue_counter_neg[i];
                 }
               }
 
@@ -177,7 +286,7 @@ namespace MR
 
                   for (ssize_t i = 0; i < enhanced_statistics.size(); ++i) {
                     if ((*default_enhanced_statistics_neg)[i] > enhanced_statistics[i])
-                      (*uncorrected_pvalue_counter_neg)[i]++;
+                      uncorrected_pvalue_counter_neg[i]++;
                   }
                 }
                 return true;
@@ -185,14 +294,14 @@ namespace MR
 
             protected:
               StatsType stats_calculator;
-              std::shared_ptr<EnhancerBase> enhancer;
+              std::shared_ptr<EnhancerBase<value_type>> enhancer;
               const vector_type& empirical_enhanced_statistics;
               const vector_type& default_enhanced_statistics;
               const std::shared_ptr<vector_type> default_enhanced_statistics_neg;
               vector_type statistics;
               vector_type enhanced_statistics;
               vector<size_t> uncorrected_pvalue_counter;
-              std::shared_ptr<vector<size_t> > uncorrected_pvalue_counter_neg;
+              vector<size_t> uncorrected_pvalue_counter_neg;
               vector_type& perm_dist_pos;
               std::shared_ptr<vector_type> perm_dist_neg;
 
@@ -204,18 +313,78 @@ namespace MR
 
         // Precompute the empircal test statistic for non-stationarity adjustment
         template <class StatsType>
-          void precompute_empirical_stat (const StatsType& stats_calculator, const std::shared_ptr<EnhancerBase> enhancer,
-                                          PermutationStack& perm_stack, vector_type& empirical_statistic)
+          void precompute_empirical_stat (const StatsType& stats_calculator, const std::shared_ptr<EnhancerBase<typename StatsType::value_type>> enhancer,
+                                          PermutationStack& perm_stack, typename StatsType::vector_type& empirical_statistic)
           {
-            vector<size_t> global_enhanced_count (empirical_statistic.size(), 0);
-            {
-              PreProcessor<StatsType> preprocessor (stats_calculator, enhancer, empirical_statistic, global_enhanced_count);
-              Thread::run_queue (perm_stack, Permutation(), Thread::multi (preprocessor));
-            }
-            for (ssize_t i = 0; i < empirical_statistic.size(); ++i) {
-              if (global_enhanced_count[i] > 0)
-                empirical_statistic[i] /= static_cast<default_type> (global_enhanced_count[i]);
+            using value_type = typename StatsType::value_type;
+            using sum_type = typename PreProcessor<StatsType>::sum_type;
+            sum_type global_enhanced_sum = sum_type::Zero (stats_calculator.num_elements());
+            sum_type global_enhanced_sum_sq = sum_type::Zero (stats_calculator.num_elements());
+            vector<size_t> global_enhanced_count (stats_calculator.num_elements(), 0);
+            sum_type estimate (sum_type::Zero (stats_calculator.num_elements()));
+
+            // Without a tolerance, all permutations are processed in a single block;
+            //   otherwise the estimate is updated after each block of permutations, and
+            //   the remaining permutations are skipped once the standard error of the
+            //   estimate in every element, relative to the estimate itself, falls below
+            //   the tolerance
+            const default_type tolerance = get_nonstationarity_tolerance();
+            const size_t block_size = tolerance ? NONSTATIONARITY_BLOCK_SIZE : perm_stack.num_permutations;
+            size_t num_processed = 0;
+            while (!perm_stack.finished()) {
+              num_processed += perm_stack.next_block (block_size).size();
+              {
+                PreProcessor<StatsType> preprocessor (stats_calculator, enhancer, global_enhanced_sum, global_enhanced_sum_sq, global_enhanced_count);
+                Thread::run_queue (perm_stack, Permutation(), Thread::multi (preprocessor));
+              }
+              for (ssize_t i = 0; i < estimate.size(); ++i)
+                estimate[i] = global_enhanced_count[i] ? global_enhanced_sum[i] / static_cast<default_type> (global_enhanced_count[i]) : 0.0;
+              if (tolerance && !perm_stack.finished()) {
+                // Elements that have not yet received any non-zero enhanced statistic do not
+                //   prevent convergence; those with only one cannot yet provide a standard error
+                bool converged = true;
+                for (ssize_t i = 0; i < estimate.size() && converged; ++i) {
+                  const size_t count = global_enhanced_count[i];
+                  if (!count)
+                    continue;
+                  if (count < 2) {
+                    converged = false;
+                  } else {
+                    const default_type variance = std::max (0.0, (global_enhanced_sum_sq[i] - count * Math::pow2 (estimate[i])) / default_type (count - 1));
+                    converged = (variance <= count * Math::pow2 (tolerance * estimate[i]));
+                  }
+                }
+                if (converged) {
+                  perm_stack.done();
+                  INFO ("empirical statistic for non-stationarity adjustment converged after " + str(num_processed) + " of " + str(perm_stack.num_permutations) + " permutations");
+                  break;
+                }
+              }
             }
+
+            empirical_statistic = estimate.template cast<value_type>();
+          }
+
+
+        template <class StatsType>
+          void precompute_empirical_stat (const StatsType& stats_calculator, const std::shared_ptr<EnhancerBase<typename StatsType::value_type>> enhancer,
+                                          vector<vector<size_t>>& permutations, typename StatsType::vector_type& empirical_statistic)
+          {
+            PermutationStack perm_stack (permutations, "precomputing empirical statistic for non-stationarity adjustment");
+            precompute_empirical_stat (stats_calculator, enhancer, perm_stack, empirical_statistic);
+          }
+
+
+        // The random permutations for non-stationarity adjustment are drawn from the same
+        //   key as those of the permutation test itself, but from a disjoint range of
+        //   generator streams, such that the two sets are independent
+        template <class StatsType>
+          void precompute_empirical_stat (const StatsType& stats_calculator, const std::shared_ptr<EnhancerBase<typename StatsType::value_type>> enhancer,
+                                          const size_t num_permutations, typename StatsType::vector_type& empirical_statistic)
+          {
+            PermutationStack perm_stack (num_permutations, stats_calculator.num_subjects(), rng_seed(),
+                                         "precomputing empirical statistic for non-stationarity adjustment", false, NONSTATIONARITY_FIRST_STREAM);
+            precompute_empirical_stat (stats_calculator, enhancer, perm_stack, empirical_statistic);
           }
 
 
@@ -223,11 +392,11 @@ namespace MR
           // Precompute the default statistic image and enhanced statistic. We need to precompute this for calculating the uncorrected p-values.
           template <class StatsType>
             void precompute_default_permutation (const StatsType& stats_calculator,
-                                                 const std::shared_ptr<EnhancerBase> enhancer,
-                                                 const vector_type& empirical_enhanced_statistic,
-                                                 vector_type& default_enhanced_statistics,
-                                                 std::shared_ptr<vector_type> default_enhanced_statistics_neg,
-                                                 vector_type& default_statistics)
+                                                 const std::shared_ptr<EnhancerBase<typename StatsType::value_type>> enhancer,
+                                                 const typename StatsType::vector_type& empirical_enhanced_statistic,
+                                                 typename StatsType::vector_type& default_enhanced_statistics,
+                                                 std::shared_ptr<typename StatsType::vector_type> default_enhanced_statistics_neg,
+                                                 typename StatsType::vector_type& default_statistics)
             {
               vector<size_t> default_labelling (stats_calculator.num_subjects());
               for (size_t i = 0; i < default_labelling.size(); ++i)
@@ -252,76 +421,147 @@ namespace MR
               }
             }
 
+          //! evaluate the permutations, and compute the uncorrected p-values
+          /*! Depending on the command-line options, permutations may be
+           * restricted to a sub-range (-permutation_range), saved periodically
+           * and resumed (-checkpoint), or not evaluated at all but instead
+           * loaded from the outputs of previous runs (-merge). Returns false if
+           * the null distribution is incomplete, in which case neither the null
+           * distribution nor the p-values are valid, and the caller should not
+           * generate its permutation testing outputs. */
           template <class StatsType>
-            inline void run_permutations (PermutationStack& perm_stack,
+            inline bool run_permutations (PermutationStack& perm_stack,
                                           const StatsType& stats_calculator,
-                                          const std::shared_ptr<EnhancerBase> enhancer,
-                                          const vector_type& empirical_enhanced_statistic,
-                                          const vector_type& default_enhanced_statistics,
-                                          const std::shared_ptr<vector_type> default_enhanced_statistics_neg,
-                                          vector_type& perm_dist_pos,
-                                          std::shared_ptr<vector_type> perm_dist_neg,
-                                          vector_type& uncorrected_pvalues,
-                                          std::shared_ptr<vector_type> uncorrected_pvalues_neg)
+                                          const std::shared_ptr<EnhancerBase<typename StatsType::value_type>> enhancer,
+                                          const typename StatsType::vector_type& empirical_enhanced_statistic,
+                                          const typename StatsType::vector_type& default_enhanced_statistics,
+                                          const std::shared_ptr<typename StatsType::vector_type> default_enhanced_statistics_neg,
+                                          typename StatsType::vector_type& perm_dist_pos,
+                                          std::shared_ptr<typename StatsType::vector_type> perm_dist_neg,
+                                          typename StatsType::vector_type& uncorrected_pvalues,
+                                          std::shared_ptr<typename StatsType::vector_type> uncorrected_pvalues_neg)
             {
-              vector<size_t> global_uncorrected_pvalue_count (stats_calculator.num_elements(), 0);
-              std::shared_ptr< vector<size_t> > global_uncorrected_pvalue_count_neg;
-              if (perm_dist_neg)
-                global_uncorrected_pvalue_count_neg.reset (new vector<size_t> (stats_calculator.num_elements(), 0));
+              using value_type = typename StatsType::value_type;
+              Checkpoint state (rng_seed(), fingerprint (stats_calculator, enhancer, empirical_enhanced_statistic.size()),
+                                perm_stack.num_permutations, stats_calculator.num_subjects(), stats_calculator.num_elements(), bool(perm_dist_neg));
+
+              auto opt = App::get_options ("merge");
+              if (opt.size()) {
+                if (App::get_options ("permutation_range").size())
+                  throw Exception ("options -merge and -permutation_range are mutually exclusive");
+                for (const auto& i : opt)
+                  state.load (i[0]);
+                if (!state.complete())
+                  throw Exception ("merged files contain only " + str(state.num_completed()) + " of " + str(perm_stack.num_permutations) + " permutations");
+              } else {
+                const std::string checkpoint_path = get_checkpoint_path();
+                if (checkpoint_path.size() && Path::exists (checkpoint_path)) {
+                  state.load (checkpoint_path);
+                  INFO ("resuming from checkpoint \"" + checkpoint_path + "\" with " + str(state.num_completed()) + " of " + str(perm_stack.num_permutations) + " permutations completed");
+                }
 
-              {
-                Processor<StatsType> processor (stats_calculator, enhancer,
-                                                empirical_enhanced_statistic,
-                                                default_enhanced_statistics, default_enhanced_statistics_neg,
-                                                perm_dist_pos, perm_dist_neg,
-                                                global_uncorrected_pvalue_count, global_uncorrected_pvalue_count_neg);
-                Thread::run_queue (perm_stack, Permutation(), Thread::multi (processor));
+                size_t first, last;
+                get_permutation_range (perm_stack.num_permutations, first, last);
+                vector<size_t> indices;
+                for (size_t i = first; i <= last; ++i) {
+                  if (!state.completed (i))
+                    indices.push_back (i);
+                }
+                perm_stack.select (indices);
+
+                // Without a checkpoint file, all permutations are processed in a single block;
+                //   otherwise the block size is adjusted such that the state is saved at
+                //   approximately the requested interval
+                //CONF option: PermutationCheckpointInterval
+                //CONF default: 300
+                //CONF The interval in seconds between successive updates of the
+                //CONF checkpoint file during permutation testing, when the
+                //CONF -checkpoint option is used.
+                const default_type interval = checkpoint_path.size() ? File::Config::get_float ("PermutationCheckpointInterval", 300.0) : 0.0;
+                size_t block_size = checkpoint_path.size() ? Thread::number_of_threads() : indices.size();
+                Timer timer;
+                while (!perm_stack.finished()) {
+                  Timer block_timer;
+                  const vector<size_t> block = perm_stack.next_block (block_size);
+                  {
+                    Processor<StatsType> processor (stats_calculator, enhancer,
+                                                    empirical_enhanced_statistic,
+                                                    default_enhanced_statistics, default_enhanced_statistics_neg,
+                                                    perm_dist_pos, perm_dist_neg,
+                                                    state.uncorrected_pvalue_count, state.uncorrected_pvalue_count_neg);
+                    Thread::run_queue (perm_stack, Permutation(), Thread::multi (processor));
+                  }
+                  for (auto i : block)
+                    state.set (i, perm_dist_pos[i], perm_dist_neg ? (*perm_dist_neg)[i] : 0.0);
+                  if (checkpoint_path.size()) {
+                    if (perm_stack.finished() || timer.elapsed() >= interval) {
+                      state.save (checkpoint_path);
+                      timer.start();
+                    }
+                    const default_type time_per_permutation = block_timer.elapsed() / block.size();
+                    block_size = std::max (size_t(Thread::number_of_threads()), size_t(interval / std::max (time_per_permutation, 1.0e-6)));
+                  }
+                }
+              }
+
+              for (size_t i = 0; i != perm_stack.num_permutations; ++i) {
+                if (state.completed (i)) {
+                  perm_dist_pos[i] = value_type (state.perm_dist[i]);
+                  if (perm_dist_neg)
+                    (*perm_dist_neg)[i] = value_type (state.perm_dist_neg[i]);
+                }
+              }
+
+              if (!state.complete()) {
+                CONSOLE (str(state.num_completed()) + " of " + str(perm_stack.num_permutations) + " permutations completed; "
+                         "use the -merge option once all permutations have been evaluated to generate the permutation testing outputs");
+                return false;
               }
 
               for (size_t i = 0; i < stats_calculator.num_elements(); ++i) {
-                uncorrected_pvalues[i] = global_uncorrected_pvalue_count[i] / default_type(perm_stack.num_permutations);
+                uncorrected_pvalues[i] = state.uncorrected_pvalue_count[i] / default_type(perm_stack.num_permutations);
                 if (perm_dist_neg)
-                  (*uncorrected_pvalues_neg)[i] = (*global_uncorrected_pvalue_count_neg)[i] / default_type(perm_stack.num_permutations);
+                  (*uncorrected_pvalues_neg)[i] = (*state.uncorrected_pvalue_count_neg)[i] / default_type(perm_stack.num_permutations);
               }
-
+              return true;
             }
 
 
             template <class StatsType>
-              inline void run_permutations (vector<vector<size_t>>& permutations,
+              inline bool run_permutations (vector<vector<size_t>>& permutations,
                                             const StatsType& stats_calculator,
-                                            const std::shared_ptr<EnhancerBase> enhancer,
-                                            const vector_type& empirical_enhanced_statistic,
-                                            const vector_type& default_enhanced_statistics,
-                                            const std::shared_ptr<vector_type> default_enhanced_statistics_neg,
-                                            vector_type& perm_dist_pos,
-                                            std::shared_ptr<vector_type> perm_dist_neg,
-                                            vector_type& uncorrected_pvalues,
-                                            std::shared_ptr<vector_type> uncorrected_pvalues_neg)
+                                            const std::shared_ptr<EnhancerBase<typename StatsType::value_type>> enhancer,
+                                            const typename StatsType::vector_type& empirical_enhanced_statistic,
+                                            const typename StatsType::vector_type& default_enhanced_statistics,
+                                            const std::shared_ptr<typename StatsType::vector_type> default_enhanced_statistics_neg,
+                                            typename StatsType::vector_type& perm_dist_pos,
+                                            std::shared_ptr<typename StatsType::vector_type> perm_dist_neg,
+                                            typename StatsType::vector_type& uncorrected_pvalues,
+                                            std::shared_ptr<typename StatsType::vector_type> uncorrected_pvalues_neg)
               {
                 PermutationStack perm_stack (permutations, "running " + str(permutations.size()) + " permutations");
 
-                run_permutations (perm_stack, stats_calculator, enhancer, empirical_enhanced_statistic, default_enhanced_statistics, default_enhanced_statistics_neg,
-                                  perm_dist_pos, perm_dist_neg, uncorrected_pvalues, uncorrected_pvalues_neg);
+                return run_permutations (perm_stack, stats_calculator, enhancer, empirical_enhanced_statistic, default_enhanced_statistics, default_enhanced_statistics_neg,
+                                         perm_dist_pos, perm_dist_neg, uncorrected_pvalues, uncorrected_pvalues_neg);
               }
 
 
             template <class StatsType>
-              inline void run_permutations (const size_t num_permutations,
+              inline bool run_permutations (const size_t num_permutations,
                                             const StatsType& stats_calculator,
-                                            const std::shared_ptr<EnhancerBase> enhancer,
-                                            const vector_type& empirical_enhanced_statistic,
-                                            const vector_type& default_enhanced_statistics,
-                                            const std::shared_ptr<vector_type> default_enhanced_statistics_neg,
-                                            vector_type& perm_dist_pos,
-                                            std::shared_ptr<vector_type> perm_dist_neg,
-                                            vector_type& uncorrected_pvalues,
-                                            std::shared_ptr<vector_type> uncorrected_pvalues_neg)
+                                            const std::shared_ptr<EnhancerBase<typename StatsType::value_type>> enhancer,
+                                            const typename StatsType::vector_type& empirical_enhanced_statistic,
+                                            const typename StatsType::vector_type& default_enhanced_statistics,
+                                            const std::shared_ptr<typename StatsType::vector_type> default_enhanced_statistics_neg,
+                                            typename StatsType::vector_type& perm_dist_pos,
+                                            std::shared_ptr<typename StatsType::vector_type> perm_dist_neg,
+                                            typename StatsType::vector_type& uncorrected_pvalues,
+                                            std::shared_ptr<typename StatsType::vector_type> uncorrected_pvalues_neg)
               {
-                PermutationStack perm_stack (num_permutations, stats_calculator.num_subjects(), "running " + str(num_permutations) + " permutations");
+                PermutationStack perm_stack (num_permutations, stats_calculator.num_subjects(), rng_seed(), "running " + str(num_permutations) + " permutations");
 
-                run_permutations (perm_stack, stats_calculator, enhancer, empirical_enhanced_statistic, default_enhanced_statistics, default_enhanced_statistics_neg,
-                                  perm_dist_pos, perm_dist_neg, uncorrected_pvalues, uncorrected_pvalues_neg);
+                return run_permutations (perm_stack, stats_calculator, enhancer, empirical_enhanced_statistic, default_enhanced_statistics, default_enhanced_statistics_neg,
+                                         perm_dist_pos, perm_dist_neg, uncorrected_pvalues, uncorrected_pvalues_neg);
               }
 
 
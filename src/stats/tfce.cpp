@@ -14,6 +14,9 @@
 
 #include "stats/tfce.h"
 
+#include <algorithm>
+#include <limits>
+
 namespace MR
 {
   namespace Stats
@@ -41,24 +44,177 @@ namespace MR
 
 
 
-      value_type Wrapper::operator() (const vector_type& in, vector_type& out) const
+      template <typename ValueType>
+      ValueType Wrapper<ValueType>::operator() (const vector_type& in, vector_type& out) const
       {
-        out = vector_type::Zero (in.size());
-        const value_type max_input_value = in.maxCoeff();
-        for (value_type h = dH; (h-dH) < max_input_value; h += dH) {
+        const vector<vector<uint32_t>>* adjacency = enhancer->get_adjacency();
+        if (adjacency)
+          return sweep (in, *adjacency, out);
+        Eigen::Array<default_type, Eigen::Dynamic, 1> sum = Eigen::Array<default_type, Eigen::Dynamic, 1>::Zero (in.size());
+        const default_type max_input_value = in.maxCoeff();
+        for (default_type h = dH; (h-dH) < max_input_value; h += dH) {
           vector_type temp;
           const value_type max = (*enhancer) (in, h, temp);
           if (max) {
-            const value_type h_multiplier = std::pow (h, H);
+            const default_type h_multiplier = std::pow (h, H);
             for (size_t index = 0; index != size_t(in.size()); ++index)
-              out[index] += (std::pow (temp[index], E) * h_multiplier);
+              sum[index] += (std::pow (default_type(temp[index]), E) * h_multiplier);
           }
         }
+        out = sum.template cast<value_type>();
         return out.maxCoeff();
       }
 
 
 
+      //* \cond skip
+      namespace
+      {
+        // Disjoint-set forest over the supra-threshold elements. Each root
+        //   stores the TFCE contribution accumulated by its component; every
+        //   other node stores its own accumulation relative to that of its
+        //   parent, so that merging two components costs O(1) rather than
+        //   requiring every member to be updated.
+        class ComponentForest
+        { NOMEMALIGN
+          public:
+            static constexpr uint32_t inactive = std::numeric_limits<uint32_t>::max();
+
+            ComponentForest (const size_t num_elements, const vector<default_type>& cumulative_height, const default_type E) :
+                parent (num_elements, inactive),
+                size (num_elements, 0),
+                since (num_elements, 0),
+                acc (num_elements, 0.0),
+                cumulative_height (cumulative_height),
+                E (E) { }
+
+            bool active (const uint32_t i) const { return parent[i] != inactive; }
+
+            void add (const uint32_t i, const size_t level) {
+              parent[i] = i;
+              size[i] = 1;
+              since[i] = level;
+            }
+
+            uint32_t find (const uint32_t i) {
+              uint32_t root = i;
+              while (parent[root] != root)
+                root = parent[root];
+              path.clear();
+              for (uint32_t j = i; parent[j] != root; j = parent[j])
+                path.push_back (j);
+              // Compress from the top down, so that each node's parent is already
+              //   relative to the root by the time the node itself is visited
+              for (auto j = path.rbegin(); j != path.rend(); ++j) {
+                acc[*j] += acc[parent[*j]];
+                parent[*j] = root;
+              }
+              return root;
+            }
+
+            void merge (const uint32_t a, const uint32_t b, const size_t level) {
+              uint32_t ra = find (a), rb = find (b);
+              if (ra == rb)
+                return;
+              flush (ra, level);
+              flush (rb, level);
+              if (size[ra] > size[rb])
+                std::swap (ra, rb);
+              parent[ra] = rb;
+              acc[ra] -= acc[rb];
+              size[rb] += size[ra];
+            }
+
+            // Credit a component with all threshold levels down to (but not including)
+            //   the given level, over which its extent has remained unchanged
+            void flush (const uint32_t root, const size_t level) {
+              if (since[root] > level) {
+                acc[root] += std::pow (default_type(size[root]), E) * (cumulative_height[since[root]+1] - cumulative_height[level+1]);
+                since[root] = level;
+              }
+            }
+
+            void finalise (const uint32_t root) {
+              acc[root] += std::pow (default_type(size[root]), E) * (cumulative_height[since[root]+1] - cumulative_height[0]);
+              since[root] = 0;
+            }
+
+            default_type value (const uint32_t i) {
+              const uint32_t root = find (i);
+              return root == i ? acc[i] : acc[i] + acc[root];
+            }
+
+          private:
+            vector<uint32_t> parent, size;
+            vector<size_t> since;
+            vector<default_type> acc;
+            const vector<default_type>& cumulative_height;
+            const default_type E;
+            vector<uint32_t> path;
+        };
+      }
+      //* \endcond
+
+
+
+      // Exact equivalent of the discrete integration above for connected-component
+      //   enhancers: rather than labelling components afresh at every threshold,
+      //   elements are added in order of decreasing statistic and merged into a
+      //   disjoint-set forest, with each component's extent^E * h^H contributions
+      //   integrated lazily over the range of thresholds for which it is unchanged.
+      template <typename ValueType>
+      ValueType Wrapper<ValueType>::sweep (const vector_type& in, const vector<vector<uint32_t>>& adjacency, vector_type& out) const
+      {
+        assert (adjacency.size() == size_t(in.size()));
+        out = vector_type::Zero (in.size());
+
+        // Reproduce the thresholds of the discrete integration exactly, including the
+        //   single-precision comparison performed by Filter::Connector
+        vector<default_type> thresholds, cumulative_height (1, 0.0);
+        const default_type max_input_value = in.maxCoeff();
+        for (default_type h = dH; (h-dH) < max_input_value; h += dH) {
+          thresholds.push_back (float (h));
+          cumulative_height.push_back (cumulative_height.back() + std::pow (h, H));
+        }
+        if (thresholds.empty())
+          return 0.0;
+
+        // For each element, the number of thresholds it exceeds
+        vector<size_t> num_levels (in.size());
+        vector<uint32_t> order;
+        for (size_t i = 0; i != size_t(in.size()); ++i) {
+          num_levels[i] = std::lower_bound (thresholds.begin(), thresholds.end(), in[i]) - thresholds.begin();
+          if (num_levels[i])
+            order.push_back (i);
+        }
+        std::sort (order.begin(), order.end(), [&] (const uint32_t a, const uint32_t b) { return in[a] > in[b]; });
+
+        ComponentForest forest (in.size(), cumulative_height, E);
+        for (const auto i : order) {
+          const size_t level = num_levels[i] - 1;
+          forest.add (i, level);
+          for (const auto j : adjacency[i]) {
+            if (forest.active (j))
+              forest.merge (i, j, level);
+          }
+        }
+        for (const auto i : order) {
+          if (forest.find (i) == i)
+            forest.finalise (i);
+        }
+        for (const auto i : order)
+          out[i] = forest.value (i);
+
+        return out.maxCoeff();
+      }
+
+
+
+      template class Wrapper<float>;
+      template class Wrapper<double>;
+
+
+
     }
   }
 }
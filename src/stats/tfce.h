@@ -35,32 +35,43 @@ namespace MR
 
 
 
-      using value_type = Math::Stats::value_type;
-      using vector_type = Math::Stats::vector_type;
-
-
-
-      class EnhancerBase : public Stats::EnhancerBase
-      { MEMALIGN (EnhancerBase)
+      template <typename ValueType>
+      class EnhancerBase : public Stats::EnhancerBase<ValueType>
+      { MEMALIGN (EnhancerBase<ValueType>)
         public:
+          using value_type = ValueType;
+          using vector_type = typename Stats::EnhancerBase<ValueType>::vector_type;
+
           // Alternative functor that also takes the threshold value;
           //   makes TFCE integration cleaner
           virtual value_type operator() (const vector_type& /*input_statistics*/, const value_type /*threshold*/, vector_type& /*enhanced_statistics*/) const = 0;
 
+          // Enhancers for which the value of each element at a given threshold is the size of
+          //   the supra-threshold connected component containing it may provide the underlying
+          //   adjacency; this allows TFCE to integrate over all thresholds in a single sweep
+          virtual const vector<vector<uint32_t>>* get_adjacency() const { return nullptr; }
+
       };
 
 
 
 
-      class Wrapper : public Stats::EnhancerBase
-      { MEMALIGN (Wrapper)
+      // The TFCE parameters, the integration over thresholds and the accumulation of
+      //   the enhanced statistics are all performed in double precision, regardless
+      //   of the precision of the input statistics
+      template <typename ValueType>
+      class Wrapper : public Stats::EnhancerBase<ValueType>
+      { MEMALIGN (Wrapper<ValueType>)
         public:
-          Wrapper (const std::shared_ptr<TFCE::EnhancerBase> base) : enhancer (base), dH (NaN), E (NaN), H (NaN) { }
-          Wrapper (const std::shared_ptr<TFCE::EnhancerBase> base, const default_type dh, const default_type e, const default_type h) : enhancer (base), dH (dh), E (e), H (h) { }
+          using value_type = ValueType;
+          using vector_type = typename Stats::EnhancerBase<ValueType>::vector_type;
+
+          Wrapper (const std::shared_ptr<TFCE::EnhancerBase<ValueType>> base) : enhancer (base), dH (NaN), E (NaN), H (NaN) { }
+          Wrapper (const std::shared_ptr<TFCE::EnhancerBase<ValueType>> base, const default_type dh, const default_type e, const default_type h) : enhancer (base), dH (dh), E (e), H (h) { }
           Wrapper (const Wrapper& that) = default;
           ~Wrapper() { }
 
-          void set_tfce_parameters (const value_type d_height, const value_type extent, const value_type height)
+          void set_tfce_parameters (const default_type d_height, const default_type extent, const default_type height)
           {
             dH = d_height;
             E = extent;
@@ -69,13 +80,24 @@ namespace MR
 
           value_type operator() (const vector_type&, vector_type&) const override;
 
+          std::string parameters () const override {
+            return "TFCE dh=" + str(dH) + " E=" + str(E) + " H=" + str(H) + "; " + enhancer->parameters();
+          }
+
         private:
-          std::shared_ptr<Stats::TFCE::EnhancerBase> enhancer;
-          value_type dH, E, H;
+          std::shared_ptr<Stats::TFCE::EnhancerBase<ValueType>> enhancer;
+          default_type dH, E, H;
+
+          value_type sweep (const vector_type&, const vector<vector<uint32_t>>&, vector_type&) const;
       };
 
 
 
+      extern template class Wrapper<float>;
+      extern template class Wrapper<double>;
+
+
+
     }
   }
 }
@@ -17,13 +17,16 @@
 
 #include <array>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 #include "image_helpers.h"
+#include "thread.h"
 #include "transform.h"
 
 #include "surface/mesh.h"
 #include "surface/types.h"
+#include "surface/utils.h"
 
 
 
@@ -142,8 +145,10 @@ namespace MR
 
 
     // Image-to-mesh conversion function using the Marching Cubes algorithm
+    // If multithreaded is set, the volume is processed in slabs using all available
+    //   threads; this should be disabled if the caller is itself running concurrently
     template <class ImageType>
-    void image2mesh_mc (const ImageType& input_image, Mesh& out, const default_type threshold)
+    void image2mesh_mc (const ImageType& input_image, Mesh& out, const default_type threshold, const bool multithreaded = true)
     {
       static const Vox neighbour_offsets[] = { Vox (0, 0, 0),
                                                Vox (1, 0, 0),
@@ -435,89 +440,152 @@ namespace MR
         {0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
         {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1} };
 
-      VertexList vertices;
-      TriangleList triangles;
+      // The volume is divided into slabs of lower corner z positions, each of which
+      //   is processed independently using its own vertex & triangle buffers.
+      //   Vertices are de-duplicated within each slab using a key that uniquely
+      //   identifies the image edge along which they lie; those lying within the
+      //   plane shared by two adjacent slabs are then merged when the slabs are
+      //   concatenated in order. Since the slabs are traversed in the same order
+      //   as the serial loop, the output is identical regardless of the number
+      //   of slabs used.
+      class Slab { NOMEMALIGN
+        public:
+          VertexList vertices;
+          vector<uint64_t> edges;
+          TriangleList triangles;
+      };
+
+      const Transform transform (input_image);
+      const int64_t dim[3] = { input_image.size(0), input_image.size(1), input_image.size(2) };
+      // Edge key: index of the lower of its two grid points (offset by one, since the
+      //   lower corners start from -1) multiplied by 3, plus the axis along which the edge lies
+      auto edge_key = [&] (const Vox& p, const size_t axis) -> uint64_t {
+        return (((int64_t(p[2]) + 1) * (dim[1] + 2) + (p[1] + 1)) * (dim[0] + 2) + (p[0] + 1)) * 3 + axis;
+      };
+      auto edge_plane = [&] (const uint64_t key) -> int64_t {
+        return int64_t (key / (3 * (dim[0] + 2) * (dim[1] + 2))) - 1;
+      };
+
+      const size_t num_planes = dim[2] + 1;
+      const size_t num_slabs = multithreaded ?
+                               std::max (size_t(1), std::min (num_planes, 4 * Thread::number_of_threads())) :
+                               1;
+      auto slab_start = [&] (const size_t slab) -> int { return int (slab * num_planes / num_slabs) - 1; };
+      vector<Slab> slabs (num_slabs);
+
+      auto process_slab = [&] (const size_t slab_index)
+      {
+        Slab& slab (slabs[slab_index]);
+        std::unordered_map<uint64_t, uint32_t> edge_to_vertex_index;
+        ImageType voxel (input_image);
+        float in_vertex_values[8];
+        Vox lower_corner;
+        for (lower_corner[2] = slab_start (slab_index); lower_corner[2] != slab_start (slab_index+1); ++lower_corner[2]) {
+          for (lower_corner[1] = -1; lower_corner[1] != voxel.size(1); ++lower_corner[1]) {
+            for (lower_corner[0] = -1; lower_corner[0] != voxel.size(0); ++lower_corner[0]) {
+
+              // This is our lower corner for our region of 8 voxels
+              uint8_t code = 0x00;
+              for (size_t neighbour_index = 0; neighbour_index != 8; ++neighbour_index) {
+                assign_pos_of (lower_corner + neighbour_offsets[neighbour_index]).to (voxel);
+                in_vertex_values[neighbour_index] = 0.0f;
+                if (!is_out_of_bounds (voxel))
+                  in_vertex_values[neighbour_index] = voxel.value();
+                if (in_vertex_values[neighbour_index] > threshold)
+                  code |= (1 << neighbour_index);
+              }
+              // Our code here acts as a lookup index to the table cube_edge_flags
+              const uint32_t edge_flags = cube_edge_flags[code];
+              // Now we find out which edges are intersected, based on this flag
+              // For all relevant output vertices, we need to store the output index
+              //   of that vertex
+              std::array<uint32_t, 12> edge_to_output_vertex;
+              edge_to_output_vertex.fill (0);
+              for (size_t edge_index = 0; edge_index != 12; ++edge_index) {
+                if (edge_flags & (1 << edge_index)) {
+
+                  // OK, so now we have two vertices corresponding to this edge
+                  // However, we don't want to duplicate vertices
+                  // Therefore, need to do a lookup
+                  // Remember: we have the lower corner position, and 8 offsets from that
+                  std::array<uint8_t, 2> vertex_indices;
+                  std::array<Vox,     2> vertex_positions;
+
+                  for (size_t i = 0; i != 2; ++i) {
+                    const uint8_t vertex_index = edge_vertices[edge_index][i];
+                    vertex_indices[i] = vertex_index;
+                    vertex_positions[i] = lower_corner + neighbour_offsets[vertex_index];
+                  }
+                  // Has a vertex already been generated somewhere along this edge?
+                  size_t axis = 0;
+                  while (vertex_positions[0][axis] == vertex_positions[1][axis])
+                    ++axis;
+                  const uint64_t key = edge_key (vertex_positions[0][axis] < vertex_positions[1][axis] ? vertex_positions[0] : vertex_positions[1], axis);
+                  const auto existing = edge_to_vertex_index.insert (std::make_pair (key, uint32_t (slab.vertices.size())));
+                  if (existing.second) {
+                    edge_to_output_vertex[edge_index] = slab.vertices.size();
+                    // Calculate the precise position of this vertex, based on the
+                    //   image intensities in the two relevant voxels
+                    const default_type alpha = (threshold - in_vertex_values[vertex_indices[0]]) / (in_vertex_values[vertex_indices[1]] - in_vertex_values[vertex_indices[0]]);
+                    const Vertex pos_voxelspace = vertex_positions[0].cast<default_type>() + (alpha * (vertex_positions[1] - vertex_positions[0]).cast<default_type>());
+                    slab.vertices.push_back (transform.voxel2scanner * pos_voxelspace);
+                    slab.edges.push_back (key);
+                  } else {
+                    edge_to_output_vertex[edge_index] = existing.first->second;
+                  }
 
-      Transform transform (input_image);
-
-      ImageType voxel (input_image);
-      float in_vertex_values[8];
-      std::map< Vox, std::map<Vox, size_t> > input_vertex_pair_to_output_vertex_index_map;
-      Vox lower_corner;
-      for (lower_corner[2] = -1; lower_corner[2] != voxel.size(2); ++lower_corner[2]) {
-        for (lower_corner[1] = -1; lower_corner[1] != voxel.size(1); ++lower_corner[1]) {
-          for (lower_corner[0] = -1; lower_corner[0] != voxel.size(0); ++lower_corner[0]) {
-
-            // This is our lower corner for our region of 8 voxels
-            uint8_t code = 0x00;
-            for (size_t neighbour_index = 0; neighbour_index != 8; ++neighbour_index) {
-              assign_pos_of (lower_corner + neighbour_offsets[neighbour_index]).to (voxel);
-              in_vertex_values[neighbour_index] = 0.0f;
-              if (!is_out_of_bounds (voxel))
-                in_vertex_values[neighbour_index] = voxel.value();
-              if (in_vertex_values[neighbour_index] > threshold)
-                code |= (1 << neighbour_index);
-            }
-            // Our code here acts as a lookup index to the table cube_edge_flags
-            const uint32_t edge_flags = cube_edge_flags[code];
-            // Now we find out which edges are intersected, based on this flag
-            // For all relevant output vertices, we need to store the output index
-            //   of that vertex
-            std::array<uint32_t, 12> edge_to_output_vertex;
-            edge_to_output_vertex.fill (0);
-            for (size_t edge_index = 0; edge_index != 12; ++edge_index) {
-              if (edge_flags & (1 << edge_index)) {
-
-                // OK, so now we have two vertices corresponding to this edge
-                // However, we don't want to duplicate vertices
-                // Therefore, need to do a lookup
-                // Remember: we have the lower corner position, and 8 offsets from that
-                std::array<uint8_t, 2> vertex_indices;
-                std::array<Vox,     2> vertex_positions;
-
-                for (size_t i = 0; i != 2; ++i) {
-                  const uint8_t vertex_index = edge_vertices[edge_index][i];
-                  vertex_indices[i] = vertex_index;
-                  vertex_positions[i] = lower_corner + neighbour_offsets[vertex_index];
-                }
-                // Has a vertex already been generated somewhere along this edge?
-                auto lookup_zero_it = input_vertex_pair_to_output_vertex_index_map.find (vertex_positions[0]);
-                if (lookup_zero_it == input_vertex_pair_to_output_vertex_index_map.end())
-                  lookup_zero_it = input_vertex_pair_to_output_vertex_index_map.insert (std::make_pair (vertex_positions[0], std::map<Vox, size_t>())).first;
-                auto lookup_one_it = input_vertex_pair_to_output_vertex_index_map.find (vertex_positions[1]);
-                if (lookup_one_it == input_vertex_pair_to_output_vertex_index_map.end())
-                  lookup_one_it = input_vertex_pair_to_output_vertex_index_map.insert (std::make_pair (vertex_positions[1], std::map<Vox, size_t>())).first;
-                auto& lookup_zero = lookup_zero_it->second;
-                auto& lookup_one  = lookup_one_it ->second;
-                auto existing_zero = lookup_zero.find (vertex_positions[1]);
-                if (existing_zero == lookup_zero.end()) {
-                  lookup_zero.insert (std::make_pair (vertex_positions[1], vertices.size()));
-                  lookup_one .insert (std::make_pair (vertex_positions[0], vertices.size()));
-                  edge_to_output_vertex[edge_index] = vertices.size();
-                  // Calculate the precise position of this vertex, based on the
-                  //   image intensities in the two relevant voxels
-                  const default_type alpha = (threshold - in_vertex_values[vertex_indices[0]]) / (in_vertex_values[vertex_indices[1]] - in_vertex_values[vertex_indices[0]]);
-                  const Vertex pos_voxelspace = vertex_positions[0].cast<default_type>() + (alpha * (vertex_positions[1] - vertex_positions[0]).cast<default_type>());
-                  vertices.push_back (transform.voxel2scanner * pos_voxelspace);
-                } else {
-                  edge_to_output_vertex[edge_index] = existing_zero->second;
                 }
+              }
 
+              // OK, so now the relevant edges have an output vertex index associated with them
+              // Based on the code for this voxel, now we use the table cube_triangle_table to see
+              //   which edges need to have triangles constructed from the relevant generated vertices
+              // Note that flipping the last two vertex indices is deliberate; the provided
+              //   lookup table does not use a right-hand rule axis convention, so this is necessary
+              //   to calculate the correct surface normals
+              for (const int8_t* first_edge = cube_triangle_table[code]; *first_edge >= 0; first_edge += 3) {
+                const uint32_t indices[3] { edge_to_output_vertex[*first_edge], edge_to_output_vertex[*(first_edge+2)], edge_to_output_vertex[*(first_edge+1)] };
+                slab.triangles.push_back (Triangle (indices));
               }
-            }
 
-            // OK, so now the relevant edges have an output vertex index associated with them
-            // Based on the code for this voxel, now we use the table cube_triangle_table to see
-            //   which edges need to have triangles constructed from the relevant generated vertices
-            // Note that flipping the last two vertex indices is deliberate; the provided
-            //   lookup table does not use a right-hand rule axis convention, so this is necessary
-            //   to calculate the correct surface normals
-            for (const int8_t* first_edge = cube_triangle_table[code]; *first_edge >= 0; first_edge += 3) {
-              const uint32_t indices[3] { edge_to_output_vertex[*first_edge], edge_to_output_vertex[*(first_edge+2)], edge_to_output_vertex[*(first_edge+1)] };
-              triangles.push_back (Triangle (indices));
-            }
+        } } } // Finished looping over all voxels in this slab
+      };
+
+      Thread::parallel_for (num_slabs, process_slab, 1);
 
-      } } } // Finished looping over all voxels in the input image
+      // Concatenate the slabs in order; vertices lying in the plane shared with the
+      //   preceding slab are mapped to the index already assigned to them there
+      VertexList vertices;
+      TriangleList triangles;
+      std::unordered_map<uint64_t, uint32_t> shared_plane;
+      for (size_t slab_index = 0; slab_index != num_slabs; ++slab_index) {
+        Slab& slab (slabs[slab_index]);
+        const int64_t lower_plane = slab_start (slab_index), upper_plane = slab_start (slab_index+1);
+        std::unordered_map<uint64_t, uint32_t> next_shared_plane;
+        vector<uint32_t> local_to_output (slab.vertices.size());
+        for (size_t i = 0; i != slab.vertices.size(); ++i) {
+          const uint64_t key = slab.edges[i];
+          const bool in_plane = (key % 3 != 2);
+          const int64_t plane = edge_plane (key);
+          if (in_plane && plane == lower_plane) {
+            const auto existing = shared_plane.find (key);
+            if (existing != shared_plane.end()) {
+              local_to_output[i] = existing->second;
+              continue;
+            }
+          }
+          local_to_output[i] = vertices.size();
+          if (in_plane && plane == upper_plane)
+            next_shared_plane.insert (std::make_pair (key, uint32_t (vertices.size())));
+          vertices.push_back (slab.vertices[i]);
+        }
+        for (const auto& t : slab.triangles) {
+          const uint32_t indices[3] { local_to_output[t[0]], local_to_output[t[1]], local_to_output[t[2]] };
+          triangles.push_back (Triangle (indices));
+        }
+        std::swap (shared_plane, next_shared_plane);
+        slab = Slab();
+      }
 
       // Write the result to the output class
       out.load (vertices, triangles);
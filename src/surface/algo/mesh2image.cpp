@@ -14,11 +14,13 @@
 
 #include "surface/algo/mesh2image.h"
 
-#include <map>
+#include <algorithm>
+#include <limits>
 #include <vector>
 
 #include "header.h"
 #include "progressbar.h"
+#include "thread.h"
 
 #include "surface/types.h"
 #include "surface/utils.h"
@@ -33,13 +35,55 @@ namespace MR
 
 
 
-      void mesh2image (const Mesh& mesh_realspace, Image<float>& image)
+      //* \cond skip
+      namespace
       {
 
-        // For initial segmentation of mesh - identify voxels on the mesh, inside & outside
-        enum vox_mesh_t { UNDEFINED, ON_MESH, OUTSIDE, INSIDE };
+        // Interval [start, end) of voxels along a row that do not intersect the mesh
+        class Run
+        { NOMEMALIGN
+          public:
+            Run (const int start, const int end) : start (start), end (end) { }
+            int start, end;
+        };
+
+        // Pre-computed geometry of a triangle, as required for the inside / outside test
+        class TriangleGeometry
+        { NOMEMALIGN
+          public:
+            Vertex v0, v1, v2, centre, edge_normals[3];
+        };
+
+        class UnionFind
+        { NOMEMALIGN
+          public:
+            UnionFind (const size_t size) : parent (size) {
+              for (size_t i = 0; i != size; ++i)
+                parent[i] = i;
+            }
+            size_t find (size_t i) {
+              while (parent[i] != i)
+                i = parent[i] = parent[parent[i]];
+              return i;
+            }
+            void unite (const size_t a, const size_t b) {
+              const size_t root_a = find (a), root_b = find (b);
+              if (root_a != root_b)
+                parent[std::max (root_a, root_b)] = std::min (root_a, root_b);
+            }
+          private:
+            vector<size_t> parent;
+        };
+
+      }
+      //* \endcond
+
 
-        ProgressBar progress ("converting mesh to PVE image", 6);
+
+      void mesh2image (const Mesh& mesh_realspace, Image<float>& image)
+      {
+
+        ProgressBar progress ("converting mesh to PVE image", 5);
 
         // For speed, want the vertex data to be in voxel positions
         Filter::VertexTransform transform (image);
@@ -47,12 +91,8 @@ namespace MR
         Mesh mesh;
         transform (mesh_realspace, mesh);
 
-        static const Vox adj_voxels[6] = { { -1,  0,  0 },
-                                           { +1,  0,  0 },
-                                           {  0, -1,  0 },
-                                           {  0, +1,  0 },
-                                           {  0,  0, -1 },
-                                           {  0,  0, +1 } };
+        const size_t dim[3] = { size_t(image.size(0)), size_t(image.size(1)), size_t(image.size(2)) };
+        const size_t num_rows = dim[1] * dim[2];
 
         // Compute normals for polygons
         vector<Eigen::Vector3> polygon_normals;
@@ -61,246 +101,314 @@ namespace MR
           polygon_normals.push_back (normal (mesh, *p));
         for (QuadList::const_iterator p = mesh.get_quads().begin(); p != mesh.get_quads().end(); ++p)
           polygon_normals.push_back (normal (mesh, *p));
-        ++progress;
-
-        // Create some memory to work with:
-        // Stores a flag for each voxel as encoded in enum vox_mesh_t
-        Header H (image);
-        auto init_seg = Image<uint8_t>::scratch (H);
-
-        // For every voxel, stores those polygons that may intersect the voxel
-        using Vox2Poly = std::map< Vox, vector<size_t> >;
-        Vox2Poly voxel2poly;
 
-        // Map each polygon to the underlying voxels
-        for (size_t poly_index = 0; poly_index != mesh.num_polygons(); ++poly_index) {
+        // Those quantities used when testing points against each triangle do not depend
+        //   on the point being tested, so can be computed once
+        vector<TriangleGeometry> triangle_geometry (mesh.num_triangles());
+        for (size_t i = 0; i != mesh.num_triangles(); ++i) {
+          TriangleGeometry& g (triangle_geometry[i]);
+          const Eigen::Vector3& n (polygon_normals[i]);
+          g.v0 = mesh.vert (mesh.tri (i)[0]);
+          g.v1 = mesh.vert (mesh.tri (i)[1]);
+          g.v2 = mesh.vert (mesh.tri (i)[2]);
+          g.centre = (g.v0 + g.v1 + g.v2) * (1.0/3.0);
+          g.edge_normals[0] = (g.v2-g.v0).cross (n); g.edge_normals[0].normalize();
+          g.edge_normals[1] = (g.v1-g.v2).cross (n); g.edge_normals[1].normalize();
+          g.edge_normals[2] = (g.v0-g.v1).cross (n); g.edge_normals[2].normalize();
+        }
+        ++progress;
 
-          const size_t num_vertices = (poly_index < mesh.num_triangles()) ? 3 : 4;
+        // Spatial index of the mesh: a uniform grid at the resolution of the image,
+        //   where each voxel stores those polygons that may intersect it. This is stored
+        //   in a flat structure: the indices of those voxels intersecting the mesh in
+        //   ascending order, and for each, a contiguous range of polygon indices.
+        vector<size_t> surface_voxels;
+        vector<size_t> polygon_offsets;
+        vector<uint32_t> surface_polygons;
+        {
+          vector<std::pair<size_t, uint32_t>> voxel_polygon_pairs;
+          for (size_t poly_index = 0; poly_index != mesh.num_polygons(); ++poly_index) {
+
+            const size_t num_vertices = (poly_index < mesh.num_triangles()) ? 3 : 4;
+
+            // Figure out the voxel extent of this polygon in three dimensions
+            Vox lower_bound (dim[0]-1, dim[1]-1, dim[2]-1), upper_bound (0, 0, 0);
+            for (size_t i = 0; i != num_vertices; ++i) {
+              const Vertex& v (num_vertices == 3 ? mesh.vert (mesh.tri (poly_index)[i]) : mesh.vert (mesh.quad (poly_index - mesh.num_triangles())[i]));
+              for (size_t axis = 0; axis != 3; ++axis) {
+                const int this_axis_voxel = std::round (v[axis]);
+                lower_bound[axis] = std::min (lower_bound[axis], this_axis_voxel);
+                upper_bound[axis] = std::max (upper_bound[axis], this_axis_voxel);
+              }
+            }
 
-          // Figure out the voxel extent of this polygon in three dimensions
-          Vox lower_bound (H.size(0)-1, H.size(1)-1, H.size(2)-1), upper_bound (0, 0, 0);
-          VertexList this_poly_verts;
-          if (num_vertices == 3)
-            mesh.load_triangle_vertices (this_poly_verts, poly_index);
-          else
-            mesh.load_quad_vertices (this_poly_verts, poly_index - mesh.num_triangles());
-          for (VertexList::const_iterator v = this_poly_verts.begin(); v != this_poly_verts.end(); ++v) {
+            // Constrain to lie within the dimensions of the image
             for (size_t axis = 0; axis != 3; ++axis) {
-              const int this_axis_voxel = std::round((*v)[axis]);
-              lower_bound[axis] = std::min (lower_bound[axis], this_axis_voxel);
-              upper_bound[axis] = std::max (upper_bound[axis], this_axis_voxel);
+              lower_bound[axis] = std::max (0,                lower_bound[axis]);
+              upper_bound[axis] = std::min (int(dim[axis]-1), upper_bound[axis]);
             }
+
+            // For all voxels within this rectangular region, assign this polygon to the index
+            for (int z = lower_bound[2]; z <= upper_bound[2]; ++z) {
+              for (int y = lower_bound[1]; y <= upper_bound[1]; ++y) {
+                for (int x = lower_bound[0]; x <= upper_bound[0]; ++x)
+                  voxel_polygon_pairs.push_back (std::make_pair (x + dim[0] * (y + dim[1] * z), uint32_t(poly_index)));
+            } }
+
           }
 
-          // Constrain to lie within the dimensions of the image
-          for (size_t axis = 0; axis != 3; ++axis) {
-            lower_bound[axis] = std::max(0,                   lower_bound[axis]);
-            upper_bound[axis] = std::min(int(H.size(axis)-1), upper_bound[axis]);
+          std::sort (voxel_polygon_pairs.begin(), voxel_polygon_pairs.end());
+          surface_polygons.reserve (voxel_polygon_pairs.size());
+          for (const auto& i : voxel_polygon_pairs) {
+            if (surface_voxels.empty() || i.first != surface_voxels.back()) {
+              surface_voxels.push_back (i.first);
+              polygon_offsets.push_back (surface_polygons.size());
+            }
+            surface_polygons.push_back (i.second);
           }
+          polygon_offsets.push_back (surface_polygons.size());
+        }
+        ++progress;
 
-          // For all voxels within this rectangular region, assign this polygon to the map
-          Vox voxel;
-          for (voxel[2] = lower_bound[2]; voxel[2] <= upper_bound[2]; ++voxel[2]) {
-            for (voxel[1] = lower_bound[1]; voxel[1] <= upper_bound[1]; ++voxel[1]) {
-              for (voxel[0] = lower_bound[0]; voxel[0] <= upper_bound[0]; ++voxel[0]) {
-                vector<size_t> this_voxel_polys;
-                //#if __clang__
-                //              Vox2Poly::const_iterator existing = voxel2poly.find (voxel);
-                //#else
-                //              Vox2Poly::iterator existing = voxel2poly.find (voxel);
-                //#endif
-                Vox2Poly::const_iterator existing = voxel2poly.find (voxel);
-                if (existing != voxel2poly.end()) {
-                  this_voxel_polys = existing->second;
-                  voxel2poly.erase (existing);
-                } else {
-                  // Only call this once each voxel, regardless of the number of intersecting polygons
-                  assign_pos_of (voxel).to (init_seg);
-                  init_seg.value() = ON_MESH;
-                }
-                this_voxel_polys.push_back (poly_index);
-                voxel2poly.insert (std::make_pair (voxel, this_voxel_polys));
-          } } }
 
+        // Find all voxels that are not partial-volumed with the mesh, and are not inside the mesh.
+        // This is a connected-component analysis of the voxels not intersecting the mesh;
+        //   rather than filling voxel-by-voxel, each image row is split into runs of such voxels
+        //   (in parallel across slices), and those runs that touch one another are merged.
+        vector<size_t> row_offsets (num_rows + 1, surface_voxels.size());
+        for (size_t s = surface_voxels.size(); s--;)
+          row_offsets[surface_voxels[s] / dim[0]] = s;
+        for (size_t row = num_rows; row--;)
+          row_offsets[row] = std::min (row_offsets[row], row_offsets[row+1]);
+
+        vector<vector<Run>> slice_runs (dim[2]);
+        vector<vector<size_t>> slice_run_offsets (dim[2]);
+        Thread::parallel_for (dim[2], [&] (const size_t z) {
+          auto& runs (slice_runs[z]);
+          auto& offsets (slice_run_offsets[z]);
+          for (size_t y = 0; y != dim[1]; ++y) {
+            offsets.push_back (runs.size());
+            const size_t row = y + dim[1] * z;
+            int x = 0;
+            for (size_t s = row_offsets[row]; s != row_offsets[row+1]; ++s) {
+              const int surface_x = surface_voxels[s] - row * dim[0];
+              if (surface_x > x)
+                runs.push_back (Run (x, surface_x));
+              x = surface_x + 1;
+            }
+            if (x < int(dim[0]))
+              runs.push_back (Run (x, dim[0]));
+          }
+          offsets.push_back (runs.size());
+        }, 1);
+
+        vector<size_t> slice_base (dim[2] + 1, 0);
+        for (size_t z = 0; z != dim[2]; ++z)
+          slice_base[z+1] = slice_base[z] + slice_runs[z].size();
+
+        UnionFind components (slice_base[dim[2]]);
+        auto connect_rows = [&] (const size_t z_a, const size_t y_a, const size_t z_b, const size_t y_b) {
+          size_t a = slice_run_offsets[z_a][y_a], b = slice_run_offsets[z_b][y_b];
+          const size_t a_end = slice_run_offsets[z_a][y_a+1], b_end = slice_run_offsets[z_b][y_b+1];
+          while (a != a_end && b != b_end) {
+            const Run& run_a (slice_runs[z_a][a]), &run_b (slice_runs[z_b][b]);
+            if (run_a.start < run_b.end && run_b.start < run_a.end)
+              components.unite (slice_base[z_a] + a, slice_base[z_b] + b);
+            if (run_a.end < run_b.end) ++a; else ++b;
+          }
+        };
+        for (size_t z = 0; z != dim[2]; ++z) {
+          for (size_t y = 0; y != dim[1]; ++y) {
+            if (y)
+              connect_rows (z, y, z, y-1);
+            if (z)
+              connect_rows (z, y, z-1, y);
+          }
         }
-        ++progress;
 
+        // Index of the run containing a voxel, or -1 if the voxel intersects the mesh
+        auto run_at = [&] (const Vox& v) -> ssize_t {
+          const auto& runs (slice_runs[v[2]]);
+          for (size_t r = slice_run_offsets[v[2]][v[1]]; r != slice_run_offsets[v[2]][v[1]+1]; ++r) {
+            if (v[0] >= runs[r].start && v[0] < runs[r].end)
+              return slice_base[v[2]] + r;
+          }
+          return -1;
+        };
 
-        // Find all voxels that are not partial-volumed with the mesh, and are not inside the mesh
         // Use a corner of the image FoV to commence filling of the volume, and then check that all
         //   eight corners have been flagged as outside the volume
         const Vox corner_voxels[8] = {
-            Vox (             0,              0,              0),
-            Vox (             0,              0, H.size (2) - 1),
-            Vox (             0, H.size (1) - 1,              0),
-            Vox (             0, H.size (1) - 1, H.size (2) - 1),
-            Vox (H.size (0) - 1,              0,              0),
-            Vox (H.size (0) - 1,              0, H.size (2) - 1),
-            Vox (H.size (0) - 1, H.size (1) - 1,              0),
-            Vox (H.size (0) - 1, H.size (1) - 1, H.size (2) - 1)};
-
-        // TODO This is slow; is there a faster implementation?
-        // This is essentially a connected-component analysis...
-        vector<Vox> to_expand;
-        to_expand.push_back (corner_voxels[0]);
-        assign_pos_of (corner_voxels[0]).to (init_seg);
-        init_seg.value() = vox_mesh_t::OUTSIDE;
-        do {
-          const Vox centre_voxel (to_expand.back());
-          to_expand.pop_back();
-          for (size_t adj_vox_idx = 0; adj_vox_idx != 6; ++adj_vox_idx) {
-            const Vox this_voxel (centre_voxel + adj_voxels[adj_vox_idx]);
-            assign_pos_of (this_voxel).to (init_seg);
-            if (!is_out_of_bounds (init_seg) && init_seg.value() == vox_mesh_t (UNDEFINED)) {
-              init_seg.value() = vox_mesh_t (OUTSIDE);
-              to_expand.push_back (this_voxel);
+            Vox (         0,          0,          0),
+            Vox (         0,          0, dim[2] - 1),
+            Vox (         0, dim[1] - 1,          0),
+            Vox (         0, dim[1] - 1, dim[2] - 1),
+            Vox (dim[0] - 1,          0,          0),
+            Vox (dim[0] - 1,          0, dim[2] - 1),
+            Vox (dim[0] - 1, dim[1] - 1,          0),
+            Vox (dim[0] - 1, dim[1] - 1, dim[2] - 1)};
+
+        ssize_t outside = run_at (corner_voxels[0]);
+        if (outside < 0) {
+          // Corner voxel intersects the mesh: fill commences from its neighbours
+          for (const auto& offset : { Vox (1, 0, 0), Vox (0, 1, 0), Vox (0, 0, 1) }) {
+            const Vox v (corner_voxels[0] + offset);
+            if (v[0] < int(dim[0]) && v[1] < int(dim[1]) && v[2] < int(dim[2])) {
+              const ssize_t r = run_at (v);
+              if (r >= 0) {
+                if (outside < 0)
+                  outside = r;
+                else
+                  components.unite (outside, r);
+              }
             }
           }
-        } while (!to_expand.empty());
-        ++progress;
-
-        for (size_t cnr_idx = 0; cnr_idx != 8; ++cnr_idx) {
-          assign_pos_of (corner_voxels[cnr_idx]).to (init_seg);
-          if (init_seg.value() == vox_mesh_t (UNDEFINED))
+          if (outside < 0)
             throw Exception ("Mesh is not bound within image field of view");
         }
-
-
-        // Find those voxels that remain unassigned, and set them to INSIDE
-        for (auto l = Loop (init_seg) (init_seg); l; ++l) {
-          if (init_seg.value() == vox_mesh_t (UNDEFINED))
-            init_seg.value() = vox_mesh_t (INSIDE);
+        const size_t outside_root = components.find (outside);
+        for (size_t cnr_idx = 1; cnr_idx != 8; ++cnr_idx) {
+          const ssize_t r = run_at (corner_voxels[cnr_idx]);
+          if (r >= 0 && components.find (r) != outside_root)
+            throw Exception ("Mesh is not bound within image field of view");
         }
-        ++progress;
 
-        // Write initial ternary segmentation
-        for (auto l = Loop (init_seg) (init_seg, image); l; ++l) {
-          switch (init_seg.value()) {
-            case vox_mesh_t (UNDEFINED): throw Exception ("Code error: poor filling of initial mesh estimate"); break;
-            case vox_mesh_t (ON_MESH):   image.value() = 0.5; break;
-            case vox_mesh_t (OUTSIDE):   image.value() = 0.0; break;
-            case vox_mesh_t (INSIDE):    image.value() = 1.0; break;
-          }
-        }
+        vector<uint8_t> run_is_outside (slice_base[dim[2]]);
+        for (size_t r = 0; r != run_is_outside.size(); ++r)
+          run_is_outside[r] = (components.find (r) == outside_root);
         ++progress;
 
-        // Get better partial volume estimates for all necessary voxels
-        // TODO This could be multi-threaded, but hard to justify the dev time
+
+        // Get better partial volume estimates for all voxels intersecting the mesh
         static const size_t pve_os_ratio = 10;
+        vector<float> surface_pve (surface_voxels.size());
 
-        for (Vox2Poly::const_iterator i = voxel2poly.begin(); i != voxel2poly.end(); ++i) {
+        Thread::parallel_for (surface_voxels.size(), [&] (const size_t s) {
 
-          const Vox& voxel (i->first);
+          const size_t voxel_index = surface_voxels[s];
+          const Vox voxel (voxel_index % dim[0], (voxel_index / dim[0]) % dim[1], voxel_index / (dim[0] * dim[1]));
 
-          // Generate a set of points within this voxel that need to be tested individually
-          vector<Vertex> to_test;
-          to_test.reserve (Math::pow3 (pve_os_ratio));
+          // Count the number of points within this voxel that lie inside the mesh
+          int inside_mesh_count = 0;
           for (size_t x_idx = 0; x_idx != pve_os_ratio; ++x_idx) {
             const default_type x = voxel[0] - 0.5 + ((default_type(x_idx) + 0.5) / default_type(pve_os_ratio));
             for (size_t y_idx = 0; y_idx != pve_os_ratio; ++y_idx) {
               const default_type y = voxel[1] - 0.5 + ((default_type(y_idx) + 0.5) / default_type(pve_os_ratio));
               for (size_t z_idx = 0; z_idx != pve_os_ratio; ++z_idx) {
                 const default_type z = voxel[2] - 0.5 + ((default_type(z_idx) + 0.5) / default_type(pve_os_ratio));
-                to_test.push_back (Vertex (x, y, z));
-              }
-            }
-          }
+                const Vertex p (x, y, z);
 
-          // Count the number of these points that lie inside the mesh
-          int inside_mesh_count = 0;
-          for (vector<Vertex>::const_iterator i_p = to_test.begin(); i_p != to_test.end(); ++i_p) {
-            const Vertex& p (*i_p);
+                default_type best_min_edge_distance = -std::numeric_limits<default_type>::infinity();
+                bool best_result_inside = false;
+
+                // Only test against those polygons that are near this voxel
+                for (size_t i = polygon_offsets[s]; i != polygon_offsets[s+1]; ++i) {
+                  const size_t polygon_index = surface_polygons[i];
+                  const Eigen::Vector3& n (polygon_normals[polygon_index]);
 
-            default_type best_min_edge_distance = -std::numeric_limits<default_type>::infinity();
-            bool best_result_inside = false;
+                  bool is_inside = false;
+                  default_type min_edge_distance = std::numeric_limits<default_type>::infinity();
 
-            // Only test against those polygons that are near this voxel
-            for (vector<size_t>::const_iterator polygon_index = i->second.begin(); polygon_index != i->second.end(); ++polygon_index) {
-              const Eigen::Vector3& n (polygon_normals[*polygon_index]);
+                  if (polygon_index < mesh.num_triangles()) {
 
-              const size_t polygon_num_vertices = (*polygon_index < mesh.num_triangles()) ? 3 : 4;
-              VertexList v;
+                    const TriangleGeometry& g (triangle_geometry[polygon_index]);
 
-              bool is_inside = false;
-              default_type min_edge_distance = std::numeric_limits<default_type>::infinity();
+                    // First: is it aligned with the normal?
+                    const Vertex diff (p - g.centre);
+                    is_inside = (diff.dot (n) <= 0.0);
 
-              if (polygon_num_vertices == 3) {
+                    // Second: how well does it project onto this polygon?
+                    const Vertex p_on_plane (p - (n * (diff.dot (n))));
 
-                mesh.load_triangle_vertices (v, *polygon_index);
+                    std::array<default_type, 3> edge_distances;
+                    edge_distances[0] = (p_on_plane-g.v0).dot (g.edge_normals[0]);
+                    edge_distances[1] = (p_on_plane-g.v2).dot (g.edge_normals[1]);
+                    edge_distances[2] = (p_on_plane-g.v1).dot (g.edge_normals[2]);
+                    min_edge_distance = std::min (edge_distances[0], std::min (edge_distances[1], edge_distances[2]));
 
-                // First: is it aligned with the normal?
-                const Vertex poly_centre ((v[0] + v[1] + v[2]) * (1.0/3.0));
-                const Vertex diff (p - poly_centre);
-                is_inside = (diff.dot (n) <= 0.0);
+                  } else {
 
-                // Second: how well does it project onto this polygon?
-                const Vertex p_on_plane (p - (n * (diff.dot (n))));
+                    const size_t quad_index = polygon_index - mesh.num_triangles();
+                    const Vertex v[4] = { mesh.vert (mesh.quad (quad_index)[0]), mesh.vert (mesh.quad (quad_index)[1]),
+                                          mesh.vert (mesh.quad (quad_index)[2]), mesh.vert (mesh.quad (quad_index)[3]) };
 
-                std::array<default_type, 3> edge_distances;
-                Vertex zero = (v[2]-v[0]).cross (n); zero.normalize();
-                Vertex one  = (v[1]-v[2]).cross (n); one .normalize();
-                Vertex two  = (v[0]-v[1]).cross (n); two .normalize();
-                edge_distances[0] = (p_on_plane-v[0]).dot (zero);
-                edge_distances[1] = (p_on_plane-v[2]).dot (one);
-                edge_distances[2] = (p_on_plane-v[1]).dot (two);
-                min_edge_distance = std::min (edge_distances[0], std::min (edge_distances[1], edge_distances[2]));
+                    // This may be slightly ill-posed with a quad; no guarantee of fixed normal
+                    // Proceed regardless
 
-              } else {
+                    // First: is it aligned with the normal?
+                    const Vertex poly_centre ((v[0] + v[1] + v[2] + v[3]) * 0.25);
+                    const Vertex diff (p - poly_centre);
+                    is_inside = (diff.dot (n) <= 0.0);
 
-                mesh.load_quad_vertices (v, *polygon_index);
+                    // Second: how well does it project onto this polygon?
+                    const Vertex p_on_plane (p - (n * (diff.dot (n))));
 
-                // This may be slightly ill-posed with a quad; no guarantee of fixed normal
-                // Proceed regardless
+                    for (int edge = 0; edge != 4; ++edge) {
+                      // Want an appropriate vector emanating from this edge from which to test the 'on-plane' distance
+                      //   (bearing in mind that there may not be a uniform normal)
+                      // For this, I'm going to take a weighted average based on the relative distance between the
+                      //   two points at either end of this edge
+                      // Edge is between points p1 and p2; edge 0 is between points 0 and 1
+                      const Vertex& p0 ((edge-1) >= 0 ? v[edge-1] : v[3]);
+                      const Vertex& p1 (v[edge]);
+                      const Vertex& p2 ((edge+1) < 4 ? v[edge+1] : v[0]);
+                      const Vertex& p3 ((edge+2) < 4 ? v[edge+2] : v[edge-2]);
 
-                // First: is it aligned with the normal?
-                const Vertex poly_centre ((v[0] + v[1] + v[2] + v[3]) * 0.25);
-                const Vertex diff (p - poly_centre);
-                is_inside = (diff.dot (n) <= 0.0);
+                      const default_type d1 = (p1 - p_on_plane).norm();
+                      const default_type d2 = (p2 - p_on_plane).norm();
+                      // Give more weight to the normal at the point that's closer
+                      Vertex edge_normal = (d2*(p0-p1) + d1*(p3-p2));
+                      edge_normal.normalize();
 
-                // Second: how well does it project onto this polygon?
-                const Vertex p_on_plane (p - (n * (diff.dot (n))));
+                      // Now, how far away is the point within the plane from this edge?
+                      const default_type this_edge_distance = (p_on_plane - p1).dot (edge_normal);
+                      min_edge_distance = std::min (min_edge_distance, this_edge_distance);
 
-                for (int edge = 0; edge != 4; ++edge) {
-                  // Want an appropriate vector emanating from this edge from which to test the 'on-plane' distance
-                  //   (bearing in mind that there may not be a uniform normal)
-                  // For this, I'm going to take a weighted average based on the relative distance between the
-                  //   two points at either end of this edge
-                  // Edge is between points p1 and p2; edge 0 is between points 0 and 1
-                  const Vertex& p0 ((edge-1) >= 0 ? v[edge-1] : v[3]);
-                  const Vertex& p1 (v[edge]);
-                  const Vertex& p2 ((edge+1) < 4 ? v[edge+1] : v[0]);
-                  const Vertex& p3 ((edge+2) < 4 ? v[edge+2] : v[edge-2]);
+                    }
 
-                  const default_type d1 = (p1 - p_on_plane).norm();
-                  const default_type d2 = (p2 - p_on_plane).norm();
-                  // Give more weight to the normal at the point that's closer
-                  Vertex edge_normal = (d2*(p0-p1) + d1*(p3-p2));
-                  edge_normal.normalize();
+                  }
 
-                  // Now, how far away is the point within the plane from this edge?
-                  const default_type this_edge_distance = (p_on_plane - p1).dot (edge_normal);
-                  min_edge_distance = std::min (min_edge_distance, this_edge_distance);
+                  if (min_edge_distance > best_min_edge_distance) {
+                    best_min_edge_distance = min_edge_distance;
+                    best_result_inside = is_inside;
+                  }
 
                 }
 
-              }
+                if (best_result_inside)
+                  ++inside_mesh_count;
 
-              if (min_edge_distance > best_min_edge_distance) {
-                best_min_edge_distance = min_edge_distance;
-                best_result_inside = is_inside;
               }
-
             }
+          }
 
-            if (best_result_inside)
-              ++inside_mesh_count;
+          surface_pve[s] = (default_type)inside_mesh_count / (default_type)Math::pow3 (pve_os_ratio);
 
-          }
+        }, 16);
+        ++progress;
 
-          assign_pos_of (voxel).to (image);
-          image.value() = (default_type)inside_mesh_count / (default_type)Math::pow3 (pve_os_ratio);
 
-        }
+        // Write the output image: partial volume estimates for voxels intersecting the mesh,
+        //   and either 0.0 or 1.0 for those outside or inside the mesh respectively
+        Thread::parallel_for (dim[2], [&] (const size_t z) {
+          Image<float> out (image);
+          out.index(2) = z;
+          const auto& runs (slice_runs[z]);
+          for (size_t y = 0; y != dim[1]; ++y) {
+            out.index(1) = y;
+            for (size_t r = slice_run_offsets[z][y]; r != slice_run_offsets[z][y+1]; ++r) {
+              const float value = run_is_outside[slice_base[z] + r] ? 0.0 : 1.0;
+              for (out.index(0) = runs[r].start; out.index(0) != runs[r].end; ++out.index(0))
+                out.value() = value;
+            }
+            const size_t row = y + dim[1] * z;
+            for (size_t s = row_offsets[row]; s != row_offsets[row+1]; ++s) {
+              out.index(0) = surface_voxels[s] - row * dim[0];
+              out.value() = surface_pve[s];
+            }
+          }
+        }, 1);
+        ++progress;
 
       }
 
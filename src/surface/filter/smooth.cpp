@@ -16,6 +16,8 @@
 
 #include <set>
 
+#include "thread.h"
+
 #include "surface/utils.h"
 
 namespace MR
@@ -43,12 +45,13 @@ namespace MR
           throw Exception ("Cannot perform smoothing on this mesh: no triangulation information");
 
         // Pre-compute polygon centroids and areas
-        VertexList centroids;
-        vector<default_type> areas;
-        for (TriangleList::const_iterator p = in.triangles.begin(); p != in.triangles.end(); ++p) {
-          centroids.push_back ((in.vertices[(*p)[0]] + in.vertices[(*p)[1]] + in.vertices[(*p)[2]]) * (1.0/3.0));
-          areas.push_back (area (in, *p));
-        }
+        VertexList centroids (T);
+        vector<default_type> areas (T);
+        Thread::parallel_for (T, [&] (const size_t t) {
+          const Triangle& p (in.triangles[t]);
+          centroids[t] = (in.vertices[p[0]] + in.vertices[p[1]] + in.vertices[p[2]]) * (1.0/3.0);
+          areas[t] = area (in, p);
+        });
         if (progress) ++(*progress);
 
         // Perform pre-calculation of an appropriate mesh neighbourhood for each vertex
@@ -60,53 +63,36 @@ namespace MR
         //
         // Initialisation is different to iterations: Need a single pass to find those
         //   polygons that actually use the vertex
-        vector< std::set<uint32_t> > vert_polys (V, std::set<uint32_t>());
-        // For each vertex, don't just want to store the polygons within the neighbourhood;
-        //   also want to store those that will be expanded from in the next iteration
-        vector< vector<uint32_t> > vert_polys_to_expand (V, vector<uint32_t>());
-
-        for (uint32_t t = 0; t != T; ++t) {
-          for (uint32_t i = 0; i != 3; ++i) {
-            vert_polys[(in.triangles[t])[i]].insert (t);
-            vert_polys_to_expand[(in.triangles[t])[i]].push_back (t);
-          }
-        }
+        vector< vector<uint32_t> > vert_polys, vert_quads;
+        in.vertex_polygons (vert_polys, vert_quads);
         if (progress) ++(*progress);
 
         // Now, we want to expand this selection outwards for each vertex
         // To do this, also want to produce a list for each polygon: containing those polygons
         //   that share a common edge (i.e. two vertices)
-        vector< vector<uint32_t> > poly_neighbours (T, vector<uint32_t>());
-        for (uint32_t i = 0; i != T; ++i) {
-          for (uint32_t j = i+1; j != T; ++j) {
-            if (in.triangles[i].shares_edge (in.triangles[j])) {
-              poly_neighbours[i].push_back (j);
-              poly_neighbours[j].push_back (i);
-
-            }
-          }
-        }
+        vector< vector<uint32_t> > poly_neighbours;
+        in.triangle_neighbours (poly_neighbours);
         if (progress) ++(*progress);
 
         // TODO Will want to develop a better heuristic for this
-        for (size_t iter = 0; iter != 8; ++iter) {
-          for (uint32_t v = 0; v != V; ++v) {
-
+        // Each vertex's neighbourhood is grown independently, so vertices can be processed in parallel;
+        //   the final neighbourhood is stored as a sorted list
+        Thread::parallel_for (V, [&] (const size_t v) {
+          std::set<uint32_t> neighbourhood (vert_polys[v].begin(), vert_polys[v].end());
+          vector<uint32_t> front (vert_polys[v]);
+          for (size_t iter = 0; iter != 8; ++iter) {
             // Find polygons at the outer edge of this expanding front, and add them to the neighbourhood for this vertex
             vector<uint32_t> next_front;
-            for (vector<uint32_t>::const_iterator front = vert_polys_to_expand[v].begin(); front != vert_polys_to_expand[v].end(); ++front) {
-              for (vector<uint32_t>::const_iterator expansion = poly_neighbours[*front].begin(); expansion != poly_neighbours[*front].end(); ++expansion) {
-                const std::set<uint32_t>::const_iterator existing = vert_polys[v].find (*expansion);
-                if (existing == vert_polys[v].end()) {
-                  vert_polys[v].insert (*expansion);
-                  next_front.push_back (*expansion);
-                }
+            for (const auto f : front) {
+              for (const auto expansion : poly_neighbours[f]) {
+                if (neighbourhood.insert (expansion).second)
+                  next_front.push_back (expansion);
               }
             }
-            vert_polys_to_expand[v] = std::move (next_front);
-
+            front = std::move (next_front);
           }
-        }
+          vert_polys[v].assign (neighbourhood.begin(), neighbourhood.end());
+        });
         if (progress) ++(*progress);
 
 
@@ -114,21 +100,17 @@ namespace MR
         // Need to perform a first mollification pass, where the polygon normals are
         //   smoothed but the vertices are not perturbed
         // However, in order to calculate these new normals, we need to calculate new vertex positions!
-        VertexList mollified_vertices;
+        VertexList mollified_vertices (V);
         // Use half standard spatial factor for mollification
         // Denominator = 2(SF/2)^2
         const default_type spatial_mollification_power_multiplier = -2.0 / Math::pow2 (spatial);
         // No need to normalise the Gaussian; have to explicitly normalise afterwards
-        for (uint32_t v = 0; v != V; ++v) {
+        Thread::parallel_for (V, [&] (const size_t v) {
 
           Vertex new_pos (0.0, 0.0, 0.0);
           default_type sum_weights = 0.0;
 
-          // For now, just use every polygon as part of the estimate
-          // Eventually, restrict this to some form of mesh neighbourhood
-          //for (size_t i = 0; i != centroids.size(); ++i) {
-          for (std::set<uint32_t>::const_iterator it = vert_polys[v].begin(); it != vert_polys[v].end(); ++it) {
-            const uint32_t i = *it;
+          for (const auto i : vert_polys[v]) {
             default_type this_weight = areas[i];
             const default_type distance_sq = (centroids[i] - in.vertices[v]).squaredNorm();
             this_weight *= std::exp (distance_sq * spatial_mollification_power_multiplier);
@@ -138,30 +120,28 @@ namespace MR
           }
 
           new_pos *= (1.0 / sum_weights);
-          mollified_vertices.push_back (new_pos);
+          mollified_vertices[v] = new_pos;
 
-        }
+        });
         if (progress) ++(*progress);
 
         // Have new vertices; compute polygon normals based on these vertices
         Mesh mollified_mesh;
         mollified_mesh.load (mollified_vertices, in.triangles);
-        VertexList tangents;
-        for (TriangleList::const_iterator p = mollified_mesh.triangles.begin(); p != mollified_mesh.triangles.end(); ++p)
-          tangents.push_back (normal (mollified_mesh, *p));
+        VertexList tangents (T);
+        Thread::parallel_for (T, [&] (const size_t t) { tangents[t] = normal (mollified_mesh, mollified_mesh.triangles[t]); });
         if (progress) ++(*progress);
 
         // Now perform the actual smoothing
         const default_type spatial_power_multiplier = -0.5 / Math::pow2 (spatial);
         const default_type influence_power_multiplier = -0.5 / Math::pow2 (influence);
-        for (size_t v = 0; v != V; ++v) {
+        out.vertices.resize (V);
+        Thread::parallel_for (V, [&] (const size_t v) {
 
           Vertex new_pos (0.0, 0.0, 0.0);
           default_type sum_weights = 0.0;
 
-          //for (size_t i = 0; i != centroids.size(); ++i) {
-          for (std::set<uint32_t>::const_iterator it = vert_polys[v].begin(); it != vert_polys[v].end(); ++it) {
-            const uint32_t i = *it;
+          for (const auto i : vert_polys[v]) {
             default_type this_weight = areas[i];
             const default_type distance_sq = (centroids[i] - in.vertices[v]).squaredNorm();
             this_weight *= std::exp (distance_sq * spatial_power_multiplier);
@@ -173,9 +153,9 @@ namespace MR
           }
 
           new_pos *= (1.0 / sum_weights);
-          out.vertices.push_back (new_pos);
+          out.vertices[v] = new_pos;
 
-        }
+        });
         if (progress) ++(*progress);
 
         out.triangles = in.triangles;
@@ -14,11 +14,16 @@
 
 #include "surface/mesh.h"
 
+#include <algorithm>
 #include <ios>
 #include <iostream>
+#include <limits>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "thread.h"
+
 #include "surface/freesurfer.h"
 #include "surface/utils.h"
 
@@ -70,20 +75,82 @@ namespace MR
 
     void Mesh::calculate_normals()
     {
-      normals.clear();
+      // Gather rather than scatter polygon normals, so that vertices can be
+      //   processed concurrently; contributions are still summed in polygon order
+      VertexList triangle_normals (triangles.size()), quad_normals (quads.size());
+      Thread::parallel_for (triangles.size(), [&] (const size_t i) { triangle_normals[i] = normal (*this, triangles[i]); });
+      Thread::parallel_for (quads.size(),     [&] (const size_t i) { quad_normals[i]     = normal (*this, quads[i]); });
+      vector<vector<uint32_t>> vertex_triangles, vertex_quads;
+      vertex_polygons (vertex_triangles, vertex_quads);
       normals.assign (vertices.size(), Vertex (0.0, 0.0, 0.0));
-      for (TriangleList::const_iterator p = triangles.begin(); p != triangles.end(); ++p) {
-        const Vertex this_normal = normal (*this, *p);
-        for (size_t index = 0; index != 3; ++index)
-          normals[(*p)[index]] += this_normal;
+      Thread::parallel_for (vertices.size(), [&] (const size_t v) {
+        for (const auto t : vertex_triangles[v])
+          normals[v] += triangle_normals[t];
+        for (const auto q : vertex_quads[v])
+          normals[v] += quad_normals[q];
+        normals[v].normalize();
+      });
+    }
+
+
+
+    void Mesh::vertex_polygons (vector<vector<uint32_t>>& vertex_triangles, vector<vector<uint32_t>>& vertex_quads) const
+    {
+      vertex_triangles.assign (vertices.size(), vector<uint32_t>());
+      vertex_quads.assign (vertices.size(), vector<uint32_t>());
+      for (uint32_t t = 0; t != triangles.size(); ++t) {
+        for (size_t i = 0; i != 3; ++i) {
+          auto& list = vertex_triangles[triangles[t][i]];
+          // Guard against degenerate polygons that reference the same vertex twice
+          if (list.empty() || list.back() != t)
+            list.push_back (t);
+        }
+      }
+      for (uint32_t q = 0; q != quads.size(); ++q) {
+        for (size_t i = 0; i != 4; ++i) {
+          auto& list = vertex_quads[quads[q][i]];
+          if (list.empty() || list.back() != q)
+            list.push_back (q);
+        }
+      }
+    }
+
+
+
+    void Mesh::triangle_neighbours (vector<vector<uint32_t>>& neighbours) const
+    {
+      const size_t T = triangles.size();
+      neighbours.assign (T, vector<uint32_t>());
+
+      // Hash each undirected edge to the head of a linked list of the
+      //   half-edges (3*triangle + position) that traverse it
+      std::unordered_map<uint64_t, uint32_t> edge_heads;
+      edge_heads.reserve (3 * T);
+      vector<uint32_t> next_halfedge (3 * T, std::numeric_limits<uint32_t>::max());
+      for (uint32_t t = 0; t != T; ++t) {
+        for (uint32_t i = 0; i != 3; ++i) {
+          const uint32_t a = triangles[t][i], b = triangles[t][(i+1)%3];
+          const uint64_t key = (uint64_t(std::min (a, b)) << 32) | uint64_t(std::max (a, b));
+          const uint32_t halfedge = 3*t + i;
+          auto head = edge_heads.insert (std::make_pair (key, halfedge));
+          if (!head.second) {
+            for (uint32_t h = head.first->second; h != std::numeric_limits<uint32_t>::max(); h = next_halfedge[h]) {
+              if (h / 3 != t) {
+                neighbours[t].push_back (h / 3);
+                neighbours[h / 3].push_back (t);
+              }
+            }
+            next_halfedge[halfedge] = head.first->second;
+            head.first->second = halfedge;
+          }
+        }
       }
-      for (QuadList::const_iterator p = quads.begin(); p != quads.end(); ++p) {
-        const Vertex this_normal = normal (*this, *p);
-        for (size_t index = 0; index != 4; ++index)
-          normals[(*p)[index]] += this_normal;
+
+      // Two triangles may share more than one edge if the mesh is degenerate
+      for (auto& list : neighbours) {
+        std::sort (list.begin(), list.end());
+        list.erase (std::unique (list.begin(), list.end()), list.end());
       }
-      for (VertexList::iterator n = normals.begin(); n != normals.end(); ++n)
-        n->normalize();
     }
 
 
@@ -162,6 +162,13 @@ namespace MR
         void load_triangle_vertices (VertexList&, const size_t) const;
         void load_quad_vertices     (VertexList&, const size_t) const;
 
+        // Adjacency information; both are computed in time linear in the number of polygons,
+        //   and list indices in increasing order
+        //! for each vertex, the triangles and quads of which it is a part
+        void vertex_polygons (vector<vector<uint32_t>>&, vector<vector<uint32_t>>&) const;
+        //! for each triangle, the other triangles with which it shares an edge
+        void triangle_neighbours (vector<vector<uint32_t>>&) const;
+
 
       protected:
         VertexList vertices;
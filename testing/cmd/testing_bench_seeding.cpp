@@ -0,0 +1,129 @@
+/* Copyright (c) 2008-2017 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+#include "command.h"
+#include "image.h"
+#include "thread.h"
+#include "timer.h"
+#include "transform.h"
+#include "algo/loop.h"
+
+#include "dwi/tractography/rng.h"
+#include "dwi/tractography/seeding/basic.h"
+
+using namespace MR;
+using namespace App;
+using namespace MR::DWI::Tractography;
+
+void usage ()
+{
+  AUTHOR = "agent (agent@local)";
+
+  SYNOPSIS = "Compare the throughput of weighted image seeding via rejection sampling and via an alias table";
+
+  ARGUMENTS
+  + Argument ("image", "the seed weighting image.").type_image_in ()
+  + Argument ("number", "the number of seeds to draw per thread.").type_integer (1);
+}
+
+
+
+// Rejection sampling as previously used for -seed_rejection:
+// draw voxels uniformly within the image and accept against the image maximum
+class RejectionSeeder { MEMALIGN(RejectionSeeder)
+  public:
+    RejectionSeeder (const std::string& path) :
+      image (Image<float>::open (path)),
+      voxel2scanner (Transform (image).voxel2scanner.cast<float>()),
+      max (0.0)
+    {
+      for (auto l = Loop (0,3) (image); l; ++l)
+        max = std::max (max, float (image.value()));
+    }
+
+    bool get_seed (Eigen::Vector3f& p) const
+    {
+      auto seed = image;
+      std::uniform_real_distribution<float> uniform;
+      float selector;
+      do {
+        seed.index(0) = std::uniform_int_distribution<int> (0, image.size(0)-1) (*rng);
+        seed.index(1) = std::uniform_int_distribution<int> (0, image.size(1)-1) (*rng);
+        seed.index(2) = std::uniform_int_distribution<int> (0, image.size(2)-1) (*rng);
+        selector = uniform (*rng) * max;
+      } while (seed.value() < selector);
+      p = { seed.index(0)+uniform(*rng)-0.5f, seed.index(1)+uniform(*rng)-0.5f, seed.index(2)+uniform(*rng)-0.5f };
+      p = voxel2scanner * p;
+      return true;
+    }
+
+  private:
+    Image<float> image;
+    Eigen::Transform<float, 3, Eigen::AffineCompact> voxel2scanner;
+    float max;
+};
+
+
+
+template <class SeederType>
+class Worker { MEMALIGN(Worker<SeederType>)
+  public:
+    Worker (const SeederType& seeder, const size_t number) :
+      seeder (seeder), number (number) { }
+
+    void execute () {
+      Math::Philox generator (Math::RNG::get_seed());
+      rng = &generator;
+      Eigen::Vector3f p, sum (0.0, 0.0, 0.0);
+      for (size_t n = 0; n != number; ++n) {
+        seeder.get_seed (p);
+        sum += p;
+      }
+      // prevent the compiler from optimising the loop away
+      if (!sum.allFinite())
+        WARN ("non-finite seed position generated");
+    }
+
+  private:
+    const SeederType& seeder;
+    const size_t number;
+};
+
+
+
+template <class SeederType>
+double seeds_per_second (const SeederType& seeder, const size_t number)
+{
+  Timer timer;
+  Thread::run (Thread::multi (Worker<SeederType> (seeder, number)), "seeding thread");
+  return std::max (Thread::number_of_threads(), size_t(1)) * number / timer.elapsed();
+}
+
+
+
+void run ()
+{
+  const size_t number = argument[1];
+
+  const RejectionSeeder rejection (argument[0]);
+  const Seeding::Rejection alias (argument[0]);
+
+  const double rejection_rate = seeds_per_second (rejection, number);
+  const double alias_rate = seeds_per_second (alias, number);
+
+  std::cout << "threads: " << Thread::number_of_threads() << "\n"
+            << "rejection sampling: " << rejection_rate << " seeds/s\n"
+            << "alias table: " << alias_rate << " seeds/s\n"
+            << "speedup: " << alias_rate / rejection_rate << "\n";
+}
+
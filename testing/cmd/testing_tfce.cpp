@@ -0,0 +1,99 @@
+/* Copyright (c) 2008-2017 the MRtrix3 contributors.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see http://www.mrtrix.org/.
+ */
+
+
+#include "command.h"
+#include "image.h"
+#include "filter/connected_components.h"
+#include "math/stats/typedefs.h"
+
+#include "stats/cluster.h"
+#include "stats/tfce.h"
+
+using namespace MR;
+using namespace App;
+
+#define DEFAULT_TFCE_DH 0.1
+#define DEFAULT_TFCE_H 2.0
+#define DEFAULT_TFCE_E 0.5
+
+void usage ()
+{
+  AUTHOR = "J-Donald Tournier (jdtournier@gmail.com)";
+
+  SYNOPSIS = "Compute the TFCE-enhanced statistic of an image by explicit connected-component "
+             "labelling at every threshold, for comparison with the output of mrclusterstats";
+
+  ARGUMENTS
+  + Argument ("input", "the statistic image.").type_image_in ()
+  + Argument ("mask", "the mask within which to perform the enhancement.").type_image_in ()
+  + Argument ("output", "the enhanced statistic image.").type_image_out ();
+
+  OPTIONS
+  + Stats::TFCE::Options (DEFAULT_TFCE_DH, DEFAULT_TFCE_E, DEFAULT_TFCE_H)
+
+  + Option ("connectivity", "use 26-voxel-neighbourhood connectivity (Default: 6)");
+}
+
+
+
+using value_type = Math::Stats::stat_value_type;
+using vector_type = Math::Stats::stat_vector_type;
+
+
+
+// Withholding the adjacency forces TFCE::Wrapper to label the connected
+//   components afresh at every threshold
+class ClusterSizePerThreshold : public Stats::Cluster::ClusterSize<value_type> { MEMALIGN(ClusterSizePerThreshold)
+  public:
+    ClusterSizePerThreshold (const Filter::Connector& connector) :
+      Stats::Cluster::ClusterSize<value_type> (connector, NaN) { }
+
+    const vector<vector<uint32_t>>* get_adjacency() const override { return nullptr; }
+};
+
+
+
+void run ()
+{
+  auto mask = Image<float>::open (argument[1]);
+  Filter::Connector connector (get_options ("connectivity").size());
+  const vector<vector<int>> mask_indices = connector.precompute_adjacency (mask);
+
+  auto input = Image<float>::open (argument[0]);
+  check_dimensions (input, mask, 0, 3);
+  vector_type stats (mask_indices.size());
+  for (size_t i = 0; i != mask_indices.size(); ++i) {
+    for (size_t axis = 0; axis != 3; ++axis)
+      input.index (axis) = mask_indices[i][axis];
+    stats[i] = input.value();
+  }
+
+  std::shared_ptr<Stats::TFCE::EnhancerBase<value_type>> base (new ClusterSizePerThreshold (connector));
+  Stats::TFCE::Wrapper<value_type> enhancer (base,
+                                             get_option_value ("tfce_dh", DEFAULT_TFCE_DH),
+                                             get_option_value ("tfce_e", DEFAULT_TFCE_E),
+                                             get_option_value ("tfce_h", DEFAULT_TFCE_H));
+  vector_type enhanced;
+  enhancer (stats, enhanced);
+
+  Header header (mask);
+  header.datatype() = DataType::Float32;
+  auto output = Image<float>::create (argument[2], header);
+  for (size_t i = 0; i != mask_indices.size(); ++i) {
+    for (size_t axis = 0; axis != 3; ++axis)
+      output.index (axis) = mask_indices[i][axis];
+    output.value() = enhanced[i];
+  }
+}
+
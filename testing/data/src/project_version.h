@@ -0,0 +1 @@
+#define MRTRIX_PROJECT_VERSION "84728ead-dirty"